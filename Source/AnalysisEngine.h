@@ -0,0 +1,549 @@
+//
+//  AnalysisEngine.h
+//  3DAudioVisualizers
+//
+//  Offline analysis of files or raw PCM through the same RingBuffer, FFT and
+//  band mapping the visualizers use. No GUI or OpenGL dependencies.
+//
+
+#pragma once
+
+#if ! TOWEL_HEADLESS
+ #include "../JuceLibraryCode/JuceHeader.h"
+#endif
+
+#include "RingBuffer.h"
+#include "StreamAnalyzer.h"
+#include "SpectrumBands.h"
+#include "AnalysisRecording.h"
+
+//==============================================================================
+/** A block-wise source of PCM audio for offline analysis.
+ */
+class PcmInput
+{
+public:
+    virtual ~PcmInput() {}
+
+    virtual double getSampleRate() const = 0;
+    virtual int getNumChannels() const = 0;
+
+    /** Reads up to numSamples into dest, which has getNumChannels() channels.
+        Returns the number read; 0 means the input is finished.
+     */
+    virtual int read (AudioBuffer<float>& dest, int numSamples) = 0;
+};
+
+/** Reads any file an AudioFormatManager can open.
+ */
+class AudioFileInput : public PcmInput
+{
+public:
+    /** Takes ownership of reader.
+     */
+    AudioFileInput (AudioFormatReader* reader)
+    :   formatReader (reader)
+    {
+    }
+
+    double getSampleRate() const override   { return formatReader->sampleRate; }
+    int getNumChannels() const override     { return (int) formatReader->numChannels; }
+
+    int read (AudioBuffer<float>& dest, int numSamples) override
+    {
+        const int numToRead = (int) jmin ((int64) numSamples, formatReader->lengthInSamples - position);
+
+        if (numToRead <= 0)
+            return 0;
+
+        formatReader->read (&dest, 0, numToRead, position, true, true);
+        position += numToRead;
+        return numToRead;
+    }
+
+private:
+    std::unique_ptr<AudioFormatReader> formatReader;
+    int64 position = 0;
+};
+
+/** Reads headerless interleaved little-endian PCM, e.g. from a pipe.
+ */
+class RawPcmInput : public PcmInput
+{
+public:
+    enum Encoding
+    {
+        float32Encoding = 0,
+        int16Encoding
+    };
+
+    RawPcmInput (InputStream& stream, double sampleRate, int numChannels, Encoding encoding)
+    :   input (stream),
+        rate (sampleRate),
+        channels (jmax (1, numChannels)),
+        sampleEncoding (encoding)
+    {
+    }
+
+    double getSampleRate() const override   { return rate; }
+    int getNumChannels() const override     { return channels; }
+
+    int read (AudioBuffer<float>& dest, int numSamples) override
+    {
+        const int bytesPerSample = sampleEncoding == float32Encoding ? 4 : 2;
+        const int frameBytes = bytesPerSample * channels;
+
+        raw.ensureSize ((size_t) (frameBytes * numSamples));
+        auto* bytes = static_cast<char*> (raw.getData());
+
+        // Pipes deliver short reads, so keep going until a whole block or EOF
+        int bytesRead = 0;
+
+        while (bytesRead < frameBytes * numSamples)
+        {
+            const int n = input.read (bytes + bytesRead, frameBytes * numSamples - bytesRead);
+
+            if (n <= 0)
+                break;
+
+            bytesRead += n;
+        }
+
+        const int numRead = bytesRead / frameBytes;
+
+        for (int ch = 0; ch < channels; ++ch)
+        {
+            auto* out = dest.getWritePointer (ch);
+            const char* in = bytes + ch * bytesPerSample;
+
+            if (sampleEncoding == float32Encoding)
+                for (int i = 0; i < numRead; ++i, in += frameBytes)
+                    out[i] = ByteOrder::littleEndianFloat (in);
+            else
+                for (int i = 0; i < numRead; ++i, in += frameBytes)
+                    out[i] = (int16) ByteOrder::littleEndianShort (in) * (1.0f / 32768.0f);
+        }
+
+        return numRead;
+    }
+
+private:
+    InputStream& input;
+    double rate;
+    int channels;
+    Encoding sampleEncoding;
+    MemoryBlock raw;
+};
+
+//==============================================================================
+/** Receives the frames of one offline analysis run.
+ */
+class AnalysisFrameWriter
+{
+public:
+    virtual ~AnalysisFrameWriter() {}
+
+    /** Called once before the first frame. numValues is the number of values
+        passed to every writeFrame() call.
+     */
+    virtual void begin (double sampleRate, int numValues) = 0;
+
+    virtual void writeFrame (const AnalysisFrame& frame, const float* values, int numValues) = 0;
+
+    virtual void end() {}
+};
+
+/** One line per frame: sample clock, time in seconds, then the values.
+ */
+class CsvFrameWriter : public AnalysisFrameWriter
+{
+public:
+    CsvFrameWriter (OutputStream& stream)
+    :   output (stream)
+    {
+    }
+
+    void begin (double newSampleRate, int numValues) override
+    {
+        sampleRate = newSampleRate;
+        output << "sample,seconds";
+
+        for (int i = 0; i < numValues; ++i)
+            output << "," << i;
+
+        output << "\n";
+    }
+
+    void writeFrame (const AnalysisFrame& frame, const float* values, int numValues) override
+    {
+        line.clear();
+        line << String (frame.sampleClock) << "," << String (frame.sampleClock / sampleRate, 6);
+
+        for (int i = 0; i < numValues; ++i)
+            line << "," << String (values[i], 6);
+
+        output << line << "\n";
+    }
+
+    void end() override
+    {
+        output.flush();
+    }
+
+private:
+    OutputStream& output;
+    double sampleRate = 1.0;
+    String line;
+};
+
+/** Fixed-size little-endian records: a header ("TAF1", uint32 version,
+    float64 sample rate, int32 values per frame), then per frame an int64
+    sample clock followed by the float32 values.
+ */
+class BinaryFrameWriter : public AnalysisFrameWriter
+{
+public:
+    enum
+    {
+        version = 1
+    };
+
+    BinaryFrameWriter (OutputStream& stream)
+    :   output (stream)
+    {
+    }
+
+    void begin (double sampleRate, int numValues) override
+    {
+        output.write ("TAF1", 4);
+        output.writeInt ((int) version);
+        output.writeDouble (sampleRate);
+        output.writeInt (numValues);
+    }
+
+    void writeFrame (const AnalysisFrame& frame, const float* values, int numValues) override
+    {
+        output.writeInt64 (frame.sampleClock);
+
+        for (int i = 0; i < numValues; ++i)
+            output.writeFloat (values[i]);
+    }
+
+    void end() override
+    {
+        output.flush();
+    }
+
+private:
+    OutputStream& output;
+};
+
+/** Writes an analysis recording (see AnalysisRecording.h) that the app can
+    replay. Recordings always hold the full FFT frame, so the values passed
+    to writeFrame() are ignored, and no waveform is stored.
+ */
+class RecordingFrameWriter : public AnalysisFrameWriter
+{
+public:
+    RecordingFrameWriter (OutputStream& stream)
+    :   output (stream)
+    {
+    }
+
+    void begin (double sampleRate, int) override
+    {
+        recorder = std::make_unique<AnalysisRecorder> (output, sampleRate, (int) AnalysisFrame::maxBins, 0);
+    }
+
+    void writeFrame (const AnalysisFrame& frame, const float*, int) override
+    {
+        recorder->writeFrame (frame);
+    }
+
+    void end() override
+    {
+        recorder->finish();
+    }
+
+private:
+    OutputStream& output;
+    std::unique_ptr<AnalysisRecorder> recorder;
+};
+
+//==============================================================================
+/** Runs a PcmInput through a RingBuffer and StreamAnalyzer exactly as a live
+    stream would, one frame per StreamAnalyzer hop, and hands every frame to
+    an AnalysisFrameWriter.
+
+    Each instance owns all its buffers, so any number of them can run on
+    different threads at once.
+ */
+class OfflineAnalyzer
+{
+public:
+    struct Options
+    {
+        int blockSize = 4096;                           // Samples read from the input at a time
+        int numBands = SpectrumBands::defaultNumBands;  // Bands as drawn by the Spectrum
+        SpectrumBands::Scale scale;                     // Spectrum and dB range of the bands
+        bool rawBins = false;                           // Write spectrum magnitudes instead of bands
+        bool levels = false;                            // Write loudness and levels instead, see getLevelValues()
+        bool constantQ = false;                         // Analyse with a ConstantQTransform instead of the FFT
+        ConstantQTransform::Settings constantQSettings;
+    };
+
+    OfflineAnalyzer (const Options& analyzerOptions)
+    :   options (analyzerOptions)
+    {
+    }
+
+    /** Number of values per frame written with Options::levels.
+     */
+    static int getNumLevelValues (int numChannels)
+    {
+        return 4 + 3 * jmin (numChannels, (int) AnalysisLevels::maxChannels);
+    }
+
+    /** Converts a frame's levels to the values written with Options::levels:
+        momentary, short-term and integrated loudness in LUFS, the maximum
+        true peak in dBTP, then per channel the true peak, RMS and peak in dB.
+     */
+    static void getLevelValues (const AnalysisLevels& levels, float* values)
+    {
+        *values++ = levels.momentaryLoudness;
+        *values++ = levels.shortTermLoudness;
+        *values++ = levels.integratedLoudness;
+        *values++ = Decibels::gainToDecibels (levels.maxTruePeak);
+
+        for (int i = 0; i < levels.numChannels; ++i)
+        {
+            *values++ = Decibels::gainToDecibels (levels.truePeak[i]);
+            *values++ = Decibels::gainToDecibels (levels.rms[i]);
+            *values++ = Decibels::gainToDecibels (levels.peak[i]);
+        }
+    }
+
+    /** The levels of the last frame of the last run(), which cover the whole
+        input: its integrated loudness and maximum true peak.
+     */
+    const AnalysisLevels& getFinalLevels() const    { return finalLevels; }
+
+    /** Analyses input to the end. Returns the number of frames written.
+     */
+    int64 run (PcmInput& input, AnalysisFrameWriter& writer)
+    {
+        const int numChannels = input.getNumChannels();
+        const int hopSize = StreamAnalyzer::getHopSize (input.getSampleRate());
+
+        // The ring only ever has to hold one hop plus the analysis window
+        RingBuffer<float> ringBuffer (numChannels, jmax (hopSize, 256) * 10);
+        AnalysisFrameExchange analysis;
+        StreamAnalyzer analyzer (ringBuffer, analysis);
+        analyzer.setSampleRate (input.getSampleRate());
+        analyzer.setConstantQ (options.constantQ, options.constantQSettings);
+
+        const int numBins = options.constantQ ? ConstantQTransform::getNumBins (input.getSampleRate(), options.constantQSettings)
+                                              : (int) AnalysisFrame::maxBins;
+
+        AudioBuffer<float> block (numChannels, options.blockSize);
+        AnalysisFrame frame;
+        const int numValues = options.levels ? getNumLevelValues (numChannels)
+                            : options.rawBins ? numBins
+                            : options.numBands;
+        HeapBlock<float> values ((size_t) jmax (1, numValues));
+        int samplesToNextFrame = hopSize;
+        int64 numFrames = 0;
+        finalLevels = AnalysisLevels();
+
+        writer.begin (input.getSampleRate(), numValues);
+
+        for (;;)
+        {
+            const int numRead = input.read (block, options.blockSize);
+
+            if (numRead <= 0)
+                break;
+
+            // Feed the ring up to each hop boundary so a frame lands on every
+            // hop, however the input's blocks are aligned
+            for (int start = 0; start < numRead;)
+            {
+                const int numToWrite = jmin (samplesToNextFrame, numRead - start);
+                ringBuffer.writeSamples (block, start, numToWrite);
+                start += numToWrite;
+                samplesToNextFrame -= numToWrite;
+
+                if (samplesToNextFrame > 0)
+                    continue;
+
+                samplesToNextFrame = hopSize;
+
+                analyzer.analyse();
+                analysis.read (frame);
+
+                if (options.levels)
+                {
+                    getLevelValues (frame.levels, values);
+                    writer.writeFrame (frame, values, numValues);
+                }
+                else if (options.rawBins)
+                {
+                    writer.writeFrame (frame, frame.magnitudes, frame.numBins);
+                }
+                else
+                {
+                    SpectrumBands::map (frame, values, options.numBands, 1.0f, options.scale);
+                    writer.writeFrame (frame, values, options.numBands);
+                }
+
+                finalLevels = frame.levels;
+                ++numFrames;
+            }
+        }
+
+        writer.end();
+        return numFrames;
+    }
+
+private:
+    Options options;
+    AnalysisLevels finalLevels;
+};
+
+//==============================================================================
+/** Analyses many files in parallel, one ThreadPool job per file. Each file
+    writes its frames to its own output file next to the others in
+    outputDirectory.
+ */
+class BatchAnalyzer
+{
+public:
+    enum OutputFormat
+    {
+        csvFormat = 0,
+        binaryFormat,
+        recordingFormat
+    };
+
+    struct FileResult
+    {
+        File input, output;
+        int64 numFrames = 0;
+        AnalysisLevels levels;  // Of the whole file, see OfflineAnalyzer::getFinalLevels()
+        String error;           // Empty on success
+    };
+
+    BatchAnalyzer (AudioFormatManager& formats, const OfflineAnalyzer::Options& analyzerOptions,
+                   OutputFormat format, int numThreads)
+    :   formatManager (formats),
+        options (analyzerOptions),
+        outputFormat (format),
+        pool (jmax (1, numThreads))
+    {
+    }
+
+    static String getFileExtension (OutputFormat format)
+    {
+        switch (format)
+        {
+            case binaryFormat:      return ".taf";
+            case recordingFormat:   return ".twar";
+            default:                return ".csv";
+        }
+    }
+
+    /** Creates the writer for format, writing to stream.
+     */
+    static std::unique_ptr<AnalysisFrameWriter> createWriter (OutputFormat format, OutputStream& stream)
+    {
+        switch (format)
+        {
+            case binaryFormat:      return std::make_unique<BinaryFrameWriter> (stream);
+            case recordingFormat:   return std::make_unique<RecordingFrameWriter> (stream);
+            default:                return std::make_unique<CsvFrameWriter> (stream);
+        }
+    }
+
+    /** Analyses every file and waits for all of them. Results are in the same
+        order as inputs.
+     */
+    Array<FileResult> run (const Array<File>& inputs, const File& outputDirectory)
+    {
+        Array<FileResult> results;
+        results.resize (inputs.size());
+
+        for (int i = 0; i < inputs.size(); ++i)
+        {
+            results.getReference (i).input = inputs[i];
+            results.getReference (i).output = outputDirectory.getChildFile (inputs[i].getFileNameWithoutExtension()
+                                                                             + getFileExtension (outputFormat));
+        }
+
+        // Jobs write into their own result slot only, so no locking is needed
+        for (int i = 0; i < inputs.size(); ++i)
+            pool.addJob (new FileJob (*this, results.getReference (i)), true);
+
+        while (pool.getNumJobs() > 0)
+            Thread::sleep (10);
+
+        return results;
+    }
+
+    /** Analyses one file. Called on a pool thread.
+     */
+    void analyseFile (FileResult& result) const
+    {
+        std::unique_ptr<AudioFormatReader> reader (formatManager.createReaderFor (result.input));
+
+        if (reader == nullptr)
+        {
+            result.error = "unsupported or unreadable audio file";
+            return;
+        }
+
+        result.output.deleteFile();
+        FileOutputStream stream (result.output);
+
+        if (stream.failedToOpen())
+        {
+            result.error = "cannot write " + result.output.getFullPathName();
+            return;
+        }
+
+        AudioFileInput input (reader.release());
+        auto writer = createWriter (outputFormat, stream);
+
+        OfflineAnalyzer analyzer (options);
+        result.numFrames = analyzer.run (input, *writer);
+        result.levels = analyzer.getFinalLevels();
+    }
+
+private:
+    class FileJob : public ThreadPoolJob
+    {
+    public:
+        FileJob (const BatchAnalyzer& batchAnalyzer, FileResult& fileResult)
+        :   ThreadPoolJob ("Analyse " + fileResult.input.getFileName()),
+            owner (batchAnalyzer),
+            result (fileResult)
+        {
+        }
+
+        JobStatus runJob() override
+        {
+            owner.analyseFile (result);
+            return jobHasFinished;
+        }
+
+    private:
+        const BatchAnalyzer& owner;
+        FileResult& result;
+    };
+
+    AudioFormatManager& formatManager;
+    OfflineAnalyzer::Options options;
+    OutputFormat outputFormat;
+    ThreadPool pool;
+
+    JUCE_DECLARE_NON_COPYABLE (BatchAnalyzer)
+};
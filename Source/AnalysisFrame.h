@@ -0,0 +1,135 @@
+//
+//  AnalysisFrame.h
+//  3DAudioVisualizers
+//
+//  One frame of analysis results and the lock-free slot used to hand it from
+//  the analysis thread to any number of consumers.
+//
+
+#pragma once
+
+#if ! TOWEL_HEADLESS
+ #include "../JuceLibraryCode/JuceHeader.h"
+#endif
+#include <atomic>
+#include <cstring>
+
+/** Loudness and level readings of a stream at the end of one frame.
+
+    Loudness follows ITU-R BS.1770 / EBU R 128, in LUFS, with every channel
+    weighted equally. Levels are linear gains, 1.0 being full scale. See
+    LevelMeter.h for how each value is measured.
+ */
+struct AnalysisLevels
+{
+    enum
+    {
+        maxChannels = 8
+    };
+
+    static constexpr float minimumLoudness = -100.0f;
+
+    int numChannels = 0;                            // 0 if the frame carries no levels
+    float momentaryLoudness = minimumLoudness;      // LUFS over the last 400 ms
+    float shortTermLoudness = minimumLoudness;      // LUFS over the last 3 s
+    float integratedLoudness = minimumLoudness;     // Gated LUFS since the meter was reset
+    float maxTruePeak = 0.0f;                       // Highest true peak on any channel since the reset
+    float truePeak[maxChannels];                    // Highest true peak since the previous frame
+    float rms[maxChannels];                         // RMS with 300 ms integration
+    float peak[maxChannels];                        // Sample peak, falling 20 dB in 1.7 s
+};
+
+/** The results of analysing one window of a stream.
+
+    This is plain data so it can be copied around with memcpy, recorded to
+    disk, or sent over a socket without any serialisation step.
+ */
+struct AnalysisFrame
+{
+    enum
+    {
+        maxBins = 512
+    };
+
+    int64 sampleClock = 0;      // RingBuffer sample clock at the end of the analysed window
+    int numBins = 0;            // Number of valid entries in magnitudes
+    int binsPerOctave = 0;      // 0: FFT bins from DC up. Otherwise constant-Q bins, see minFrequency
+    float minFrequency = 0.0f;  // Constant-Q only: bin i is centred on minFrequency * 2^(i / binsPerOctave) Hz
+    float magnitudes[maxBins];  // Linear magnitudes, lowest frequency first
+
+    // Filled from magnitudes by a SpectrumProcessor. Recordings and the
+    // analysis server only carry magnitudes, so their readers fill these
+    // themselves if they need them.
+    float levelDb[maxBins];     // dB relative to a full scale sine, optionally averaged
+    float smoothedDb[maxBins];  // levelDb with attack/release ballistics
+    float peakDb[maxBins];      // Held and decaying peaks of levelDb
+
+    AnalysisLevels levels;      // Metered over all audio since the previous frame
+};
+
+/** Hands the most recent AnalysisFrame from one writer to any number of
+    readers without locks.
+
+    This is a sequence lock: the writer never waits, and a reader that raced a
+    publish() simply copies the frame again. Readers only ever see the newest
+    frame; frames they were too slow to read are skipped.
+ */
+class AnalysisFrameExchange
+{
+public:
+    AnalysisFrameExchange() {}
+
+    /** Publishes a new frame. Only one thread may call this.
+     */
+    void publish (const AnalysisFrame& newFrame)
+    {
+        const uint32 s = sequence.load (std::memory_order_relaxed);
+
+        // An odd sequence number marks a write in progress
+        sequence.store (s + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence (std::memory_order_release);
+
+        std::memcpy (&frame, &newFrame, sizeof (AnalysisFrame));
+
+        sequence.store (s + 2, std::memory_order_release);
+    }
+
+    /** Copies the newest frame into dest. Returns false if nothing has been
+        published yet.
+     */
+    bool read (AnalysisFrame& dest) const
+    {
+        for (;;)
+        {
+            const uint32 before = sequence.load (std::memory_order_acquire);
+
+            if (before == 0)
+                return false;
+
+            if ((before & 1) == 0)
+            {
+                std::memcpy (&dest, &frame, sizeof (AnalysisFrame));
+                std::atomic_thread_fence (std::memory_order_acquire);
+
+                if (sequence.load (std::memory_order_relaxed) == before)
+                    return true;
+            }
+
+            Thread::yield();
+        }
+    }
+
+    /** Returns a number that changes every time a frame is published, so
+        consumers can cheaply check for new data before calling read().
+     */
+    uint32 getSequence() const noexcept
+    {
+        return sequence.load (std::memory_order_acquire);
+    }
+
+private:
+    std::atomic<uint32> sequence { 0 };
+    AnalysisFrame frame;
+
+    JUCE_DECLARE_NON_COPYABLE (AnalysisFrameExchange)
+};
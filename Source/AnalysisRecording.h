@@ -0,0 +1,495 @@
+//
+//  AnalysisRecording.h
+//  3DAudioVisualizers
+//
+//  A compact, versioned file format for recording AnalysisFrames and reading
+//  them back with random access.
+//
+
+#pragma once
+
+#if ! TOWEL_HEADLESS
+ #include "../JuceLibraryCode/JuceHeader.h"
+#endif
+
+#include "AnalysisFrame.h"
+
+/** Layout of an analysis recording (.twar). All values are little-endian.
+
+        Header      "TWAR", uint16 version, uint16 flags, float64 sample rate,
+                    int32 bins per frame, int32 waveform samples per frame,
+                    int32 keyframe interval, int32 reserved
+        Frames      one record per frame, see below
+        Index       int32 count, then count x (int64 sample clock, int64 offset)
+                    of every keyframe-interval-th frame
+        Footer      int64 index offset, "TWAX"
+
+    Every frame record starts with a type byte, 'K' (keyframe) or 'D' (delta).
+    A keyframe stores its int64 sample clock, a delta frame stores the
+    distance to the previous frame's clock as a varint. Both then store the
+    frame's peak magnitude as float32, the magnitudes and the waveform.
+
+    Without quantizeFlag, magnitudes and waveform are raw float32 and every
+    frame is a keyframe. With it, each magnitude becomes one byte on a dB
+    scale relative to the frame peak (dynamicRangeDb below the peak maps to
+    0) and the waveform becomes int16. deltaFlag additionally stores the
+    magnitude bytes of delta frames as zigzag varints of the difference to
+    the previous frame, which is one byte per bin for typical material.
+
+    A recording that was never finished (no footer) is still readable; it
+    just cannot seek without scanning. Live streams use a keyframe interval
+    of 0: every frame is a keyframe, so a receiver can drop any of them, and
+    no index is kept.
+ */
+struct AnalysisRecordingFormat
+{
+    enum
+    {
+        version = 1,
+        headerSize = 32,
+        footerSize = 12,
+        defaultKeyframeInterval = 60
+    };
+
+    enum Flags
+    {
+        quantizeFlag = 1 << 0,
+        deltaFlag    = 1 << 1,
+        waveformFlag = 1 << 2
+    };
+
+    static constexpr float dynamicRangeDb = 96.0f;
+};
+
+//==============================================================================
+/** Writes AnalysisFrames (and optionally the audio window each was computed
+    from) to an OutputStream. The stream does not need to be seekable, so a
+    recording can go straight to a pipe or socket.
+
+    Not thread safe: call from one thread at a time.
+ */
+class AnalysisRecorder
+{
+public:
+    AnalysisRecorder (OutputStream& stream, double sampleRate, int numBins, int waveformSize,
+                      int formatFlags = AnalysisRecordingFormat::quantizeFlag | AnalysisRecordingFormat::deltaFlag,
+                      int keyframeInterval = AnalysisRecordingFormat::defaultKeyframeInterval)
+    :   output (stream),
+        bins (jlimit (0, (int) AnalysisFrame::maxBins, numBins)),
+        waveformSamples (jmax (0, waveformSize)),
+        flags (formatFlags),
+        interval (jmax (0, keyframeInterval))
+    {
+        if (waveformSamples > 0)
+            flags |= AnalysisRecordingFormat::waveformFlag;
+        else
+            flags &= ~AnalysisRecordingFormat::waveformFlag;
+
+        if ((flags & AnalysisRecordingFormat::quantizeFlag) == 0 || interval == 0)
+            flags &= ~AnalysisRecordingFormat::deltaFlag;
+
+        output.write ("TWAR", 4);
+        output.writeShort ((short) AnalysisRecordingFormat::version);
+        output.writeShort ((short) flags);
+        output.writeDouble (sampleRate);
+        output.writeInt (bins);
+        output.writeInt (waveformSamples);
+        output.writeInt (interval);
+        output.writeInt (0);
+    }
+
+    ~AnalysisRecorder()
+    {
+        finish();
+    }
+
+    /** Appends a frame. waveform must hold the waveformSize samples given to
+        the constructor, or may be nullptr if that was 0.
+     */
+    void writeFrame (const AnalysisFrame& frame, const float* waveform = nullptr)
+    {
+        jassert (! finished);
+
+        const bool quantize = (flags & AnalysisRecordingFormat::quantizeFlag) != 0;
+        const bool indexed = interval > 0 && (numFrames % interval) == 0;
+        const bool keyframe = indexed || (flags & AnalysisRecordingFormat::deltaFlag) == 0;
+        const int numValues = jmin (bins, frame.numBins);
+        const float peak = numValues > 0 ? FloatVectorOperations::findMinAndMax (frame.magnitudes, numValues).getEnd() : 0.0f;
+
+        if (indexed)
+            index.add ({ frame.sampleClock, output.getPosition() });
+
+        if (keyframe)
+        {
+            output.writeByte ('K');
+            output.writeInt64 (frame.sampleClock);
+        }
+        else
+        {
+            output.writeByte ('D');
+            writeVarint ((uint64) (frame.sampleClock - lastSampleClock));
+        }
+
+        output.writeFloat (peak);
+
+        for (int i = 0; i < bins; ++i)
+        {
+            const float value = i < numValues ? frame.magnitudes[i] : 0.0f;
+
+            if (! quantize)
+            {
+                output.writeFloat (value);
+                continue;
+            }
+
+            const int q = quantizeMagnitude (value, peak);
+
+            if (keyframe)
+                output.writeByte ((char) q);
+            else
+                writeVarint (zigzag (q - previous[i]));
+
+            previous[i] = q;
+        }
+
+        for (int i = 0; i < waveformSamples; ++i)
+        {
+            if (quantize)
+                output.writeShort ((short) roundToInt (jlimit (-1.0f, 1.0f, waveform[i]) * 32767.0f));
+            else
+                output.writeFloat (waveform[i]);
+        }
+
+        lastSampleClock = frame.sampleClock;
+        ++numFrames;
+    }
+
+    /** Writes the seek index and footer. Called by the destructor if needed.
+     */
+    void finish()
+    {
+        if (finished)
+            return;
+
+        finished = true;
+        const int64 indexOffset = output.getPosition();
+
+        output.writeInt (index.size());
+
+        for (auto& entry : index)
+        {
+            output.writeInt64 (entry.sampleClock);
+            output.writeInt64 (entry.offset);
+        }
+
+        output.writeInt64 (indexOffset);
+        output.write ("TWAX", 4);
+        output.flush();
+    }
+
+    int64 getNumFrames() const    { return numFrames; }
+
+    //==========================================================================
+    static int quantizeMagnitude (float value, float peak)
+    {
+        if (value <= 0.0f || peak <= 0.0f)
+            return 0;
+
+        const float db = Decibels::gainToDecibels (value / peak, -AnalysisRecordingFormat::dynamicRangeDb);
+        return jlimit (0, 255, roundToInt ((db / AnalysisRecordingFormat::dynamicRangeDb + 1.0f) * 255.0f));
+    }
+
+private:
+    struct IndexEntry
+    {
+        int64 sampleClock;
+        int64 offset;
+    };
+
+    static uint64 zigzag (int value)
+    {
+        return (uint64) (uint32) ((value << 1) ^ (value >> 31));
+    }
+
+    void writeVarint (uint64 value)
+    {
+        while (value >= 0x80)
+        {
+            output.writeByte ((char) ((value & 0x7f) | 0x80));
+            value >>= 7;
+        }
+
+        output.writeByte ((char) value);
+    }
+
+    OutputStream& output;
+    int bins, waveformSamples, flags, interval;
+    Array<IndexEntry> index;
+    int previous[AnalysisFrame::maxBins] = {};
+    int64 lastSampleClock = 0;
+    int64 numFrames = 0;
+    bool finished = false;
+
+    JUCE_DECLARE_NON_COPYABLE (AnalysisRecorder)
+};
+
+//==============================================================================
+/** Reads a recording written by AnalysisRecorder from a seekable InputStream.
+
+    Decoding a frame is a table lookup per bin, so this is cheap enough to run
+    on the audio thread when the stream is in memory (MemoryInputStream).
+ */
+class AnalysisRecordingReader
+{
+public:
+    AnalysisRecordingReader (InputStream& stream)
+    :   input (stream)
+    {
+        char magic[4] = {};
+
+        if (input.read (magic, 4) != 4 || std::memcmp (magic, "TWAR", 4) != 0)
+            return;
+
+        const int fileVersion = (uint16) input.readShort();
+        flags = (uint16) input.readShort();
+        sampleRate = input.readDouble();
+        bins = input.readInt();
+        waveformSamples = input.readInt();
+        input.readInt();    // keyframe interval, implied by the index
+        input.readInt();
+
+        if (fileVersion > AnalysisRecordingFormat::version
+             || bins < 0 || bins > AnalysisFrame::maxBins || waveformSamples < 0 || sampleRate <= 0.0)
+            return;
+
+        for (int q = 0; q < 256; ++q)
+            dequantize[q] = q == 0 ? 0.0f
+                                   : Decibels::decibelsToGain ((q / 255.0f - 1.0f) * AnalysisRecordingFormat::dynamicRangeDb);
+
+        dataEnd = input.getTotalLength();
+        readIndex();
+
+        input.setPosition (AnalysisRecordingFormat::headerSize);
+        valid = true;
+    }
+
+    bool isValid() const                { return valid; }
+    double getSampleRate() const        { return sampleRate; }
+    int getNumBins() const              { return bins; }
+    int getWaveformSize() const         { return waveformSamples; }
+
+    /** Sample clock of the first and last keyframe, or 0 without an index.
+     */
+    Range<int64> getIndexedRange() const
+    {
+        return index.isEmpty() ? Range<int64>() : Range<int64> (index.getFirst().sampleClock, index.getLast().sampleClock);
+    }
+
+    /** Decodes the next frame. waveform may be nullptr; otherwise it must hold
+        getWaveformSize() samples. Returns false at the end of the recording,
+        including a last frame that was cut short.
+     */
+    bool readNextFrame (AnalysisFrame& frame, float* waveform = nullptr)
+    {
+        if (! valid || (dataEnd >= 0 && input.getPosition() >= dataEnd) || input.isExhausted())
+            return false;
+
+        truncated = false;
+        const auto type = readValue<uint8>();
+        const bool quantize = (flags & AnalysisRecordingFormat::quantizeFlag) != 0;
+        int decoded[AnalysisFrame::maxBins];
+
+        if (type == 'K')
+            frame.sampleClock = (int64) readValue<uint64>();
+        else if (type == 'D' && hasPrevious)
+            frame.sampleClock = lastSampleClock + (int64) readVarint();
+        else
+            return false;
+
+        const float peak = readFloat();
+        frame.numBins = bins;
+        frame.levels = AnalysisLevels();    // Recordings do not store levels
+
+        for (int i = 0; i < bins; ++i)
+        {
+            if (! quantize)
+            {
+                frame.magnitudes[i] = readFloat();
+                continue;
+            }
+
+            const int q = type == 'K' ? (int) readValue<uint8>()
+                                      : previous[i] + unzigzag (readVarint());
+            decoded[i] = jlimit (0, 255, q);
+            frame.magnitudes[i] = peak * dequantize[decoded[i]];
+        }
+
+        for (int i = 0; i < waveformSamples; ++i)
+        {
+            const float sample = quantize ? (int16) readValue<uint16>() * (1.0f / 32767.0f) : readFloat();
+
+            if (waveform != nullptr)
+                waveform[i] = sample;
+        }
+
+        // A partial record leaves the delta state as it was
+        if (truncated)
+            return false;
+
+        if (quantize)
+            std::memcpy (previous, decoded, sizeof (int) * (size_t) bins);
+
+        lastSampleClock = frame.sampleClock;
+        hasPrevious = true;
+        return true;
+    }
+
+    /** Positions the reader so the next frame read is the first one at or
+        after sampleClock. Jumps to the nearest keyframe through the index and
+        decodes forward from there.
+     */
+    void seek (int64 sampleClock)
+    {
+        if (! valid)
+            return;
+
+        int64 offset = AnalysisRecordingFormat::headerSize;
+
+        for (auto& entry : index)
+        {
+            if (entry.sampleClock > sampleClock)
+                break;
+
+            offset = entry.offset;
+        }
+
+        input.setPosition (offset);
+        hasPrevious = false;
+
+        AnalysisFrame frame;
+
+        for (;;)
+        {
+            const int64 framePosition = input.getPosition();
+            const int64 previousClock = lastSampleClock;
+            const bool previousValid = hasPrevious;
+            int savedPrevious[AnalysisFrame::maxBins];
+            std::memcpy (savedPrevious, previous, sizeof (int) * (size_t) bins);
+
+            if (! readNextFrame (frame))
+                return;
+
+            if (frame.sampleClock >= sampleClock)
+            {
+                // Step back so the caller reads this frame next
+                input.setPosition (framePosition);
+                lastSampleClock = previousClock;
+                hasPrevious = previousValid;
+                std::memcpy (previous, savedPrevious, sizeof (int) * (size_t) bins);
+                return;
+            }
+        }
+    }
+
+private:
+    struct IndexEntry
+    {
+        int64 sampleClock;
+        int64 offset;
+    };
+
+    void readIndex()
+    {
+        if (dataEnd < AnalysisRecordingFormat::headerSize + AnalysisRecordingFormat::footerSize)
+            return;
+
+        input.setPosition (dataEnd - AnalysisRecordingFormat::footerSize);
+        const int64 indexOffset = input.readInt64();
+        char magic[4] = {};
+
+        if (input.read (magic, 4) != 4 || std::memcmp (magic, "TWAX", 4) != 0
+             || indexOffset < AnalysisRecordingFormat::headerSize || indexOffset >= dataEnd)
+            return;
+
+        input.setPosition (indexOffset);
+        const int count = input.readInt();
+
+        if (count < 0 || indexOffset + 4 + 16 * (int64) count > dataEnd - AnalysisRecordingFormat::footerSize)
+            return;
+
+        index.ensureStorageAllocated (count);
+
+        for (int i = 0; i < count; ++i)
+        {
+            IndexEntry entry;
+            entry.sampleClock = input.readInt64();
+            entry.offset = input.readInt64();
+            index.add (entry);
+        }
+
+        dataEnd = indexOffset;
+    }
+
+    /** Reads a little-endian integer, noting a short read in truncated.
+     */
+    template <typename IntType>
+    IntType readValue()
+    {
+        uint8 bytes[sizeof (IntType)] = {};
+
+        if (input.read (bytes, (int) sizeof (IntType)) != (int) sizeof (IntType))
+            truncated = true;
+
+        IntType value = 0;
+
+        for (int i = (int) sizeof (IntType); --i >= 0;)
+            value = (IntType) ((value << 8) | bytes[i]);
+
+        return value;
+    }
+
+    float readFloat()
+    {
+        const auto bits = readValue<uint32>();
+        float value;
+        std::memcpy (&value, &bits, sizeof (value));
+        return value;
+    }
+
+    uint64 readVarint()
+    {
+        uint64 value = 0;
+
+        for (int shift = 0; shift < 64; shift += 7)
+        {
+            const auto byte = readValue<uint8>();
+            value |= (uint64) (byte & 0x7f) << shift;
+
+            if ((byte & 0x80) == 0)
+                break;
+        }
+
+        return value;
+    }
+
+    static int unzigzag (uint64 value)
+    {
+        return (int) (value >> 1) ^ -(int) (value & 1);
+    }
+
+    InputStream& input;
+    bool valid = false;
+    int flags = 0;
+    double sampleRate = 0.0;
+    int bins = 0, waveformSamples = 0;
+    int64 dataEnd = -1;
+    Array<IndexEntry> index;
+
+    float dequantize[256];
+    int previous[AnalysisFrame::maxBins] = {};
+    int64 lastSampleClock = 0;
+    bool hasPrevious = false;
+    bool truncated = false;
+
+    JUCE_DECLARE_NON_COPYABLE (AnalysisRecordingReader)
+};
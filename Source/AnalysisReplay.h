@@ -0,0 +1,207 @@
+//
+//  AnalysisReplay.h
+//  3DAudioVisualizers
+//
+//  Records a stream's analysis to an AnalysisRecording file and plays such a
+//  file back as a stream, without running any DSP.
+//
+
+#pragma once
+
+#include "../JuceLibraryCode/JuceHeader.h"
+#include "AudioStream.h"
+#include "AnalysisRecording.h"
+
+/** Records every frame a stream's StreamAnalyzer produces, plus the audio
+    window it was computed from, so the oscilloscopes can be replayed too.
+
+    Frames are written on the analysis thread as they are published. Start
+    recording once the audio device is running, so the stream's sample rate
+    is known.
+ */
+class StreamRecorder : private StreamAnalyzer::Listener
+{
+public:
+    StreamRecorder (AudioStream& streamToRecord, const File& file)
+    :   stream (streamToRecord),
+        waveform (1, StreamAnalyzer::getWindowSize())
+    {
+        file.deleteFile();
+        fileStream = file.createOutputStream();
+
+        if (fileStream == nullptr || stream.getSampleRate() <= 0.0)
+            return;
+
+        recorder = std::make_unique<AnalysisRecorder> (*fileStream, stream.getSampleRate(),
+                                                       (int) AnalysisFrame::maxBins, waveform.getNumSamples());
+        stream.getAnalyzer().setListener (this);
+    }
+
+    ~StreamRecorder()
+    {
+        stream.getAnalyzer().setListener (nullptr);
+
+        // Writes the seek index before the file is closed
+        recorder = nullptr;
+        fileStream = nullptr;
+    }
+
+    bool isRecording() const    { return recorder != nullptr; }
+
+private:
+    void analysisFrameReady (const AnalysisFrame& frame, const AudioBuffer<float>& window) override
+    {
+        // Store what the oscilloscopes draw: the sum of all channels. Halved to
+        // keep a stereo sum inside the quantizer's range; ReplaySource writes
+        // it to both channels, which sums back to the original.
+        const int numSamples = jmin (window.getNumSamples(), waveform.getNumSamples());
+        auto* mono = waveform.getWritePointer (0);
+
+        FloatVectorOperations::clear (mono, waveform.getNumSamples());
+
+        for (int ch = 0; ch < window.getNumChannels(); ++ch)
+            FloatVectorOperations::addWithMultiply (mono, window.getReadPointer (ch), 0.5f, numSamples);
+
+        recorder->writeFrame (frame, mono);
+    }
+
+    AudioStream& stream;
+    std::unique_ptr<FileOutputStream> fileStream;
+    std::unique_ptr<AnalysisRecorder> recorder;
+    AudioBuffer<float> waveform;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (StreamRecorder)
+};
+
+//==============================================================================
+/** Plays an analysis recording into a stream, in a loop. The recorded frames
+    are published as the stream's analysis and the recorded audio windows are
+    written to its RingBuffer, so every visualizer works unchanged while no
+    FFT is computed at all. Recordings only hold magnitudes, so the dB spectra
+    are recomputed here with default ballistics.
+
+    Each frame writes the hop of audio since the previous frame, not its whole
+    window, so the RingBuffer's sample clock advances with the recording's
+    frames: the newest hop of the window when windows overlap, or the window
+    after holding its first sample when they leave gaps. The clock runs at
+    the recording's sample rate.
+
+    The whole file is loaded into memory up front so the audio thread never
+    touches the disk.
+ */
+class ReplaySource : public StreamSource
+{
+public:
+    ReplaySource (const File& file)
+    {
+        file.loadFileAsData (data);
+        input = std::make_unique<MemoryInputStream> (data, false);
+        reader = std::make_unique<AnalysisRecordingReader> (*input);
+
+        if (reader->isValid())
+        {
+            waveform.setSize (2, jmax (1, reader->getWaveformSize()));
+            waveform.clear();
+            padding.setSize (2, waveform.getNumSamples());
+            rewind();
+        }
+    }
+
+    /** False if the file is not an analysis recording.
+     */
+    bool isValid() const    { return reader->isValid() && hasPendingFrame; }
+
+    bool providesAnalysis() const override                      { return true; }
+    void attachAnalysis (AnalysisFrameExchange& exchange) override { analysis = &exchange; }
+
+    void prepare (int, double sampleRate) override
+    {
+        deviceSampleRate = sampleRate;
+    }
+
+    void processBlock (const AudioSourceChannelInfo& deviceInput,
+                       RingBuffer<float>& ringBuffer) override
+    {
+        if (! isValid() || analysis == nullptr || deviceSampleRate <= 0.0)
+            return;
+
+        // Advance in the recording's own sample clock
+        playbackClock += deviceInput.numSamples * reader->getSampleRate() / deviceSampleRate;
+
+        while (pendingFrame.sampleClock - firstSampleClock <= playbackClock)
+        {
+            if (reader->getWaveformSize() > 0)
+                writeHop (ringBuffer, pendingFrame.sampleClock - previousSampleClock);
+
+            spectrumProcessor.process (pendingFrame, (pendingFrame.sampleClock - previousSampleClock) / reader->getSampleRate(),
+                                       StreamAnalyzer::getFullScaleMagnitude());
+            previousSampleClock = pendingFrame.sampleClock;
+            analysis->publish (pendingFrame);
+
+            if (! readPendingFrame())
+            {
+                // Loop, and wait for the next block before playing the first frame again
+                rewind();
+                break;
+            }
+        }
+    }
+
+private:
+    /** Writes the hop samples that led up to the pending frame, or its whole
+        window for the first frame of the loop (hop 0).
+     */
+    void writeHop (RingBuffer<float>& ringBuffer, int64 hop)
+    {
+        const int windowSize = reader->getWaveformSize();
+        waveform.copyFrom (1, 0, waveform, 0, 0, windowSize);
+
+        // Windows further apart than their size: hold the first sample across the gap
+        for (int64 gap = hop - windowSize; gap > 0;)
+        {
+            const int numSamples = (int) jmin (gap, (int64) padding.getNumSamples());
+
+            for (int ch = 0; ch < padding.getNumChannels(); ++ch)
+                FloatVectorOperations::fill (padding.getWritePointer (ch), waveform.getSample (0, 0), numSamples);
+
+            ringBuffer.writeSamples (padding, 0, numSamples);
+            gap -= numSamples;
+        }
+
+        const int newest = hop > 0 ? (int) jmin (hop, (int64) windowSize) : windowSize;
+        ringBuffer.writeSamples (waveform, windowSize - newest, newest);
+    }
+
+    bool readPendingFrame()
+    {
+        hasPendingFrame = reader->readNextFrame (pendingFrame, waveform.getWritePointer (0));
+        return hasPendingFrame;
+    }
+
+    void rewind()
+    {
+        reader->seek (0);
+        playbackClock = 0.0;
+        spectrumProcessor.reset();
+
+        if (readPendingFrame())
+            firstSampleClock = previousSampleClock = pendingFrame.sampleClock;
+    }
+
+    MemoryBlock data;
+    std::unique_ptr<MemoryInputStream> input;
+    std::unique_ptr<AnalysisRecordingReader> reader;
+    AnalysisFrameExchange* analysis = nullptr;
+
+    AnalysisFrame pendingFrame;
+    bool hasPendingFrame = false;
+    AudioBuffer<float> waveform;
+    AudioBuffer<float> padding;     // Held samples between windows, see writeHop()
+    int64 firstSampleClock = 0;
+    int64 previousSampleClock = 0;
+    SpectrumProcessor spectrumProcessor;
+    double playbackClock = 0.0;
+    double deviceSampleRate = 0.0;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (ReplaySource)
+};
@@ -0,0 +1,492 @@
+//
+//  AnalysisServer.h
+//  3DAudioVisualizers
+//
+//  Streams a stream's analysis frames to any number of local socket clients.
+//
+
+#pragma once
+
+#if ! TOWEL_HEADLESS
+ #include "../JuceLibraryCode/JuceHeader.h"
+#endif
+
+#include "AnalysisRecording.h"
+#include <memory>
+
+/** Publishes the frames of one AnalysisFrameExchange over TCP, so dashboards
+    and remote displays can show the analysis without running their own FFT.
+
+    The server reads the exchange exactly like the renderers do: it polls the
+    sequence number and copies the newest frame, so it never blocks the
+    analysis thread and never holds more than one frame from it. It only
+    polls while clients are connected, at twice the rate frames arrive;
+    otherwise its thread sleeps until a connection comes in.
+
+    Each connection receives an analysis recording (see AnalysisRecording.h)
+    with a keyframe interval of 0: a 32 byte header, then one self-contained
+    keyframe record per frame. AnalysisClient reads it, and so does
+    AnalysisRecordingReader on any socket stream.
+
+    Every frame is encoded once and shared by all clients. Each client has its
+    own sender thread and a bounded queue:
+      - Batching: whatever is queued, up to maxBatchFrames, goes out in one
+        socket write, at most once every batchIntervalMs.
+      - Backpressure: a client that reads slowly fills its kernel buffer,
+        which blocks only its own sender thread.
+      - Drop-oldest: once maxQueuedFrames are waiting, the oldest is dropped,
+        so a slow client always catches up to the newest frames. Receivers
+        can spot the gap in the sample clocks.
+
+    If the format changes (new sample rate or bin count) connected clients are
+    disconnected, so each connection only ever sees one header.
+
+    The listener binds to 127.0.0.1 unless localhostOnly is false. JUCE has no
+    Unix domain sockets, so local clients use the loopback interface.
+ */
+class AnalysisServer : private Thread
+{
+public:
+    struct Options
+    {
+        int port = 7411;                // 0 picks a free port, see getPort()
+        bool localhostOnly = true;
+        int maxClients = 32;
+        int maxQueuedFrames = 32;       // Per client; the oldest frame is dropped beyond this
+        int maxBatchFrames = 8;         // Frames sent with one socket write
+        int batchIntervalMs = 0;        // Minimum time between writes; 0 sends as soon as possible
+        bool quantize = true;           // One byte per bin instead of float32
+    };
+
+    AnalysisServer (const Options& serverOptions)
+    :   Thread ("Analysis Server"),
+        options (serverOptions)
+    {
+    }
+
+    ~AnalysisServer()
+    {
+        stop();
+    }
+
+    /** Starts listening. Returns false if the port could not be opened.
+     */
+    bool start()
+    {
+        stop();
+
+        if (! listener.createListener (options.port, options.localhostOnly ? "127.0.0.1" : String()))
+            return false;
+
+        droppedByClosedClients = 0;
+
+        startThread();
+        return true;
+    }
+
+    /** Closes the listener and every connection.
+     */
+    void stop()
+    {
+        stopThread (1000);
+        listener.close();
+
+        const ScopedLock sl (clientLock);
+
+        for (auto* client : clients)
+            droppedByClosedClients += client->getNumDroppedFrames();
+
+        clients.clear();
+    }
+
+    bool isRunning() const      { return isThreadRunning(); }
+    int getPort() const         { return listener.getBoundPort(); }
+
+    /** Serves the frames published to exchange, analysed at sampleRate. Pass
+        nullptr before the exchange is deleted. Can be called from any thread.
+     */
+    void setSource (AnalysisFrameExchange* exchange, double sampleRate)
+    {
+        const ScopedLock sl (sourceLock);
+
+        source = sampleRate > 0.0 ? exchange : nullptr;
+        sourceSampleRate = sampleRate;
+        lastSequence = 0;
+    }
+
+    int getNumClients() const
+    {
+        const ScopedLock sl (clientLock);
+        return clients.size();
+    }
+
+    /** Frames dropped for slow clients since start(), summed over clients.
+     */
+    int64 getNumDroppedFrames() const
+    {
+        const ScopedLock sl (clientLock);
+        int64 total = droppedByClosedClients;
+
+        for (auto* client : clients)
+            total += client->getNumDroppedFrames();
+
+        return total;
+    }
+
+private:
+    using Message = std::shared_ptr<const MemoryBlock>;
+
+    //==========================================================================
+    /** One connection and the thread that writes to it.
+     */
+    class Client : private Thread
+    {
+    public:
+        Client (StreamingSocket* connectedSocket, const Options& serverOptions)
+        :   Thread ("Analysis Server Client"),
+            socket (connectedSocket),
+            options (serverOptions)
+        {
+            queue.ensureStorageAllocated (options.maxQueuedFrames);
+            startThread();
+        }
+
+        ~Client()
+        {
+            signalThreadShouldExit();
+            socket->close();    // Unblocks a write to a client that stopped reading
+            stopThread (1000);
+        }
+
+        /** Queues a frame, dropping the oldest one if the queue is full.
+         */
+        void push (const Message& header, const Message& frame)
+        {
+            {
+                const ScopedLock sl (queueLock);
+
+                if (queue.size() >= options.maxQueuedFrames)
+                {
+                    queue.remove (0);
+                    ++numDropped;
+                }
+
+                queue.add (frame);
+                currentHeader = header;
+            }
+
+            notify();
+        }
+
+        bool isConnected() const            { return isThreadRunning(); }
+        int64 getNumDroppedFrames() const   { return numDropped.load(); }
+
+    private:
+        void run() override
+        {
+            Array<Message> batch;
+            MemoryOutputStream buffer;    // Keeps its allocation across reset()
+            Message sentHeader;
+
+            while (! threadShouldExit())
+            {
+                Message header;
+
+                {
+                    const ScopedLock sl (queueLock);
+                    const int numToSend = jmin (queue.size(), jmax (1, options.maxBatchFrames));
+
+                    for (int i = 0; i < numToSend; ++i)
+                        batch.add (queue[i]);
+
+                    queue.removeRange (0, numToSend);
+                    header = currentHeader;
+                }
+
+                if (batch.isEmpty())
+                {
+                    wait (100);
+                    continue;
+                }
+
+                buffer.reset();
+
+                if (header != sentHeader)
+                {
+                    // A client only ever gets one header
+                    if (sentHeader != nullptr)
+                        break;
+
+                    buffer.write (header->getData(), header->getSize());
+                    sentHeader = header;
+                }
+
+                for (auto& frame : batch)
+                    buffer.write (frame->getData(), frame->getSize());
+
+                batch.clearQuick();
+
+                if (socket->write (buffer.getData(), (int) buffer.getDataSize()) != (int) buffer.getDataSize())
+                    break;
+
+                if (options.batchIntervalMs > 0)
+                    wait (options.batchIntervalMs);
+            }
+
+            socket->close();
+        }
+
+        std::unique_ptr<StreamingSocket> socket;
+        const Options& options;
+
+        CriticalSection queueLock;
+        Array<Message> queue;
+        Message currentHeader;
+        std::atomic<int64> numDropped { 0 };
+
+        JUCE_DECLARE_NON_COPYABLE (Client)
+    };
+
+    //==========================================================================
+    /** Accepts connections, forwards new frames and reaps closed connections.
+     */
+    void run() override
+    {
+        AnalysisFrame frame;
+
+        while (! threadShouldExit())
+        {
+            const bool serving = getNumClients() > 0;
+
+            // Doubles as the poll interval for new frames, which only matter to clients
+            if (listener.waitUntilReady (true, serving ? pollIntervalMs : idleIntervalMs) == 1)
+                acceptClient();
+
+            if (serving && readNewFrame (frame))
+                broadcast (frame);
+
+            removeClosedClients();
+        }
+    }
+
+    void acceptClient()
+    {
+        std::unique_ptr<StreamingSocket> socket (listener.waitForNextConnection());
+
+        if (socket == nullptr)
+            return;
+
+        const ScopedLock sl (clientLock);
+
+        if (clients.size() < options.maxClients)
+            clients.add (new Client (socket.release(), options));
+    }
+
+    bool readNewFrame (AnalysisFrame& frame)
+    {
+        const ScopedLock sl (sourceLock);
+
+        if (source == nullptr)
+            return false;
+
+        const uint32 sequence = source->getSequence();
+
+        if (sequence == lastSequence || ! source->read (frame))
+            return false;
+
+        const double now = Time::getMillisecondCounterHiRes();
+
+        // Each publish adds 2 to the sequence, so this averages how often
+        // frames arrive even when some were skipped. A pause only nudges it
+        if (lastSequence != 0)
+        {
+            const double intervalMs = (now - lastFrameTime) / (double) jmax ((uint32) 1, (sequence - lastSequence) / 2);
+            frameIntervalMs += 0.1 * (jmin (intervalMs, 2.0 * maxPollIntervalMs) - frameIntervalMs);
+            pollIntervalMs = jlimit ((int) minPollIntervalMs, (int) maxPollIntervalMs, roundToInt (frameIntervalMs / 2.0));
+        }
+
+        lastSequence = sequence;
+        lastFrameTime = now;
+
+        // A new format gets a new header, which disconnects existing clients
+        if (encoder == nullptr || encoderSampleRate != sourceSampleRate || encoderNumBins != frame.numBins)
+            createEncoder (sourceSampleRate, frame.numBins);
+
+        return true;
+    }
+
+    void createEncoder (double sampleRate, int numBins)
+    {
+        encoder = nullptr;
+        encoded.reset();
+
+        encoder = std::make_unique<AnalysisRecorder> (encoded, sampleRate, numBins, 0,
+                                                      options.quantize ? (int) AnalysisRecordingFormat::quantizeFlag : 0, 0);
+        header = std::make_shared<const MemoryBlock> (encoded.getData(), encoded.getDataSize());
+        encoderSampleRate = sampleRate;
+        encoderNumBins = numBins;
+    }
+
+    void broadcast (const AnalysisFrame& frame)
+    {
+        encoded.reset();
+        encoder->writeFrame (frame);
+        auto message = std::make_shared<const MemoryBlock> (encoded.getData(), encoded.getDataSize());
+
+        const ScopedLock sl (clientLock);
+
+        for (auto* client : clients)
+            client->push (header, message);
+    }
+
+    void removeClosedClients()
+    {
+        const ScopedLock sl (clientLock);
+
+        for (int i = clients.size(); --i >= 0;)
+        {
+            if (! clients[i]->isConnected())
+            {
+                droppedByClosedClients += clients[i]->getNumDroppedFrames();
+                clients.remove (i);
+            }
+        }
+    }
+
+    enum
+    {
+        minPollIntervalMs = 1,
+        maxPollIntervalMs = 50,
+        idleIntervalMs = 200            // Without clients; a connection wakes it at once
+    };
+
+    const Options options;
+    StreamingSocket listener;
+
+    CriticalSection sourceLock;
+    AnalysisFrameExchange* source = nullptr;
+    double sourceSampleRate = 0.0;
+    uint32 lastSequence = 0;
+
+    // Only touched by the server thread
+    double lastFrameTime = 0.0, frameIntervalMs = 0.0;
+    int pollIntervalMs = minPollIntervalMs;     // Half the time between frames
+    MemoryOutputStream encoded;
+    std::unique_ptr<AnalysisRecorder> encoder;
+    Message header;
+    double encoderSampleRate = 0.0;
+    int encoderNumBins = 0;
+
+    CriticalSection clientLock;
+    OwnedArray<Client> clients;
+    int64 droppedByClosedClients = 0;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (AnalysisServer)
+};
+
+//==============================================================================
+/** Connects to an AnalysisServer and decodes its frames.
+ */
+class AnalysisClient
+{
+public:
+    AnalysisClient() {}
+
+    /** Connects and waits for the stream header, which the server sends with
+        the first frame after connecting. Returns false on failure.
+     */
+    bool connect (const String& host, int port, int timeoutMs = 3000)
+    {
+        disconnect();
+
+        if (! socket.connect (host, port, timeoutMs))
+            return false;
+
+        input = std::make_unique<SocketInputStream> (socket);
+        reader = std::make_unique<AnalysisRecordingReader> (*input);
+        return reader->isValid();
+    }
+
+    void disconnect()
+    {
+        socket.close();
+        reader = nullptr;
+        input = nullptr;
+    }
+
+    double getSampleRate() const    { return reader != nullptr ? reader->getSampleRate() : 0.0; }
+    int getNumBins() const          { return reader != nullptr ? reader->getNumBins() : 0; }
+
+    /** Blocks until the next frame arrives. Returns false once the connection
+        is closed.
+     */
+    bool readNextFrame (AnalysisFrame& frame)
+    {
+        return reader != nullptr && reader->readNextFrame (frame);
+    }
+
+private:
+    /** Reads the socket as a stream, blocking until each read is complete.
+        Buffered, because the reader decodes a byte at a time.
+     */
+    class SocketInputStream : public InputStream
+    {
+    public:
+        SocketInputStream (StreamingSocket& s) : socket (s), buffer (bufferSize) {}
+
+        int64 getTotalLength() override             { return -1; }
+        bool isExhausted() override                 { return bufferedBytes == 0 && ! socket.isConnected(); }
+        int64 getPosition() override                { return position; }
+        bool setPosition (int64 newPosition) override { return newPosition == position; }
+
+        int read (void* destBuffer, int maxBytesToRead) override
+        {
+            auto* dest = static_cast<char*> (destBuffer);
+            int numRead = 0;
+
+            while (numRead < maxBytesToRead)
+            {
+                if (bufferedBytes == 0)
+                {
+                    // Blocks for the first byte only, then takes whatever has arrived
+                    const int n = socket.read (buffer, (int) bufferSize, false);
+
+                    if (n <= 0)
+                    {
+                        socket.close();
+                        break;
+                    }
+
+                    bufferStart = 0;
+                    bufferedBytes = n;
+                }
+
+                const int n = jmin (maxBytesToRead - numRead, bufferedBytes);
+                std::memcpy (dest + numRead, buffer + bufferStart, (size_t) n);
+                bufferStart += n;
+                bufferedBytes -= n;
+                numRead += n;
+            }
+
+            position += numRead;
+            return numRead;
+        }
+
+    private:
+        enum
+        {
+            bufferSize = 65536
+        };
+
+        StreamingSocket& socket;
+        HeapBlock<char> buffer;
+        int bufferStart = 0, bufferedBytes = 0;
+        int64 position = 0;
+    };
+
+    StreamingSocket socket;
+    std::unique_ptr<SocketInputStream> input;
+    std::unique_ptr<AnalysisRecordingReader> reader;
+
+    JUCE_DECLARE_NON_COPYABLE (AnalysisClient)
+};
@@ -0,0 +1,245 @@
+//
+//  AnalysisServerLoopback.h
+//  3DAudioVisualizers
+//
+//  Runs an AnalysisServer against local clients over the loopback interface.
+//
+
+#pragma once
+
+#include "../JuceLibraryCode/JuceHeader.h"
+#include "AnalysisServer.h"
+#include <atomic>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+/** Checks AnalysisServer end to end without any outside service.
+
+    A publisher thread fills an AnalysisFrameExchange with frames whose sample
+    clock advances by one hop and whose magnitudes are a known function of
+    that clock. Several AnalysisClients connect on localhost; the first
+    --slow of them sleep after every frame until their socket buffers fill
+    and the server starts dropping the oldest frames for them. Every client checks that
+    frames arrive in order and decode to the expected values.
+
+        "Towel OpenGL Audio Visualizer" --analysis-server-test [--clients=4]
+            [--slow=1] [--slow-ms=20] [--fps=240] [--seconds=4] [--bins=512]
+
+    The server polls for new frames at twice the rate they are published, and
+    at least every millisecond, so like any reader of an AnalysisFrameExchange
+    it skips frames published faster than that.
+
+    The run fails if any client sees frames out of order or corrupted, or a
+    fast client misses more than 10% of the frames.
+ */
+class AnalysisServerLoopback
+{
+public:
+    struct Options
+    {
+        int numClients = 4;
+        int numSlowClients = 1;
+        int slowClientDelayMs = 20;
+        double framesPerSecond = 240.0;
+        double seconds = 4.0;
+        int numBins = AnalysisFrame::maxBins;
+    };
+
+    struct ClientResult
+    {
+        bool connected = false;
+        int64 framesReceived = 0;
+        int64 framesMissed = 0;     // Gaps in the sample clock
+        int64 outOfOrder = 0;
+        int64 corrupted = 0;
+    };
+
+    //==========================================================================
+    /** Parses options from the command line, runs the test and prints one row
+        per client. Returns a process exit code.
+     */
+    static int runFromCommandLine (const String& commandLine)
+    {
+        Options options;
+        StringArray args;
+        args.addTokens (commandLine, true);
+
+        for (auto& arg : args)
+        {
+            auto value = arg.fromFirstOccurrenceOf ("=", false, false);
+
+            if (arg.startsWith ("--clients="))      options.numClients = jmax (1, value.getIntValue());
+            else if (arg.startsWith ("--slow="))    options.numSlowClients = jmax (0, value.getIntValue());
+            else if (arg.startsWith ("--slow-ms=")) options.slowClientDelayMs = jmax (1, value.getIntValue());
+            else if (arg.startsWith ("--fps="))     options.framesPerSecond = jlimit (1.0, 1000.0 / (double) minFrameIntervalMs, value.getDoubleValue());
+            else if (arg.startsWith ("--seconds=")) options.seconds = jmax (0.1, value.getDoubleValue());
+            else if (arg.startsWith ("--bins="))    options.numBins = jlimit (1, (int) AnalysisFrame::maxBins, value.getIntValue());
+        }
+
+        AnalysisServer::Options serverOptions;
+        serverOptions.port = 0;
+        AnalysisServer server (serverOptions);
+
+        if (! server.start())
+        {
+            std::cout << "cannot open a listening socket on localhost" << std::endl;
+            return 1;
+        }
+
+        int64 framesPublished = 0;
+        auto results = run (options, server, framesPublished);
+
+        std::cout << "Analysis server loopback: port " << server.getPort()
+                  << ", " << framesPublished << " frames of " << options.numBins << " bins at "
+                  << options.framesPerSecond << " fps" << std::endl;
+
+        std::cout << "client  slow  received  missed  out of order  corrupted" << std::endl;
+
+        bool failed = false;
+
+        for (int i = 0; i < (int) results.size(); ++i)
+        {
+            auto& r = results[(size_t) i];
+            const bool slow = i < options.numSlowClients;
+
+            failed = failed || ! r.connected || r.outOfOrder > 0 || r.corrupted > 0
+                       || (! slow && r.framesReceived < framesPublished * 9 / 10);
+
+            std::cout << String (i).paddedLeft (' ', 6)
+                      << String (slow ? "yes" : "no").paddedLeft (' ', 6)
+                      << String (r.framesReceived).paddedLeft (' ', 10)
+                      << String (r.framesMissed).paddedLeft (' ', 8)
+                      << String (r.outOfOrder).paddedLeft (' ', 14)
+                      << String (r.corrupted).paddedLeft (' ', 11) << std::endl;
+        }
+
+        std::cout << "dropped by the server: " << server.getNumDroppedFrames() << std::endl;
+        std::cout << (failed ? "FAILED" : "OK") << std::endl;
+        return failed ? 1 : 0;
+    }
+
+    /** Publishes frames for options.seconds while the clients read them.
+     */
+    static std::vector<ClientResult> run (const Options& options, AnalysisServer& server, int64& framesPublished)
+    {
+        AnalysisFrameExchange exchange;
+        server.setSource (&exchange, sampleRate);
+
+        std::vector<ClientResult> results ((size_t) options.numClients);
+        std::vector<std::unique_ptr<AnalysisClient>> clients;
+        std::vector<std::thread> readers;
+        std::atomic<int> numConnected { 0 };
+        std::atomic<bool> finished { false };
+
+        for (int i = 0; i < options.numClients; ++i)
+        {
+            clients.push_back (std::make_unique<AnalysisClient>());
+
+            readers.emplace_back ([&, i]
+            {
+                auto& client = *clients[(size_t) i];
+                auto& result = results[(size_t) i];
+                const bool slow = i < options.numSlowClients;
+
+                // Connecting blocks until the first frame has been published
+                ++numConnected;
+                result.connected = client.connect ("127.0.0.1", server.getPort());
+
+                AnalysisFrame frame;
+                int64 lastClock = -1;
+
+                while (result.connected && client.readNextFrame (frame))
+                {
+                    ++result.framesReceived;
+
+                    if (frame.sampleClock <= lastClock)
+                        ++result.outOfOrder;
+                    else if (lastClock >= 0)
+                        result.framesMissed += (frame.sampleClock - lastClock) / hopSize - 1;
+
+                    if (! matchesExpected (frame, options.numBins))
+                        ++result.corrupted;
+
+                    lastClock = frame.sampleClock;
+
+                    if (slow && ! finished)
+                        Thread::sleep (options.slowClientDelayMs);
+                }
+            });
+        }
+
+        // Let the clients reach the server before the first frame
+        while (numConnected.load() < options.numClients || server.getNumClients() < options.numClients)
+            Thread::sleep (1);
+
+        const auto startTime = Time::getMillisecondCounterHiRes();
+        const auto numFrames = (int64) (options.seconds * options.framesPerSecond);
+        AnalysisFrame frame;
+
+        for (framesPublished = 0; framesPublished < numFrames; ++framesPublished)
+        {
+            fillExpected (frame, framesPublished * hopSize, options.numBins);
+            exchange.publish (frame);
+
+            const auto due = startTime + (framesPublished + 1) * 1000.0 / options.framesPerSecond;
+            const auto msToWait = due - Time::getMillisecondCounterHiRes();
+
+            // Never publish back to back: the exchange only keeps the newest
+            // frame, so a late publisher catching up would skip frames itself
+            Thread::sleep (jmax ((int) minFrameIntervalMs, (int) std::ceil (msToWait)));
+        }
+
+        // Give the fast clients time to drain, then hang up on everyone. Slow
+        // clients read whatever is still buffered at full speed, which shows
+        // the frames the server dropped for them as a gap.
+        Thread::sleep (200);
+        finished = true;
+        server.setSource (nullptr, 0.0);
+        server.stop();
+
+        for (auto& reader : readers)
+            reader.join();
+
+        return results;
+    }
+
+private:
+    enum
+    {
+        hopSize = 800,
+        minFrameIntervalMs = 3
+    };
+
+    static constexpr double sampleRate = 48000.0;
+
+    /** Magnitudes are a ramp whose slope depends on the sample clock, with the
+        peak always at the last bin so quantization is exact there.
+     */
+    static void fillExpected (AnalysisFrame& frame, int64 sampleClock, int numBins)
+    {
+        frame.sampleClock = sampleClock;
+        frame.numBins = numBins;
+
+        const float top = 1.0f + (float) ((sampleClock / hopSize) % 100);
+
+        for (int i = 0; i < numBins; ++i)
+            frame.magnitudes[i] = top * (float) (i + 1) / (float) numBins;
+    }
+
+    static bool matchesExpected (const AnalysisFrame& frame, int numBins)
+    {
+        AnalysisFrame expected;
+        fillExpected (expected, frame.sampleClock, numBins);
+
+        if (frame.numBins != numBins)
+            return false;
+
+        // One quantization step is 96 / 255 dB
+        for (int i = 0; i < numBins; ++i)
+            if (std::abs (Decibels::gainToDecibels (frame.magnitudes[i]) - Decibels::gainToDecibels (expected.magnitudes[i])) > 0.2f)
+                return false;
+
+        return true;
+    }
+};
@@ -0,0 +1,424 @@
+//
+//  AudioStream.h
+//  3DAudioVisualizers
+//
+//  A named audio source with its own RingBuffer and analysis.
+//
+
+#pragma once
+
+#include "../JuceLibraryCode/JuceHeader.h"
+#include "RingBuffer.h"
+#include "OscilloscopeTrigger.h"
+#include "StreamAnalyzer.h"
+#include "SharedRingBuffer.h"
+
+//==============================================================================
+/** Produces audio for one AudioStream. Sources are called on the audio thread,
+    once per device callback, and write straight into the stream's RingBuffer.
+ */
+class StreamSource
+{
+public:
+    virtual ~StreamSource() {}
+
+    virtual void prepare (int /*samplesPerBlockExpected*/, double /*sampleRate*/) {}
+    virtual void release() {}
+
+    /** Writes the next block of audio into ringBuffer. Must not allocate or
+        block: size everything in prepare(). Debug builds check the whole
+        audio callback, see ScopedNoHeapAllocation.
+
+        @param deviceInput  the device callback buffer, still holding the
+                            device input when this is called
+        @param ringBuffer   the stream's RingBuffer
+     */
+    virtual void processBlock (const AudioSourceChannelInfo& deviceInput,
+                               RingBuffer<float>& ringBuffer) = 0;
+
+    /** True if this source's audio comes from the audio device inputs, so the
+        device input latency applies to it.
+     */
+    virtual bool isDeviceInput() const    { return false; }
+
+    /** Sources that already have analysis (e.g. a replayed recording) return
+        true and publish their own frames to the exchange passed to
+        attachAnalysis(); the stream's StreamAnalyzer is then never run.
+     */
+    virtual bool providesAnalysis() const   { return false; }
+    virtual void attachAnalysis (AnalysisFrameExchange&) {}
+};
+
+//==============================================================================
+/** A group of one or two adjacent device input channels. A mono group leaves
+    the second RingBuffer channel silent.
+ */
+class DeviceInputSource : public StreamSource
+{
+public:
+    DeviceInputSource (int firstInputChannel, int numInputChannels)
+    :   firstChannel (firstInputChannel),
+        numChannels (jlimit (1, 2, numInputChannels))
+    {
+    }
+
+    void prepare (int samplesPerBlockExpected, double) override
+    {
+        silence.setSize (1, samplesPerBlockExpected);
+        silence.clear();
+    }
+
+    void processBlock (const AudioSourceChannelInfo& deviceInput,
+                       RingBuffer<float>& ringBuffer) override
+    {
+        auto& buffer = *deviceInput.buffer;
+
+        if (firstChannel >= buffer.getNumChannels()
+            || deviceInput.numSamples > silence.getNumSamples())
+            return;
+
+        const float* channels[2];
+        channels[0] = buffer.getReadPointer (firstChannel, deviceInput.startSample);
+        channels[1] = (numChannels > 1 && firstChannel + 1 < buffer.getNumChannels())
+                        ? buffer.getReadPointer (firstChannel + 1, deviceInput.startSample)
+                        : silence.getReadPointer (0);
+
+        ringBuffer.writeSamples (channels, deviceInput.numSamples);
+    }
+
+    bool isDeviceInput() const override    { return true; }
+
+private:
+    int firstChannel;
+    int numChannels;
+    AudioBuffer<float> silence;
+};
+
+//==============================================================================
+/** Plays a file in a loop into the stream only. The file is not audible; the
+    main transport in MainContentComponent is what the user hears.
+
+    The file is read ahead on readThread, so the audio thread only copies
+    samples that are already in memory.
+ */
+class FilePlayerSource : public StreamSource
+{
+public:
+    enum
+    {
+        readAheadSamples = 1 << 15
+    };
+
+    /** Takes ownership of reader. readThread must outlive the source.
+     */
+    FilePlayerSource (AudioFormatReader* reader, TimeSliceThread& readThread)
+    {
+        readerSource = std::make_unique<AudioFormatReaderSource> (reader, true);
+        readerSource->setLooping (true);
+        transportSource.setSource (readerSource.get(), readAheadSamples, &readThread, reader->sampleRate);
+        transportSource.start();
+    }
+
+    ~FilePlayerSource()
+    {
+        transportSource.setSource (nullptr);
+    }
+
+    void prepare (int samplesPerBlockExpected, double sampleRate) override
+    {
+        transportSource.prepareToPlay (samplesPerBlockExpected, sampleRate);
+        scratch.setSize (2, samplesPerBlockExpected);
+    }
+
+    void release() override
+    {
+        transportSource.releaseResources();
+    }
+
+    void processBlock (const AudioSourceChannelInfo& deviceInput,
+                       RingBuffer<float>& ringBuffer) override
+    {
+        const int numSamples = jmin (deviceInput.numSamples, scratch.getNumSamples());
+
+        AudioSourceChannelInfo info (&scratch, 0, numSamples);
+        transportSource.getNextAudioBlock (info);
+        ringBuffer.writeSamples (scratch, 0, numSamples);
+    }
+
+private:
+    std::unique_ptr<AudioFormatReaderSource> readerSource;
+    AudioTransportSource transportSource;
+    AudioBuffer<float> scratch;
+};
+
+//==============================================================================
+/** One named audio stream: a source, the RingBuffer it writes into, and the
+    analysis computed from that RingBuffer.
+
+    Streams without a source are fed by calling writeSamples() from the audio
+    thread instead.
+ */
+class AudioStream
+{
+public:
+    /** Breakdown of how long audio takes to reach the visualizers.
+     */
+    struct InputLatency
+    {
+        double deviceMs = 0.0;      // Reported by the audio device driver (device inputs only)
+        double blockMs = 0.0;       // One audio callback block
+        double bufferAgeMs = 0.0;   // Measured wait in the RingBuffer before a visualizer read it
+
+        double getTotalMs() const   { return deviceMs + blockMs + bufferAgeMs; }
+    };
+
+    AudioStream (const String& streamName, std::unique_ptr<StreamSource> streamSource, int numChannels = 2)
+    :   name (streamName),
+        source (std::move (streamSource)),
+        ringBuffer (numChannels, defaultBlockSize * ringBufferBlocks),
+        analyzer (ringBuffer, analysis)
+    {
+        if (source != nullptr)
+            source->attachAnalysis (analysis);
+    }
+
+    const String& getName() const    { return name; }
+
+    //==========================================================================
+    // Audio Lifecycle
+
+    /** Sizes the RingBuffer for a new audio device. The RingBuffer only
+        reallocates when it needs more room than it ever had.
+     */
+    void prepare (int samplesPerBlockExpected, double newSampleRate)
+    {
+        sampleRate = newSampleRate;
+        samplesPerBlock = samplesPerBlockExpected;
+
+        // Read + write sizes must stay below the ring size (see RingBuffer.h).
+        // Oscilloscope triggers read up to half the ring, up to
+        // getMaxReadDelay() behind the newest sample.
+        const int blockSize = jmax (samplesPerBlockExpected, (int) minimumBlockSize);
+        const int requiredSize = jmax (blockSize * ringBufferBlocks,
+                                       2 * OscilloscopeTrigger::getHistorySize (sampleRate)
+                                           + OscilloscopeTrigger::getMaxReadDelay (sampleRate));
+
+        if (requiredSize != ringBuffer.getBufferSize())
+            ringBuffer.setSize (requiredSize);
+        else
+            ringBuffer.clear();
+
+        sharedScratch.setSize (ringBuffer.getNumChannels(), blockSize, false, false, true);
+        analyzer.setSampleRate (sampleRate);
+
+        if (auto* shared = sharedOutput.get())
+            shared->setSampleRate (sampleRate);
+
+        if (source != nullptr)
+            source->prepare (samplesPerBlockExpected, sampleRate);
+    }
+
+    void release()
+    {
+        if (source != nullptr)
+            source->release();
+
+        ringBuffer.clear();
+    }
+
+    /** Pulls the next block from the source. Audio thread only.
+     */
+    void processBlock (const AudioSourceChannelInfo& deviceInput)
+    {
+        const int64 writtenBefore = ringBuffer.getTotalSamplesWritten();
+
+        if (source != nullptr)
+            source->processBlock (deviceInput, ringBuffer);
+
+        mirrorAudioToSharedOutput (writtenBefore);
+        wakeSchedulerIfNeeded();
+    }
+
+    /** Pushes audio into a stream that has no source. Audio thread only.
+     */
+    void writeSamples (AudioBuffer<float>& audioData, int startSample, int numSamples)
+    {
+        const int64 writtenBefore = ringBuffer.getTotalSamplesWritten();
+        ringBuffer.writeSamples (audioData, startSample, numSamples);
+        mirrorAudioToSharedOutput (writtenBefore);
+        wakeSchedulerIfNeeded();
+    }
+
+    //==========================================================================
+    // Analysis
+
+    /** True when a new analysis frame should be computed, i.e. the stream
+        advanced by one hop (see StreamAnalyzer::getHopSize()).
+     */
+    bool isAnalysisDue() const
+    {
+        if (source != nullptr && source->providesAnalysis())
+            return false;
+
+        return sampleRate > 0.0 && analyzer.isDue (StreamAnalyzer::getHopSize (sampleRate));
+    }
+
+    /** Sets the event the audio thread signals whenever this stream has work
+        for the analysis scheduler: a hop to analyse, or a replayed frame to
+        mirror into shared memory. Set by StreamRegistry before the stream
+        runs.
+     */
+    void setSchedulerEvent (WaitableEvent* event)
+    {
+        schedulerEvent = event;
+    }
+
+    /** True while analysis frames are mirrored into shared memory.
+     */
+    bool hasSharedOutput() const
+    {
+        return sharedOutput.get() != nullptr;
+    }
+
+    /** Mirrors this stream's audio and analysis into shared memory, or stops
+        (nullptr). Use StreamRegistry::setSharedOutput(), which synchronises
+        with the analysis scheduler; shared must outlive the audio device.
+     */
+    void setSharedOutput (SharedRingBuffer* shared)
+    {
+        jassert (shared == nullptr || shared->getNumChannels() == ringBuffer.getNumChannels());
+
+        if (shared != nullptr && sampleRate > 0.0)
+            shared->setSampleRate (sampleRate);
+
+        lastSharedFrameSequence = 0;
+        sharedOutput = shared;
+    }
+
+    /** Copies a newly published analysis frame to the shared output. Called
+        by the StreamRegistry's scheduler thread, the only writer of frames.
+     */
+    void mirrorAnalysisToSharedOutput()
+    {
+        auto* shared = sharedOutput.get();
+
+        if (shared == nullptr)
+            return;
+
+        const uint32 sequence = analysis.getSequence();
+
+        if (sequence != lastSharedFrameSequence && analysis.read (sharedFrame))
+        {
+            lastSharedFrameSequence = sequence;
+            shared->publishFrame (sharedFrame);
+        }
+    }
+
+    StreamAnalyzer& getAnalyzer()                   { return analyzer; }
+    AnalysisFrameExchange& getAnalysis()            { return analysis; }
+    RingBuffer<float>& getRingBuffer()              { return ringBuffer; }
+    double getSampleRate() const                    { return sampleRate; }
+
+    //==========================================================================
+    // Latency
+
+    /** Sets the input latency reported by the audio device. Ignored unless the
+        source is a device input.
+     */
+    void setDeviceInputLatency (int latencyInSamples)
+    {
+        deviceInputLatencySamples = (source != nullptr && source->isDeviceInput()) ? latencyInSamples : 0;
+    }
+
+    /** Sets how long the newest sample takes to be heard after it is
+        written: the device output latency plus one block. 0 for streams
+        that are not played, which then show their newest samples.
+     */
+    void setPlaybackLatency (int latencyInSamples)
+    {
+        playbackLatencySamples = jmax (0, latencyInSamples);
+    }
+
+    int getPlaybackLatency() const                  { return playbackLatencySamples; }
+
+    /** Returns the current input-to-visualizer latency. The device and block
+        parts come from the driver, the buffer part is measured on every read.
+        Display scan-out after the frame is rendered is not included.
+     */
+    InputLatency getInputLatency() const
+    {
+        InputLatency latency;
+
+        if (sampleRate > 0.0)
+        {
+            latency.deviceMs = 1000.0 * deviceInputLatencySamples / sampleRate;
+            latency.blockMs = 1000.0 * samplesPerBlock / sampleRate;
+        }
+
+        latency.bufferAgeMs = 1000.0 * ringBuffer.getLastReadAgeSeconds();
+        return latency;
+    }
+
+private:
+    /** Copies what the last write added to the RingBuffer to the shared
+        output. Runs on the audio thread, the only writer of audio.
+     */
+    void mirrorAudioToSharedOutput (int64 writtenBefore)
+    {
+        auto* shared = sharedOutput.get();
+        const int numSamples = (int) (ringBuffer.getTotalSamplesWritten() - writtenBefore);
+
+        if (shared == nullptr || numSamples <= 0)
+            return;
+
+        if (numSamples > sharedScratch.getNumSamples() || numSamples >= shared->getBufferSize())
+        {
+            jassertfalse;   // Block larger than prepared for, or than the shared ring
+            return;
+        }
+
+        ringBuffer.copyLatestSamples (sharedScratch, numSamples);
+        shared->writeSamples (sharedScratch, 0, numSamples);
+    }
+
+    /** Signals the scheduler if it has something to do for this stream. The
+        event only holds its lock for as long as the scheduler takes to wake.
+     */
+    void wakeSchedulerIfNeeded()
+    {
+        if (schedulerEvent == nullptr)
+            return;
+
+        const bool replaysToSharedOutput = source != nullptr && source->providesAnalysis() && hasSharedOutput();
+
+        if (isAnalysisDue() || replaysToSharedOutput)
+            schedulerEvent->signal();
+    }
+
+    enum
+    {
+        defaultBlockSize = 1024,
+        minimumBlockSize = 256,     // Largest read size of any visualizer
+        ringBufferBlocks = 10
+    };
+
+    String name;
+    std::unique_ptr<StreamSource> source;
+    RingBuffer<float> ringBuffer;
+    AnalysisFrameExchange analysis;
+    StreamAnalyzer analyzer;
+
+    double sampleRate = 0.0;
+    int samplesPerBlock = 0;
+    int deviceInputLatencySamples = 0;
+    int playbackLatencySamples = 0;
+
+    WaitableEvent* schedulerEvent = nullptr;
+
+    Atomic<SharedRingBuffer*> sharedOutput { nullptr };
+    AudioBuffer<float> sharedScratch;       // Audio thread only
+    AnalysisFrame sharedFrame;              // Scheduler thread only
+    uint32 lastSharedFrameSequence = 0;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (AudioStream)
+};
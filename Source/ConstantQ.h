@@ -0,0 +1,395 @@
+//
+//  ConstantQ.h
+//  3DAudioVisualizers
+//
+//  Streaming constant-Q spectrum: log-spaced bins with the same number of
+//  bins per octave from the lowest octave to the highest.
+//
+
+#pragma once
+
+#if ! TOWEL_HEADLESS
+ #include "../JuceLibraryCode/JuceHeader.h"
+#endif
+#include "AnalysisFrame.h"
+#include <cmath>
+#include <map>
+#include <memory>
+#include <vector>
+
+/** A constant-Q transform computed on a decimated pyramid with one sparse
+    spectral kernel.
+
+    Level 0 of the pyramid is the input; every further level is the previous
+    one low-passed by a half-band filter and decimated by two. Octave o (0
+    being the highest) is analysed at level o, where it covers the same
+    normalised frequencies as the top octave does at level 0. So one kernel
+    of binsPerOctave bins serves every octave, and the low octaves get their
+    long windows from a short FFT at a low sample rate instead of a long FFT
+    at the full rate.
+
+    The kernel is the Brown-Puckette spectral kernel: the FFT of each bin's
+    Hann-windowed complex exponential, with everything below a threshold
+    dropped, so each bin is a handful of multiply-adds on the FFT of the
+    newest fftSize samples of its level. Kernels only depend on the bins per
+    octave and the top frequency relative to the sample rate, and are shared
+    by every transform with the same parameters (see getKernel()).
+
+    Feed audio with process() as it arrives, then call getMagnitudes() once
+    per frame. Magnitudes are scaled like the FFT path's, so a full scale
+    sine reaches the magnitude passed as fullScaleMagnitude in its bin, and
+    SpectrumProcessor and SpectrumBands work unchanged. Only prepare()
+    allocates.
+ */
+class ConstantQTransform
+{
+public:
+    struct Settings
+    {
+        int binsPerOctave = 24;
+        float minFrequency = 32.703f;   // Centre of the lowest bin, C1
+        int numOctaves = 0;             // 0 fits as many octaves as the sample rate allows
+    };
+
+    enum
+    {
+        maxOctaves = 10,
+        maxBinsPerOctave = 48,
+        maxFftSize = 4096
+    };
+
+    /** The sparse spectral kernel of one octave: for each bin, the FFT bins
+        it reads and their weights.
+     */
+    struct Kernel
+    {
+        struct Weight
+        {
+            int fftBin;
+            float real, imag;
+        };
+
+        int binsPerOctave = 0;
+        int fftSize = 0;
+        std::vector<int> firstWeight;   // Per bin, plus one past the end
+        std::vector<Weight> weights;
+    };
+
+    ConstantQTransform() {}
+
+    //==========================================================================
+    /** The number of octaves prepare() will use: settings.numOctaves if it
+        fits, otherwise as many as fit below 0.45 times the sample rate and
+        inside AnalysisFrame::maxBins.
+     */
+    static int getNumOctaves (double sampleRate, const Settings& s)
+    {
+        const int binsPerOctave = jlimit (1, (int) maxBinsPerOctave, s.binsPerOctave);
+        int fit = 0;
+
+        while (fit < maxOctaves
+                && s.minFrequency * std::pow (2.0, fit + 1) <= 0.45 * sampleRate
+                && (fit + 1) * binsPerOctave <= AnalysisFrame::maxBins)
+            ++fit;
+
+        return s.numOctaves > 0 ? jmin (s.numOctaves, fit) : fit;
+    }
+
+    static int getNumBins (double sampleRate, const Settings& s)
+    {
+        return getNumOctaves (sampleRate, s) * jlimit (1, (int) maxBinsPerOctave, s.binsPerOctave);
+    }
+
+    /** Sets the transform up for a sample rate, and clears it.
+     */
+    void prepare (double sampleRate, const Settings& newSettings)
+    {
+        settings = newSettings;
+        settings.binsPerOctave = jlimit (1, (int) maxBinsPerOctave, settings.binsPerOctave);
+        settings.numOctaves = numOctaves = getNumOctaves (sampleRate, settings);
+
+        if (numOctaves == 0)
+        {
+            kernel = nullptr;
+            return;
+        }
+
+        const double topFrequency = settings.minFrequency * std::pow (2.0, numOctaves);
+        kernel = getKernel (settings.binsPerOctave, topFrequency / sampleRate);
+        fftSize = kernel->fftSize;
+        fft = std::make_unique<dsp::FFT> (roundToInt (std::log2 (fftSize)));
+
+        fftData.allocate ((size_t) (2 * fftSize), true);
+        history.allocate ((size_t) (numOctaves * fftSize), true);
+        delayLines.allocate ((size_t) (numOctaves * 2 * halfBandLength), true);
+
+        reset();
+    }
+
+    /** Clears the pyramid, as if prepare() had just been called.
+     */
+    void reset()
+    {
+        if (kernel == nullptr)
+            return;
+
+        FloatVectorOperations::clear (history, numOctaves * fftSize);
+        FloatVectorOperations::clear (delayLines, numOctaves * 2 * halfBandLength);
+
+        for (auto& l : levels)
+            l = Level();
+    }
+
+    const Settings& getSettings() const     { return settings; }
+    int getNumBins() const                  { return kernel != nullptr ? numOctaves * settings.binsPerOctave : 0; }
+    int getFftSize() const                  { return fftSize; }
+
+    /** Centre frequency of a bin, lowest first.
+     */
+    float getBinFrequency (int bin) const
+    {
+        return settings.minFrequency * std::pow (2.0f, (float) bin / (float) settings.binsPerOctave);
+    }
+
+    //==========================================================================
+    /** Pushes mono audio through the pyramid.
+     */
+    void process (const float* samples, int numSamples)
+    {
+        if (kernel == nullptr)
+            return;
+
+        for (int i = 0; i < numSamples; ++i)
+            push (samples[i]);
+    }
+
+    /** Analyses the newest audio of every level and writes getNumBins()
+        magnitudes to dest, lowest frequency first.
+     */
+    void getMagnitudes (float* dest, float fullScaleMagnitude)
+    {
+        if (kernel == nullptr)
+            return;
+
+        const int binsPerOctave = settings.binsPerOctave;
+
+        // A sine of amplitude a reaches a / 2 in its bin
+        const float scale = 2.0f * fullScaleMagnitude;
+
+        for (int octave = 0; octave < numOctaves; ++octave)
+        {
+            // Oldest first, so the kernels' right-aligned windows cover the newest samples
+            const float* ring = history + octave * fftSize;
+            const int oldest = levels[octave].writeIndex;
+
+            FloatVectorOperations::copy (fftData, ring + oldest, fftSize - oldest);
+            FloatVectorOperations::copy (fftData + fftSize - oldest, ring, oldest);
+            FloatVectorOperations::clear (fftData + fftSize, fftSize);
+
+            fft->performRealOnlyForwardTransform (fftData, true);
+
+            auto* out = dest + (numOctaves - 1 - octave) * binsPerOctave;
+
+            for (int bin = 0; bin < binsPerOctave; ++bin)
+            {
+                float real = 0.0f, imag = 0.0f;
+
+                for (int w = kernel->firstWeight[(size_t) bin]; w < kernel->firstWeight[(size_t) bin + 1]; ++w)
+                {
+                    const auto& k = kernel->weights[(size_t) w];
+                    const float xr = fftData[2 * k.fftBin];
+                    const float xi = fftData[2 * k.fftBin + 1];
+
+                    real += xr * k.real - xi * k.imag;
+                    imag += xr * k.imag + xi * k.real;
+                }
+
+                out[bin] = scale * std::sqrt (real * real + imag * imag);
+            }
+        }
+    }
+
+    //==========================================================================
+    /** Returns the kernel for binsPerOctave bins whose top octave ends at
+        topFrequency, as a fraction of the sample rate. Kernels are computed
+        on first use and kept for the life of the process, so every stream
+        at the same rate and settings shares one.
+     */
+    static std::shared_ptr<const Kernel> getKernel (int binsPerOctave, double topFrequency)
+    {
+        static CriticalSection cacheLock;
+        static std::map<std::pair<int, int>, std::shared_ptr<const Kernel>> cache;
+
+        const auto key = std::make_pair (binsPerOctave, roundToInt (topFrequency * 1.0e6));
+        const ScopedLock sl (cacheLock);
+        auto& cached = cache[key];
+
+        if (cached == nullptr)
+            cached = computeKernel (binsPerOctave, topFrequency);
+
+        return cached;
+    }
+
+private:
+    enum
+    {
+        halfBandLength = 63,                    // Taps of the decimation filter
+        halfBandCentre = halfBandLength / 2,
+        halfBandPairs = (halfBandCentre + 1) / 2  // Nonzero taps either side of the centre
+    };
+
+    struct Level
+    {
+        int writeIndex = 0;     // Into this level's history ring
+        int delayIndex = 0;     // Into the delay line of the filter feeding the next level
+        bool skip = false;      // Decimation phase
+    };
+
+    /** Writes one sample into level 0 and carries it down the pyramid as far
+        as the decimation phases let it.
+     */
+    void push (float sample)
+    {
+        static const auto coefficients = computeHalfBand();
+
+        for (int level = 0;; ++level)
+        {
+            auto& l = levels[level];
+            history[level * fftSize + l.writeIndex] = sample;
+            l.writeIndex = (l.writeIndex + 1) & (fftSize - 1);
+
+            if (level + 1 >= numOctaves)
+                return;
+
+            // Every sample is written twice, so the last halfBandLength are
+            // always contiguous from delayIndex
+            auto* delay = delayLines + level * 2 * halfBandLength;
+            delay[l.delayIndex] = delay[l.delayIndex + halfBandLength] = sample;
+            l.delayIndex = l.delayIndex + 1 < halfBandLength ? l.delayIndex + 1 : 0;
+
+            l.skip = ! l.skip;
+
+            if (l.skip)
+                return;
+
+            const float* x = delay + l.delayIndex + halfBandCentre;
+            float y = 0.5f * x[0];
+
+            for (int p = 0; p < halfBandPairs; ++p)
+                y += coefficients[(size_t) p] * (x[-(2 * p + 1)] + x[2 * p + 1]);
+
+            sample = y;
+        }
+    }
+
+    /** The odd taps either side of the centre of a Kaiser-windowed half-band
+        lowpass; the centre tap is 0.5 and the even taps are zero.
+     */
+    static std::vector<float> computeHalfBand()
+    {
+        const double beta = 8.0;
+        std::vector<float> c ((size_t) halfBandPairs);
+        double sum = 0.0;
+
+        for (int p = 0; p < halfBandPairs; ++p)
+        {
+            const double d = 2 * p + 1;
+            const double sinc = std::sin (MathConstants<double>::halfPi * d) / (MathConstants<double>::pi * d);
+            const double r = d / halfBandCentre;
+            const double window = besselI0 (beta * std::sqrt (1.0 - r * r)) / besselI0 (beta);
+
+            c[(size_t) p] = (float) (sinc * window);
+            sum += sinc * window;
+        }
+
+        // Unity gain at DC: the pairs add up to the other half
+        for (auto& v : c)
+            v = (float) (v * 0.25 / sum);
+
+        return c;
+    }
+
+    static double besselI0 (double x)
+    {
+        double term = 1.0, sum = 1.0;
+
+        for (int k = 1; k < 32 && term > sum * 1.0e-12; ++k)
+        {
+            const double h = x / (2.0 * k);
+            term *= h * h;
+            sum += term;
+        }
+
+        return sum;
+    }
+
+    static std::shared_ptr<const Kernel> computeKernel (int binsPerOctave, double topFrequency)
+    {
+        auto k = std::make_shared<Kernel>();
+        const double q = 1.0 / (std::pow (2.0, 1.0 / binsPerOctave) - 1.0);
+
+        k->binsPerOctave = binsPerOctave;
+        k->fftSize = jmin ((int) maxFftSize, nextPowerOfTwo ((int) std::ceil (q / (0.5 * topFrequency))));
+
+        const int n = k->fftSize;
+        dsp::FFT fft (roundToInt (std::log2 (n)));
+        std::vector<dsp::Complex<float>> temporal ((size_t) n), spectral ((size_t) n);
+
+        for (int bin = 0; bin < binsPerOctave; ++bin)
+        {
+            const double frequency = topFrequency * std::pow (2.0, (double) (bin - binsPerOctave) / binsPerOctave);
+            const int length = jlimit (1, n, roundToInt (q / frequency));
+
+            std::fill (temporal.begin(), temporal.end(), dsp::Complex<float>());
+            double windowSum = 0.0;
+
+            for (int i = 0; i < length; ++i)
+                windowSum += 0.5 - 0.5 * std::cos (MathConstants<double>::twoPi * (i + 0.5) / length);
+
+            // Right-aligned, so every bin's window ends at the newest sample
+            for (int i = 0; i < length; ++i)
+            {
+                const double window = (0.5 - 0.5 * std::cos (MathConstants<double>::twoPi * (i + 0.5) / length)) / windowSum;
+                const double phase = MathConstants<double>::twoPi * frequency * i;
+                temporal[(size_t) (n - length + i)] = { (float) (window * std::cos (phase)), (float) (window * std::sin (phase)) };
+            }
+
+            fft.perform (temporal.data(), spectral.data(), false);
+
+            float largest = 0.0f;
+
+            for (auto& s : spectral)
+                largest = jmax (largest, std::abs (s));
+
+            // The negative frequencies of a real input mirror the positive
+            // ones, and the kernel has nothing there above the threshold
+            k->firstWeight.push_back ((int) k->weights.size());
+
+            for (int j = 0; j <= n / 2; ++j)
+            {
+                const auto s = spectral[(size_t) j];
+
+                if (std::abs (s) >= kernelThreshold * largest)
+                    k->weights.push_back ({ j, s.real() / (float) n, -s.imag() / (float) n });
+            }
+        }
+
+        k->firstWeight.push_back ((int) k->weights.size());
+        return k;
+    }
+
+    static constexpr float kernelThreshold = 0.0054f;   // Relative to each bin's largest weight
+
+    Settings settings;
+    int numOctaves = 0;
+    int fftSize = 0;
+    std::shared_ptr<const Kernel> kernel;
+    std::unique_ptr<dsp::FFT> fft;
+
+    HeapBlock<float> fftData;
+    HeapBlock<float> history;       // fftSize samples per level
+    HeapBlock<float> delayLines;    // Two copies of halfBandLength samples per level
+    Level levels[maxOctaves];
+
+    JUCE_DECLARE_NON_COPYABLE (ConstantQTransform)
+};
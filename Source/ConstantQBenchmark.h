@@ -0,0 +1,121 @@
+//
+//  ConstantQBenchmark.h
+//  3DAudioVisualizers
+//
+//  Headless benchmark of ConstantQTransform on many channels at once.
+//
+
+#pragma once
+
+#include "../JuceLibraryCode/JuceHeader.h"
+#include "ConstantQ.h"
+#include "SignalGenerator.h"
+#include <chrono>
+#include <iostream>
+
+/** Runs one ConstantQTransform per channel on a single thread, at the
+    analysis rate a stream uses, and reports how much faster than real time
+    they all run together.
+
+    Each channel gets its own generator seed. The audio is rendered before
+    the clock starts, so only the transforms are timed.
+
+        "Towel OpenGL Audio Visualizer" --constant-q-benchmark [--channels=8]
+            [--bins-per-octave=24] [--rate=48000] [--seconds=10] [--generator=pink]
+ */
+class ConstantQBenchmark
+{
+public:
+    struct Options
+    {
+        int numChannels = 8;
+        ConstantQTransform::Settings settings;
+        double sampleRate = 48000.0;
+        double seconds = 10.0;
+        SignalGenerator::Type type = SignalGenerator::pinkNoise;
+    };
+
+    /** Runs the benchmark described by the command line and prints the
+        result. Returns a process exit code.
+     */
+    static int runFromCommandLine (const String& commandLine)
+    {
+        Options options;
+        StringArray args;
+        args.addTokens (commandLine, true);
+
+        for (auto& arg : args)
+        {
+            auto value = arg.fromFirstOccurrenceOf ("=", false, false);
+
+            if (arg.startsWith ("--channels="))             options.numChannels = jmax (1, value.getIntValue());
+            else if (arg.startsWith ("--bins-per-octave=")) options.settings.binsPerOctave = jmax (1, value.getIntValue());
+            else if (arg.startsWith ("--rate="))            options.sampleRate = jmax (1000.0, value.getDoubleValue());
+            else if (arg.startsWith ("--seconds="))         options.seconds = jmax (0.1, value.getDoubleValue());
+            else if (arg.startsWith ("--generator="))       options.type = SignalGenerator::findType (value);
+        }
+
+        if (options.type == SignalGenerator::numTypes)
+        {
+            std::cout << "unknown generator, expected --generator=" << SignalGenerator::getTypeNames() << std::endl;
+            return 1;
+        }
+
+        const int numBins = ConstantQTransform::getNumBins (options.sampleRate, options.settings);
+
+        if (numBins == 0)
+        {
+            std::cout << "no octave above " << options.settings.minFrequency << " Hz fits at " << options.sampleRate << " Hz" << std::endl;
+            return 1;
+        }
+
+        const double wallSeconds = run (options);
+        const double realTime = options.seconds / jmax (1.0e-9, wallSeconds);
+
+        std::cout << "constant-Q: " << options.numChannels << " channels, " << numBins << " bins ("
+                  << ConstantQTransform::getNumOctaves (options.sampleRate, options.settings) << " octaves of "
+                  << jlimit (1, (int) ConstantQTransform::maxBinsPerOctave, options.settings.binsPerOctave) << "), "
+                  << options.sampleRate << " Hz, " << String (options.seconds, 2) << " s of audio in "
+                  << String (wallSeconds, 3) << " s (" << String (realTime, 1) << "x real time, "
+                  << String (100.0 / realTime, 1) << "% of one core)" << std::endl;
+
+        return 0;
+    }
+
+    /** Returns the wall clock seconds the transforms took.
+     */
+    static double run (const Options& options)
+    {
+        const int hopSize = StreamAnalyzer::getHopSize (options.sampleRate);
+        const int numSamples = jmax (hopSize, (int) (options.seconds * options.sampleRate));
+
+        AudioBuffer<float> audio (options.numChannels, numSamples);
+        OwnedArray<ConstantQTransform> transforms;
+
+        for (int ch = 0; ch < options.numChannels; ++ch)
+        {
+            SignalGenerator::Settings settings;
+            settings.seed = (uint32) ch + 1;
+
+            SignalGenerator generator (options.type, settings);
+            generator.prepare (options.sampleRate, 4096);
+            generator.render (audio.getWritePointer (ch), numSamples);
+
+            transforms.add (new ConstantQTransform())->prepare (options.sampleRate, options.settings);
+        }
+
+        float magnitudes[AnalysisFrame::maxBins];
+        const auto startTime = std::chrono::steady_clock::now();
+
+        for (int start = 0; start + hopSize <= numSamples; start += hopSize)
+        {
+            for (int ch = 0; ch < options.numChannels; ++ch)
+            {
+                transforms[ch]->process (audio.getReadPointer (ch, start), hopSize);
+                transforms[ch]->getMagnitudes (magnitudes, StreamAnalyzer::getFullScaleMagnitude());
+            }
+        }
+
+        return std::chrono::duration<double> (std::chrono::steady_clock::now() - startTime).count();
+    }
+};
@@ -0,0 +1,142 @@
+//
+//  DecimatorBenchmark.h
+//  3DAudioVisualizers
+//
+//  Headless timing and accuracy check of WaveformDecimator.
+//
+
+#pragma once
+
+#include "../JuceLibraryCode/JuceHeader.h"
+#include "WaveformDecimator.h"
+#include "SignalGenerator.h"
+#include <chrono>
+#include <iostream>
+
+/** Feeds a generator into a RingBuffer one display frame at a time and
+    reduces windows of 10k, 100k and 1M samples to one envelope column per
+    pixel after every frame, the way Oscilloscope2D does. Prints the time per
+    frame for each window, which should hardly grow with the window, and the
+    largest difference from a brute force scan of the last frame.
+
+        "Towel OpenGL Audio Visualizer" --decimator-benchmark [--width=1920]
+            [--rate=48000] [--seconds=30] [--generator=pink]
+ */
+class DecimatorBenchmark
+{
+public:
+    struct Options
+    {
+        int width = 1920;
+        double sampleRate = 48000.0;
+        double seconds = 30.0;
+        SignalGenerator::Type type = SignalGenerator::pinkNoise;
+    };
+
+    /** Runs the benchmark described by the command line and prints the
+        result. Returns a process exit code.
+     */
+    static int runFromCommandLine (const String& commandLine)
+    {
+        Options options;
+        StringArray args;
+        args.addTokens (commandLine, true);
+
+        for (auto& arg : args)
+        {
+            auto value = arg.fromFirstOccurrenceOf ("=", false, false);
+
+            if (arg.startsWith ("--width="))            options.width = jlimit (16, 16384, value.getIntValue());
+            else if (arg.startsWith ("--rate="))        options.sampleRate = jmax (1000.0, value.getDoubleValue());
+            else if (arg.startsWith ("--seconds="))     options.seconds = jmax (0.1, value.getDoubleValue());
+            else if (arg.startsWith ("--generator="))   options.type = SignalGenerator::findType (value);
+        }
+
+        if (options.type == SignalGenerator::numTypes)
+        {
+            std::cout << "unknown generator, expected --generator=" << SignalGenerator::getTypeNames() << std::endl;
+            return 1;
+        }
+
+        std::cout << "decimator: " << options.width << " columns, " << options.sampleRate << " Hz, "
+                  << String (options.seconds, 2) << " s" << std::endl;
+
+        bool accurate = true;
+
+        for (int windowSize : { 10000, 100000, (int) WaveformDecimator::maxWindowSize })
+        {
+            float maxError = 0.0f;
+            const double microseconds = run (options, windowSize, maxError);
+            accurate = accurate && maxError < 1.0e-3f;
+
+            std::cout << "  " << String (windowSize).paddedLeft (' ', 7) << " samples: "
+                      << String (microseconds, 1) << " us per frame, max error " << maxError << std::endl;
+        }
+
+        return accurate ? 0 : 1;
+    }
+
+    /** Returns the mean microseconds per frame of update() plus
+        getColumns(), and sets maxError to the largest difference of the last
+        frame's columns from a brute force scan.
+     */
+    static double run (const Options& options, int windowSize, float& maxError)
+    {
+        const int hopSize = jmax (1, roundToInt (options.sampleRate / 60.0));
+        const int numFrames = jmax (1, (int) (options.seconds * 60.0));
+        const int numColumns = jmin (options.width, windowSize);
+        const double samplesPerColumn = windowSize / (double) numColumns;
+
+        SignalGenerator generator (options.type);
+        generator.prepare (options.sampleRate, hopSize);
+
+        RingBuffer<float> ringBuffer (1, hopSize * 10);
+        AudioBuffer<float> block (1, hopSize);
+        WaveformDecimator decimator;
+        HeapBlock<WaveformDecimator::Column> columns ((size_t) numColumns);
+
+        // Everything pushed, for the brute force check
+        HeapBlock<float> history ((size_t) hopSize * (size_t) numFrames);
+        double totalSeconds = 0.0;
+
+        for (int frame = 0; frame < numFrames; ++frame)
+        {
+            generator.render (block.getWritePointer (0), hopSize);
+            FloatVectorOperations::copy (history + (size_t) frame * (size_t) hopSize, block.getReadPointer (0), hopSize);
+            ringBuffer.writeSamples (block, 0, hopSize);
+
+            const auto startTime = std::chrono::steady_clock::now();
+            decimator.update (ringBuffer);
+            decimator.getColumns (samplesPerColumn, numColumns, columns);
+            totalSeconds += std::chrono::duration<double> (std::chrono::steady_clock::now() - startTime).count();
+        }
+
+        maxError = 0.0f;
+        const int64 numSamples = decimator.getNumSamplesPushed();
+        const int64 lastColumn = (int64) std::floor (numSamples / samplesPerColumn);
+
+        for (int i = 0; i < numColumns; ++i)
+        {
+            const int64 column = lastColumn - numColumns + i;
+            const int64 start = jmax ((int64) 0, numSamples - (int64) WaveformDecimator::maxWindowSize,
+                                      (int64) std::floor (column * samplesPerColumn));
+            const int64 end = (int64) std::floor ((column + 1) * samplesPerColumn);
+
+            if (start >= end)
+                continue;
+
+            const auto range = FloatVectorOperations::findMinAndMax (history + start, (int) (end - start));
+            double sumOfSquares = 0.0;
+
+            for (int64 s = start; s < end; ++s)
+                sumOfSquares += history[s] * history[s];
+
+            const float rms = (float) std::sqrt (sumOfSquares / (double) (end - start));
+
+            maxError = jmax (maxError, std::abs (columns[i].min - range.getStart()),
+                             std::abs (columns[i].max - range.getEnd()), std::abs (columns[i].rms - rms));
+        }
+
+        return 1.0e6 * totalSeconds / numFrames;
+    }
+};
@@ -0,0 +1,170 @@
+//
+//  FramePacer.h
+//  3DAudioVisualizers
+//
+//  Predicts when a frame reaches the screen and which sample is heard at
+//  that moment.
+//
+
+#pragma once
+
+#include "../JuceLibraryCode/JuceHeader.h"
+#include "RingBuffer.h"
+#include <atomic>
+#include <cmath>
+
+/** Keeps a visualizer's picture in step with the sound.
+
+    A visualizer that reads the newest samples when it renders shows them
+    early by the audio output latency and late by the time until its frame
+    is on screen. Both vary with the device, the block size and when the
+    frame happens to render. beginFrame() predicts the display time of the
+    frame being drawn. getAudibleSample() then returns the position on a
+    RingBuffer's sample clock that will be heard at that moment. Read the
+    samples that end there, see RingBuffer::readSamplesEndingAt().
+
+    Display time: with vsync, a frame is shown at the first vertical blank
+    after it is drawn, and is scanned out over one refresh period. While the
+    context repaints continuously (setContinuous()), a frame that starts
+    within one and a half periods of the previous one was waiting for that
+    frame's swap. Its start is therefore taken as a blank, which gives the
+    phase. The period is the typical interval between such frames. When
+    frames are triggered by a timer instead, e.g. by FrameScheduler, their
+    starts follow the timer rather than the display, so nothing is
+    measured: the swap is assumed to come half a period after drawing, as
+    it is until the phase is known. setDisplayLatency() adds what happens
+    after the swap, e.g. a compositor or a TV's processing.
+
+    Audio time: a stream heard through the device plays its newest sample
+    playbackLatency samples after that sample was written. That is the
+    device output latency plus one block. RingBuffer::getLastWriteTicks()
+    gives when the samples were written.
+
+    One FramePacer per OpenGL context; everything but setDisplayLatency()
+    and setContinuous() must be called on its render thread.
+ */
+class FramePacer
+{
+public:
+    FramePacer() = default;
+
+    /** Adds a fixed delay between the swap and the picture appearing. Can be
+        called from any thread.
+     */
+    void setDisplayLatency (double seconds)
+    {
+        displayLatency = seconds;
+    }
+
+    /** Tells the pacer whether its context repaints continuously, so that
+        frame starts line up with the display's blanks. Off by default. Can
+        be called from any thread.
+     */
+    void setContinuous (bool shouldMeasureBlanks)
+    {
+        continuous = shouldMeasureBlanks;
+    }
+
+    /** Call when a frame starts rendering. Returns when it is expected to be
+        shown, in getSeconds().
+     */
+    double beginFrame()
+    {
+        const double now = getSeconds();
+        const double interval = now - frameStart;
+        frameStart = now;
+
+        if (! continuous.load())
+        {
+            // A timer started this frame: forget the phase measured before
+            lastBlank = -phaseTimeout;
+        }
+        else if (interval > 0.0 && interval < 1.5 * period)
+        {
+            // Blocked in the previous swap: this frame starts at a blank
+            lastBlank = now;
+
+            if (interval < 0.8 * period)
+                period = jmax ((double) minPeriod, interval);
+            else
+                period += 0.05 * (interval - period);
+        }
+
+        const double drawn = now + drawSeconds;
+        const double swap = now - lastBlank < phaseTimeout
+                                ? lastBlank + std::ceil ((drawn - lastBlank) / period) * period
+                                : drawn + 0.5 * period;
+
+        // Halfway through scan-out
+        return swap + 0.5 * period + displayLatency.load();
+    }
+
+    /** Call when a frame is drawn, before it is swapped.
+     */
+    void endFrame()
+    {
+        drawSeconds += 0.1 * (getSeconds() - frameStart - drawSeconds);
+    }
+
+    /** The estimated refresh period of the display, in seconds.
+     */
+    double getRefreshPeriod() const noexcept    { return period; }
+
+    /** The position on ringBuffer's sample clock that is heard at time (in
+        getSeconds()), for a stream whose newest sample is heard
+        playbackLatency samples after it was written. With no playback
+        latency, or while nothing is written, that is the newest sample.
+
+        Small steps back from audio callback jitter are held, so successive
+        frames never go back in time.
+     */
+    int64 getAudibleSample (const RingBuffer<float>& ringBuffer, double sampleRate,
+                            int playbackLatency, double time)
+    {
+        int64 written = 0, writeTicks = 0;
+
+        // Pair the sample clock with the time of the write that set it
+        for (int attempt = 0; attempt < 4; ++attempt)
+        {
+            written = ringBuffer.getTotalSamplesWritten();
+            writeTicks = ringBuffer.getLastWriteTicks();
+
+            if (ringBuffer.getTotalSamplesWritten() == written)
+                break;
+        }
+
+        if (playbackLatency <= 0 || sampleRate <= 0.0)
+            return written;
+
+        const double elapsed = time - Time::highResolutionTicksToSeconds (writeTicks);
+        int64 audible = jmin (written, written - playbackLatency + (int64) std::floor (elapsed * sampleRate));
+
+        if (audible < lastAudible && lastAudible - audible < playbackLatency && lastAudible <= written)
+            audible = lastAudible;
+
+        lastAudible = audible;
+        return audible;
+    }
+
+    /** The clock beginFrame() predicts on, in seconds.
+     */
+    static double getSeconds()
+    {
+        return Time::highResolutionTicksToSeconds (Time::getHighResolutionTicks());
+    }
+
+private:
+    static constexpr double minPeriod = 1.0 / 480.0;
+    static constexpr double phaseTimeout = 1.0;     // Seconds a measured blank is trusted
+
+    std::atomic<double> displayLatency { 0.0 };
+    std::atomic<bool> continuous { false };
+
+    double period = 1.0 / 60.0;
+    double frameStart = 0.0;
+    double lastBlank = -phaseTimeout;
+    double drawSeconds = 0.0;
+    int64 lastAudible = 0;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (FramePacer)
+};
@@ -0,0 +1,265 @@
+//
+//  FrameScheduler.h
+//  3DAudioVisualizers
+//
+//  Repaints the OpenGL visualizers when there is something new to draw,
+//  instead of continuously.
+//
+
+#pragma once
+
+#include "../JuceLibraryCode/JuceHeader.h"
+#include <functional>
+#include <vector>
+
+/** Decides when each visualizer's OpenGLContext repaints.
+
+    Each client reports a content version, a number that changes whenever it
+    has new data to draw: a RingBuffer's sample clock or an
+    AnalysisFrameExchange's sequence. One message thread timer polls all
+    running clients. A burst of new data between two ticks becomes a single
+    repaint, and no client repaints faster than its maximum frame rate.
+
+    Nothing is repainted while nothing changes, e.g. while the file
+    transport is stopped, or while a client is not on screen: hidden, in a
+    minimised window or outside every display. A client that changed while
+    off screen repaints once it shows again. When nothing was drawn for a
+    second, the timer itself slows down to idleHz.
+
+    A client can keep repainting for a while after its last change (see
+    setLingerSeconds()), so that trails finish fading. Settings changes
+    that alter the picture without new data call invalidate().
+
+    Settings::continuous goes back to repainting at the display rate.
+
+    All functions must be called on the message thread.
+ */
+class FrameScheduler  : private Timer
+{
+public:
+    struct Settings
+    {
+        double maxFramesPerSecond = 60.0;   // Default cap for every client
+        bool continuous = false;            // Repaint every running client at the display rate
+    };
+
+    enum
+    {
+        idleHz = 10,
+        minActiveHz = 30,
+        maxActiveHz = 1000
+    };
+
+    FrameScheduler() = default;
+
+    ~FrameScheduler() override
+    {
+        stopTimer();
+    }
+
+    /** Adds a client under an id of the caller's choice, e.g. its index.
+        It starts out stopped. getContentVersion is called on the message
+        thread, so it must be safe to call while the client renders.
+     */
+    void addClient (int id, Component& component, OpenGLContext& openGLContext,
+                    std::function<int64()> getContentVersion)
+    {
+        jassert (id >= 0);
+
+        if (id >= (int) clients.size())
+            clients.resize ((size_t) id + 1);
+
+        auto& client = clients[(size_t) id];
+        client.component = &component;
+        client.openGLContext = &openGLContext;
+        client.getContentVersion = std::move (getContentVersion);
+    }
+
+    void setSettings (const Settings& newSettings)
+    {
+        settings = newSettings;
+
+        for (auto& client : clients)
+            if (client.running)
+                client.openGLContext->setContinuousRepainting (settings.continuous);
+
+        updateTimer();
+    }
+
+    const Settings& getSettings() const noexcept    { return settings; }
+
+    /** Starts or stops repainting a client. A started client draws at least
+        once.
+     */
+    void setRunning (int id, bool shouldRun)
+    {
+        auto* client = getClient (id);
+
+        if (client == nullptr || client->running == shouldRun)
+            return;
+
+        client->running = shouldRun;
+        client->dirty = shouldRun;
+        client->openGLContext->setContinuousRepainting (shouldRun && settings.continuous);
+
+        if (shouldRun)
+            lastBusyTime = getSeconds();
+
+        updateTimer();
+    }
+
+    /** Caps one client's frame rate below Settings::maxFramesPerSecond; 0
+        goes back to the default.
+     */
+    void setMaxFramesPerSecond (int id, double framesPerSecond)
+    {
+        if (auto* client = getClient (id))
+            client->maxFramesPerSecond = framesPerSecond;
+    }
+
+    /** Keeps repainting a client for this long after its content last
+        changed.
+     */
+    void setLingerSeconds (int id, double seconds)
+    {
+        if (auto* client = getClient (id))
+            client->lingerSeconds = jmax (0.0, seconds);
+    }
+
+    /** Repaints a client on the next tick even if it has no new data.
+     */
+    void invalidate (int id)
+    {
+        if (auto* client = getClient (id))
+        {
+            client->dirty = true;
+            client->lastChangeTime = getSeconds();
+            lastBusyTime = client->lastChangeTime;
+            updateTimer();
+        }
+    }
+
+    void invalidateAll()
+    {
+        for (int id = 0; id < (int) clients.size(); ++id)
+            if (clients[(size_t) id].component != nullptr)
+                invalidate (id);
+    }
+
+private:
+    struct Client
+    {
+        Component* component = nullptr;
+        OpenGLContext* openGLContext = nullptr;
+        std::function<int64()> getContentVersion;
+
+        double maxFramesPerSecond = 0.0;
+        double lingerSeconds = 0.0;
+
+        bool running = false;
+        bool dirty = false;
+        int64 lastVersion = 0;
+        double lastChangeTime = 0.0;
+        double lastRepaintTime = 0.0;
+    };
+
+    Client* getClient (int id)
+    {
+        if (id >= 0 && id < (int) clients.size() && clients[(size_t) id].component != nullptr)
+            return &clients[(size_t) id];
+
+        jassertfalse;
+        return nullptr;
+    }
+
+    static double getSeconds()
+    {
+        return Time::getMillisecondCounterHiRes() * 0.001;
+    }
+
+    /** False if the component is hidden, in a minimised window or entirely
+        off every display.
+     */
+    static bool isOnScreen (Component& component)
+    {
+        if (! component.isShowing())
+            return false;
+
+        return Desktop::getInstance().getDisplays().getRectangleList (false)
+                                                   .intersectsRectangle (component.getScreenBounds());
+    }
+
+    int getActiveHz() const
+    {
+        // Twice the frame rate, so frames are not late by a whole tick
+        return jlimit ((int) minActiveHz, (int) maxActiveHz, roundToInt (2.0 * settings.maxFramesPerSecond));
+    }
+
+    void updateTimer()
+    {
+        bool anyRunning = false;
+
+        for (auto& client : clients)
+            anyRunning = anyRunning || client.running;
+
+        if (! anyRunning || settings.continuous)
+        {
+            stopTimer();
+            return;
+        }
+
+        const int hz = getSeconds() - lastBusyTime < 1.0 ? getActiveHz() : (int) idleHz;
+
+        if (getTimerInterval() != 1000 / hz)
+            startTimer (1000 / hz);
+    }
+
+    void timerCallback() override
+    {
+        const double now = getSeconds();
+        const double tickSeconds = getTimerInterval() * 0.001;
+
+        for (auto& client : clients)
+        {
+            if (! client.running)
+                continue;
+
+            const int64 version = client.getContentVersion();
+
+            if (version != client.lastVersion)
+            {
+                client.lastVersion = version;
+                client.lastChangeTime = now;
+                client.dirty = true;
+            }
+
+            const bool lingering = now - client.lastChangeTime < client.lingerSeconds;
+
+            // A client that changed off screen stays dirty until it shows again
+            if (! (client.dirty || lingering) || ! isOnScreen (*client.component))
+                continue;
+
+            lastBusyTime = now;
+
+            const double framesPerSecond = client.maxFramesPerSecond > 0.0
+                                               ? jmin (client.maxFramesPerSecond, settings.maxFramesPerSecond)
+                                               : settings.maxFramesPerSecond;
+
+            // Half a tick early is closer to the cap than half a tick late
+            if (now - client.lastRepaintTime < 1.0 / framesPerSecond - 0.5 * tickSeconds)
+                continue;
+
+            client.openGLContext->triggerRepaint();
+            client.lastRepaintTime = now;
+            client.dirty = false;
+        }
+
+        updateTimer();
+    }
+
+    std::vector<Client> clients;
+    Settings settings;
+    double lastBusyTime = 0.0;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (FrameScheduler)
+};
@@ -0,0 +1,181 @@
+//
+//  GeneratorBenchmark.h
+//  3DAudioVisualizers
+//
+//  Headless load generator: feeds a SignalGenerator through a stream's
+//  RingBuffer and analysis at any block size and speed.
+//
+
+#pragma once
+
+#include "../JuceLibraryCode/JuceHeader.h"
+#include "SignalGenerator.h"
+#include "ScratchArena.h"
+#include <chrono>
+#include <iostream>
+#include <thread>
+
+/** Runs one AudioStream from a SignalGenerator without audio hardware or a
+    window, and reports throughput plus a checksum of every analysis frame.
+
+    Analysis runs inline after each block that completes a hop, so the set of
+    frames (and therefore the checksum) is identical from run to run for the
+    same options. Use the checksum to catch regressions in the analysis path.
+
+    Where heap allocations are counted (TOWEL_COUNT_ALLOCATIONS, on in debug
+    builds), any allocation in the stream's audio callback fails the run.
+
+        "Towel OpenGL Audio Visualizer" --generator-benchmark --generator=pink
+            [--block=512] [--rate=48000] [--seconds=10] [--speed=0] [--seed=1]
+
+    --speed is a multiple of real time; 0 runs as fast as possible.
+ */
+class GeneratorBenchmark
+{
+public:
+    struct Options
+    {
+        SignalGenerator::Type type = SignalGenerator::sineSweep;
+        SignalGenerator::Settings settings;
+        int blockSize = 512;
+        double sampleRate = 48000.0;
+        double seconds = 10.0;      // Length of audio to generate
+        double speed = 0.0;         // Multiple of real time, 0 = free running
+    };
+
+    struct Result
+    {
+        int64 samplesWritten = 0;
+        int64 framesAnalysed = 0;
+        double wallSeconds = 0.0;
+        uint64 checksum = 0;
+        int64 audioAllocations = 0;     // Heap allocations in processBlock(), if counted
+    };
+
+    //==========================================================================
+    /** Parses the generator type and options from the command line. Returns
+        false and leaves options untouched past the type if the type is
+        unknown.
+     */
+    static bool parseCommandLine (const String& commandLine, Options& options)
+    {
+        StringArray args;
+        args.addTokens (commandLine, true);
+
+        for (auto& arg : args)
+        {
+            auto value = arg.fromFirstOccurrenceOf ("=", false, false);
+
+            if (arg.startsWith ("--generator="))
+            {
+                options.type = SignalGenerator::findType (value);
+
+                if (options.type == SignalGenerator::numTypes)
+                    return false;
+            }
+            else if (arg.startsWith ("--block="))   options.blockSize = jmax (1, value.getIntValue());
+            else if (arg.startsWith ("--rate="))    options.sampleRate = jmax (1000.0, value.getDoubleValue());
+            else if (arg.startsWith ("--seconds=")) options.seconds = jmax (0.0, value.getDoubleValue());
+            else if (arg.startsWith ("--speed="))   options.speed = jmax (0.0, value.getDoubleValue());
+            else if (arg.startsWith ("--seed="))    options.settings.seed = (uint32) value.getLargeIntValue();
+        }
+
+        return true;
+    }
+
+    /** Runs the benchmark described by the command line and prints the
+        result. Returns a process exit code.
+     */
+    static int runFromCommandLine (const String& commandLine)
+    {
+        Options options;
+
+        if (! parseCommandLine (commandLine, options))
+        {
+            std::cout << "unknown generator, expected --generator=" << SignalGenerator::getTypeNames() << std::endl;
+            return 1;
+        }
+
+        auto r = run (options);
+
+        std::cout << "generator " << SignalGenerator::getTypeName (options.type)
+                  << ": block " << options.blockSize
+                  << ", " << options.sampleRate << " Hz, "
+                  << String (r.samplesWritten / options.sampleRate, 2) << " s of audio in "
+                  << String (r.wallSeconds, 3) << " s ("
+                  << String (r.samplesWritten / options.sampleRate / jmax (1.0e-9, r.wallSeconds), 1) << "x real time), "
+                  << r.framesAnalysed << " frames, checksum "
+                  << String::toHexString ((int64) r.checksum) << std::endl;
+
+       #if TOWEL_COUNT_ALLOCATIONS
+        if (r.audioAllocations > 0)
+        {
+            std::cout << r.audioAllocations << " heap allocations on the audio path" << std::endl;
+            return 1;
+        }
+       #endif
+
+        return 0;
+    }
+
+    static Result run (const Options& options)
+    {
+        AudioStream stream (SignalGenerator::getTypeName (options.type),
+                            std::make_unique<GeneratorSource> (options.type, options.settings));
+        stream.prepare (options.blockSize, options.sampleRate);
+
+        // Generator sources ignore the device input; only the block size is used
+        AudioBuffer<float> deviceBuffer (2, options.blockSize);
+        deviceBuffer.clear();
+        const AudioSourceChannelInfo deviceInput (&deviceBuffer, 0, options.blockSize);
+
+        const int64 totalSamples = (int64) (options.seconds * options.sampleRate);
+        const auto blockDuration = std::chrono::duration<double> (options.speed > 0.0
+                                        ? options.blockSize / (options.sampleRate * options.speed)
+                                        : 0.0);
+
+        AnalysisFrame frame;
+        Result result;
+        result.checksum = 14695981039346656037ull;     // FNV-1a offset basis
+
+        const auto startTime = std::chrono::steady_clock::now();
+        auto nextDeadline = startTime;
+
+        while (result.samplesWritten < totalSamples)
+        {
+            const int64 allocationsBefore = HeapAllocationCounter::getThreadCount();
+            stream.processBlock (deviceInput);
+            result.audioAllocations += HeapAllocationCounter::getThreadCount() - allocationsBefore;
+            result.samplesWritten += options.blockSize;
+
+            if (stream.isAnalysisDue())
+            {
+                stream.getAnalyzer().analyse();
+                stream.getAnalysis().read (frame);
+                result.checksum = hashFrame (result.checksum, frame);
+                ++result.framesAnalysed;
+            }
+
+            if (options.speed > 0.0)
+            {
+                nextDeadline += std::chrono::duration_cast<std::chrono::steady_clock::duration> (blockDuration);
+                std::this_thread::sleep_until (nextDeadline);
+            }
+        }
+
+        result.wallSeconds = std::chrono::duration<double> (std::chrono::steady_clock::now() - startTime).count();
+        return result;
+    }
+
+private:
+    static uint64 hashFrame (uint64 hash, const AnalysisFrame& frame)
+    {
+        auto* bytes = reinterpret_cast<const uint8*> (frame.magnitudes);
+        const size_t numBytes = sizeof (float) * (size_t) frame.numBins;
+
+        for (size_t i = 0; i < numBytes; ++i)
+            hash = (hash ^ bytes[i]) * 1099511628211ull;
+
+        return hash;
+    }
+};
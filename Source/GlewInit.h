@@ -0,0 +1,40 @@
+//
+//  GlewInit.h
+//  3DAudioVisualizers
+//
+//  Loads the OpenGL entry points each visualizer's context needs.
+//
+
+#pragma once
+
+#include "../JuceLibraryCode/JuceHeader.h"
+#include <GL/glew.h>
+#include "Trace.h"
+
+/** Loads GLEW's function pointers for the calling thread's OpenGL context.
+
+    Call it first in every OpenGLRenderer::newOpenGLContextCreated(). With
+    GLEW linked statically, as on Windows, every gl* function past OpenGL
+    1.1 is a null pointer until glewInit() has run, and each visualizer has
+    its own context, created in whichever order they are first shown.
+
+    Fails, after logging why, if GLEW could not load. The caller should then
+    show the error and skip its GL setup, its frames and its GL cleanup, as
+    any call past OpenGL 1.1 would crash.
+ */
+inline Result initialiseGlew()
+{
+    TOWEL_TRACE_ZONE ("glewInit");
+
+    glewExperimental = GL_TRUE;     // Also loads core profile functions GLEW does not list
+    const GLenum err = glewInit();
+
+    if (err != GLEW_OK)
+    {
+        const String error ("GLEW Initialization failed: " + String ((const char*) glewGetErrorString (err)));
+        DBG (error);
+        return Result::fail (error);
+    }
+
+    return Result::ok();
+}
@@ -0,0 +1,446 @@
+//
+//  LevelMeter.h
+//  3DAudioVisualizers
+//
+//  Streaming loudness (LUFS), true-peak and RMS/peak metering.
+//
+
+#pragma once
+
+#if ! TOWEL_HEADLESS
+ #include "../JuceLibraryCode/JuceHeader.h"
+#endif
+#include "AnalysisFrame.h"
+#include <cmath>
+
+/** Meters every sample of a stream and reports AnalysisLevels.
+
+    Loudness follows ITU-R BS.1770-4 and EBU R 128: each channel goes through
+    the K-weighting filter (a high shelf and a high pass), and its mean square
+    is summed over 100 ms sub-blocks.
+      - Momentary loudness averages the last 4 sub-blocks (400 ms).
+      - Short-term loudness averages the last 30 (3 s), or as many as there
+        are once 400 ms have been metered.
+      - Integrated loudness averages the overlapping 400 ms blocks since
+        reset() that pass the absolute gate (-70 LUFS) and the relative gate
+        (10 LU below the loudness of the blocks above the absolute gate).
+        Blocks are kept in a 0.1 LU histogram of summed energies, so memory
+        stays constant however long the programme is.
+    All channels are weighted 1.0, which is correct for mono and stereo; the
+    1.41 surround weights would need a channel layout that streams lack.
+
+    True peak is measured with 4x oversampling through a 48 tap polyphase
+    interpolator, as BS.1770 recommends. Its inner loops and the sample peak
+    run through FloatVectorOperations, so they use SIMD; the K-weighting
+    filters are recursive and stay scalar.
+
+    RMS integrates the mean square with a 300 ms time constant, and the
+    sample peak falls 20 dB in 1.7 s (IEC 60268-10 type I).
+
+    Not thread safe: one thread calls process() and getLevels(). process()
+    never allocates.
+ */
+class LevelMeter
+{
+public:
+    LevelMeter()
+    {
+        designInterpolator();
+    }
+
+    /** Sets the stream format and clears all readings.
+     */
+    void prepare (double newSampleRate, int newNumChannels)
+    {
+        jassert (newSampleRate > 0.0);
+
+        sampleRate = newSampleRate;
+        numChannels = jlimit (0, (int) AnalysisLevels::maxChannels, newNumChannels);
+        subBlockSize = jmax (1, roundToInt (sampleRate * subBlockSeconds));
+        peakReleasePerSample = std::pow (10.0, -peakReleaseDb / (20.0 * peakReleaseSeconds * sampleRate));
+
+        designKWeighting();
+        reset();
+    }
+
+    /** Clears all readings, including integrated loudness and the maximum
+        true peak.
+     */
+    void reset()
+    {
+        for (auto& c : channels)
+            c = ChannelState();
+
+        for (auto& bin : histogram)
+            bin = HistogramBin();
+
+        for (auto& e : subBlockEnergies)
+            e = 0.0;
+
+        subBlockFill = 0;
+        subBlockEnergy = 0.0;
+        numSubBlocks = 0;
+        maxTruePeak = 0.0f;
+    }
+
+    double getSampleRate() const    { return sampleRate; }
+    int getNumChannels() const      { return numChannels; }
+
+    /** Meters numSamples of buffer, starting at startSample. Each call must
+        continue exactly where the previous one ended.
+     */
+    void process (const AudioBuffer<float>& buffer, int startSample, int numSamples)
+    {
+        jassert (sampleRate > 0.0 && buffer.getNumChannels() >= numChannels);
+
+        for (int done = 0; done < numSamples;)
+        {
+            const int n = jmin (numSamples - done, (int) chunkSize);
+            processChunk (buffer, startSample + done, n);
+            done += n;
+        }
+    }
+
+    /** Fills levels with the current readings, and starts a new interval for
+        the per-channel true peaks.
+     */
+    void getLevels (AnalysisLevels& levels)
+    {
+        levels.numChannels = numChannels;
+        levels.momentaryLoudness = numSubBlocks >= momentarySubBlocks ? toLoudness (averageEnergy (momentarySubBlocks))
+                                                                       : AnalysisLevels::minimumLoudness;
+        levels.shortTermLoudness = numSubBlocks >= momentarySubBlocks ? toLoudness (averageEnergy (shortTermSubBlocks))
+                                                                       : AnalysisLevels::minimumLoudness;
+        levels.integratedLoudness = getIntegratedLoudness();
+        levels.maxTruePeak = maxTruePeak;
+
+        for (int i = 0; i < numChannels; ++i)
+        {
+            auto& c = channels[i];
+            levels.truePeak[i] = c.truePeak;
+            levels.rms[i] = (float) std::sqrt (c.meanSquare);
+            levels.peak[i] = c.peak;
+            c.truePeak = 0.0f;
+        }
+    }
+
+private:
+    enum
+    {
+        oversampling = 4,
+        tapsPerPhase = 12,
+        chunkSize = 1024,               // Samples processed per pass, sizes the scratch buffers
+        momentarySubBlocks = 4,
+        shortTermSubBlocks = 30,
+        numHistogramBins = 1000         // 0.1 LU each, from the absolute gate up
+    };
+
+    static constexpr double subBlockSeconds = 0.1;
+    static constexpr double absoluteGate = -70.0;
+    static constexpr double relativeGate = -10.0;
+    static constexpr double histogramStep = 0.1;
+    static constexpr double rmsSeconds = 0.3;
+    static constexpr double peakReleaseDb = 20.0;
+    static constexpr double peakReleaseSeconds = 1.7;
+
+    /** A transposed direct form II biquad section, in double precision so
+        the 38 Hz high pass stays accurate at high sample rates.
+     */
+    struct Biquad
+    {
+        double b0 = 1.0, b1 = 0.0, b2 = 0.0, a1 = 0.0, a2 = 0.0;
+    };
+
+    struct ChannelState
+    {
+        double z1[2] = {}, z2[2] = {};          // K-weighting filter state, one pair per stage
+        float history[tapsPerPhase - 1] = {};   // Last input samples, for the interpolator
+        double meanSquare = 0.0;
+        float peak = 0.0f;
+        float truePeak = 0.0f;
+    };
+
+    struct HistogramBin
+    {
+        double energy = 0.0;
+        int64 count = 0;
+    };
+
+    //==========================================================================
+    void processChunk (const AudioBuffer<float>& buffer, int startSample, int numSamples)
+    {
+        const float rmsCoefficient = (float) std::exp (-numSamples / (rmsSeconds * sampleRate));
+        const float peakDecay = (float) std::pow (peakReleasePerSample, (double) numSamples);
+
+        for (int i = 0; i < numChannels; ++i)
+        {
+            const float* samples = buffer.getReadPointer (i, startSample);
+            auto& c = channels[i];
+
+            const auto range = FloatVectorOperations::findMinAndMax (samples, numSamples);
+            const float samplePeak = jmax (-range.getStart(), range.getEnd());
+
+            c.peak = jmax (samplePeak, c.peak * peakDecay);
+            c.truePeak = jmax (c.truePeak, samplePeak, measureTruePeak (c, samples, numSamples));
+            maxTruePeak = jmax (maxTruePeak, c.truePeak);
+
+            const double meanSquare = sumOfSquares (samples, numSamples) / numSamples;
+            c.meanSquare = meanSquare + rmsCoefficient * (c.meanSquare - meanSquare);
+        }
+
+        // K-weighted energy, split at the 100 ms sub-block boundaries
+        for (int pos = 0; pos < numSamples;)
+        {
+            const int n = jmin (numSamples - pos, subBlockSize - subBlockFill);
+
+            for (int i = 0; i < numChannels; ++i)
+                subBlockEnergy += kWeightedEnergy (channels[i], buffer.getReadPointer (i, startSample + pos), n);
+
+            pos += n;
+            subBlockFill += n;
+
+            if (subBlockFill == subBlockSize)
+                completeSubBlock();
+        }
+    }
+
+    /** Returns the largest interpolated sample magnitude between the samples
+        of this chunk and the previous one.
+     */
+    float measureTruePeak (ChannelState& c, const float* samples, int numSamples)
+    {
+        constexpr int historySize = tapsPerPhase - 1;
+
+        FloatVectorOperations::copy (padded, c.history, historySize);
+        FloatVectorOperations::copy (padded + historySize, samples, numSamples);
+
+        float peak = 0.0f;
+
+        for (int phase = 0; phase < oversampling; ++phase)
+        {
+            FloatVectorOperations::clear (interpolated, numSamples);
+
+            for (int tap = 0; tap < tapsPerPhase; ++tap)
+                FloatVectorOperations::addWithMultiply (interpolated, padded + historySize - tap,
+                                                        interpolator[phase][tap], numSamples);
+
+            const auto range = FloatVectorOperations::findMinAndMax (interpolated, numSamples);
+            peak = jmax (peak, -range.getStart(), range.getEnd());
+        }
+
+        FloatVectorOperations::copy (c.history, padded + numSamples, historySize);
+        return peak;
+    }
+
+    /** Sums squares in four independent accumulators, which lets the
+        compiler keep them in one SIMD register.
+     */
+    static double sumOfSquares (const float* samples, int numSamples)
+    {
+        float sums[4] = {};
+        int i = 0;
+
+        for (; i + 4 <= numSamples; i += 4)
+            for (int j = 0; j < 4; ++j)
+                sums[j] += samples[i + j] * samples[i + j];
+
+        double sum = (double) sums[0] + sums[1] + sums[2] + sums[3];
+
+        for (; i < numSamples; ++i)
+            sum += samples[i] * samples[i];
+
+        return sum;
+    }
+
+    double kWeightedEnergy (ChannelState& c, const float* samples, int numSamples)
+    {
+        const auto& s1 = kWeighting[0];
+        const auto& s2 = kWeighting[1];
+        double z1a = c.z1[0], z2a = c.z2[0], z1b = c.z1[1], z2b = c.z2[1];
+        double energy = 0.0;
+
+        for (int i = 0; i < numSamples; ++i)
+        {
+            const double x = samples[i];
+            const double y1 = s1.b0 * x + z1a;
+            z1a = s1.b1 * x - s1.a1 * y1 + z2a;
+            z2a = s1.b2 * x - s1.a2 * y1;
+
+            const double y2 = s2.b0 * y1 + z1b;
+            z1b = s2.b1 * y1 - s2.a1 * y2 + z2b;
+            z2b = s2.b2 * y1 - s2.a2 * y2;
+
+            energy += y2 * y2;
+        }
+
+        c.z1[0] = z1a; c.z2[0] = z2a; c.z1[1] = z1b; c.z2[1] = z2b;
+        return energy;
+    }
+
+    void completeSubBlock()
+    {
+        subBlockEnergies[numSubBlocks % shortTermSubBlocks] = subBlockEnergy / subBlockSize;
+        ++numSubBlocks;
+        subBlockFill = 0;
+        subBlockEnergy = 0.0;
+
+        // Gating blocks are 400 ms long and start every 100 ms
+        if (numSubBlocks < momentarySubBlocks)
+            return;
+
+        const double energy = averageEnergy (momentarySubBlocks);
+        const double loudness = toLoudness (energy);
+
+        if (loudness <= absoluteGate)
+            return;
+
+        auto& bin = histogram[histogramBin (loudness)];
+        bin.energy += energy;
+        ++bin.count;
+    }
+
+    /** Mean energy of the newest numBlocks sub-blocks, or of all of them if
+        there are fewer.
+     */
+    double averageEnergy (int numBlocks) const
+    {
+        const int n = (int) jmin ((int64) numBlocks, numSubBlocks);
+        double sum = 0.0;
+
+        for (int i = 1; i <= n; ++i)
+            sum += subBlockEnergies[(numSubBlocks - i) % shortTermSubBlocks];
+
+        return n > 0 ? sum / n : 0.0;
+    }
+
+    float getIntegratedLoudness() const
+    {
+        double energy = 0.0;
+        int64 count = 0;
+
+        for (auto& bin : histogram)
+        {
+            energy += bin.energy;
+            count += bin.count;
+        }
+
+        if (count == 0)
+            return AnalysisLevels::minimumLoudness;
+
+        const double gate = toLoudness (energy / count) + relativeGate;
+        energy = 0.0;
+        count = 0;
+
+        for (int i = jmax (0, histogramBin (gate)); i < numHistogramBins; ++i)
+        {
+            energy += histogram[i].energy;
+            count += histogram[i].count;
+        }
+
+        return count > 0 ? toLoudness (energy / count) : AnalysisLevels::minimumLoudness;
+    }
+
+    static int histogramBin (double loudness)
+    {
+        return jlimit (0, numHistogramBins - 1, (int) ((loudness - absoluteGate) / histogramStep));
+    }
+
+    static float toLoudness (double energy)
+    {
+        return energy > 0.0 ? jmax (AnalysisLevels::minimumLoudness, (float) (-0.691 + 10.0 * std::log10 (energy)))
+                            : AnalysisLevels::minimumLoudness;
+    }
+
+    //==========================================================================
+    /** The BS.1770 K-weighting filter, recomputed for the sample rate from
+        its analogue prototype so it matches the 48 kHz reference exactly.
+     */
+    void designKWeighting()
+    {
+        const double pi = MathConstants<double>::pi;
+
+        // Stage 1: high shelf, +4 dB above about 1.5 kHz
+        {
+            const double f0 = 1681.974450955533, gainDb = 3.999843853973347, q = 0.7071752369554196;
+            const double k = std::tan (pi * f0 / sampleRate);
+            const double vh = std::pow (10.0, gainDb / 20.0);
+            const double vb = std::pow (vh, 0.4996667741545416);
+            const double a0 = 1.0 + k / q + k * k;
+
+            auto& s = kWeighting[0];
+            s.b0 = (vh + vb * k / q + k * k) / a0;
+            s.b1 = 2.0 * (k * k - vh) / a0;
+            s.b2 = (vh - vb * k / q + k * k) / a0;
+            s.a1 = 2.0 * (k * k - 1.0) / a0;
+            s.a2 = (1.0 - k / q + k * k) / a0;
+        }
+
+        // Stage 2: high pass at 38 Hz
+        {
+            const double f0 = 38.13547087602444, q = 0.5003270373238773;
+            const double k = std::tan (pi * f0 / sampleRate);
+            const double a0 = 1.0 + k / q + k * k;
+
+            auto& s = kWeighting[1];
+            s.b0 = 1.0;
+            s.b1 = -2.0;
+            s.b2 = 1.0;
+            s.a1 = 2.0 * (k * k - 1.0) / a0;
+            s.a2 = (1.0 - k / q + k * k) / a0;
+        }
+    }
+
+    /** A Blackman-windowed sinc low pass at the original Nyquist frequency,
+        split into one set of taps per output phase. Each phase is normalised
+        to unity gain at DC.
+     */
+    void designInterpolator()
+    {
+        constexpr int numTaps = oversampling * tapsPerPhase;
+        const double pi = MathConstants<double>::pi;
+        const double centre = (numTaps - 1) / 2.0;
+
+        for (int phase = 0; phase < oversampling; ++phase)
+        {
+            double sum = 0.0;
+
+            for (int tap = 0; tap < tapsPerPhase; ++tap)
+            {
+                const int n = phase + tap * oversampling;
+                const double x = (n - centre) / oversampling;
+                const double sinc = std::sin (pi * x) / (pi * x);
+                const double window = 0.42 - 0.5 * std::cos (2.0 * pi * n / (numTaps - 1))
+                                           + 0.08 * std::cos (4.0 * pi * n / (numTaps - 1));
+
+                interpolator[phase][tap] = (float) (sinc * window);
+                sum += sinc * window;
+            }
+
+            for (auto& c : interpolator[phase])
+                c = (float) (c / sum);
+        }
+    }
+
+    double sampleRate = 0.0;
+    int numChannels = 0;
+    int subBlockSize = 1;
+    double peakReleasePerSample = 1.0;
+
+    Biquad kWeighting[2];
+    float interpolator[oversampling][tapsPerPhase];
+    ChannelState channels[AnalysisLevels::maxChannels];
+    float maxTruePeak = 0.0f;
+
+    // Loudness
+    double subBlockEnergies[shortTermSubBlocks];
+    int subBlockFill = 0;
+    double subBlockEnergy = 0.0;
+    int64 numSubBlocks = 0;
+    HistogramBin histogram[numHistogramBins];
+
+    // Scratch for the interpolator
+    float padded[tapsPerPhase - 1 + chunkSize];
+    float interpolated[chunkSize];
+
+    JUCE_DECLARE_NON_COPYABLE (LevelMeter)
+};
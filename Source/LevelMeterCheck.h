@@ -0,0 +1,132 @@
+//
+//  LevelMeterCheck.h
+//  3DAudioVisualizers
+//
+//  Headless check of LevelMeter's loudness and true peak against the
+//  EBU Tech 3341 reference signals.
+//
+
+#pragma once
+
+#include "../JuceLibraryCode/JuceHeader.h"
+#include "LevelMeter.h"
+#include <initializer_list>
+#include <iostream>
+
+/** Meters stereo sine tones with known readings and compares LevelMeter's
+    results with them, within the tolerances of EBU Tech 3341:
+
+    - A 1 kHz sine at -23 dBFS for 20 s reads -23.0 LUFS momentary,
+      short-term and integrated, within 0.1 LU.
+    - 1 kHz at -72, -36, -23, -36 and -72 dBFS (10, 10, 60, 10 and 10 s)
+      integrates to -23.0 LUFS within 0.1 LU: the -72 dBFS parts fall below
+      the absolute gate and the -36 dBFS parts below the relative gate.
+      Without the relative gate it would read about -24.2 LUFS.
+    - A sine at a quarter of the sample rate and 0 dBFS, sampled 45 degrees
+      off its peaks, has a sample peak of -3.0 dBFS but a true peak of
+      0.0 dBTP, within -0.4 and +0.2 dB.
+
+        "Towel OpenGL Audio Visualizer" --level-meter-check [--rate=48000]
+
+    Prints every reading and fails if any is out of tolerance.
+ */
+class LevelMeterCheck
+{
+public:
+    /** Runs the check at the rate given on the command line and prints the
+        result. Returns a process exit code.
+     */
+    static int runFromCommandLine (const String& commandLine)
+    {
+        double sampleRate = 48000.0;
+        StringArray args;
+        args.addTokens (commandLine, true);
+
+        for (auto& arg : args)
+            if (arg.startsWith ("--rate="))
+                sampleRate = jmax (8000.0, arg.fromFirstOccurrenceOf ("=", false, false).getDoubleValue());
+
+        std::cout << "LevelMeter check: " << sampleRate << " Hz, stereo" << std::endl;
+
+        LevelMeter meter;
+        AnalysisLevels levels;
+        bool failed = false;
+
+        meter.prepare (sampleRate, 2);
+        meterSine (meter, 1000.0, 0.0, { { -23.0, 20.0 } });
+        meter.getLevels (levels);
+
+        failed |= ! expect ("1 kHz -23 dBFS momentary  ", levels.momentaryLoudness, -23.0, 0.1, 0.1, "LUFS");
+        failed |= ! expect ("1 kHz -23 dBFS short-term ", levels.shortTermLoudness, -23.0, 0.1, 0.1, "LUFS");
+        failed |= ! expect ("1 kHz -23 dBFS integrated ", levels.integratedLoudness, -23.0, 0.1, 0.1, "LUFS");
+
+        meter.prepare (sampleRate, 2);
+        meterSine (meter, 1000.0, 0.0, { { -72.0, 10.0 }, { -36.0, 10.0 }, { -23.0, 60.0 }, { -36.0, 10.0 }, { -72.0, 10.0 } });
+        meter.getLevels (levels);
+
+        failed |= ! expect ("gated integrated          ", levels.integratedLoudness, -23.0, 0.1, 0.1, "LUFS");
+
+        meter.prepare (sampleRate, 2);
+        meterSine (meter, sampleRate / 4.0, MathConstants<double>::pi / 4.0, { { 0.0, 1.0 } });
+        meter.getLevels (levels);
+
+        failed |= ! expect ("fs/4 0 dBFS sample peak   ", Decibels::gainToDecibels (levels.peak[0]), -3.01, 0.1, 0.1, "dBFS");
+        failed |= ! expect ("fs/4 0 dBFS true peak     ", Decibels::gainToDecibels (levels.maxTruePeak), 0.0, 0.4, 0.2, "dBTP");
+
+        std::cout << (failed ? "FAILED" : "OK") << std::endl;
+        return failed ? 1 : 0;
+    }
+
+private:
+    struct Segment
+    {
+        double decibels;
+        double seconds;
+    };
+
+    /** Meters a sine of frequency on both channels, made of segments at
+        different levels. The phase runs on across segments.
+     */
+    static void meterSine (LevelMeter& meter, double frequency, double startPhase, std::initializer_list<Segment> segments)
+    {
+        enum { blockSize = 480 };
+
+        AudioBuffer<float> block (2, blockSize);
+        const double phaseIncrement = MathConstants<double>::twoPi * frequency / meter.getSampleRate();
+        double phase = startPhase;
+
+        for (auto& segment : segments)
+        {
+            const double gain = Decibels::decibelsToGain (segment.decibels, -200.0);
+            int64 remaining = roundToInt (segment.seconds * meter.getSampleRate());
+
+            while (remaining > 0)
+            {
+                const int n = (int) jmin ((int64) blockSize, remaining);
+
+                for (int i = 0; i < n; ++i)
+                {
+                    block.setSample (0, i, (float) (gain * std::sin (phase)));
+                    phase = std::fmod (phase + phaseIncrement, MathConstants<double>::twoPi);
+                }
+
+                block.copyFrom (1, 0, block, 0, 0, n);
+                meter.process (block, 0, n);
+                remaining -= n;
+            }
+        }
+    }
+
+    /** Prints a reading and whether it lies within expected - below and
+        expected + above.
+     */
+    static bool expect (const char* name, double measured, double expected, double below, double above, const char* unit)
+    {
+        const bool ok = measured >= expected - below && measured <= expected + above;
+
+        std::cout << "  " << name << ": " << String (measured, 2) << " " << unit << ", expected "
+                  << String (expected, 2) << (ok ? "" : "  FAILED") << std::endl;
+
+        return ok;
+    }
+};
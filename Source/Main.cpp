@@ -11,6 +11,115 @@
 #include <GL/glew.h>
 #include "../JuceLibraryCode/JuceHeader.h"
 #include "MainComponent.cpp"  
+#include "RingBufferStress.h"
+#include "GeneratorBenchmark.h"
+#include "AnalysisServerLoopback.h"
+#include "SharedRingBufferStress.h"
+#include "ConstantQBenchmark.h"
+#include "TriggerBenchmark.h"
+#include "DecimatorBenchmark.h"
+#include "OscilloscopeBenchmark.h"
+#include "LevelMeterCheck.h"
+#include "Trace.h"
+#include "ScratchArena.h"
+#include <cerrno>
+#include <cstdlib>
+#include <new>
+
+#if JUCE_MSVC
+ #include <crtdbg.h>
+#endif
+
+#if TOWEL_COUNT_ALLOCATIONS && JUCE_LINUX && defined (__GLIBC__)
+//==============================================================================
+// Counts every heap allocation per thread, see ScopedNoHeapAllocation. These
+// replace the malloc family for the whole process, so JUCE's HeapBlock,
+// AudioBuffer and Array are counted as well as operator new, which calls
+// malloc. free() is glibc's own.
+extern "C"
+{
+    void* __libc_malloc (size_t);
+    void* __libc_calloc (size_t, size_t);
+    void* __libc_realloc (void*, size_t);
+    void* __libc_memalign (size_t, size_t);
+
+    void* malloc (size_t size) noexcept
+    {
+        HeapAllocationCounter::noteAllocation();
+        return __libc_malloc (size);
+    }
+
+    void* calloc (size_t numElements, size_t elementSize) noexcept
+    {
+        HeapAllocationCounter::noteAllocation();
+        return __libc_calloc (numElements, elementSize);
+    }
+
+    void* realloc (void* memory, size_t size) noexcept
+    {
+        HeapAllocationCounter::noteAllocation();
+        return __libc_realloc (memory, size);
+    }
+
+    void* memalign (size_t alignment, size_t size) noexcept
+    {
+        HeapAllocationCounter::noteAllocation();
+        return __libc_memalign (alignment, size);
+    }
+
+    void* aligned_alloc (size_t alignment, size_t size) noexcept
+    {
+        return memalign (alignment, size);
+    }
+
+    int posix_memalign (void** memory, size_t alignment, size_t size) noexcept
+    {
+        if (alignment % sizeof (void*) != 0 || (alignment & (alignment - 1)) != 0)
+            return EINVAL;
+
+        *memory = memalign (alignment, size);
+        return *memory != nullptr ? 0 : ENOMEM;
+    }
+}
+
+#elif TOWEL_COUNT_ALLOCATIONS && JUCE_MSVC && defined (_DEBUG)
+//==============================================================================
+// Counts every heap allocation per thread, see ScopedNoHeapAllocation. The
+// debug CRT calls this for malloc, calloc, realloc and operator new alike.
+static int countAllocation (int allocationType, void*, size_t, int, long, const unsigned char*, int)
+{
+    if (allocationType != _HOOK_FREE)
+        HeapAllocationCounter::noteAllocation();
+
+    return TRUE;
+}
+
+static const auto previousAllocationHook = _CrtSetAllocHook (countAllocation);
+
+#elif TOWEL_COUNT_ALLOCATIONS
+//==============================================================================
+// Counts operator new per thread, see ScopedNoHeapAllocation. The array and
+// nothrow forms call this one. Elsewhere the malloc family is not counted.
+void* operator new (std::size_t size)
+{
+    HeapAllocationCounter::noteAllocation();
+
+    if (auto* memory = std::malloc (size > 0 ? size : 1))
+        return memory;
+
+    throw std::bad_alloc();
+}
+
+void operator delete (void* memory) noexcept
+{
+    std::free (memory);
+}
+
+void operator delete (void* memory, std::size_t) noexcept
+{
+    std::free (memory);
+}
+#endif
 
 //==============================================================================
 class _3DAudioVisualizersApplication  : public JUCEApplication
@@ -34,6 +143,84 @@ public:
     void initialise(const String& commandLine) override
     {
         // This method is where you should put your application's initialisation code.
+        
+        // --trace[=<file>] records startup, device switches and frames as a Chrome trace, written on quit.
+        // --trace-events=<n> keeps the newest n zones of each thread
+        if (commandLine.contains ("--trace"))
+        {
+            auto path = commandLine.fromFirstOccurrenceOf ("--trace=", false, false).upToFirstOccurrenceOf (" ", false, false).unquoted();
+            traceFile = File::getCurrentWorkingDirectory().getChildFile (path.isNotEmpty() ? path : "trace.json");
+
+            const int eventsPerThread = commandLine.fromFirstOccurrenceOf ("--trace-events=", false, false).getIntValue();
+            Trace::start (eventsPerThread > 0 ? eventsPerThread : (int) Trace::defaultEventsPerThread);
+        }
+
+        TOWEL_TRACE_ZONE ("initialise");
+
+        // Headless diagnostics: run and quit without opening a window
+        if (commandLine.contains ("--ringbuffer-stress"))
+        {
+            setApplicationReturnValue (RingBufferStress::runFromCommandLine (commandLine));
+            quit();
+            return;
+        }
+
+        if (commandLine.contains ("--generator-benchmark"))
+        {
+            setApplicationReturnValue (GeneratorBenchmark::runFromCommandLine (commandLine));
+            quit();
+            return;
+        }
+
+        if (commandLine.contains ("--analysis-server-test"))
+        {
+            setApplicationReturnValue (AnalysisServerLoopback::runFromCommandLine (commandLine));
+            quit();
+            return;
+        }
+
+        if (commandLine.contains ("--shared-ring-stress") || commandLine.contains ("--shared-ring-reader="))
+        {
+            setApplicationReturnValue (SharedRingBufferStress::runFromCommandLine (commandLine));
+            quit();
+            return;
+        }
+
+        if (commandLine.contains ("--constant-q-benchmark"))
+        {
+            setApplicationReturnValue (ConstantQBenchmark::runFromCommandLine (commandLine));
+            quit();
+            return;
+        }
+
+        if (commandLine.contains ("--trigger-benchmark"))
+        {
+            setApplicationReturnValue (TriggerBenchmark::runFromCommandLine (commandLine));
+            quit();
+            return;
+        }
+
+        if (commandLine.contains ("--decimator-benchmark"))
+        {
+            setApplicationReturnValue (DecimatorBenchmark::runFromCommandLine (commandLine));
+            quit();
+            return;
+        }
+
+        if (commandLine.contains ("--level-meter-check"))
+        {
+            setApplicationReturnValue (LevelMeterCheck::runFromCommandLine (commandLine));
+            quit();
+            return;
+        }
+
+        // Needs a window for its OpenGL context; quits by itself when done
+        if (commandLine.contains ("--oscilloscope-benchmark"))
+        {
+            oscilloscopeBenchmark = std::make_unique<OscilloscopeBenchmark> (commandLine);
+            return;
+        }
+        
         mainWindow = std::make_unique<MainWindow>(getApplicationName());
     }
 
@@ -41,6 +228,10 @@ public:
     {
         // Add your application's shutdown code here.
         mainWindow = nullptr; // (deletes our window)
+        oscilloscopeBenchmark = nullptr;
+
+        if (traceFile != File() && ! Trace::write (traceFile))
+            DBG ("Could not write the trace to " + traceFile.getFullPathName());
     }
 
     //==============================================================================
@@ -92,6 +283,8 @@ public:
 
 private:
     std::unique_ptr<MainWindow> mainWindow;
+    std::unique_ptr<OscilloscopeBenchmark> oscilloscopeBenchmark;
+    File traceFile;
 };
 
 //==============================================================================
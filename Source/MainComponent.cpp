@@ -4,27 +4,103 @@
 */
 #include <GL/glew.h>    
 #include "../JuceLibraryCode/JuceHeader.h"
-#include "Oscilloscope2D.h"
-#include "Oscilloscope3D.h"
-#include "Spectrum.h"
-#include "RingBuffer.h"
+#include "StreamRegistry.h"
+#include "SignalGenerator.h"
+#include "AnalysisReplay.h"
+#include "AnalysisServer.h"
+#include "VisualizerPipeline.h"
+#include "WaveformOverview.h"
+#include "Trace.h"
 
 /** The MainContentComponent is the component that holds all the buttons and
     visualizers. This component fills the entire window.
 */
 class MainContentComponent : public AudioAppComponent,
     public ChangeListener,
-    public Button::Listener
+    public Button::Listener,
+    private Timer
 {
 public:
-    MainContentComponent() : audioIOSelector(deviceManager, 1, 2, 0, 0, false, false, true, true)
+    MainContentComponent() : audioIOSelector(deviceManager, 1, 2, 0, 0, false, false, true, true),
+        fileStream(streamRegistry.addStream("File Player")),
+        inputStream(streamRegistry.addStream("Input 1+2", std::make_unique<DeviceInputSource>(0, 2))),
+        visualizerPipeline(fileStream, *this)
     {
+        TOWEL_TRACE_ZONE("MainContentComponent");
+
+        // Extra streams: single device inputs and a test tone that needs no hardware
+        streamRegistry.addStream("Input 1", std::make_unique<DeviceInputSource>(0, 1));
+        streamRegistry.addStream("Input 2", std::make_unique<DeviceInputSource>(1, 1));
+        streamRegistry.addStream("Loopback Test", std::make_unique<GeneratorSource>(SignalGenerator::sineSweep));
+
+        // --generator=<type> on the command line starts on a synthetic stream
+        auto* startStream = &fileStream;
+        auto generatorName = JUCEApplication::getCommandLineParameters().fromFirstOccurrenceOf("--generator=", false, false)
+                                                                        .upToFirstOccurrenceOf(" ", false, false);
+        auto generatorType = SignalGenerator::findType(generatorName);
+
+        if (generatorType != SignalGenerator::numTypes)
+            startStream = &streamRegistry.addStream("Generator: " + generatorName, std::make_unique<GeneratorSource>(generatorType));
+
+        // --serve[=port] publishes the analysis of the shown stream to local socket clients
+        auto commandLine = JUCEApplication::getCommandLineParameters();
+
+        if (commandLine.contains("--serve"))
+        {
+            AnalysisServer::Options serverOptions;
+            auto port = commandLine.fromFirstOccurrenceOf("--serve=", false, false).getIntValue();
+
+            if (port > 0)
+                serverOptions.port = port;
+
+            analysisServer = std::make_unique<AnalysisServer>(serverOptions);
+
+            if (! analysisServer->start())
+            {
+                DBG("Cannot serve analysis on port " + String(serverOptions.port));
+                analysisServer = nullptr;
+            }
+        }
+
+        // --share[=/name] mirrors the shown stream into shared memory for other processes
+        if (commandLine.contains("--share"))
+        {
+            auto name = commandLine.fromFirstOccurrenceOf("--share=", false, false).upToFirstOccurrenceOf(" ", false, false);
+
+            if (name.isEmpty())
+                name = "/towel-visualizer";
+
+            // --share-mode=<octal> opens the segment to other users, owner only by default
+            auto mode = commandLine.fromFirstOccurrenceOf("--share-mode=", false, false).upToFirstOccurrenceOf(" ", false, false);
+            const int permissions = mode.isNotEmpty() ? (int) std::strtol(mode.toRawUTF8(), nullptr, 8)
+                                                      : (int) SharedRingBuffer::ownerOnly;
+
+            sharedRingBuffer = SharedRingBuffer::create(name, 2, sharedRingBufferSize, permissions);
+
+            if (sharedRingBuffer == nullptr)
+                DBG("Cannot create shared memory segment " + name);
+        }
+
+        // --constant-q[=binsPerOctave] analyses every stream with log-spaced bins instead of the FFT
+        if (commandLine.contains("--constant-q"))
+        {
+            ConstantQTransform::Settings constantQSettings;
+            auto binsPerOctave = commandLine.fromFirstOccurrenceOf("--constant-q=", false, false).getIntValue();
+
+            if (binsPerOctave > 0)
+                constantQSettings.binsPerOctave = binsPerOctave;
+
+            streamRegistry.setConstantQ(true, constantQSettings);
+        }
+
         formatManager.registerBasicFormats();
+        fileReadThread.startThread(3);
         audioTransportSource.addChangeListener(this);
-        setAudioChannels(2, 2);  // Initially Stereo Input to Stereo Output
 
-        // Initialize ringBuffer before using it
-        ringBuffer = new RingBuffer<GLfloat>(2, 1024 * 10); // Adjust buffer size as needed
+        {
+            TOWEL_TRACE_ZONE("setAudioChannels");
+            setAudioChannels(2, 2);  // Initially Stereo Input to Stereo Output
+        }
 
         // GUI Setup
         addAndMakeVisible(&openFileButton);
@@ -43,19 +119,154 @@ public:
         stopButton.setColour(TextButton::buttonColourId, Colours::red);
         stopButton.setEnabled(false);
 
-        // Now that ringBuffer is initialized, we can use it
-        spectrum = new Spectrum(ringBuffer);
-        addChildComponent(spectrum);
-        spectrum->setVisible(true);
-        spectrum->start();
+        addAndMakeVisible(&audioInputButton);
+        audioInputButton.setButtonText("Audio Input");
+        audioInputButton.addListener(this);
+
+        addAndMakeVisible(&streamSelector);
+        streamSelector.onChange = [this] { streamSelected(); };
+        updateStreamSelector(*startStream);
+
+        addAndMakeVisible(&addStreamButton);
+        addStreamButton.setButtonText("Add File Stream");
+        addStreamButton.addListener(this);
+
+        addAndMakeVisible(&monitorInputButton);
+        monitorInputButton.setButtonText("Monitor Input");
+        monitorInputButton.addListener(this);
+
+        addAndMakeVisible(&recordButton);
+        recordButton.setButtonText("Record");
+        recordButton.addListener(this);
+
+        // Picks the visualizer; the ids are VisualizerPipeline::VisualizerType + 1
+        addAndMakeVisible(&viewSelector);
+        viewSelector.addItem("Spectrum", VisualizerPipeline::spectrumType + 1);
+        viewSelector.addItem("Spectrogram", VisualizerPipeline::spectrogramType + 1);
+        viewSelector.addItem("Oscilloscope 2D", VisualizerPipeline::oscilloscope2DType + 1);
+        viewSelector.addItem("Oscilloscope 3D", VisualizerPipeline::oscilloscope3DType + 1);
+        viewSelector.onChange = [this] { viewSelected(); };
+
+        addAndMakeVisible(&lineScopeButton);
+        lineScopeButton.setButtonText("Line Scope");
+        lineScopeButton.addListener(this);
+
+        // Shown once a file is opened; clicking it seeks the file
+        addChildComponent(&waveformOverview);
+        waveformOverview.onSeek = [this](double seconds) { audioTransportSource.setPosition(seconds); };
+
+        addAndMakeVisible(&latencyLabel);
+        latencyLabel.setJustificationType(Justification::centredLeft);
+        latencyLabel.setFont(Font(14.0f));
+
+        addAndMakeVisible(&levelsLabel);
+        levelsLabel.setJustificationType(Justification::centredLeft);
+        levelsLabel.setFont(Font(14.0f));
+
+        // --spectrum-view=level|smoothed|peak picks which dB spectrum the Spectrum draws
+        auto spectrumView = commandLine.fromFirstOccurrenceOf("--spectrum-view=", false, false).upToFirstOccurrenceOf(" ", false, false);
+
+        if (spectrumView.isNotEmpty())
+        {
+            SpectrumBands::Scale scale;
+            scale.view = spectrumView == "level" ? SpectrumBands::levelView
+                       : spectrumView == "peak" ? SpectrumBands::peakView
+                       : SpectrumBands::smoothedView;
+            visualizerPipeline.setSpectrumScale(scale);
+        }
+
+        // --trigger=rising|falling|free, --holdoff=<ms> and --no-pitch-lock set up the oscilloscope trigger
+        {
+            OscilloscopeTrigger::Settings trigger;
+            trigger.mode = OscilloscopeTrigger::findMode(commandLine.fromFirstOccurrenceOf("--trigger=", false, false).upToFirstOccurrenceOf(" ", false, false));
+            trigger.holdoffSeconds = jmax(0.0, commandLine.fromFirstOccurrenceOf("--holdoff=", false, false).getDoubleValue() / 1000.0);
+            trigger.pitchLock = ! commandLine.contains("--no-pitch-lock");
+            visualizerPipeline.setTriggerSettings(trigger);
+        }
+
+        // --scope-window=<ms> draws the last <ms> of audio in the 2D oscilloscope as an envelope
+        auto scopeWindowMs = commandLine.fromFirstOccurrenceOf("--scope-window=", false, false).getDoubleValue();
+
+        if (scopeWindowMs > 0.0)
+            visualizerPipeline.setOscilloscopeTimeWindow(scopeWindowMs / 1000.0);
+
+        // --phosphor=<ms> leaves trails that fade to 1/e in <ms>; --draw-every=<n> draws new data every n frames
+        auto phosphorMs = commandLine.fromFirstOccurrenceOf("--phosphor=", false, false).getDoubleValue();
+
+        if (phosphorMs > 0.0)
+        {
+            Phosphor::Settings phosphor;
+            phosphor.decaySeconds = phosphorMs / 1000.0;
+            phosphor.drawInterval = jmax(1, commandLine.fromFirstOccurrenceOf("--draw-every=", false, false).getIntValue());
+            visualizerPipeline.setPhosphor(phosphor);
+        }
+
+        // Visualizers repaint when new data arrives, at most --max-fps=<n> times a second;
+        // --continuous-repaint repaints at the display rate instead
+        {
+            FrameScheduler::Settings scheduling;
+            auto maxFps = commandLine.fromFirstOccurrenceOf("--max-fps=", false, false).getDoubleValue();
+
+            if (maxFps > 0.0)
+                scheduling.maxFramesPerSecond = maxFps;
+
+            scheduling.continuous = commandLine.contains("--continuous-repaint");
+            visualizerPipeline.setFrameScheduling(scheduling);
+        }
+
+        // --display-latency=<ms> delays the oscilloscopes further for displays with their own processing
+        auto displayLatencyMs = commandLine.fromFirstOccurrenceOf("--display-latency=", false, false).getDoubleValue();
+
+        if (displayLatencyMs != 0.0)
+            visualizerPipeline.setDisplayLatency(displayLatencyMs / 1000.0);
+
+        // --shader-dir=<path> loads the visualizers' shaders from files there and reloads them on every save
+        auto shaderDirectory = commandLine.fromFirstOccurrenceOf("--shader-dir=", false, false).upToFirstOccurrenceOf(" ", false, false);
+
+        if (shaderDirectory.isNotEmpty())
+        {
+            visualizerPipeline.setShaderDirectory(File::getCurrentWorkingDirectory().getChildFile(shaderDirectory.unquoted()));
+
+            if (auto* shaderCompiler = visualizerPipeline.getShaderCompiler())
+                addAndMakeVisible(shaderCompiler, 0); // A single pixel behind everything else
+        }
+
+        // --scope-renderer=lines draws the 2D oscilloscope as line geometry instead of a full-screen shader
+        if (commandLine.contains("--scope-renderer=lines"))
+        {
+            lineScopeButton.setToggleState(true, dontSendNotification);
+            visualizerPipeline.setOscilloscopeRenderer(Oscilloscope2D::lineRenderer);
+        }
+
+        // --view=spectrum|spectrogram|scope2d|scope3d picks the first visualizer (--spectrogram is short
+        // for --view=spectrogram). Only the shown visualizer is created, once every setting above is
+        // known, see VisualizerPipeline
+        auto view = commandLine.fromFirstOccurrenceOf("--view=", false, false).upToFirstOccurrenceOf(" ", false, false);
+        auto initialType = VisualizerPipeline::spectrumType;
+
+        if (view == "spectrogram" || commandLine.contains("--spectrogram"))
+            initialType = VisualizerPipeline::spectrogramType;
+        else if (view == "scope2d")
+            initialType = VisualizerPipeline::oscilloscope2DType;
+        else if (view == "scope3d")
+            initialType = VisualizerPipeline::oscilloscope3DType;
+
+        viewSelector.setSelectedId(initialType + 1, dontSendNotification);
+        visualizerPipeline.showOnly(initialType);
 
         setSize(800, 600); // Set the initial size of the component
+
+        startTimerHz(4); // Refreshes the latency and level readouts
     }
 
 
     ~MainContentComponent()
     {
+        stopTimer();
         shutdownAudio();
+
+        if (sharedStream != nullptr)
+            streamRegistry.setSharedOutput(*sharedStream, nullptr);
     }
 
     //==============================================================================
@@ -65,56 +276,59 @@ public:
     */
     void prepareToPlay(int samplesPerBlockExpected, double sampleRate) override
     {
+        TOWEL_TRACE_ZONE("prepareToPlay");
+
         // Setup Audio Source
         audioTransportSource.prepareToPlay(samplesPerBlockExpected, sampleRate);
 
-        // Setup Ring Buffer of GLfloat's for the visualizer to use
-        ringBuffer = new RingBuffer<GLfloat>(2, samplesPerBlockExpected * 10);
+        // Resize every stream's Ring Buffer in place; visualizers and their GL contexts are reused
+        streamRegistry.prepare(samplesPerBlockExpected, sampleRate);
 
-        // Allocate all Visualizers
-        oscilloscope2D = new Oscilloscope2D(ringBuffer);
-        addChildComponent(oscilloscope2D);
+        if (auto* device = deviceManager.getCurrentAudioDevice())
+        {
+            streamRegistry.setDeviceInputLatency(device->getInputLatencyInSamples());
 
-        oscilloscope3D = new Oscilloscope3D(ringBuffer);
-        addChildComponent(oscilloscope3D);
+            // Only the file player is heard; the end of each block plays a block plus the output latency later
+            fileStream.setPlaybackLatency(device->getOutputLatencyInSamples() + samplesPerBlockExpected);
+        }
 
-        spectrum = new Spectrum(ringBuffer);
-        addChildComponent(spectrum);
+        visualizerPipeline.updateSampleRates();
+        publishAttachedStream();
     }
 
     /** Called after rendering Audio.
     */
     void releaseResources() override
     {
-        // Delete all visualizer allocations
-        if (oscilloscope2D != nullptr)
-        {
-            oscilloscope2D->stop();
-            removeChildComponent(oscilloscope2D);
-            delete oscilloscope2D;
-        }
-
-        if (oscilloscope3D != nullptr)
-        {
-            oscilloscope3D->stop();
-            removeChildComponent(oscilloscope3D);
-            delete oscilloscope3D;
-        }
-
-        if (spectrum != nullptr)
-        {
-            spectrum->stop();
-            removeChildComponent(spectrum);
-            delete spectrum;
-        }
+        TOWEL_TRACE_ZONE("releaseResources");
 
         audioTransportSource.releaseResources();
-        delete ringBuffer;
+
+        // Keep every allocation for the next prepareToPlay()
+        streamRegistry.release();
     }
 
     /** The audio rendering callback.
     */
 void getNextAudioBlock(const AudioSourceChannelInfo& bufferToFill) override {
+    Trace::setThreadName("Audio");
+    TOWEL_TRACE_ZONE("getNextAudioBlock");
+
+    // Nothing below may allocate: every buffer was sized in prepareToPlay() and files are read ahead
+    const ScopedNoHeapAllocation noAllocation;
+
+    // Run every stream while the device input is still in the buffer. Input
+    // streams write straight from it into their ring buffers, no extra copy.
+    streamRegistry.processBlock(bufferToFill);
+
+    if (audioInputModeEnabled) {
+        // Pass the input through to the outputs only when monitoring
+        if (! monitorInputEnabled)
+            bufferToFill.clearActiveBufferRegion();
+
+        return;
+    }
+
     // Clear the buffer first to ensure clean slate for operations
     bufferToFill.clearActiveBufferRegion();
 
@@ -123,15 +337,8 @@ void getNextAudioBlock(const AudioSourceChannelInfo& bufferToFill) override {
         // Get audio data from the file
         audioTransportSource.getNextAudioBlock(bufferToFill);
 
-        // Write the obtained audio samples to the ring buffer for visualization or further processing
-        ringBuffer->writeSamples(*bufferToFill.buffer, bufferToFill.startSample, bufferToFill.numSamples);
-    }
-
-    // If microphone input is enabled, handle accordingly
-    if (audioInputModeEnabled) {
-        // Additional handling for mic input can be placed here
-        // For now, we're ensuring mic input doesn't produce audible output:
-        bufferToFill.clearActiveBufferRegion();
+        // Write the obtained audio samples to the file stream for visualization or further processing
+        fileStream.writeSamples(*bufferToFill.buffer, bufferToFill.startSample, bufferToFill.numSamples);
     }
 
     // If neither mode is enabled, the buffer remains cleared from the initial step
@@ -161,9 +368,27 @@ void getNextAudioBlock(const AudioSourceChannelInfo& bufferToFill) override {
         openFileButton.setBounds(margin, margin, buttonWidth - 2 * margin, buttonHeight);
         playButton.setBounds(openFileButton.getRight() + margin, margin, buttonWidth - 2 * margin, buttonHeight);
         stopButton.setBounds(playButton.getRight() + margin, margin, buttonWidth - 2 * margin, buttonHeight);
+        audioInputButton.setBounds(stopButton.getRight() + margin, margin, buttonWidth - 2 * margin, buttonHeight);
+        levelsLabel.setBounds(audioInputButton.getRight() + margin, margin, getWidth() - audioInputButton.getRight() - 2 * margin, buttonHeight);
+
+        streamSelector.setBounds(margin, openFileButton.getBottom() + margin, buttonWidth - 2 * margin, buttonHeight);
+        addStreamButton.setBounds(streamSelector.getRight() + margin, streamSelector.getY(), buttonWidth - 2 * margin, buttonHeight);
+        monitorInputButton.setBounds(addStreamButton.getRight() + margin, streamSelector.getY(), buttonWidth - 2 * margin, buttonHeight);
+        recordButton.setBounds(monitorInputButton.getRight() + margin, streamSelector.getY(), 80, buttonHeight);
+        viewSelector.setBounds(recordButton.getRight() + margin, streamSelector.getY(), 140, buttonHeight);
+        lineScopeButton.setBounds(viewSelector.getRight() + margin, streamSelector.getY(), 100, buttonHeight);
+        latencyLabel.setBounds(lineScopeButton.getRight() + margin, recordButton.getY(), getWidth() - lineScopeButton.getRight() - 2 * margin, buttonHeight);
+
+        int top = monitorInputButton.getBottom() + margin;
+
+        if (waveformOverview.isVisible())
+        {
+            waveformOverview.setBounds(margin, top, getWidth() - 2 * margin, waveformOverviewHeight);
+            top = waveformOverview.getBottom() + margin;
+        }
 
-        // Set the bounds for the spectrum visualizer
-        spectrum->setBounds(0, openFileButton.getBottom() + margin, getWidth(), getHeight() - (openFileButton.getBottom() + margin));
+        // Set the bounds for the visualizers
+        visualizerPipeline.setBounds({ 0, top, getWidth(), getHeight() - top });
     }
 
 
@@ -188,12 +413,16 @@ void buttonClicked(Button* button) override {
             auto* reader = formatManager.createReaderFor(file);
             if (reader != nullptr) {
                 std::unique_ptr<AudioFormatReaderSource> newSource(new AudioFormatReaderSource(reader, true));
-                audioTransportSource.setSource(newSource.get(), 0, nullptr, reader->sampleRate);
+                audioTransportSource.setSource(newSource.get(), FilePlayerSource::readAheadSamples, &fileReadThread, reader->sampleRate);
                 audioReaderSource.reset(newSource.release()); // Ensure the source is kept alive
                 playButton.setEnabled(true);
                 stopButton.setEnabled(false);
                 audioFileModeEnabled = true;
                 audioInputModeEnabled = false;
+                updateStreamSelector(fileStream);
+
+                waveformOverview.setVisible(waveformOverview.setFile(formatManager, file));
+                resized();
             }
         }
     } else if (button == &playButton && !audioTransportSource.isPlaying()) {
@@ -208,6 +437,17 @@ void buttonClicked(Button* button) override {
         playButton.setEnabled(true); // Ensure button is re-enabled
         stopButton.setEnabled(false);
         audioTransportState = Stopped;
+    } else if (button == &audioInputButton) {
+        audioInputButtonClicked();
+    } else if (button == &monitorInputButton) {
+        monitorInputEnabled = monitorInputButton.getToggleState();
+    } else if (button == &addStreamButton) {
+        addFileStreamButtonClicked();
+    } else if (button == &recordButton) {
+        recordButtonClicked();
+    } else if (button == &lineScopeButton) {
+        visualizerPipeline.setOscilloscopeRenderer(lineScopeButton.getToggleState() ? Oscilloscope2D::lineRenderer
+                                                                                    : Oscilloscope2D::fragmentRenderer);
     }
 }
 
@@ -221,7 +461,7 @@ void handleOpenFileButton() {
 
         if (reader) {
             auto* newSource = new AudioFormatReaderSource(reader.release(), true);
-            audioTransportSource.setSource(newSource, 0, nullptr, newSource->getAudioFormatReader()->sampleRate);
+            audioTransportSource.setSource(newSource, FilePlayerSource::readAheadSamples, &fileReadThread, newSource->getAudioFormatReader()->sampleRate);
             audioReaderSource.reset(newSource);
             playButton.setEnabled(true);
             stopButton.setEnabled(false);
@@ -273,7 +513,7 @@ void handleStopButton() {
                 if (reader != nullptr)
                 {
                     audioReaderSource.reset(new AudioFormatReaderSource(reader, true));
-                    audioTransportSource.setSource(audioReaderSource.get(), 0, nullptr, reader->sampleRate);
+                    audioTransportSource.setSource(audioReaderSource.get(), FilePlayerSource::readAheadSamples, &fileReadThread, reader->sampleRate);
                     playButton.setEnabled(true);
                     stopButton.setEnabled(false);
                     audioFileModeEnabled = true;
@@ -318,7 +558,7 @@ void handleStopButton() {
             if (reader != nullptr)
             {
                 audioReaderSource.reset(new AudioFormatReaderSource(reader, true));
-                audioTransportSource.setSource(audioReaderSource.get(), 0, nullptr, reader->sampleRate);
+                audioTransportSource.setSource(audioReaderSource.get(), FilePlayerSource::readAheadSamples, &fileReadThread, reader->sampleRate);
                 playButton.setEnabled(true);
                 stopButton.setEnabled(false);
                 audioFileModeEnabled = true;
@@ -404,56 +644,174 @@ private:
 
         playButton.setEnabled(false);
         stopButton.setEnabled(false);
+
+        updateStreamSelector(inputStream);
     }
 
-    void showIOSelectorButtonClicked()
+    /** Adds another looping file player stream, which can be visualized
+        without being heard. Analysis recordings (.twar) are replayed instead.
+     */
+    void addFileStreamButtonClicked()
     {
-        oscilloscope2DButton.setToggleState(false, NotificationType::dontSendNotification);
-        oscilloscope3DButton.setToggleState(false, NotificationType::dontSendNotification);
-        spectrumButton.setToggleState(false, NotificationType::dontSendNotification);
-
-        bool audioIOShouldBeVisibile = !audioIOSelector.isVisible();
-
-        audioIOSelector.setVisible(audioIOShouldBeVisibile);
+        FileChooser chooser("Select a file to add as a stream...", File(), formatManager.getWildcardForAllFormats() + ";*.twar");
 
-        if (audioIOShouldBeVisibile)
+        if (chooser.browseForFileToOpen())
         {
-            if (oscilloscope2D != nullptr)
-            {
-                oscilloscope2D->setVisible(false);
-                oscilloscope2D->stop();
-            }
+            auto file = chooser.getResult();
 
-            if (oscilloscope3D != nullptr)
+            if (file.hasFileExtension("twar"))
             {
-                oscilloscope3D->setVisible(false);
-                oscilloscope3D->stop();
-            }
+                auto replay = std::make_unique<ReplaySource>(file);
 
-            if (spectrum != nullptr)
+                if (replay->isValid())
+                    updateStreamSelector(streamRegistry.addStream(file.getFileName(), std::move(replay)));
+            }
+            else if (auto* reader = formatManager.createReaderFor(file))
             {
-                spectrum->setVisible(false);
-                spectrum->stop();
+                auto& stream = streamRegistry.addStream(file.getFileName(), std::make_unique<FilePlayerSource>(reader, fileReadThread));
+                updateStreamSelector(stream);
             }
         }
-        else
+    }
+
+    /** Starts or stops recording the analysis of the stream the visualizers
+        show to a .twar file, which can be added back as a replay stream.
+     */
+    void recordButtonClicked()
+    {
+        streamRecorder = nullptr;
+
+        if (! recordButton.getToggleState())
+            return;
+
+        auto* stream = visualizerPipeline.getAttachedStream(VisualizerPipeline::spectrumType);
+        FileChooser chooser("Record analysis to...", File::getSpecialLocation(File::userDocumentsDirectory), "*.twar");
+
+        if (stream != nullptr && chooser.browseForFileToSave(true))
         {
-            if (oscilloscope2DButton.getToggleState())
-            {
-                oscilloscope3D->setVisible(true);
-                oscilloscope3D->start();
-            }
-            else if (oscilloscope3DButton.getToggleState())
-            {
-                oscilloscope3D->setVisible(true);
-                oscilloscope3D->start();
-            }
-            else if (spectrumButton.getToggleState())
-            {
-                oscilloscope3D->setVisible(true);
-                oscilloscope3D->start();
-            }
+            streamRecorder = std::make_unique<StreamRecorder>(*stream, chooser.getResult().withFileExtension("twar"));
+
+            if (! streamRecorder->isRecording())
+                streamRecorder = nullptr;
         }
+
+        recordButton.setToggleState(streamRecorder != nullptr, dontSendNotification);
+    }
+
+    /** Refills the stream selector and attaches the visualizers to selected.
+     */
+    void updateStreamSelector(AudioStream& selected)
+    {
+        streamSelector.clear(dontSendNotification);
+
+        for (int i = 0; i < streamRegistry.getNumStreams(); ++i)
+        {
+            auto* stream = streamRegistry.getStream(i);
+            streamSelector.addItem(stream->getName(), i + 1);
+
+            if (stream == &selected)
+                streamSelector.setSelectedId(i + 1, dontSendNotification);
+        }
+
+        visualizerPipeline.attachAll(selected);
+        publishAttachedStream();
+    }
+
+    void streamSelected()
+    {
+        if (auto* stream = streamRegistry.getStream(streamSelector.getSelectedId() - 1))
+        {
+            visualizerPipeline.attachAll(*stream);
+            publishAttachedStream();
+        }
+    }
+
+    /** Points the analysis server and the shared memory segment, if enabled,
+        at the stream the visualizers show.
+     */
+    void publishAttachedStream()
+    {
+        auto* stream = visualizerPipeline.getAttachedStream(VisualizerPipeline::spectrumType);
+
+        if (analysisServer != nullptr)
+        {
+            if (stream != nullptr)
+                analysisServer->setSource(&stream->getAnalysis(), stream->getSampleRate());
+            else
+                analysisServer->setSource(nullptr, 0.0);
+        }
+
+        if (sharedRingBuffer != nullptr && stream != sharedStream)
+        {
+            if (sharedStream != nullptr)
+                streamRegistry.setSharedOutput(*sharedStream, nullptr);
+
+            sharedStream = stream;
+
+            if (sharedStream != nullptr)
+                streamRegistry.setSharedOutput(*sharedStream, sharedRingBuffer.get());
+        }
+    }
+
+    /** Updates the latency readout for the stream the visualizers show.
+     */
+    void timerCallback() override
+    {
+        auto* stream = visualizerPipeline.getAttachedStream(VisualizerPipeline::spectrumType);
+
+        if (stream == nullptr)
+        {
+            latencyLabel.setText("", dontSendNotification);
+            levelsLabel.setText("", dontSendNotification);
+            return;
+        }
+
+        updateLevelsLabel(*stream);
+
+        auto latency = stream->getInputLatency();
+
+        latencyLabel.setText("Latency: " + String(latency.getTotalMs(), 1) + " ms"
+                             + "  (device " + String(latency.deviceMs, 1)
+                             + ", block " + String(latency.blockMs, 1)
+                             + ", buffer " + String(latency.bufferAgeMs, 1) + ")"
+                             + (analysisServer != nullptr ? "  Serving " + String(analysisServer->getNumClients())
+                                                              + " on port " + String(analysisServer->getPort()) : String()),
+                             dontSendNotification);
+    }
+
+    /** Shows the loudness and highest true peak of the newest frame. Replayed
+        recordings carry no levels, so the label stays empty for them.
+     */
+    void updateLevelsLabel(AudioStream& stream)
+    {
+        if (!stream.getAnalysis().read(levelsFrame) || levelsFrame.levels.numChannels == 0)
+        {
+            levelsLabel.setText("", dontSendNotification);
+            return;
+        }
+
+        auto& levels = levelsFrame.levels;
+        float truePeak = 0.0f;
+
+        for (int i = 0; i < levels.numChannels; ++i)
+            truePeak = jmax(truePeak, levels.truePeak[i]);
+
+        levelsLabel.setText("M " + String(levels.momentaryLoudness, 1)
+                            + "  S " + String(levels.shortTermLoudness, 1)
+                            + "  I " + String(levels.integratedLoudness, 1) + " LUFS"
+                            + "  TP " + String(Decibels::gainToDecibels(truePeak), 1)
+                            + " (max " + String(Decibels::gainToDecibels(levels.maxTruePeak), 1) + ") dBTP",
+                            dontSendNotification);
+    }
+
+    /** Shows the visualizer picked in the view selector, creating it the first time.
+    */
+    void viewSelected()
+    {
+        const int type = viewSelector.getSelectedId() - 1;
+
+        if (type >= 0 && type < VisualizerPipeline::numVisualizerTypes)
+            visualizerPipeline.showOnly((VisualizerPipeline::VisualizerType) type);
     }
 
 
@@ -477,36 +835,57 @@ private:
     //==============================================================================
     // PRIVATE MEMBER VARIABLES
 
-    // App State
-    bool audioFileModeEnabled;
-    bool audioInputModeEnabled;
+    // App State (read on the audio thread)
+    std::atomic<bool> audioFileModeEnabled { false };
+    std::atomic<bool> audioInputModeEnabled { false };
+    std::atomic<bool> monitorInputEnabled { false };
 
     // GUI Buttons
     TextButton openFileButton;
     TextButton audioInputButton;
-    TextButton showIOSelectorButton;
     TextButton playButton;
     TextButton stopButton;
-
-    TextButton oscilloscope2DButton;
-    TextButton oscilloscope3DButton;
-    TextButton spectrumButton;
+    ComboBox streamSelector;
+    TextButton addStreamButton;
+    ToggleButton monitorInputButton;
+    ToggleButton recordButton;
+    ComboBox viewSelector;
+    ToggleButton lineScopeButton;
+    Label latencyLabel;
+    Label levelsLabel;
+    AnalysisFrame levelsFrame;      // Message thread only
 
     AudioDeviceSelectorComponent audioIOSelector;
 
     // Audio File Reading Variables
     AudioFormatManager formatManager;
+    TimeSliceThread fileReadThread { "Audio File Reader" };   // Reads ahead for every file transport
     std::unique_ptr<AudioFormatReaderSource> audioReaderSource;
     AudioTransportSource audioTransportSource;
-    AudioTransportState audioTransportState;
+    AudioTransportState audioTransportState = Stopped;
+
+    // Overview of the opened file, scanned in the background
+    enum { waveformOverviewHeight = 60 };
+    WaveformOverview waveformOverview;
+
+    // Audio streams, each with its own Ring Buffer and analysis
+    StreamRegistry streamRegistry;
+    AudioStream& fileStream;    // Fed by the audible file transport above
+    AudioStream& inputStream;   // Device inputs 1+2
+
+    // Visualizers, allocated once and reused across device changes
+    VisualizerPipeline visualizerPipeline;
+
+    // Records the analysis of one stream while the Record button is on
+    std::unique_ptr<StreamRecorder> streamRecorder;
 
-    // Audio & GL Audio Buffer
-    RingBuffer<float>* ringBuffer;
+    // Publishes the shown stream's analysis when started with --serve
+    std::unique_ptr<AnalysisServer> analysisServer;
 
-    // Visualizers
-    Oscilloscope2D* oscilloscope2D;
-    Oscilloscope3D* oscilloscope3D;
-    Spectrum* spectrum;
+    // Mirrors the shown stream into shared memory when started with --share
+    enum { sharedRingBufferSize = 1 << 16 };
+    std::unique_ptr<SharedRingBuffer> sharedRingBuffer;
+    AudioStream* sharedStream = nullptr;
 
     JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(MainContentComponent)
 };
@@ -11,9 +11,31 @@
 #include "../JuceLibraryCode/JuceHeader.h"
 #include <GL/glew.h>    
 #include "RingBuffer.h"
+#include "OscilloscopeTrigger.h"
+#include "WaveformDecimator.h"
+#include "Phosphor.h"
+#include "FramePacer.h"
+#include "ShaderCache.h"
+#include "ShaderLibrary.h"
+#include "ScratchArena.h"
+#include "GlewInit.h"
+#include "Trace.h"
+
+/** This 2D Oscilloscope has two renderers, chosen with setRenderer():
+
+    - fragmentRenderer: a full-screen quad whose fragment shader computes each
+      pixel's distance to the trace. Its cost grows with the pixel count.
+    - lineRenderer: the trace is drawn as a polyline. Each segment is a small
+      quad, expanded by the glow radius, and its fragment shader draws the
+      distance to that segment. Overlapping quads are combined with GL_MAX
+      blending, so the joints are seamless. Only pixels near the trace are
+      shaded.
+
+    Both renderers draw the same thickness and glow. The line renderer
+    measures distance perpendicular to the trace, not vertically, and fades
+    the glow out at three thicknesses. Envelopes (see setTimeWindow()) always
+    use the fragment renderer.
 
-/** This 2D Oscilloscope uses a Fragment-Shader based implementation.
- 
     Future Update: modify the fragment-shader to do some visual compression so
     you can see both soft and loud movements easier. Currently, the most loud
     parts of a song to a bit too far out of the frame and the soft parts don't
@@ -29,13 +51,20 @@ class Oscilloscope2D :  public Component,
     
 public:
     
-    Oscilloscope2D (RingBuffer<GLfloat> * ringBuffer)
-    : readBuffer (2, RING_BUFFER_READ_SIZE)
+    enum Renderer
+    {
+        fragmentRenderer,
+        lineRenderer
+    };
+    
+    Oscilloscope2D (RingBuffer<GLfloat> * ringBuffer, ScratchArena& scratch)
     {
         // Sets the OpenGL version to 3.2
         openGLContext.setOpenGLVersionRequired (OpenGLContext::OpenGLVersion::openGL3_2);
         
         this->ringBuffer = ringBuffer;
+        envelopeColumns = scratch.allocate<WaveformDecimator::Column> (maxEnvelopeColumns);
+        decimator.useStorage (scratch.allocate<float> (WaveformDecimator::getStorageSize()));   // Untouched until --scope-window
         
         // Attach the OpenGL context but do not start [ see start() ]
         openGLContext.setRenderer(this);
@@ -45,6 +74,7 @@ public:
         addAndMakeVisible (statusLabel);
         statusLabel.setJustificationType (Justification::topLeft);
         statusLabel.setFont (Font (14.0f));
+        statusLabel.setText ("Starting OpenGL...", dontSendNotification);    // Until the shaders are ready
     }
     
     ~Oscilloscope2D()
@@ -75,6 +105,100 @@ public:
         openGLContext.setContinuousRepainting (false);
     }
     
+    /** Switches to reading from a different RingBuffer. Safe to call while
+        rendering; the new buffer is picked up on the next frame.
+     */
+    void setRingBuffer (RingBuffer<GLfloat> * newRingBuffer)
+    {
+        ringBuffer = newRingBuffer;
+    }
+    
+    /** Sets the sample rate of the RingBuffer, which the trigger needs to
+        search for a stable start. Until then, the trace free-runs.
+     */
+    void setSampleRate (double newSampleRate)
+    {
+        trigger.setSampleRate (newSampleRate);
+        sampleRate = newSampleRate;
+    }
+    
+    /** Shows the last seconds of audio as a min/max/RMS envelope, one pixel
+        column at a time, instead of the 256 sample trace; 0 goes back to the
+        trace. The window is kept between one sample per column and
+        WaveformDecimator::maxWindowSize samples.
+     */
+    void setTimeWindow (double seconds)
+    {
+        timeWindowSeconds = seconds;
+    }
+    
+    void setTriggerSettings (const OscilloscopeTrigger::Settings& settings)
+    {
+        trigger.setSettings (settings);
+    }
+    
+    /** Chooses how the trace is drawn from the next frame on. Safe to call
+        while rendering.
+     */
+    void setRenderer (Renderer newRenderer)
+    {
+        renderer = newRenderer;
+    }
+    
+    Renderer getRenderer() const noexcept       { return renderer.load(); }
+    
+    /** Changes whenever new samples are written to the RingBuffer. See
+        FrameScheduler.
+     */
+    int64 getContentVersion() const
+    {
+        auto* source = ringBuffer.get();
+        return source != nullptr ? source->getTotalSamplesWritten() : 0;
+    }
+    
+    OpenGLContext& getOpenGLContext() noexcept  { return openGLContext; }
+    
+    /** Turns trails on or off. See Phosphor.
+     */
+    void setPhosphor (const Phosphor::Settings& settings)
+    {
+        phosphor.setSettings (settings);
+    }
+    
+    /** Lets library replace the shaders with ones loaded from files.
+     */
+    void addShaders (ShaderLibrary& library)
+    {
+        library.addShader ("Oscilloscope2D", shaderSlot, openGLContext, true);
+        library.addShader ("Oscilloscope2DLines", lineShaderSlot, openGLContext, true);
+    }
+    
+    /** Sets how long the newest sample in the RingBuffer takes to be heard,
+        see AudioStream::setPlaybackLatency(). Each frame then shows the
+        samples heard while it is on screen instead of the newest ones.
+        0 shows the newest samples.
+     */
+    void setPlaybackLatency (int latencyInSamples)
+    {
+        playbackLatency = latencyInSamples;
+    }
+    
+    /** Adds a delay between a frame being swapped and it being visible,
+        e.g. to match a display with its own processing. See FramePacer.
+     */
+    void setDisplayLatency (double seconds)
+    {
+        pacer.setDisplayLatency (seconds);
+    }
+
+    /** Tells the frame timing whether the context repaints continuously.
+        See FramePacer::setContinuous().
+     */
+    void setContinuousRepainting (bool isContinuous)
+    {
+        pacer.setContinuous (isContinuous);
+    }
+    
     
     //==========================================================================
     // OpenGL Callbacks
@@ -85,12 +209,29 @@ public:
      */
     void newOpenGLContextCreated() override
     {
+        Trace::setThreadName ("OpenGL Oscilloscope2D");
+        TOWEL_TRACE_ZONE ("Oscilloscope2D::newOpenGLContextCreated");
+
+        const auto glew = initialiseGlew();
+        glewLoaded = glew.wasOk();
+
+        if (glew.failed())
+        {
+            statusText = glew.getErrorMessage();
+            triggerAsyncUpdate();
+            return;
+        }
+
         // Setup Shaders
         createShaders();
+        phosphor.create (openGLContext);
         
         // Setup Buffer Objects
         glGenBuffers (1, &VBO); // Vertex Buffer Object
         glGenBuffers (1, &EBO); // Element Buffer Object
+        glGenBuffers (1, &lineVBO);
+        
+        glGetIntegerv (GL_MAX_TEXTURE_SIZE, &maxTextureSize);
     }
     
     /** Called when done rendering OpenGL, as an OpenGLContext object is closing.
@@ -98,8 +239,21 @@ public:
      */
     void openGLContextClosing() override
     {
-        shader.release();
-        uniforms.release();
+        if (! glewLoaded)
+            return;
+        
+        uniforms.reset();
+        shader.reset();
+        lineUniforms.reset();
+        lineShader.reset();
+        phosphor.release();
+        
+        glDeleteBuffers (1, &lineVBO);
+        lineVBO = 0;
+        
+        glDeleteTextures (1, &envelopeTexture);
+        envelopeTexture = 0;
+        envelopeTextureWidth = 0;
     }
     
     
@@ -107,18 +261,97 @@ public:
      */
     void renderOpenGL() override
     {
+        TOWEL_TRACE_ZONE ("Oscilloscope2D::renderOpenGL");
         jassert (OpenGLHelpers::isContextActive());
         
-        // Setup Viewport
+        if (! glewLoaded)
+        {
+            OpenGLHelpers::clear (getLookAndFeel().findColour (ResizableWindow::backgroundColourId));
+            return;
+        }
+        
+        updateShaders();
+        
         const float renderingScale = (float) openGLContext.getRenderingScale();
-        glViewport (0, 0, roundToInt (renderingScale * getWidth()), roundToInt (renderingScale * getHeight()));
+        renderFrame (roundToInt (renderingScale * getWidth()), roundToInt (renderingScale * getHeight()));
+    }
+    
+    /** Draws one width by height pixel frame into the current render target
+        with the selected renderer. Must be called on the OpenGL thread;
+        OscilloscopeBenchmark uses it to draw into frame buffers of any size.
+     */
+    void renderFrame (int width, int height)
+    {
+        // The trace ends at what is heard while this frame is on screen
+        const double displayTime = pacer.beginFrame();
+        
+        if (auto* source = ringBuffer.get())
+            audibleSample = pacer.getAudibleSample (*source, sampleRate.load(), playbackLatency.load(), displayTime);
+        
+        // With trails on, this frame is drawn over the faded previous ones
+        if (phosphor.beginFrame (width, height))
+        {
+            // Shaders and trails are set up by now; drawing only uses memory sized up front
+            const ScopedNoHeapAllocation noAllocation;
+            drawTrace (width, height);
+        }
+        
+        phosphor.endFrame();
+        pacer.endFrame();
+    }
+    
+    
+    //==========================================================================
+    // JUCE Callbacks
+    
+    void paint (Graphics& g) override
+    {
+    }
+    
+    void resized () override
+    {
+        statusLabel.setBounds (getLocalBounds().reduced (4).removeFromTop (75));
+    }
+    
+private:
+    
+    //==========================================================================
+    // OpenGL Functions
+    
+    /** Draws the trace, or the envelope, with the selected renderer.
+     */
+    void drawTrace (int width, int height)
+    {
+        // Setup Viewport
+        glViewport (0, 0, width, height);
+        
+        if (renderer.load() == lineRenderer && timeWindowSeconds.load() <= 0.0 && lineShader != nullptr)
+        {
+            renderLines (width, height);
+            return;
+        }
         
         // Set background Color
-        OpenGLHelpers::clear (getLookAndFeel().findColour (ResizableWindow::backgroundColourId));
+        if (! phosphor.isActive() || shader == nullptr)
+            OpenGLHelpers::clear (getLookAndFeel().findColour (ResizableWindow::backgroundColourId));
+        
+        // The shader did not compile: its error is in the status text
+        if (shader == nullptr)
+            return;
         
-        // Enable Alpha Blending
+        // Enable Alpha Blending. The shader covers every pixel, so over trails
+        // it keeps the brighter of the two instead
         glEnable (GL_BLEND);
-        glBlendFunc (GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+        
+        if (phosphor.isActive())
+        {
+            glBlendEquation (GL_MAX);
+            glBlendFunc (GL_ONE, GL_ONE);
+        }
+        else
+        {
+            glBlendFunc (GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+        }
         
         // Use Shader Program that's been defined
         shader->use();
@@ -126,20 +359,19 @@ public:
         // Setup the Uniforms for use in the Shader
         
         if (uniforms->resolution != nullptr)
-            uniforms->resolution->set ((GLfloat) renderingScale * getWidth(), (GLfloat) renderingScale * getHeight());
+            uniforms->resolution->set ((GLfloat) width, (GLfloat) height);
+        
+        // Long time windows are drawn as envelopes, decimated on the CPU
+        const bool drawEnvelope = updateEnvelope (width);
+        
+        if (uniforms->envelopeMode != nullptr)
+            uniforms->envelopeMode->set ((GLint) (drawEnvelope ? 1 : 0));
         
         // Read in samples from ring buffer
-        if (uniforms->audioSampleData != nullptr)
+        if (! drawEnvelope && uniforms->audioSampleData != nullptr)
         {
-            ringBuffer->readSamples (readBuffer, RING_BUFFER_READ_SIZE);
-            
-            FloatVectorOperations::clear (visualizationBuffer, RING_BUFFER_READ_SIZE);
-            
-            // Sum channels together
-            for (int i = 0; i < 2; ++i)
-            {
-                FloatVectorOperations::add (visualizationBuffer, readBuffer.getReadPointer(i, 0), RING_BUFFER_READ_SIZE);
-            }
+            // Channels summed, starting where the trigger holds the waveform still
+            trigger.read (*ringBuffer.get(), visualizationBuffer, RING_BUFFER_READ_SIZE, audibleSample);
             
             uniforms->audioSampleData->set (visualizationBuffer, 256);
         }
@@ -190,32 +422,150 @@ public:
         // Reset the element buffers so child Components draw correctly
         glBindBuffer (GL_ARRAY_BUFFER, 0);
         glBindBuffer (GL_ELEMENT_ARRAY_BUFFER, 0);
+        glBindTexture (GL_TEXTURE_2D, 0);
+        glBlendEquation (GL_FUNC_ADD);
         //glBindVertexArray(0);
     }
     
+    enum
+    {
+        numLineSegments = RING_BUFFER_READ_SIZE - 1,
+        verticesPerSegment = 6,         // Two triangles
+        floatsPerLineVertex = 6,        // Corner x, y, then the segment's ends ax, ay, bx, by
+        maxEnvelopeColumns = 8192       // Widest envelope in pixels; wider frames draw the trace
+    };
     
-    //==========================================================================
-    // JUCE Callbacks
-    
-    void paint (Graphics& g) override
+    /** The line renderer: one quad per segment of the trace, reaching
+        glowRadius beyond the segment on every side.
+     */
+    void renderLines (int width, int height)
     {
+        // Same scale as the fragment shader: THICKNESS of the height, centred
+        const float thickness = 0.02f * (float) height;
+        const float glowRadius = 3.0f * thickness;     // The glow is faded out completely here
+        
+        // Same background as the fragment renderer, so switching renderers keeps it
+        if (! phosphor.isActive())
+            OpenGLHelpers::clear (getLookAndFeel().findColour (ResizableWindow::backgroundColourId));
+        
+        // Channels summed, starting where the trigger holds the waveform still
+        trigger.read (*ringBuffer.get(), visualizationBuffer, RING_BUFFER_READ_SIZE, audibleSample);
+        
+        auto getPoint = [&] (int i)
+        {
+            return Point<float> ((float) width * (float) i / (float) numLineSegments,
+                                 (float) height * (0.5f - visualizationBuffer[i] / 2.5f));
+        };
+        
+        GLfloat* vertex = lineVertices;
+        Point<float> a = getPoint (0);
+        
+        for (int i = 0; i < numLineSegments; ++i)
+        {
+            const Point<float> b = getPoint (i + 1);
+            const float length = a.getDistanceFrom (b);
+            const Point<float> along = length > 0.0f ? (b - a) * (glowRadius / length) : Point<float> (glowRadius, 0.0f);
+            const Point<float> across (-along.y, along.x);
+            
+            const Point<float> corners[] = { a - along - across, a - along + across,
+                                             b + along - across, b + along + across };
+            
+            for (int corner : { 0, 1, 2, 2, 1, 3 })
+            {
+                *vertex++ = corners[corner].x;
+                *vertex++ = corners[corner].y;
+                *vertex++ = a.x;
+                *vertex++ = a.y;
+                *vertex++ = b.x;
+                *vertex++ = b.y;
+            }
+            
+            a = b;
+        }
+        
+        // Each pixel keeps the brightest segment's glow
+        glEnable (GL_BLEND);
+        glBlendEquation (GL_MAX);
+        glBlendFunc (GL_ONE, GL_ONE);
+        
+        lineShader->use();
+        
+        if (lineUniforms->resolution != nullptr)
+            lineUniforms->resolution->set ((GLfloat) width, (GLfloat) height);
+        
+        if (lineUniforms->thickness != nullptr)
+            lineUniforms->thickness->set (thickness);
+        
+        if (lineUniforms->glowRadius != nullptr)
+            lineUniforms->glowRadius->set (glowRadius);
+        
+        glBindBuffer (GL_ARRAY_BUFFER, lineVBO);
+        glBufferData (GL_ARRAY_BUFFER, sizeof (lineVertices), lineVertices, GL_STREAM_DRAW);
+        
+        const GLsizei stride = floatsPerLineVertex * sizeof (GLfloat);
+        glVertexAttribPointer (0, 2, GL_FLOAT, GL_FALSE, stride, (GLvoid*) 0);
+        glVertexAttribPointer (1, 4, GL_FLOAT, GL_FALSE, stride, (GLvoid*) (2 * sizeof (GLfloat)));
+        glEnableVertexAttribArray (0);
+        glEnableVertexAttribArray (1);
+        
+        glDrawArrays (GL_TRIANGLES, 0, numLineSegments * verticesPerSegment);
+        
+        // Reset state so child Components draw correctly
+        glDisableVertexAttribArray (1);
+        glBlendEquation (GL_FUNC_ADD);
+        glBindBuffer (GL_ARRAY_BUFFER, 0);
     }
     
-    void resized () override
+    /** When a time window is set, decimates it to one column per pixel and
+        binds the columns as the envelope texture. Returns false to draw the
+        trace instead.
+     */
+    bool updateEnvelope (int width)
     {
-        statusLabel.setBounds (getLocalBounds().reduced (4).removeFromTop (75));
+        const double seconds = timeWindowSeconds.load();
+        const double rate = sampleRate.load();
+        
+        if (seconds <= 0.0 || rate <= 0.0 || width <= 0 || width > jmin ((int) maxEnvelopeColumns, (int) maxTextureSize)
+            || uniforms->envelope == nullptr)
+            return false;
+        
+        // Cost depends on the width only; the decimator keeps up with new samples
+        const int windowSize = jlimit (width, (int) WaveformDecimator::maxWindowSize, roundToInt (seconds * rate));
+        
+        decimator.update (*ringBuffer.get());
+        decimator.getColumns (windowSize / (double) width, width, envelopeColumns);
+        
+        if (envelopeTexture == 0)
+            glGenTextures (1, &envelopeTexture);
+        
+        glActiveTexture (GL_TEXTURE0);
+        glBindTexture (GL_TEXTURE_2D, envelopeTexture);
+        glPixelStorei (GL_UNPACK_ALIGNMENT, 4);
+        
+        if (width != envelopeTextureWidth)
+        {
+            glTexImage2D (GL_TEXTURE_2D, 0, GL_RGB32F, width, 1, 0, GL_RGB, GL_FLOAT, envelopeColumns);
+            glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+            glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+            glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+            glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+            envelopeTextureWidth = width;
+        }
+        else
+        {
+            glTexSubImage2D (GL_TEXTURE_2D, 0, 0, 0, width, 1, GL_RGB, GL_FLOAT, envelopeColumns);
+        }
+        
+        uniforms->envelope->set ((GLint) 0);
+        return true;
     }
     
-private:
-    
-    //==========================================================================
-    // OpenGL Functions
-    
-    
     /** Loads the OpenGL Shaders and sets up the whole ShaderProgram
     */
     void createShaders()
     {
+        TOWEL_TRACE_ZONE ("Oscilloscope2D::createShaders");
+
         vertexShader =
         "attribute vec3 position;\n"
         "\n"
@@ -227,6 +577,8 @@ private:
         fragmentShader =
         "uniform vec2  resolution;\n"
         "uniform float audioSampleData[256];\n"
+        "uniform sampler2D envelope;\n"    // One texel per pixel column: min, max, RMS
+        "uniform int envelopeMode;\n"
         "\n"
         "void getAmplitudeForXPos (in float xPos, out float audioAmplitude)\n"
         "{\n"
@@ -241,38 +593,168 @@ private:
         "void main()\n"
         "{\n"
         "    float y = gl_FragCoord.y / resolution.y;\n"
-        "    float amplitude = 0.0;\n"
-        "    getAmplitudeForXPos (gl_FragCoord.x, amplitude);\n"
+        "    float r;\n"
+        "\n"
+        "    if (envelopeMode != 0)\n"
+        "    {\n"
+        // Solid between min and max, brightest within the RMS, glowing outside
+        "        vec3 column = texture2D (envelope, vec2 (gl_FragCoord.x / resolution.x, 0.5)).rgb;\n"
+        "        float bottom = 0.5 - column.g / 2.5;\n"
+        "        float top = 0.5 - column.r / 2.5;\n"
+        "        float distance = max (max (bottom - y, y - top), 0.0);\n"
+        "        r = distance > 0.0 ? abs (THICKNESS / distance) : (abs (y - 0.5) < column.b / 2.5 ? 1.0 : 0.6);\n"
+        "    }\n"
+        "    else\n"
+        "    {\n"
+        "        float amplitude = 0.0;\n"
+        "        getAmplitudeForXPos (gl_FragCoord.x, amplitude);\n"
         "\n"
         // Centers & Reduces Wave Amplitude
-        "    amplitude = 0.5 - amplitude / 2.5;\n"
-        "    float r = abs (THICKNESS / (amplitude-y));\n"
+        "        amplitude = 0.5 - amplitude / 2.5;\n"
+        "        r = abs (THICKNESS / (amplitude-y));\n"
+        "    }\n"
         "\n"
         "gl_FragColor = vec4 (r - abs (r * 0.2), r - abs (r * 0.2), r - abs (r * 0.2), 1.0);\n"
         "}\n";
         
-        std::unique_ptr<OpenGLShaderProgram> shaderProgramAttempt = std::make_unique<OpenGLShaderProgram> (openGLContext);
+        ShaderCache::Program program;
+        program.vertexShader = vertexShader;
+        program.fragmentShader = fragmentShader;
+        shaderSlot.contextCreated (program);
         
-        // Sets up pipeline of shaders and compiles the program
-        if (shaderProgramAttempt->addVertexShader (OpenGLHelpers::translateVertexShaderToV3 (vertexShader))
-            && shaderProgramAttempt->addFragmentShader (OpenGLHelpers::translateFragmentShaderToV3 (fragmentShader))
-            && shaderProgramAttempt->link())
+        program.vertexShader = OpenGLHelpers::translateVertexShaderToV3 (program.vertexShader);
+        program.fragmentShader = OpenGLHelpers::translateFragmentShaderToV3 (program.fragmentShader);
+        
+        // Sets up pipeline of shaders and compiles the program, unless it is cached
+        String error;
+        
+        if (auto shaderProgram = shaderCache->getProgram (openGLContext, program, error))
         {
-            uniforms.release();
-            shader = std::move (shaderProgramAttempt);
+            uniforms.reset();
+            shader = std::move (shaderProgram);
             uniforms.reset (new Uniforms (openGLContext, *shader));
             
 //            statusText = "GLSL: v" + String (OpenGLShaderProgram::getLanguageVersion(), 2);
-statusText = "";  // This will make the status text empty
+mainShaderError = "";  // This will make the status text empty
         }
         else
         {
-            statusText = shaderProgramAttempt->getLastError();
+            mainShaderError = error;
         }
         
+        createLineShader();
+        
+        updateStatusText();
         triggerAsyncUpdate();
     }
     
+    /** Compiles the line renderer's program. Without it, the fragment
+        renderer is used whatever setRenderer() chose.
+     */
+    void createLineShader()
+    {
+        const char* lineVertexShader =
+        "attribute vec2 corner;\n"     // Pixels
+        "attribute vec4 segment;\n"    // Both ends of the segment, in pixels
+        "uniform vec2 resolution;\n"
+        "varying vec2 pixel;\n"
+        "varying vec4 ends;\n"
+        "\n"
+        "void main()\n"
+        "{\n"
+        "    pixel = corner;\n"
+        "    ends = segment;\n"
+        "    gl_Position = vec4 (2.0 * corner / resolution - 1.0, 0.0, 1.0);\n"
+        "}\n";
+        
+        const char* lineFragmentShader =
+        "uniform float thickness;\n"
+        "uniform float glowRadius;\n"
+        "varying vec2 pixel;\n"
+        "varying vec4 ends;\n"
+        "\n"
+        "void main()\n"
+        "{\n"
+        "    vec2 ab = ends.zw - ends.xy;\n"
+        "    float t = clamp (dot (pixel - ends.xy, ab) / max (dot (ab, ab), 0.0001), 0.0, 1.0);\n"
+        "    float distance = length (pixel - ends.xy - t * ab);\n"
+        // The fragment renderer's THICKNESS / distance, faded out to 0 at the glow radius
+        "    float r = max (thickness / max (distance, 0.5) - thickness / glowRadius, 0.0);\n"
+        "    gl_FragColor = vec4 (r - abs (r * 0.2), r - abs (r * 0.2), r - abs (r * 0.2), 1.0);\n"
+        "}\n";
+        
+        ShaderCache::Program program;
+        program.vertexShader = lineVertexShader;
+        program.fragmentShader = lineFragmentShader;
+        program.attributes = { "corner", "segment" };     // renderLines() feeds the attributes by index
+        lineShaderSlot.contextCreated (program);
+        
+        program.vertexShader = OpenGLHelpers::translateVertexShaderToV3 (program.vertexShader);
+        program.fragmentShader = OpenGLHelpers::translateFragmentShaderToV3 (program.fragmentShader);
+        
+        String error;
+        
+        if (auto lineShaderProgram = shaderCache->getProgram (openGLContext, program, error))
+        {
+            lineUniforms.reset();
+            lineShader = std::move (lineShaderProgram);
+            lineUniforms.reset (new Uniforms (openGLContext, *lineShader));
+            lineShaderError = "";
+            return;
+        }
+        
+        lineShaderError = error;
+    }
+    
+    /** Shows the errors of both programs, if any. The label is updated
+        by the next handleAsyncUpdate().
+     */
+    void updateStatusText()
+    {
+        StringArray errors;
+        errors.add (mainShaderError);
+        errors.add (lineShaderError);
+        errors.removeEmptyStrings();
+        
+        statusText = errors.joinIntoString ("\n");
+    }
+    
+    /** Swaps in programs rebuilt from edited shader files. See ShaderLibrary.
+     */
+    void updateShaders()
+    {
+        ShaderCache::Program program;
+        String error;
+        
+        if (shaderSlot.takeUpdate (program, error))
+        {
+            if (auto shaderProgram = error.isEmpty() ? shaderCache->getProgram (openGLContext, program, error) : nullptr)
+            {
+                uniforms.reset();
+                shader = std::move (shaderProgram);
+                uniforms.reset (new Uniforms (openGLContext, *shader));
+            }
+            
+            mainShaderError = error;
+            updateStatusText();
+            triggerAsyncUpdate();
+        }
+        
+        if (lineShaderSlot.takeUpdate (program, error))
+        {
+            if (auto lineShaderProgram = error.isEmpty() ? shaderCache->getProgram (openGLContext, program, error) : nullptr)
+            {
+                lineUniforms.reset();
+                lineShader = std::move (lineShaderProgram);
+                lineUniforms.reset (new Uniforms (openGLContext, *lineShader));
+            }
+            
+            lineShaderError = error;
+            updateStatusText();
+            triggerAsyncUpdate();
+        }
+    }
+    
 
     //==============================================================================
     // This class just manages the uniform values that the fragment shader uses.
@@ -285,11 +767,16 @@ statusText = "";  // This will make the status text empty
             
             resolution.reset (createUniform (openGLContext, shaderProgram, "resolution"));
             audioSampleData.reset (createUniform (openGLContext, shaderProgram, "audioSampleData"));
+            envelope.reset (createUniform (openGLContext, shaderProgram, "envelope"));
+            envelopeMode.reset (createUniform (openGLContext, shaderProgram, "envelopeMode"));
+            thickness.reset (createUniform (openGLContext, shaderProgram, "thickness"));
+            glowRadius.reset (createUniform (openGLContext, shaderProgram, "glowRadius"));
             
         }
         
         //ScopedPointer<OpenGLShaderProgram::Uniform> projectionMatrix, viewMatrix;
-        std::unique_ptr<OpenGLShaderProgram::Uniform> resolution, audioSampleData;
+        std::unique_ptr<OpenGLShaderProgram::Uniform> resolution, audioSampleData, envelope, envelopeMode,
+                                                      thickness, glowRadius;
         
     private:
         static OpenGLShaderProgram::Uniform* createUniform (OpenGLContext& openGLContext,
@@ -306,34 +793,52 @@ statusText = "";  // This will make the status text empty
     
     // OpenGL Variables
     OpenGLContext openGLContext;
+    bool glewLoaded = false;                    // OpenGL thread only; without GLEW no GL call is made
     GLuint VBO, VAO, EBO;
     
-    std::unique_ptr<OpenGLShaderProgram> shader;
+    SharedResourcePointer<ShaderCache> shaderCache;
+    std::shared_ptr<OpenGLShaderProgram> shader;
     std::unique_ptr<Uniforms> uniforms;
+    ShaderSlot shaderSlot, lineShaderSlot;      // Shader files, see addShaders()
     
     const char* vertexShader;
     const char* fragmentShader;
+    
+    // Line renderer, see setRenderer()
+    std::atomic<Renderer> renderer { fragmentRenderer };
+    std::shared_ptr<OpenGLShaderProgram> lineShader;
+    std::unique_ptr<Uniforms> lineUniforms;
+    GLuint lineVBO = 0;
+    GLfloat lineVertices [numLineSegments * verticesPerSegment * floatsPerLineVertex];
+    
+    Phosphor phosphor;                  // Trails, see setPhosphor()
 
     
     // Audio Buffer
-    RingBuffer<GLfloat> * ringBuffer;
-    AudioBuffer<GLfloat> readBuffer;    // Stores data read from ring buffer
+    Atomic<RingBuffer<GLfloat> *> ringBuffer;   // Swapped by setRingBuffer() on the message thread
+    OscilloscopeTrigger trigger;        // Picks where each trace starts in the ring buffer
     GLfloat visualizationBuffer [RING_BUFFER_READ_SIZE];    // Single channel to visualize
     
+    // Audio/visual sync, see setPlaybackLatency()
+    FramePacer pacer;
+    std::atomic<int> playbackLatency { 0 };
+    int64 audibleSample = 0;            // Where this frame's trace ends on the sample clock
+    
+    // Envelope of long time windows, see setTimeWindow()
+    std::atomic<double> sampleRate { 0.0 };
+    std::atomic<double> timeWindowSeconds { 0.0 };
+    WaveformDecimator decimator;
+    WaveformDecimator::Column* envelopeColumns = nullptr;     // maxEnvelopeColumns, in the pipeline's ScratchArena
+    GLuint envelopeTexture = 0;
+    GLsizei envelopeTextureWidth = 0;
+    GLint maxTextureSize = 0;
+    
     
     
     // Overlay GUI
+    String mainShaderError, lineShaderError;    // OpenGL thread only
     String statusText;
     Label statusLabel;
     
-    
-    /** DEV NOTE
-        If I wanted to optionally have an interchangeable shader system,
-        this would be fairly easy to add. Chack JUCE Demo -> OpenGLDemo.cpp for
-        an implementation example of this. For now, we'll just allow these
-        shader files to be static instead of interchangeable and dynamic.
-        String newVertexShader, newFragmentShader;
-     */
-    
     JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (Oscilloscope2D)
 };
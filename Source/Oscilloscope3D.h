@@ -11,6 +11,14 @@
 #include "../JuceLibraryCode/JuceHeader.h"
 #include <GL/glew.h>    
 #include "RingBuffer.h"
+#include "OscilloscopeTrigger.h"
+#include "Phosphor.h"
+#include "FramePacer.h"
+#include "ShaderCache.h"
+#include "ShaderLibrary.h"
+#include "GlewInit.h"
+#include "ScratchArena.h"
+#include "Trace.h"
 #include <fstream>
 
 /** This Oscilloscope uses a Geometry-Shader based implementation. It stores a
@@ -31,7 +39,6 @@ class Oscilloscope3D :  public Component,
 public:
     
     Oscilloscope3D (RingBuffer<GLfloat> * ringBuffer)
-    : readBuffer (2, RING_BUFFER_READ_SIZE)
     {
         // Sets the OpenGL version to 3.2
         openGLContext.setOpenGLVersionRequired (OpenGLContext::OpenGLVersion::openGL3_2);
@@ -49,6 +56,7 @@ public:
         addAndMakeVisible (statusLabel);
         statusLabel.setJustificationType (Justification::topLeft);
         statusLabel.setFont (Font (14.0f));
+        statusLabel.setText ("Starting OpenGL...", dontSendNotification);    // Until the shaders are ready
     }
     
     ~Oscilloscope3D()
@@ -79,6 +87,74 @@ public:
         openGLContext.setContinuousRepainting (false);
     }
     
+    /** Switches to reading from a different RingBuffer. Safe to call while
+        rendering; the new buffer is picked up on the next frame.
+     */
+    void setRingBuffer (RingBuffer<GLfloat> * newRingBuffer)
+    {
+        ringBuffer = newRingBuffer;
+    }
+    
+    /** Sets the sample rate of the RingBuffer, which the trigger needs to
+        search for a stable start. Until then, the trace free-runs.
+     */
+    void setSampleRate (double newSampleRate)
+    {
+        trigger.setSampleRate (newSampleRate);
+        sampleRate = newSampleRate;
+    }
+    
+    void setTriggerSettings (const OscilloscopeTrigger::Settings& settings)
+    {
+        trigger.setSettings (settings);
+    }
+    
+    /** Turns trails on or off. See Phosphor.
+     */
+    void setPhosphor (const Phosphor::Settings& settings)
+    {
+        phosphor.setSettings (settings);
+    }
+    
+    /** Sets how long the newest sample in the RingBuffer takes to be heard.
+        See Oscilloscope2D::setPlaybackLatency().
+     */
+    void setPlaybackLatency (int latencyInSamples)
+    {
+        playbackLatency = latencyInSamples;
+    }
+    
+    void setDisplayLatency (double seconds)
+    {
+        pacer.setDisplayLatency (seconds);
+    }
+
+    /** Tells the frame timing whether the context repaints continuously.
+        See FramePacer::setContinuous().
+     */
+    void setContinuousRepainting (bool isContinuous)
+    {
+        pacer.setContinuous (isContinuous);
+    }
+    
+    /** Lets library replace the shader with one loaded from files.
+     */
+    void addShaders (ShaderLibrary& library)
+    {
+        library.addShader ("Oscilloscope3D", shaderSlot, openGLContext, false);
+    }
+    
+    /** Changes whenever new samples are written to the RingBuffer. See
+        FrameScheduler.
+     */
+    int64 getContentVersion() const
+    {
+        auto* source = ringBuffer.get();
+        return source != nullptr ? source->getTotalSamplesWritten() : 0;
+    }
+    
+    OpenGLContext& getOpenGLContext() noexcept  { return openGLContext; }
+    
     
     //==========================================================================
     // OpenGL Callbacks
@@ -89,8 +165,22 @@ public:
      */
     void newOpenGLContextCreated() override
     {
+        Trace::setThreadName ("OpenGL Oscilloscope3D");
+        TOWEL_TRACE_ZONE ("Oscilloscope3D::newOpenGLContextCreated");
+
+        const auto glew = initialiseGlew();
+        glewLoaded = glew.wasOk();
+
+        if (glew.failed())
+        {
+            statusText = glew.getErrorMessage();
+            triggerAsyncUpdate();
+            return;
+        }
+
         // Setup Shaders
         createShaders();
+        phosphor.create (openGLContext);
         
         // Setup Buffer Objects
         glGenBuffers (1, &VBO); // Vertex Buffer Object
@@ -101,8 +191,12 @@ public:
      */
     void openGLContextClosing() override
     {
-        waveShader.release();
-        uniforms.release();
+        if (! glewLoaded)
+            return;
+        
+        uniforms.reset();
+        waveShader.reset();
+        phosphor.release();
     }
     
     
@@ -110,14 +204,48 @@ public:
      */
     void renderOpenGL() override
     {
+        TOWEL_TRACE_ZONE ("Oscilloscope3D::renderOpenGL");
         jassert (OpenGLHelpers::isContextActive());
         
+        if (! glewLoaded)
+        {
+            OpenGLHelpers::clear (getLookAndFeel().findColour (ResizableWindow::backgroundColourId));
+            return;
+        }
+        
+        updateShaders();
+        
         // Setup Viewport
         const float renderingScale = (float) openGLContext.getRenderingScale();
-        glViewport (0, 0, roundToInt (renderingScale * getWidth()), roundToInt (renderingScale * getHeight()));
+        const int width = roundToInt (renderingScale * getWidth());
+        const int height = roundToInt (renderingScale * getHeight());
+        
+        const double displayTime = pacer.beginFrame();
+        
+        // With trails on, this frame is drawn over the faded previous ones
+        if (! phosphor.beginFrame (width, height))
+        {
+            phosphor.endFrame();
+            pacer.endFrame();
+            return;
+        }
+        
+        // Shaders and trails are set up by now; the rest of the frame never allocates
+        const ScopedNoHeapAllocation noAllocation;
+        
+        glViewport (0, 0, width, height);
         
         // Set background Color
-        OpenGLHelpers::clear (getLookAndFeel().findColour (ResizableWindow::backgroundColourId));
+        if (! phosphor.isActive() || waveShader == nullptr)
+            OpenGLHelpers::clear (getLookAndFeel().findColour (ResizableWindow::backgroundColourId));
+        
+        // The shader did not compile: its error is in the status text
+        if (waveShader == nullptr)
+        {
+            phosphor.endFrame();
+            pacer.endFrame();
+            return;
+        }
         
         // Enable Alpha Blending
         glEnable (GL_BLEND);
@@ -149,15 +277,12 @@ public:
         // Read in audio samples from ring buffer
         if (uniforms->audioSampleData != nullptr)
         {
-            ringBuffer->readSamples (readBuffer, RING_BUFFER_READ_SIZE);
-            
-            FloatVectorOperations::clear (visualizationBuffer, RING_BUFFER_READ_SIZE);
+            // Channels summed, starting where the trigger holds the waveform
+            // still, and ending at what is heard while this frame is on screen
+            auto& source = *ringBuffer.get();
+            const int64 audibleSample = pacer.getAudibleSample (source, sampleRate.load(), playbackLatency.load(), displayTime);
             
-            // Sum channels together
-            for (int i = 0; i < 2; ++i)
-            {
-                FloatVectorOperations::add (visualizationBuffer, readBuffer.getReadPointer(i, 0), RING_BUFFER_READ_SIZE);
-            }
+            trigger.read (source, visualizationBuffer, RING_BUFFER_READ_SIZE, audibleSample);
             
             uniforms->audioSampleData->set (visualizationBuffer, 256);
         }
@@ -192,6 +317,9 @@ public:
         glBindBuffer (GL_ARRAY_BUFFER, 0);
         glBindBuffer (GL_ELEMENT_ARRAY_BUFFER, 0);
         // glBindVertexArray (0);
+        
+        phosphor.endFrame();
+        pacer.endFrame();
     }
     
     
@@ -209,11 +337,13 @@ public:
     void mouseDown (const MouseEvent& e) override
     {
         draggableOrientation.mouseDown (e.getPosition());
+        openGLContext.triggerRepaint();
     }
     
     void mouseDrag (const MouseEvent& e) override
     {
         draggableOrientation.mouseDrag (e.getPosition());
+        openGLContext.triggerRepaint();     // Drawn on demand, see FrameScheduler
     }
     
 private:
@@ -244,6 +374,8 @@ private:
     */
     void createShaders()
     {
+        TOWEL_TRACE_ZONE ("Oscilloscope3D::createShaders");
+
         vertexShader =
         "#version 330 core\n"
         "layout (location = 0) in vec2 position;\n"
@@ -450,15 +582,18 @@ private:
         "}\n";
         
         
-        std::unique_ptr<OpenGLShaderProgram> shaderProgramAttempt = std::make_unique<OpenGLShaderProgram> (openGLContext);
+        // The geometry shader (waveGeometryShader) is not part of the program yet
+        ShaderCache::Program program;
+        program.vertexShader = vertexShader;
+        program.fragmentShader = fragmentShader;
+        shaderSlot.contextCreated (program);
+        
+        String error;
         
-        if (shaderProgramAttempt->addVertexShader ((vertexShader))
-            // && shaderProgramAttempt->addShader (waveGeometryShader, GL_GEOMETRY_SHADER)
-            && shaderProgramAttempt->addFragmentShader ((fragmentShader))
-            && shaderProgramAttempt->link())
+        if (auto shaderProgram = shaderCache->getProgram (openGLContext, program, error))
         {
             uniforms.reset();
-            waveShader = std::move (shaderProgramAttempt);
+            waveShader = std::move (shaderProgram);
             uniforms = std::make_unique<Uniforms> (openGLContext, *waveShader);
             
 //            statusText = "GLSL: v" + String (OpenGLShaderProgram::getLanguageVersion(), 2);
@@ -466,9 +601,30 @@ statusText = "";  // This will make the status text empty
         }
         else
         {
-            statusText = shaderProgramAttempt->getLastError();
+            statusText = error;
+        }
+        
+        triggerAsyncUpdate();
+    }
+    
+    /** Swaps in a program rebuilt from edited shader files. See ShaderLibrary.
+     */
+    void updateShaders()
+    {
+        ShaderCache::Program program;
+        String error;
+        
+        if (! shaderSlot.takeUpdate (program, error))
+            return;
+        
+        if (auto shaderProgram = error.isEmpty() ? shaderCache->getProgram (openGLContext, program, error) : nullptr)
+        {
+            uniforms.reset();
+            waveShader = std::move (shaderProgram);
+            uniforms = std::make_unique<Uniforms> (openGLContext, *waveShader);
         }
         
+        statusText = error;
         triggerAsyncUpdate();
     }
     
@@ -505,10 +661,13 @@ statusText = "";  // This will make the status text empty
     
     // OpenGL Variables
     OpenGLContext openGLContext;
+    bool glewLoaded = false;                    // OpenGL thread only; without GLEW no GL call is made
     GLuint VBO, VAO;/*, EBO;*/
     
-    std::unique_ptr<OpenGLShaderProgram> waveShader;
+    SharedResourcePointer<ShaderCache> shaderCache;
+    std::shared_ptr<OpenGLShaderProgram> waveShader;
     std::unique_ptr<Uniforms> uniforms;
+    ShaderSlot shaderSlot;              // Shader files, see addShaders()
     
     const char* vertexShader;
     const char* fragmentShader;
@@ -519,21 +678,19 @@ statusText = "";  // This will make the status text empty
     Draggable3DOrientation draggableOrientation;
     
     // Audio Buffers
-    RingBuffer<GLfloat> * ringBuffer;
-    AudioBuffer<GLfloat> readBuffer;    // Stores data read from ring buffer
+    Atomic<RingBuffer<GLfloat> *> ringBuffer;   // Swapped by setRingBuffer() on the message thread
+    OscilloscopeTrigger trigger;        // Picks where each trace starts in the ring buffer
+    Phosphor phosphor;                  // Trails, see setPhosphor()
     GLfloat visualizationBuffer [RING_BUFFER_READ_SIZE];    // Single channel to visualize
     
+    // Audio/visual sync, see setPlaybackLatency()
+    FramePacer pacer;
+    std::atomic<double> sampleRate { 0.0 };
+    std::atomic<int> playbackLatency { 0 };
+    
     // Overlay GUI
     String statusText;
     Label statusLabel;
     
-    /** DEV NOTE
-        If I wanted to optionally have an interchangeable shader system,
-        this would be fairly easy to add. Chack JUCE Demo -> OpenGLDemo.cpp for
-        an implementation example of this. For now, we'll just allow these
-        shader files to be static instead of interchangeable and dynamic.
-        String newVertexShader, newFragmentShader;
-     */
-    
     JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (Oscilloscope3D)
 };
@@ -0,0 +1,228 @@
+//
+//  OscilloscopeBenchmark.h
+//  3DAudioVisualizers
+//
+//  Times Oscilloscope2D's fragment and line renderers at 1080p and 4K.
+//
+
+#pragma once
+
+#include "../JuceLibraryCode/JuceHeader.h"
+#include "Oscilloscope2D.h"
+#include "SignalGenerator.h"
+#include "ScratchArena.h"
+#include <chrono>
+#include <iostream>
+
+/** Opens a small window with an Oscilloscope2D fed by a SignalGenerator and,
+    once its OpenGL context is running, draws numFrames frames into
+    1920x1080 and 3840x2160 frame buffers with each renderer. One display
+    frame of audio is written before every frame, so the trigger search is
+    part of the cost, the same for both renderers.
+
+    Every frame ends with glFinish(), so the time per frame is the wall
+    clock from the start of drawing until the GPU is done. It needs no timer
+    query extension, and it includes the CPU work and the driver. Prints the
+    mean and worst frame for each size and renderer, then quits.
+
+    Where heap allocations are counted (TOWEL_COUNT_ALLOCATIONS, on in debug
+    builds), it also prints how many the timed frames made. Any allocation
+    after the warm-up frames fails the run.
+
+        "Towel OpenGL Audio Visualizer" --oscilloscope-benchmark [--frames=300]
+            [--rate=48000] [--generator=sweep]
+ */
+class OscilloscopeBenchmark  : public DocumentWindow,
+                               private Timer
+{
+public:
+    struct Options
+    {
+        int numFrames = 300;
+        double sampleRate = 48000.0;
+        SignalGenerator::Type type = SignalGenerator::sineSweep;
+    };
+
+    OscilloscopeBenchmark (const String& commandLine)
+    :   DocumentWindow ("Oscilloscope Benchmark", Colours::black, 0),
+        options (parseCommandLine (commandLine)),
+        hopSize (jmax (1, roundToInt (options.sampleRate / 60.0))),
+        ringBuffer (2, jmax (hopSize * 10, 2 * OscilloscopeTrigger::getHistorySize (options.sampleRate))),
+        generator (options.type == SignalGenerator::numTypes ? SignalGenerator::sineSweep : options.type),
+        oscilloscope (&ringBuffer, scratchArena)
+    {
+        if (options.type == SignalGenerator::numTypes)
+        {
+            std::cout << "unknown generator, expected --generator=" << SignalGenerator::getTypeNames() << std::endl;
+            finish (1);
+            return;
+        }
+
+        generator.prepare (options.sampleRate, hopSize);
+        block.setSize (2, hopSize);
+        oscilloscope.setSampleRate (options.sampleRate);
+
+        oscilloscope.setSize (640, 360);
+        setContentNonOwned (&oscilloscope, true);
+        centreWithSize (getWidth(), getHeight());
+        setVisible (true);
+
+        // The context is created on the message thread once the window is on screen
+        startTimer (100);
+    }
+
+    ~OscilloscopeBenchmark() override
+    {
+        clearContentComponent();
+    }
+
+    static Options parseCommandLine (const String& commandLine)
+    {
+        Options options;
+        StringArray args;
+        args.addTokens (commandLine, true);
+
+        for (auto& arg : args)
+        {
+            auto value = arg.fromFirstOccurrenceOf ("=", false, false);
+
+            if (arg.startsWith ("--frames="))           options.numFrames = jmax (1, value.getIntValue());
+            else if (arg.startsWith ("--rate="))        options.sampleRate = jmax (1000.0, value.getDoubleValue());
+            else if (arg.startsWith ("--generator="))   options.type = SignalGenerator::findType (value);
+        }
+
+        return options;
+    }
+
+    void closeButtonPressed() override
+    {
+        finish (1);
+    }
+
+private:
+    enum { numWarmUpFrames = 10, contextTimeoutTicks = 100 };
+
+    void timerCallback() override
+    {
+        if (oscilloscope.getOpenGLContext().getRawContext() != nullptr)
+        {
+            stopTimer();
+            oscilloscope.getOpenGLContext().executeOnGLThread ([this] (OpenGLContext& context) { run (context); }, false);
+        }
+        else if (++numTicks > contextTimeoutTicks)
+        {
+            stopTimer();
+            std::cout << "oscilloscope benchmark: no OpenGL context" << std::endl;
+            finish (1);
+        }
+    }
+
+    /** Draws every size with every renderer. Called on the OpenGL thread.
+     */
+    void run (OpenGLContext& context)
+    {
+        struct Size { const char* name; int width, height; };
+        struct Variant { const char* name; Oscilloscope2D::Renderer renderer; };
+
+        const Size sizes[] = { { "1080p", 1920, 1080 }, { "4K   ", 3840, 2160 } };
+        const Variant variants[] = { { "fragment", Oscilloscope2D::fragmentRenderer },
+                                     { "lines   ", Oscilloscope2D::lineRenderer } };
+
+        const auto initialRenderer = oscilloscope.getRenderer();
+        int exitCode = 0;
+
+        std::cout << "oscilloscope: " << options.numFrames << " frames, " << options.sampleRate << " Hz, "
+                  << SignalGenerator::getTypeName (options.type) << std::endl;
+
+        for (auto& size : sizes)
+        {
+            OpenGLFrameBuffer frameBuffer;
+
+            if (! frameBuffer.initialise (context, size.width, size.height))
+            {
+                std::cout << "  " << size.name << ": could not create a frame buffer" << std::endl;
+                exitCode = 1;
+                continue;
+            }
+
+            frameBuffer.makeCurrentRenderingTarget();
+
+            for (auto& variant : variants)
+            {
+                oscilloscope.setRenderer (variant.renderer);
+
+                for (int frame = 0; frame < numWarmUpFrames; ++frame)
+                    drawFrame (size.width, size.height);
+
+                double totalSeconds = 0.0, maxSeconds = 0.0;
+                const int64 allocationsBefore = HeapAllocationCounter::getThreadCount();
+
+                for (int frame = 0; frame < options.numFrames; ++frame)
+                {
+                    const auto startTime = std::chrono::steady_clock::now();
+                    drawFrame (size.width, size.height);
+                    const double seconds = std::chrono::duration<double> (std::chrono::steady_clock::now() - startTime).count();
+
+                    totalSeconds += seconds;
+                    maxSeconds = jmax (maxSeconds, seconds);
+                }
+
+                const int64 allocations = HeapAllocationCounter::getThreadCount() - allocationsBefore;
+
+                std::cout << "  " << size.name << " " << variant.name << ": "
+                          << String (1000.0 * totalSeconds / options.numFrames, 3) << " ms per frame (max "
+                          << String (1000.0 * maxSeconds, 3) << ")";
+
+               #if TOWEL_COUNT_ALLOCATIONS
+                std::cout << ", " << allocations << " heap allocations";
+
+                if (allocations > 0)
+                    exitCode = 1;
+               #else
+                ignoreUnused (allocations);
+               #endif
+
+                std::cout << std::endl;
+            }
+
+            frameBuffer.releaseAsRenderingTarget();
+        }
+
+        oscilloscope.setRenderer (initialRenderer);
+        finish (exitCode);
+    }
+
+    void drawFrame (int width, int height)
+    {
+        generator.render (block.getWritePointer (0), hopSize);
+        block.copyFrom (1, 0, block, 0, 0, hopSize);
+        ringBuffer.writeSamples (block, 0, hopSize);
+
+        oscilloscope.renderFrame (width, height);
+        glFinish();
+    }
+
+    /** Quits the application with exitCode, from any thread.
+     */
+    static void finish (int exitCode)
+    {
+        MessageManager::callAsync ([exitCode]
+        {
+            if (auto* app = JUCEApplicationBase::getInstance())
+                app->setApplicationReturnValue (exitCode);
+
+            JUCEApplicationBase::quit();
+        });
+    }
+
+    Options options;
+    const int hopSize;
+    RingBuffer<GLfloat> ringBuffer;
+    AudioBuffer<float> block;
+    SignalGenerator generator;
+    ScratchArena scratchArena;
+    Oscilloscope2D oscilloscope;
+    int numTicks = 0;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (OscilloscopeBenchmark)
+};
@@ -0,0 +1,533 @@
+//
+//  OscilloscopeTrigger.h
+//  3DAudioVisualizers
+//
+//  Picks where each oscilloscope trace starts, so periodic waveforms stand
+//  still instead of drifting across the screen.
+//
+
+#pragma once
+
+#if ! TOWEL_HEADLESS
+ #include "../JuceLibraryCode/JuceHeader.h"
+#endif
+#include "RingBuffer.h"
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <limits>
+#include <memory>
+
+/** The trigger of an oscilloscope: finds a stable start for each trace in the
+    recent history of a RingBuffer.
+
+    Every read() copies the newest searchMilliseconds of audio plus one trace
+    (channels summed) and picks the latest start that still leaves a whole
+    trace:
+
+    - Edge: the signal crosses the level upwards (risingEdge) or downwards
+      (fallingEdge) after having been at least the hysteresis away on the
+      other side, so noise around the level does not retrigger. Crossings are
+      interpolated to a fraction of a sample and the trace is resampled to
+      start exactly there, so high frequencies don't jitter by a sample.
+    - Holdoff: crossings within holdoffSeconds of the previous trigger are
+      ignored. The chain of triggers continues from the previous frame's, so
+      a waveform with several crossings per period keeps using the same one.
+    - Pitch lock: the period is measured by autocorrelation (the normalised
+      square difference function, computed with an FFT) and the trace starts
+      a whole number of periods after the previous frame's, snapped to the
+      nearest crossing. This holds the phase of complex waveforms, and of
+      waveforms that never reach the level, from frame to frame.
+
+    Without a trigger in the window (silence, noise, or mode freeRun) the
+    trace shows the newest samples.
+
+    The crossing search steps over scanBlockSize samples at a time with
+    FloatVectorOperations::findMinAndMax(), which is vectorised, and only
+    looks at single samples in blocks where the trigger changes state, so
+    searching 100 ms costs microseconds on the render thread.
+
+    Every buffer is allocated by the constructor, for rates up to
+    maxSampleRate, so read() never allocates. Above that, the search is
+    shortened to fit.
+
+    read() must only be called from one thread at a time. setSettings() and
+    setSampleRate() can be called from any thread.
+ */
+class OscilloscopeTrigger
+{
+public:
+    enum Mode
+    {
+        freeRun = 0,
+        risingEdge,
+        fallingEdge
+    };
+
+    struct Settings
+    {
+        Mode mode = risingEdge;
+        float level = 0.0f;             // Of the summed channels
+        float hysteresis = 0.1f;        // Fraction of the window's peak level
+        double holdoffSeconds = 0.0;
+        bool pitchLock = true;
+    };
+
+    enum
+    {
+        searchMilliseconds = 100,       // History searched for a trigger
+        correlationMilliseconds = 40,   // Longest window the period is measured on
+        maxTraceSize = 1024,
+        scanBlockSize = 32,
+        maxReadDelayMilliseconds = 250, // Furthest a read may end behind the newest sample
+        maxSampleRate = 192000,         // Highest rate searched in full
+        maxChannels = 2
+    };
+
+    OscilloscopeTrigger()
+    :   window (maxChannels, getMaxWindowSize()),
+        monoBuffer (1, getMaxWindowSize())
+    {
+        edges.allocate ((size_t) getMaxWindowSize() / 2 + 1, false);
+
+        // One FFT per correlation size, so a new sample rate only picks another
+        for (int order = minCorrelationOrder; order <= maxCorrelationOrder; ++order)
+            correlationFFTs[order - minCorrelationOrder] = std::make_unique<dsp::FFT> (order + 1);
+
+        correlationData.allocate ((size_t) (1 << maxCorrelationOrder) * 4, false);
+        nsdf.allocate ((size_t) (1 << maxCorrelationOrder) / 2 + 1, false);
+    }
+
+    /** The number of samples a RingBuffer at sampleRate must be able to
+        return in one read for a full search.
+     */
+    static int getHistorySize (double sampleRate)
+    {
+        return roundToInt (sampleRate * searchMilliseconds / 1000.0) + maxTraceSize + 1;
+    }
+
+    /** The number of samples a RingBuffer at sampleRate must hold on top of
+        twice getHistorySize() for reads that end maxReadDelayMilliseconds
+        behind the newest sample.
+     */
+    static int getMaxReadDelay (double sampleRate)
+    {
+        return roundToInt (sampleRate * maxReadDelayMilliseconds / 1000.0);
+    }
+
+    /** Returns the mode called name ("free", "rising" or "falling"), or
+        risingEdge if there is none.
+     */
+    static Mode findMode (const String& name)
+    {
+        if (name == "free")     return freeRun;
+        if (name == "falling")  return fallingEdge;
+
+        return risingEdge;
+    }
+
+    /** Can be called from any thread; takes effect with the next read().
+     */
+    void setSettings (const Settings& newSettings)
+    {
+        const SpinLock::ScopedLockType sl (settingsLock);
+        pendingSettings = newSettings;
+        settingsChanged = true;
+    }
+
+    /** Sets the sample rate of the RingBuffer being read. Until this is
+        called, traces free-run. Can be called from any thread.
+     */
+    void setSampleRate (double newSampleRate)
+    {
+        sampleRate = newSampleRate;
+    }
+
+    /** Fills dest with numSamples of the summed channels of ringBuffer,
+        starting at the trigger.
+
+        @param readEnd  sample clock position the search ends at, e.g. the
+                        sample being heard (see FramePacer). By default the
+                        newest sample. Clamped to what the ring still holds.
+        @returns        true if the trace starts at a trigger, false if it
+                        shows the latest samples because nothing triggered
+     */
+    bool read (RingBuffer<float>& ringBuffer, float* dest, int numSamples,
+               int64 readEnd = std::numeric_limits<int64>::max())
+    {
+        jassert (numSamples > 0 && numSamples <= maxTraceSize);
+        jassert (ringBuffer.getNumChannels() <= maxChannels);
+
+        updateSettings();
+
+        const double rate = sampleRate.load();
+        const bool searching = settings.mode != freeRun && rate > 0.0;
+        const int searchSize = searching ? roundToInt (rate * searchMilliseconds / 1000.0) : 0;
+
+        // Reads plus writes must stay below the ring size (see RingBuffer.h),
+        // and AudioStream sizes its rings to twice getHistorySize()
+        const int windowSize = jmin (numSamples + 1 + searchSize, ringBuffer.getBufferSize() / 2, getMaxWindowSize());
+        jassert (windowSize > numSamples);
+
+        prepare (ringBuffer.getNumChannels(), windowSize, rate);
+
+        // Leave room for one window of writes while reading behind the newest sample
+        const int64 newest = ringBuffer.getTotalSamplesWritten();
+        readEnd = jmax (readEnd, newest - (ringBuffer.getBufferSize() - 2 * windowSize));
+
+        ringBuffer.readSamplesEndingAt (window, windowSize, readEnd, &readEnd);
+
+        // Sum channels together
+        float* mono = monoBuffer.getWritePointer (0);
+        FloatVectorOperations::copy (mono, window.getReadPointer (0), windowSize);
+
+        for (int ch = 1; ch < window.getNumChannels(); ++ch)
+            FloatVectorOperations::add (mono, window.getReadPointer (ch), windowSize);
+
+        // A different ring, or a resize that went back in time, breaks the chain
+        if (&ringBuffer != lastRingBuffer || readEnd < lastReadEnd)
+            hasLastTrigger = false;
+
+        lastRingBuffer = &ringBuffer;
+        lastReadEnd = readEnd;
+
+        const double windowStart = (double) (readEnd - windowSize);
+        const int latestStart = windowSize - 1 - numSamples;    // One extra sample to interpolate
+        double start = latestStart;
+
+        const bool triggered = searching && findTrigger (windowSize, latestStart, windowStart, rate, start);
+
+        hasLastTrigger = triggered;
+        lastTrigger = windowStart + start;
+
+        // Resample so the trace starts exactly at a fractional trigger
+        const int first = (int) start;
+        const float fraction = (float) (start - first);
+
+        if (fraction > 0.0f)
+        {
+            FloatVectorOperations::copyWithMultiply (dest, mono + first, 1.0f - fraction, numSamples);
+            FloatVectorOperations::addWithMultiply (dest, mono + first + 1, fraction, numSamples);
+        }
+        else
+        {
+            FloatVectorOperations::copy (dest, mono + first, numSamples);
+        }
+
+        return triggered;
+    }
+
+    /** The period pitch lock measured in the last read(), in samples, or 0
+        if it found none.
+     */
+    double getPeriodInSamples() const noexcept      { return period; }
+
+private:
+    /** The largest window read() uses, rounded up as AudioBuffer::setSize()
+        rounds, so that resizing within it never reallocates.
+     */
+    static int getMaxWindowSize()
+    {
+        return (getHistorySize (maxSampleRate) + 3) & ~3;
+    }
+
+    void updateSettings()
+    {
+        if (settingsChanged.exchange (false))
+        {
+            const SpinLock::ScopedLockType sl (settingsLock);
+            settings = pendingSettings;
+            hasLastTrigger = false;
+        }
+    }
+
+    /** Uses the buffers for a window of windowSize samples and picks the
+        autocorrelation size for sampleRate. Never allocates: the buffers
+        were sized by the constructor and only shrink here.
+     */
+    void prepare (int numChannels, int windowSize, double rate)
+    {
+        window.setSize (numChannels, windowSize, false, false, true);
+        monoBuffer.setSize (1, windowSize, false, false, true);
+
+        if (rate != correlationRate)
+        {
+            correlationRate = rate;
+            correlationSize = 0;
+            correlationFFT = nullptr;
+
+            if (rate > 0.0)
+            {
+                const int order = jlimit ((int) minCorrelationOrder, (int) maxCorrelationOrder,
+                                          (int) std::ceil (std::log2 (rate * correlationMilliseconds / 1000.0)));
+                correlationSize = 1 << order;
+                correlationFFT = correlationFFTs[order - minCorrelationOrder].get();
+            }
+        }
+    }
+
+    /** Picks the start of the trace in the window. Returns false if nothing
+        triggers.
+     */
+    bool findTrigger (int windowSize, int latestStart, double windowStart, double rate, double& start)
+    {
+        const float* mono = monoBuffer.getReadPointer (0);
+        const auto range = FloatVectorOperations::findMinAndMax (mono, windowSize);
+        const float peak = jmax (std::abs (range.getStart()), std::abs (range.getEnd()));
+
+        period = 0.0;
+
+        if (peak < silenceLevel)
+            return false;
+
+        const float sign = settings.mode == fallingEdge ? -1.0f : 1.0f;
+        const float hysteresis = jmax (silenceLevel, settings.hysteresis * peak);
+        const int numEdges = findEdges (mono, windowSize, sign * settings.level, hysteresis, sign);
+
+        if (settings.pitchLock)
+            period = findPeriod (mono, windowSize);
+
+        const double anchor = lastTrigger - windowStart;
+        const bool anchorInWindow = hasLastTrigger && anchor >= 0.0 && anchor <= latestStart;
+
+        // Pitch lock: whole periods on from the previous trace
+        if (period > 0.0 && anchorInWindow)
+        {
+            const double predicted = anchor + std::floor ((latestStart - anchor) / period) * period;
+            const double nearest = findNearestEdge (numEdges, predicted, latestStart);
+
+            start = std::abs (nearest - predicted) < 0.25 * period ? nearest : predicted;
+            return true;
+        }
+
+        // Edge with holdoff, chained from the previous trigger
+        const double holdoff = settings.holdoffSeconds * rate;
+        bool found = anchorInWindow;
+        double current = anchorInWindow ? anchor : 0.0;
+
+        for (int i = 0; i < numEdges && edges[i] <= latestStart; ++i)
+        {
+            if (! found || (edges[i] > current && edges[i] >= current + holdoff))
+            {
+                current = edges[i];
+                found = true;
+            }
+        }
+
+        if (found)
+        {
+            start = current;
+            return true;
+        }
+
+        // Locked to a period but nothing crosses the level: start the chain here
+        if (period > 0.0)
+        {
+            start = latestStart;
+            return true;
+        }
+
+        return false;
+    }
+
+    /** Runs a Schmitt trigger over x and stores the fractional position of
+        every trigger in edges. For falling edges, sign is -1 and the level is
+        negated, so both directions look like rising edges of sign * x.
+        Returns the number of edges.
+     */
+    int findEdges (const float* x, int numSamples, float fireLevel, float hysteresis, float sign)
+    {
+        const float armLevel = fireLevel - hysteresis;
+        bool armed = false;
+        int numEdges = 0;
+
+        for (int blockStart = 0; blockStart < numSamples; blockStart += scanBlockSize)
+        {
+            const int blockEnd = jmin (numSamples, blockStart + (int) scanBlockSize);
+            const auto range = FloatVectorOperations::findMinAndMax (x + blockStart, blockEnd - blockStart);
+            const float low = sign > 0.0f ? range.getStart() : -range.getEnd();
+            const float high = sign > 0.0f ? range.getEnd() : -range.getStart();
+
+            // Nothing changes state in this block
+            if (armed ? high < fireLevel : low >= armLevel)
+                continue;
+
+            for (int i = blockStart; i < blockEnd; ++i)
+            {
+                const float value = sign * x[i];
+
+                if (! armed)
+                {
+                    armed = value < armLevel;
+                }
+                else if (value >= fireLevel)
+                {
+                    // Arming needs an earlier sample below fireLevel, so i > 0
+                    const float previous = sign * x[i - 1];
+                    edges[numEdges++] = i - 1 + (double) ((fireLevel - previous) / (value - previous));
+                    armed = false;
+                }
+            }
+        }
+
+        return numEdges;
+    }
+
+    /** Returns the edge no later than latestStart closest to position, or a
+        value far away from it if there is none.
+     */
+    double findNearestEdge (int numEdges, double position, int latestStart) const
+    {
+        const double* end = edges + numEdges;
+        const double* after = std::upper_bound ((const double*) edges, end, position);
+        double nearest = -1.0e9;
+
+        if (after != edges.get())
+            nearest = *(after - 1);
+
+        if (after != end && *after <= latestStart && *after - position < position - nearest)
+            nearest = *after;
+
+        return nearest;
+    }
+
+    /** Measures the period of the newest correlationSize samples of x with
+        the normalised square difference function (McLeod and Wyvill, "A
+        Smarter Way to Find Pitch"). Returns 0 if the signal is not periodic
+        enough.
+     */
+    double findPeriod (const float* x, int numSamples)
+    {
+        const int size = correlationSize;
+
+        if (size == 0 || size > numSamples)
+            return 0.0;
+
+        x += numSamples - size;
+
+        // Autocorrelation: inverse FFT of the power spectrum, zero padded to
+        // twice the length so it does not wrap around
+        float* data = correlationData;
+        FloatVectorOperations::copy (data, x, size);
+        FloatVectorOperations::clear (data + size, size * 3);
+
+        correlationFFT->performRealOnlyForwardTransform (data, true);
+
+        for (int bin = 0; bin <= size; ++bin)
+        {
+            data[2 * bin] = data[2 * bin] * data[2 * bin] + data[2 * bin + 1] * data[2 * bin + 1];
+            data[2 * bin + 1] = 0.0f;
+        }
+
+        correlationFFT->performRealOnlyInverseTransform (data);
+
+        double energy = 0.0;
+
+        for (int i = 0; i < size; ++i)
+            energy += x[i] * x[i];
+
+        if (data[0] <= 0.0f || energy <= 0.0)
+            return 0.0;
+
+        // The FFT's scaling differs between implementations, r(0) is known
+        const double scale = energy / data[0];
+        const int maxLag = size / 2;
+        double m = 2.0 * energy;
+
+        nsdf[0] = 1.0f;
+
+        for (int lag = 1; lag <= maxLag; ++lag)
+        {
+            m -= (double) x[lag - 1] * x[lag - 1] + (double) x[size - lag] * x[size - lag];
+            nsdf[lag] = m > 0.0 ? (float) (2.0 * scale * data[lag] / m) : 0.0f;
+        }
+
+        // Key maxima: the highest point of each positive lobe after the first
+        // negative crossing. The period is the first one close to the highest.
+        int keyLags[maxKeyMaxima];
+        int numKeys = 0;
+        float highest = 0.0f;
+        int lag = 1;
+
+        while (lag < maxLag && nsdf[lag] > 0.0f)
+            ++lag;
+
+        while (lag < maxLag && numKeys < maxKeyMaxima)
+        {
+            while (lag < maxLag && nsdf[lag] <= 0.0f)
+                ++lag;
+
+            int best = -1;
+
+            while (lag < maxLag && nsdf[lag] > 0.0f)
+            {
+                if (best < 0 || nsdf[lag] > nsdf[best])
+                    best = lag;
+
+                ++lag;
+            }
+
+            // A lobe cut off by maxLag may still be rising
+            if (best > 0 && lag < maxLag)
+            {
+                keyLags[numKeys++] = best;
+                highest = jmax (highest, nsdf[best]);
+            }
+        }
+
+        if (highest < minClarity)
+            return 0.0;
+
+        for (int k = 0; k < numKeys; ++k)
+        {
+            const int key = keyLags[k];
+
+            if (nsdf[key] >= keyThreshold * highest)
+            {
+                // Parabolic interpolation around the maximum
+                const float left = nsdf[key - 1], centre = nsdf[key], right = nsdf[key + 1];
+                const float curvature = left - 2.0f * centre + right;
+                const double offset = curvature < 0.0f ? 0.5 * (left - right) / curvature : 0.0;
+
+                return key + jlimit (-0.5, 0.5, offset);
+            }
+        }
+
+        return 0.0;
+    }
+
+    static constexpr float silenceLevel = 1.0e-4f;
+    static constexpr float minClarity = 0.6f;       // NSDF peak below this is not periodic
+    static constexpr float keyThreshold = 0.9f;     // Relative to the highest key maximum
+
+    enum
+    {
+        minCorrelationOrder = 9,
+        maxCorrelationOrder = 13,
+        maxKeyMaxima = 64
+    };
+
+    SpinLock settingsLock;
+    Settings pendingSettings;
+    std::atomic<bool> settingsChanged { false };
+    std::atomic<double> sampleRate { 0.0 };
+
+    // Reader state
+    Settings settings;
+    AudioBuffer<float> window, monoBuffer;
+    HeapBlock<double> edges;        // Half the largest window plus one
+
+    double correlationRate = 0.0;
+    int correlationSize = 0;
+    std::unique_ptr<dsp::FFT> correlationFFTs[maxCorrelationOrder - minCorrelationOrder + 1];
+    dsp::FFT* correlationFFT = nullptr;     // One of correlationFFTs
+    HeapBlock<float> correlationData, nsdf;
+    double period = 0.0;
+
+    RingBuffer<float>* lastRingBuffer = nullptr;
+    int64 lastReadEnd = 0;
+    double lastTrigger = 0.0;       // Sample clock of the previous trace's start
+    bool hasLastTrigger = false;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (OscilloscopeTrigger)
+};
@@ -0,0 +1,292 @@
+//
+//  Phosphor.h
+//  3DAudioVisualizers
+//
+//  Optional persistence for the visualizers: trails that fade out instead of
+//  a fresh picture every frame.
+//
+
+#pragma once
+
+#include "../JuceLibraryCode/JuceHeader.h"
+#include <GL/glew.h>
+#include "ShaderCache.h"
+#include <cmath>
+
+/** Keeps a visualizer's picture in one of two frame buffers and fades it
+    into the other each frame, like the phosphor of an analogue screen.
+
+    With persistence on, beginFrame() binds the buffer for this frame. It
+    draws the previous frame into it with a single full-screen pass, scaled
+    by exp (-elapsed / decaySeconds). The visualizer then draws over it
+    without clearing, and endFrame() copies the result to the frame buffer
+    that was bound before. The two buffers swap roles every frame. History
+    is never redrawn, so trails cost one extra pass at any length.
+
+    The buffers are 16 bit float. In 8 bits, a dim pixel faded by a factor
+    close to 1 rounds back to its own value and the trail never disappears.
+
+    drawInterval lets a visualizer read and draw new data only every N
+    frames. The frames in between just fade, so the picture stays smooth at
+    a lower analysis cost.
+
+    setSettings() may be called from any thread. Everything else must be
+    called on the OpenGL thread.
+ */
+class Phosphor
+{
+public:
+    struct Settings
+    {
+        double decaySeconds = 0.0;  // Time for a trail to fade to 1/e; 0 turns persistence off
+        int drawInterval = 1;       // Draw new content every drawInterval frames
+    };
+
+    Phosphor() = default;
+
+    void setSettings (const Settings& newSettings)
+    {
+        const SpinLock::ScopedLockType sl (settingsLock);
+        settings = newSettings;
+    }
+
+    /** Gets the fade shader from the ShaderCache. Call from
+        newOpenGLContextCreated().
+     */
+    void create (OpenGLContext& openGLContext)
+    {
+        const char* vertexShader =
+        "attribute vec2 position;\n"
+        "varying vec2 textureCoordinate;\n"
+        "\n"
+        "void main()\n"
+        "{\n"
+        "    textureCoordinate = 0.5 * position + 0.5;\n"
+        "    gl_Position = vec4 (position, 0.0, 1.0);\n"
+        "}\n";
+
+        const char* fragmentShader =
+        "uniform sampler2D image;\n"
+        "uniform float gain;\n"
+        "varying vec2 textureCoordinate;\n"
+        "\n"
+        "void main()\n"
+        "{\n"
+        "    gl_FragColor = vec4 (gain * texture2D (image, textureCoordinate).rgb, 1.0);\n"
+        "}\n";
+
+        ShaderCache::Program program;
+        program.vertexShader = OpenGLHelpers::translateVertexShaderToV3 (vertexShader);
+        program.fragmentShader = OpenGLHelpers::translateFragmentShaderToV3 (fragmentShader);
+        program.attributes = { "position" };
+
+        String error;
+
+        if (auto shaderProgram = shaderCache->getProgram (openGLContext, program, error))
+        {
+            shader = std::move (shaderProgram);
+            image = std::make_unique<OpenGLShaderProgram::Uniform> (*shader, "image");
+            gain = std::make_unique<OpenGLShaderProgram::Uniform> (*shader, "gain");
+        }
+
+        // Full-screen quad, drawn as a triangle strip
+        const GLfloat corners[] = { -1.0f, -1.0f,   1.0f, -1.0f,   -1.0f, 1.0f,   1.0f, 1.0f };
+
+        glGenBuffers (1, &quadVBO);
+        glBindBuffer (GL_ARRAY_BUFFER, quadVBO);
+        glBufferData (GL_ARRAY_BUFFER, sizeof (corners), corners, GL_STATIC_DRAW);
+        glBindBuffer (GL_ARRAY_BUFFER, 0);
+    }
+
+    /** Frees the GL objects. Call from openGLContextClosing().
+     */
+    void release()
+    {
+        deleteTargets();
+
+        glDeleteBuffers (1, &quadVBO);
+        quadVBO = 0;
+
+        image.reset();
+        gain.reset();
+        shader.reset();
+        active = false;
+    }
+
+    //==========================================================================
+    /** Call before drawing a frame of width by height pixels.
+
+        With persistence off, this does nothing and returns true: clear and
+        draw as usual. With it on, it binds this frame's buffer with the faded
+        previous frame in it and returns whether to draw new content this
+        frame. Either way, call endFrame() afterwards.
+     */
+    bool beginFrame (int width, int height)
+    {
+        Settings current;
+        {
+            const SpinLock::ScopedLockType sl (settingsLock);
+            current = settings;
+        }
+
+        const double now = Time::getMillisecondCounterHiRes() / 1000.0;
+        const double elapsed = jlimit (0.0, 0.25, now - lastFrameTime);
+        lastFrameTime = now;
+
+        const bool wasActive = active;
+        active = current.decaySeconds > 0.0 && shader != nullptr && width > 0 && height > 0;
+
+        if (! active)
+            return true;
+
+        glGetIntegerv (GL_FRAMEBUFFER_BINDING, &previousFrameBuffer);
+
+        if (! ensureTargets (width, height))
+        {
+            active = false;
+            return true;
+        }
+
+        // Old trails would reappear when persistence is turned back on
+        if (! wasActive)
+        {
+            clearTargets();
+            frameCount = 0;
+        }
+
+        glBindFramebuffer (GL_FRAMEBUFFER, frameBuffers[target]);
+        glViewport (0, 0, width, height);
+        drawQuad (textures[1 - target], (GLfloat) std::exp (-elapsed / current.decaySeconds));
+
+        return frameCount++ % jmax (1, current.drawInterval) == 0;
+    }
+
+    /** Call after drawing a frame. With persistence on, copies it to the
+        frame buffer that was bound before beginFrame().
+     */
+    void endFrame()
+    {
+        if (! active)
+            return;
+
+        glBindFramebuffer (GL_FRAMEBUFFER, (GLuint) previousFrameBuffer);
+        glViewport (0, 0, targetWidth, targetHeight);
+        drawQuad (textures[target], 1.0f);
+
+        target = 1 - target;
+    }
+
+    /** True between beginFrame() and the next one if persistence is on. A
+        visualizer must not clear the frame buffer then.
+     */
+    bool isActive() const noexcept     { return active; }
+
+private:
+    //==========================================================================
+    bool ensureTargets (int width, int height)
+    {
+        if (frameBuffers[0] != 0 && width == targetWidth && height == targetHeight)
+            return true;
+
+        deleteTargets();
+
+        glGenTextures (2, textures);
+        glGenFramebuffers (2, frameBuffers);
+        bool complete = true;
+
+        for (int i = 0; i < 2; ++i)
+        {
+            glBindTexture (GL_TEXTURE_2D, textures[i]);
+            glTexImage2D (GL_TEXTURE_2D, 0, GL_RGBA16F, width, height, 0, GL_RGBA, GL_FLOAT, nullptr);
+            glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+            glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+            glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+            glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+            glBindFramebuffer (GL_FRAMEBUFFER, frameBuffers[i]);
+            glFramebufferTexture2D (GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, textures[i], 0);
+            complete = complete && glCheckFramebufferStatus (GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+        }
+
+        glBindTexture (GL_TEXTURE_2D, 0);
+        glBindFramebuffer (GL_FRAMEBUFFER, (GLuint) previousFrameBuffer);
+
+        if (! complete)
+        {
+            deleteTargets();
+            return false;
+        }
+
+        targetWidth = width;
+        targetHeight = height;
+        clearTargets();
+        return true;
+    }
+
+    void clearTargets()
+    {
+        glClearColor (0.0f, 0.0f, 0.0f, 1.0f);
+
+        for (auto frameBuffer : frameBuffers)
+        {
+            glBindFramebuffer (GL_FRAMEBUFFER, frameBuffer);
+            glClear (GL_COLOR_BUFFER_BIT);
+        }
+
+        glBindFramebuffer (GL_FRAMEBUFFER, (GLuint) previousFrameBuffer);
+    }
+
+    void deleteTargets()
+    {
+        if (frameBuffers[0] != 0)
+        {
+            glDeleteFramebuffers (2, frameBuffers);
+            glDeleteTextures (2, textures);
+        }
+
+        frameBuffers[0] = frameBuffers[1] = 0;
+        textures[0] = textures[1] = 0;
+        targetWidth = targetHeight = 0;
+    }
+
+    /** Draws texture over the whole viewport, multiplied by gainValue.
+     */
+    void drawQuad (GLuint texture, GLfloat gainValue)
+    {
+        glDisable (GL_BLEND);
+        shader->use();
+
+        glActiveTexture (GL_TEXTURE0);
+        glBindTexture (GL_TEXTURE_2D, texture);
+        image->set ((GLint) 0);
+        gain->set (gainValue);
+
+        glBindBuffer (GL_ARRAY_BUFFER, quadVBO);
+        glVertexAttribPointer (0, 2, GL_FLOAT, GL_FALSE, 2 * sizeof (GLfloat), (GLvoid*) 0);
+        glEnableVertexAttribArray (0);
+        glDrawArrays (GL_TRIANGLE_STRIP, 0, 4);
+
+        glBindBuffer (GL_ARRAY_BUFFER, 0);
+        glBindTexture (GL_TEXTURE_2D, 0);
+    }
+
+    SpinLock settingsLock;
+    Settings settings;
+
+    SharedResourcePointer<ShaderCache> shaderCache;
+    std::shared_ptr<OpenGLShaderProgram> shader;
+    std::unique_ptr<OpenGLShaderProgram::Uniform> image, gain;
+    GLuint quadVBO = 0;
+
+    GLuint textures[2] = { 0, 0 };
+    GLuint frameBuffers[2] = { 0, 0 };
+    GLsizei targetWidth = 0, targetHeight = 0;
+    int target = 0;                     // The buffer drawn into this frame
+    GLint previousFrameBuffer = 0;
+
+    bool active = false;
+    int64 frameCount = 0;
+    double lastFrameTime = 0.0;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (Phosphor)
+};
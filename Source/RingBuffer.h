@@ -7,9 +7,12 @@
 
 #pragma once
 
-#include "../JuceLibraryCode/JuceHeader.h"
-#include <GL/glew.h>    
+#if ! TOWEL_HEADLESS
+ #include "../JuceLibraryCode/JuceHeader.h"
+#endif
 #include <memory>
+#include <atomic>
+#include <limits>
 
 /** A circular, lock-free buffer for multiple channels of audio.
  
@@ -20,7 +23,8 @@
  
     Also, ensure that the number of samples read from the RingBuffer at any time
     plus the number of samples written to the RingBuffer at any time never exceed
-    the buffer size. This prevents read/write overlap.
+    the buffer size. This prevents read/write overlap. readSamplesChecked()
+    reports when that rule was broken for a particular read.
 */
 template <class Type>
 class RingBuffer
@@ -38,7 +42,54 @@ public:
         this->numChannels = numChannels;
         
         audioBuffer = std::make_unique<AudioBuffer<Type>> (numChannels, bufferSize);
+        audioBuffer->clear();
         writePosition = 0;
+        totalSamplesWritten = 0;
+        writeClaimPosition = 0;
+        lastWriteTicks = Time::getHighResolutionTicks();
+        lastReadAgeTicks = 0;
+        activeReaders = 0;
+        resizing = false;
+    }
+    
+    /** Changes the number of samples the RingBuffer holds and clears it.
+     
+        Memory is only reallocated when newBufferSize is larger than any size
+        used before, so switching back and forth between audio devices reuses
+        the same allocation. Readers that arrive during the resize get silence
+        instead of blocking. The writer must not be running (e.g. call this
+        from prepareToPlay()).
+     
+        The sample clock (see getTotalSamplesWritten()) keeps counting across
+        resizes.
+     */
+    void setSize (int newBufferSize)
+    {
+        jassert (newBufferSize > 1);
+        
+        resizing = true;
+        
+        // Wait for readers that were already copying to finish
+        while (activeReaders.get() > 0)
+            Thread::yield();
+        
+        audioBuffer->setSize (numChannels, newBufferSize, false, true, true);
+        audioBuffer->clear();
+        bufferSize = newBufferSize;
+        
+        const int64 curTotalWritten = totalSamplesWritten.get();
+        writePosition = (int) (curTotalWritten % bufferSize);
+        writeClaimPosition = curTotalWritten;
+        
+        resizing = false;
+    }
+    
+    /** Fills the RingBuffer with silence. Like setSize(), only call this while
+        the writer is not running.
+     */
+    void clear()
+    {
+        setSize (bufferSize);
     }
     
     
@@ -54,83 +105,229 @@ public:
      */
     void writeSamples (AudioBuffer<Type> & newAudioData, int startSample, int numSamples)
     {
+        jassert (newAudioData.getNumChannels() >= numChannels);
+        
+        writeChannels ([&] (int channel) { return newAudioData.getReadPointer (channel, startSample); },
+                       numSamples);
+    }
+    
+    /** Writes samples to all channels in the RingBuffer from separate channel
+        pointers. Use this to write a subset of a larger buffer's channels (e.g.
+        one group of device inputs) without copying them somewhere first.
+     
+        @param channelData      one pointer per RingBuffer channel, each to at
+                                least numSamples samples
+        @param numSamples       the number of samples to write
+     */
+    void writeSamples (const Type* const* channelData, int numSamples)
+    {
+        writeChannels ([channelData] (int channel) { return channelData[channel]; },
+                       numSamples);
+    }
+    
+    /** Reads readSize number of samples in front of the write position from all
+        channels in the RingBuffer into the bufferToFill.
+     
+         @param bufferToFill    buffer to be filled with most recent audio
+                                samples from the RingBuffer
+         @param readSize        number of samples to read from the RingBuffer.
+                                Note, this must be less than the buffer size
+                                of the RingBuffer specified in the constructor.
+    */
+    void readSamples (AudioBuffer<Type> & bufferToFill, int readSize)
+    {
+        /*
+            Further, as stated in the class comment, it is also bad to have a
+            read zone that overlaps with the writing zone, but this wont't cause
+            too much of a visual problem unless it happens often.
+            To combat this, the user should avoid having any read size and any
+            write size that when added together, exceed the bufferSize of the
+            RingBuffer. Use readSamplesChecked() to detect when it happens.
+         */
+        if (beginRead (bufferToFill))
+        {
+            copyMostRecentSamples (bufferToFill, readSize, totalSamplesWritten.get());
+            endRead();
+        }
+    }
+    
+    /** Same as readSamples(), but also reports whether the writer overwrote
+        any part of the region while it was being copied.
+     
+        @param bufferToFill    buffer to be filled with most recent audio
+                               samples from the RingBuffer
+        @param readSize        number of samples to read from the RingBuffer
+        @param readEndSample   if not nullptr, receives the sample clock (see
+                               getTotalSamplesWritten()) one past the newest
+                               sample that was read
+        @returns               true if the samples in bufferToFill are intact,
+                               false if a concurrent write overlapped the read
+     */
+    bool readSamplesChecked (AudioBuffer<Type> & bufferToFill, int readSize,
+                             int64* readEndSample = nullptr)
+    {
+        return readSamplesEndingAt (bufferToFill, readSize, std::numeric_limits<int64>::max(), readEndSample);
+    }
+    
+    /** Same as readSamplesChecked(), but reads the samples that end at a
+        given sample clock position instead of the newest ones, e.g. to show
+        what is being heard rather than what was just written.
+     
+        readSize plus how far the read ends behind the newest sample, plus any
+        write, must stay below the buffer size. Older samples are overwritten
+        and the read reports false.
+     
+        @param endSample       sample clock position one past the last sample
+                               to read; clamped to the newest sample
+     */
+    bool readSamplesEndingAt (AudioBuffer<Type> & bufferToFill, int readSize, int64 endSample,
+                              int64* readEndSample = nullptr)
+    {
+        if (! beginRead (bufferToFill))
+            return false;
+        
+        const int64 readEnd = jmin (endSample, totalSamplesWritten.get());
+        copyMostRecentSamples (bufferToFill, readSize, readEnd);
+        
+        if (readEndSample != nullptr)
+            *readEndSample = readEnd;
+        
+        // Keep the sample loads above from being reordered past the check.
+        std::atomic_thread_fence (std::memory_order_acquire);
+        
+        // Any write that started before our copy finished has already claimed
+        // its region, and everything older than (claim - bufferSize) is gone.
+        const bool intact = writeClaimPosition.get() - readEnd + readSize <= bufferSize;
+        
+        endRead();
+        return intact;
+    }
+    
+    /** Copies the numSamples newest samples of every channel into dest. Only
+        call this from the writer's thread, e.g. right after a write to mirror
+        it elsewhere; unlike readSamples() it is not counted as a read, so
+        getLastReadAgeSeconds() still reflects the visualizers.
+     */
+    void copyLatestSamples (AudioBuffer<Type> & dest, int numSamples)
+    {
+        copyMostRecentSamples (dest, numSamples, totalSamplesWritten.get());
+    }
+    
+    /** Returns the total number of samples written to each channel since the
+        RingBuffer was created. This is a 64-bit sample clock that never wraps.
+     */
+    int64 getTotalSamplesWritten() const noexcept   { return totalSamplesWritten.get(); }
+    
+    /** Returns when the last write finished, in Time::getHighResolutionTicks().
+        It is published after getTotalSamplesWritten(), so read the sample
+        clock before and after it to pair the two.
+     */
+    int64 getLastWriteTicks() const noexcept        { return lastWriteTicks.get(); }
+    
+    /** Returns how old the newest sample was, in seconds, when it was last
+        read. This is the time audio spends waiting in the RingBuffer before a
+        visualizer picks it up.
+     */
+    double getLastReadAgeSeconds() const noexcept
+    {
+        return Time::highResolutionTicksToSeconds (lastReadAgeTicks.get());
+    }
+    
+    int getBufferSize() const noexcept              { return bufferSize; }
+    int getNumChannels() const noexcept             { return numChannels; }
+    
+private:
+    /** Shared implementation of both writeSamples() overloads. getChannel (i)
+        returns the first sample to write for RingBuffer channel i.
+     */
+    template <typename ChannelGetter>
+    void writeChannels (ChannelGetter&& getChannel, int numSamples)
+    {
+        // A single write must never lap the ring, otherwise it would overwrite
+        // the samples it just wrote.
+        jassert (numSamples < bufferSize);
+        jassert (! resizing.get());
+        
+        const int curWritePosition = writePosition.get();
+        const int64 curTotalWritten = totalSamplesWritten.get();
+        
+        // Announce the region about to be overwritten before touching it, so
+        // readSamplesChecked() can tell if its copy raced with this write.
+        writeClaimPosition = curTotalWritten + numSamples;
+        std::atomic_thread_fence (std::memory_order_release);
+        
         for (int i = 0; i < numChannels; ++i)
         {
-            const int curWritePosition = writePosition.get();
+            const Type* source = getChannel (i);
             
             // If we need to loop around the ring
             if (curWritePosition + numSamples > bufferSize - 1)
             {
                 int samplesToEdgeOfBuffer = bufferSize - curWritePosition;
                 
-                audioBuffer->copyFrom (i, curWritePosition, newAudioData, i,
-                                       startSample, samplesToEdgeOfBuffer);
+                audioBuffer->copyFrom (i, curWritePosition, source, samplesToEdgeOfBuffer);
                 
-                audioBuffer->copyFrom (i, 0, newAudioData, i,
-                                       startSample + samplesToEdgeOfBuffer,
+                audioBuffer->copyFrom (i, 0, source + samplesToEdgeOfBuffer,
                                        numSamples - samplesToEdgeOfBuffer);
             }
             // If we stay inside the ring
             else
             {
-                audioBuffer->copyFrom (i, curWritePosition, newAudioData, i,
-                                       startSample, numSamples);
+                audioBuffer->copyFrom (i, curWritePosition, source, numSamples);
             }
         }
         
-        writePosition += numSamples;
-        writePosition = writePosition.get() % bufferSize;
-        
         /*
-            Although it would seem that the above two lines could cause a
-            problem for the consumer calling readsSamples() since it uses the
-            value of writePosition to calculate the readPosition, this is not
-            the case.
-            
-            1.  Since writePosition is Atomic, there will be no torn reads.
-         
-            2.  In the case that the producer only executes the line:
-        
-                    writePosition += numSamples;
+            The new write position is computed locally and published with a
+            single store, so a consumer calling readSamples() can never observe
+            a writePosition outside the bounds of the buffer.
          
-                then writePosition has the posibility of being outside the
-                bounds of the buffer. If the consumer then calls readsSamples()
-                and executes the line:
+            1.  Since writePosition is Atomic, there will be no torn reads.
          
-                    int readPosition = (writePosition.get() % bufferSize) - readSize;
+            2.  The sample data is copied before the position is published, so
+                any position a consumer sees only covers fully written samples.
          
-                it protects itself from an out-of-bounds writePosition by
-                calculating the modulus with the buffer size. If the
-                writePosition is outside the bounds of the buffer momentarily,
-                the consumer's call to readSamples() stays protected and accurate.
+            totalSamplesWritten is published last. It is the 64-bit sample
+            clock of the newest sample in the buffer and never wraps.
          */
+        writePosition = (curWritePosition + numSamples) % bufferSize;
+        totalSamplesWritten = curTotalWritten + numSamples;
+        lastWriteTicks = Time::getHighResolutionTicks();
     }
     
-    /** Reads readSize number of samples in front of the write position from all
-        channels in the RingBuffer into the bufferToFill.
-     
-         @param bufferToFill    buffer to be filled with most recent audio
-                                samples from the RingBuffer
-         @param readSize        number of samples to read from the RingBuffer.
-                                Note, this must be less than the buffer size
-                                of the RingBuffer specified in the constructor.
-    */
-    void readSamples (AudioBuffer<Type> & bufferToFill, int readSize)
+    /** Registers a reader so setSize() waits for it. Returns false (and fills
+        bufferToFill with silence) if a resize is in progress.
+     */
+    bool beginRead (AudioBuffer<Type> & bufferToFill)
+    {
+        ++activeReaders;
+        
+        if (resizing.get())
+        {
+            --activeReaders;
+            bufferToFill.clear();
+            return false;
+        }
+        
+        return true;
+    }
+    
+    void endRead()
+    {
+        lastReadAgeTicks = Time::getHighResolutionTicks() - lastWriteTicks.get();
+        --activeReaders;
+    }
+    
+    /** Copies the readSize samples that end at the given sample clock position
+        into bufferToFill.
+     */
+    void copyMostRecentSamples (AudioBuffer<Type> & bufferToFill, int readSize, int64 readEnd)
     {
         // Ensure readSize does not exceed bufferSize
         jassert (readSize < bufferSize);
         
-        /*
-            Further, as stated in the class comment, it is also bad to have a
-            read zone that overlaps with the writing zone, but this wont't cause
-            too much of a visual problem unless it happens often.
-            To combat this, the user should avoid having any read size and any
-            write size that when added together, exceed the bufferSize of the
-            RingBuffer.
-         */
-        
-        // Calculate readPosition based on writePosition
-        int readPosition = (writePosition.get() % bufferSize) - readSize;
+        // Calculate readPosition based on the published write position
+        int readPosition = (int) (readEnd % bufferSize) - readSize;
         
         // If read position goes into negative bounds, loop it around the ring
         if (readPosition < 0)
@@ -158,13 +355,18 @@ public:
         }
     }
     
-private:
     int bufferSize;
     int numChannels;
     std::unique_ptr<AudioBuffer<Type>> audioBuffer;
     Atomic<int> writePosition; // This must be atomic so the conumer does
                                // not read it in a torn state as it is being
                                // changed.
+    Atomic<int64> totalSamplesWritten;  // Sample clock of the newest published sample
+    Atomic<int64> writeClaimPosition;   // Sample clock the in-progress write will reach
+    Atomic<int64> lastWriteTicks;       // When the newest sample was published
+    Atomic<int64> lastReadAgeTicks;     // Age of the newest sample at the last read
+    Atomic<int> activeReaders;          // Readers currently copying, see setSize()
+    Atomic<bool> resizing;
     
     JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (RingBuffer)
 };
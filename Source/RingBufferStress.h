@@ -0,0 +1,247 @@
+//
+//  RingBufferStress.h
+//  3DAudioVisualizers
+//
+//  Multi-threaded stress and throughput harness for RingBuffer.
+//
+
+#pragma once
+
+#include "../JuceLibraryCode/JuceHeader.h"
+#include "RingBuffer.h"
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+/** Drives one RingBuffer with a single writer and N concurrent readers to
+    check the claims made in RingBuffer.h.
+
+    The writer pushes a counting pattern (channel 0 holds the sample clock,
+    channel 1 holds its negation) at a realistic audio block size. Every reader
+    checks that each read is a contiguous run of that pattern which ends
+    exactly at the write position it observed. A read that fails this check
+    is "torn". readSamplesChecked() is expected to flag every torn read; a torn
+    read that was not flagged is a real bug and makes the run fail.
+
+    Run it from the command line of the app:
+
+        "Towel OpenGL Audio Visualizer" --ringbuffer-stress [--readers=8]
+            [--block=512] [--read=256] [--size=5120] [--seconds=2] [--realtime]
+
+    The readers are swept from 1 to --readers so throughput scaling can be read
+    straight off the table.
+
+    ThreadSanitizer: build with -fsanitize=thread. The sample payload is
+    deliberately shared without locks (that is the point of the RingBuffer),
+    so suppress races on the payload copy only and keep the position handling
+    checked:
+
+        TSAN_OPTIONS="suppressions=tsan.supp" with tsan.supp containing
+        race:RingBuffer<*>::copyMostRecentSamples
+ */
+class RingBufferStress
+{
+public:
+    struct Options
+    {
+        int maxReaders = 8;
+        int writeBlockSize = 512;
+        int readSize = 256;
+        int bufferSize = 512 * 10;
+        double secondsPerRun = 2.0;
+        double sampleRate = 48000.0;
+        bool realtime = false;   // Pace the writer at sampleRate and readers at 60 fps
+    };
+
+    struct Result
+    {
+        int numReaders = 0;
+        double seconds = 0.0;
+        int64 samplesWritten = 0;
+        int64 reads = 0;
+        int64 tornReads = 0;
+        int64 flaggedReads = 0;
+        int64 undetectedTornReads = 0;
+    };
+
+    //==========================================================================
+    /** Parses options from the command line, runs the reader sweep and prints
+        one row per reader count. Returns a process exit code.
+     */
+    static int runFromCommandLine (const String& commandLine)
+    {
+        Options options;
+        StringArray args;
+        args.addTokens (commandLine, true);
+
+        for (auto& arg : args)
+        {
+            auto value = arg.fromFirstOccurrenceOf ("=", false, false);
+
+            if (arg.startsWith ("--readers="))      options.maxReaders = jmax (1, value.getIntValue());
+            else if (arg.startsWith ("--block="))   options.writeBlockSize = jmax (1, value.getIntValue());
+            else if (arg.startsWith ("--read="))    options.readSize = jmax (1, value.getIntValue());
+            else if (arg.startsWith ("--size="))    options.bufferSize = jmax (2, value.getIntValue());
+            else if (arg.startsWith ("--seconds=")) options.secondsPerRun = jmax (0.1, value.getDoubleValue());
+            else if (arg == "--realtime")           options.realtime = true;
+        }
+
+        if (options.writeBlockSize >= options.bufferSize || options.readSize >= options.bufferSize)
+        {
+            std::cout << "block and read sizes must both be smaller than the buffer size" << std::endl;
+            return 1;
+        }
+
+        std::cout << "RingBuffer stress: block " << options.writeBlockSize
+                  << ", read " << options.readSize
+                  << ", size " << options.bufferSize
+                  << (options.writeBlockSize + options.readSize > options.bufferSize ? " (overlapping)" : "")
+                  << (options.realtime ? ", realtime" : ", free running") << std::endl;
+
+        std::cout << "readers  Msamples/s written  reads/s total  reads/s per reader  torn  flagged  undetected" << std::endl;
+
+        bool failed = false;
+
+        for (int numReaders = 1; numReaders <= options.maxReaders; ++numReaders)
+        {
+            auto r = run (options, numReaders);
+            failed = failed || r.undetectedTornReads > 0;
+
+            std::cout << String (r.numReaders).paddedLeft (' ', 7)
+                      << String (r.samplesWritten / r.seconds / 1.0e6, 2).paddedLeft (' ', 20)
+                      << String (roundToInt (r.reads / r.seconds)).paddedLeft (' ', 15)
+                      << String (roundToInt (r.reads / r.seconds / numReaders)).paddedLeft (' ', 20)
+                      << String (r.tornReads).paddedLeft (' ', 6)
+                      << String (r.flaggedReads).paddedLeft (' ', 9)
+                      << String (r.undetectedTornReads).paddedLeft (' ', 12) << std::endl;
+        }
+
+        std::cout << (failed ? "FAILED: torn reads went undetected" : "OK") << std::endl;
+        return failed ? 1 : 0;
+    }
+
+    /** Runs one writer against numReaders readers for options.secondsPerRun.
+     */
+    static Result run (const Options& options, int numReaders)
+    {
+        RingBuffer<double> ringBuffer (2, options.bufferSize);
+        std::atomic<bool> running { true };
+        std::atomic<int64> samplesWritten { 0 };
+
+        // Prime the whole ring so readers never see the initial zeros
+        AudioBuffer<double> block (2, options.writeBlockSize);
+        int64 clock = 0;
+
+        while (clock < options.bufferSize)
+            clock = writeBlock (ringBuffer, block, clock);
+
+        std::vector<Result> readerResults ((size_t) numReaders);
+        std::vector<std::thread> readers;
+
+        std::thread writer ([&]
+        {
+            auto blockDuration = std::chrono::duration<double> (options.writeBlockSize / options.sampleRate);
+            auto nextDeadline = std::chrono::steady_clock::now();
+            int64 writerClock = clock;
+
+            while (running.load (std::memory_order_relaxed))
+            {
+                writerClock = writeBlock (ringBuffer, block, writerClock);
+
+                if (options.realtime)
+                {
+                    nextDeadline += std::chrono::duration_cast<std::chrono::steady_clock::duration> (blockDuration);
+                    std::this_thread::sleep_until (nextDeadline);
+                }
+            }
+
+            samplesWritten = writerClock - clock;
+        });
+
+        for (int i = 0; i < numReaders; ++i)
+        {
+            readers.emplace_back ([&, i]
+            {
+                auto& result = readerResults[(size_t) i];
+                AudioBuffer<double> readBuffer (2, options.readSize);
+
+                while (running.load (std::memory_order_relaxed))
+                {
+                    int64 readEnd = 0;
+                    const bool intact = ringBuffer.readSamplesChecked (readBuffer, options.readSize, &readEnd);
+                    const bool torn = ! isContiguous (readBuffer, options.readSize, readEnd);
+
+                    ++result.reads;
+                    result.tornReads += torn ? 1 : 0;
+                    result.flaggedReads += intact ? 0 : 1;
+                    result.undetectedTornReads += (torn && intact) ? 1 : 0;
+
+                    if (options.realtime)
+                        std::this_thread::sleep_for (std::chrono::microseconds (16667));
+                }
+            });
+        }
+
+        const auto startTime = std::chrono::steady_clock::now();
+        std::this_thread::sleep_for (std::chrono::duration<double> (options.secondsPerRun));
+        running = false;
+
+        writer.join();
+
+        for (auto& reader : readers)
+            reader.join();
+
+        Result total;
+        total.numReaders = numReaders;
+        total.seconds = std::chrono::duration<double> (std::chrono::steady_clock::now() - startTime).count();
+        total.samplesWritten = samplesWritten.load();
+
+        for (auto& r : readerResults)
+        {
+            total.reads += r.reads;
+            total.tornReads += r.tornReads;
+            total.flaggedReads += r.flaggedReads;
+            total.undetectedTornReads += r.undetectedTornReads;
+        }
+
+        return total;
+    }
+
+private:
+    /** Fills block with the next run of the counting pattern and writes it.
+        Returns the sample clock after the write.
+     */
+    static int64 writeBlock (RingBuffer<double>& ringBuffer, AudioBuffer<double>& block, int64 clock)
+    {
+        const int numSamples = block.getNumSamples();
+        auto* left = block.getWritePointer (0);
+        auto* right = block.getWritePointer (1);
+
+        for (int i = 0; i < numSamples; ++i)
+        {
+            left[i] = (double) (clock + i);
+            right[i] = -left[i];
+        }
+
+        ringBuffer.writeSamples (block, 0, numSamples);
+        return clock + numSamples;
+    }
+
+    /** Checks that the read holds the readSize pattern samples ending just
+        before readEnd, in both channels.
+     */
+    static bool isContiguous (const AudioBuffer<double>& readBuffer, int readSize, int64 readEnd)
+    {
+        const auto* left = readBuffer.getReadPointer (0);
+        const auto* right = readBuffer.getReadPointer (1);
+        const double first = (double) (readEnd - readSize);
+
+        for (int i = 0; i < readSize; ++i)
+            if (left[i] != first + i || right[i] != -left[i])
+                return false;
+
+        return true;
+    }
+};
@@ -0,0 +1,175 @@
+//
+//  ScratchArena.h
+//  3DAudioVisualizers
+//
+//  Hands out scratch memory up front, so the audio and render paths never
+//  allocate, and checks that they do not.
+//
+
+#pragma once
+
+#include "../JuceLibraryCode/JuceHeader.h"
+#include <type_traits>
+#include <vector>
+
+#if JUCE_LINUX
+ #include <sys/mman.h>
+#endif
+
+/** Counts heap allocations in debug builds. Set to 0 or 1 to override.
+    Main.cpp then routes malloc, calloc and realloc (glibc) or the debug CRT
+    alloc hook (MSVC) through HeapAllocationCounter::noteAllocation(), so
+    JUCE containers are counted along with operator new. Elsewhere only
+    operator new is.
+ */
+#ifndef TOWEL_COUNT_ALLOCATIONS
+ #define TOWEL_COUNT_ALLOCATIONS JUCE_DEBUG
+#endif
+
+//==============================================================================
+/** Scratch buffers for everything drawn by one VisualizerPipeline.
+
+    Each visualizer takes its fixed-size scratch with allocate() when it is
+    constructed, and keeps it until the arena is destroyed: there is no
+    free. Every buffer starts on its own cache line, so buffers written by
+    different render threads never share one, and comes zeroed.
+
+    The buffers are carved out of slabs of at least minimumSlabSize bytes, aligned
+    to 2 MiB so that a slab can be backed by huge pages. On Linux the slabs
+    are advised as such. Untouched pages of a slab cost no memory.
+
+    allocate() locks, so it can be called from any thread, but never call it
+    on the audio or render paths.
+ */
+class ScratchArena
+{
+public:
+    enum
+    {
+        cacheLineSize = 64,
+        hugePageSize = 2 * 1024 * 1024
+    };
+
+    explicit ScratchArena (size_t minimumSlabSize = hugePageSize)
+    :   slabSize (roundUp (jmax ((size_t) 1, minimumSlabSize), (size_t) hugePageSize))
+    {
+    }
+
+    /** Returns numElements zeroed elements, aligned to a cache line. They
+        stay valid for the lifetime of the arena.
+     */
+    template <typename ElementType>
+    ElementType* allocate (size_t numElements)
+    {
+        static_assert (std::is_trivially_default_constructible<ElementType>::value
+                        && std::is_trivially_destructible<ElementType>::value,
+                       "Arena memory is zeroed and never destroyed");
+        static_assert (alignof (ElementType) <= cacheLineSize, "Over-aligned element type");
+
+        const size_t numBytes = roundUp (jmax ((size_t) 1, numElements * sizeof (ElementType)), (size_t) cacheLineSize);
+        const ScopedLock sl (lock);
+
+        if (slabs.empty() || slabs.back().used + numBytes > slabs.back().size)
+            addSlab (jmax (slabSize, roundUp (numBytes, (size_t) hugePageSize)));
+
+        auto& slab = slabs.back();
+        auto* block = slab.start + slab.used;
+        slab.used += numBytes;
+        bytesAllocated += numBytes;
+
+        return reinterpret_cast<ElementType*> (block);
+    }
+
+    /** The bytes handed out so far, including the padding to cache lines.
+     */
+    size_t getBytesAllocated() const
+    {
+        const ScopedLock sl (lock);
+        return bytesAllocated;
+    }
+
+private:
+    struct Slab
+    {
+        HeapBlock<char> memory;
+        char* start = nullptr;      // memory, aligned up to hugePageSize
+        size_t size = 0;
+        size_t used = 0;
+    };
+
+    static size_t roundUp (size_t value, size_t multiple) noexcept
+    {
+        return (value + multiple - 1) / multiple * multiple;
+    }
+
+    void addSlab (size_t size)
+    {
+        Slab slab;
+
+        // Zeroed by the allocator, so pages are only committed when first used
+        slab.memory.calloc (size + hugePageSize);
+        const auto address = (size_t) reinterpret_cast<pointer_sized_uint> (slab.memory.get());
+        slab.start = reinterpret_cast<char*> (roundUp (address, (size_t) hugePageSize));
+        slab.size = size;
+
+       #if JUCE_LINUX && defined (MADV_HUGEPAGE)
+        madvise (slab.start, size, MADV_HUGEPAGE);
+       #endif
+
+        slabs.push_back (std::move (slab));
+    }
+
+    const size_t slabSize;
+
+    CriticalSection lock;
+    std::vector<Slab> slabs;
+    size_t bytesAllocated = 0;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (ScratchArena)
+};
+
+//==============================================================================
+/** The number of heap allocations made on each thread, when
+    TOWEL_COUNT_ALLOCATIONS is on. Always 0 otherwise.
+ */
+struct HeapAllocationCounter
+{
+    static int64 getThreadCount() noexcept
+    {
+        return getCount();
+    }
+
+    /** Called by the allocation hooks in Main.cpp.
+     */
+    static void noteAllocation() noexcept
+    {
+        ++getCount();
+    }
+
+private:
+    static int64& getCount() noexcept
+    {
+        static thread_local int64 count = 0;
+        return count;
+    }
+};
+
+/** Asserts, when allocations are counted, that the calling thread makes no
+    heap allocation in the enclosing scope.
+ */
+class ScopedNoHeapAllocation
+{
+public:
+    ScopedNoHeapAllocation() noexcept = default;
+
+    ~ScopedNoHeapAllocation()
+    {
+        // Something on a real-time path allocated: size it up front instead
+        jassert (HeapAllocationCounter::getThreadCount() == startCount);
+    }
+
+private:
+    const int64 startCount = HeapAllocationCounter::getThreadCount();
+
+    JUCE_DECLARE_NON_COPYABLE (ScopedNoHeapAllocation)
+};
@@ -0,0 +1,291 @@
+//
+//  ShaderCache.h
+//  3DAudioVisualizers
+//
+//  Links each shader program once per context and keeps program binaries
+//  across contexts and runs, so visualizers start without compiling GLSL.
+//
+
+#pragma once
+
+#include "../JuceLibraryCode/JuceHeader.h"
+#include <GL/glew.h>
+#include "Trace.h"
+#include <map>
+#include <memory>
+
+/** Where the visualizers get their shader programs from.
+
+    A program is identified by the SHA-256 of its sources, the attributes
+    bound before linking, and the driver: GL_VENDOR, GL_RENDERER and
+    GL_VERSION. getProgram() looks in three places before compiling:
+
+    - The programs already linked on the same OpenGLContext, held weakly in
+      an object associated with the context. Visualizers that share a
+      context share programs.
+    - The program binaries (glGetProgramBinary) of programs linked on any
+      context during this run. Loading one needs no GLSL compiler.
+    - The same binaries saved on disk by earlier runs, in the application
+      data directory. Startup skips compiling entirely once the cache is
+      warm, which matters most on software GL.
+
+    A binary the driver rejects, e.g. after a driver update that kept its
+    version string, is compiled again and replaced. Without
+    ARB_get_program_binary, programs are still shared within a context but
+    always compiled.
+
+    Hold it with a SharedResourcePointer, so every visualizer uses the same
+    cache. getProgram() can be called on any context's OpenGL thread.
+ */
+class ShaderCache
+{
+public:
+    /** The sources of a program, exactly as passed to the GL, so apply
+        OpenGLHelpers::translateVertexShaderToV3() etc. first.
+     */
+    struct Program
+    {
+        String vertexShader;
+        String fragmentShader;
+        StringArray attributes;     // Bound to locations 0, 1, ... before linking
+        bool saveToDisk = true;     // False keeps the binary for this run only. Not part of the key
+    };
+
+    ShaderCache() = default;
+
+    /** Returns the linked program for source on openGLContext, which must be
+        active. On failure, returns nullptr and sets error to the compile or
+        link log.
+
+        Sources that change often, like shader files being edited, should
+        clear Program::saveToDisk so each version does not leave a binary
+        behind in getDirectory().
+     */
+    std::shared_ptr<OpenGLShaderProgram> getProgram (OpenGLContext& openGLContext, const Program& source, String& error)
+    {
+        jassert (OpenGLHelpers::isContextActive());
+
+        const String key = getKey (source);
+        auto& linked = getContextPrograms (openGLContext).programs[key];
+
+        if (auto program = linked.lock())
+            return program;
+
+        const bool binariesSupported = GLEW_ARB_get_program_binary || GLEW_VERSION_4_1;
+        std::shared_ptr<OpenGLShaderProgram> program;
+
+        if (binariesSupported)
+            program = loadBinary (openGLContext, key);
+
+        if (program == nullptr)
+        {
+            program = compile (openGLContext, source, binariesSupported, error);
+
+            if (program == nullptr)
+                return nullptr;
+
+            if (binariesSupported)
+                saveBinary (*program, key, source.saveToDisk);
+        }
+
+        linked = program;
+        return program;
+    }
+
+    /** The directory binaries are saved in.
+     */
+    static File getDirectory()
+    {
+        return File::getSpecialLocation (File::userApplicationDataDirectory)
+                   .getChildFile (ProjectInfo::projectName)
+                   .getChildFile ("ShaderCache");
+    }
+
+private:
+    /** Programs linked on one context. Released with the context.
+     */
+    struct ContextPrograms  : public ReferenceCountedObject
+    {
+        std::map<String, std::weak_ptr<OpenGLShaderProgram>> programs;
+    };
+
+    struct Binary
+    {
+        GLenum format = 0;
+        MemoryBlock data;
+    };
+
+    static constexpr uint32 fileMagic = 0x43535754;     // "TWSC"
+
+    static ContextPrograms& getContextPrograms (OpenGLContext& openGLContext)
+    {
+        static const char* const objectName = "ShaderCache";
+
+        auto* programs = dynamic_cast<ContextPrograms*> (openGLContext.getAssociatedObject (objectName));
+
+        if (programs == nullptr)
+        {
+            programs = new ContextPrograms();
+            openGLContext.setAssociatedObject (objectName, programs);
+        }
+
+        return *programs;
+    }
+
+    static String getGLString (GLenum name)
+    {
+        auto* value = glGetString (name);
+        return value != nullptr ? String ((const char*) value) : String();
+    }
+
+    static String getKey (const Program& source)
+    {
+        MemoryOutputStream text;
+        text << getGLString (GL_VENDOR) << '\0' << getGLString (GL_RENDERER) << '\0' << getGLString (GL_VERSION) << '\0'
+             << source.vertexShader << '\0' << source.fragmentShader << '\0' << source.attributes.joinIntoString (",");
+
+        return SHA256 (text.getData(), text.getDataSize()).toHexString();
+    }
+
+    std::shared_ptr<OpenGLShaderProgram> compile (OpenGLContext& openGLContext, const Program& source,
+                                                  bool retrievable, String& error)
+    {
+        TOWEL_TRACE_ZONE ("ShaderCache::compile");
+        auto program = std::make_shared<OpenGLShaderProgram> (openGLContext);
+
+        if (program->addVertexShader (source.vertexShader)
+            && program->addFragmentShader (source.fragmentShader))
+        {
+            bindAttributes (*program, source);
+
+            if (retrievable)
+                glProgramParameteri (program->getProgramID(), GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+
+            if (program->link())
+                return program;
+        }
+
+        error = program->getLastError();
+        return nullptr;
+    }
+
+    static void bindAttributes (OpenGLShaderProgram& program, const Program& source)
+    {
+        for (int i = 0; i < source.attributes.size(); ++i)
+            glBindAttribLocation (program.getProgramID(), (GLuint) i, source.attributes[i].toRawUTF8());
+    }
+
+    /** Makes a program from the binary saved under key, in memory or on disk.
+        Forgets binaries the driver rejects.
+     */
+    std::shared_ptr<OpenGLShaderProgram> loadBinary (OpenGLContext& openGLContext, const String& key)
+    {
+        TOWEL_TRACE_ZONE ("ShaderCache::loadBinary");
+        const ScopedLock sl (lock);
+
+        auto found = binaries.find (key);
+
+        if (found == binaries.end())
+        {
+            Binary binary;
+
+            if (! readFile (key, binary))
+                return nullptr;
+
+            found = binaries.emplace (key, std::move (binary)).first;
+        }
+
+        auto program = std::make_shared<OpenGLShaderProgram> (openGLContext);
+        const auto& binary = found->second;
+
+        glProgramBinary (program->getProgramID(), binary.format, binary.data.getData(), (GLsizei) binary.data.getSize());
+
+        GLint linked = GL_FALSE;
+        glGetProgramiv (program->getProgramID(), GL_LINK_STATUS, &linked);
+
+        if (linked == GL_TRUE)
+            return program;
+
+        binaries.erase (found);
+        getFile (key).deleteFile();
+        return nullptr;
+    }
+
+    /** Keeps the binary of a freshly linked program in memory and, if
+        toDisk, on disk.
+     */
+    void saveBinary (OpenGLShaderProgram& program, const String& key, bool toDisk)
+    {
+        GLint size = 0;
+        glGetProgramiv (program.getProgramID(), GL_PROGRAM_BINARY_LENGTH, &size);
+
+        if (size <= 0)
+            return;
+
+        Binary binary;
+        binary.data.setSize ((size_t) size);
+
+        GLsizei length = 0;
+        glGetProgramBinary (program.getProgramID(), size, &length, &binary.format, binary.data.getData());
+
+        if (length <= 0)
+            return;
+
+        binary.data.setSize ((size_t) length);
+
+        const ScopedLock sl (lock);
+
+        if (toDisk)
+            writeFile (key, binary);
+
+        binaries[key] = std::move (binary);
+    }
+
+    static File getFile (const String& key)
+    {
+        return getDirectory().getChildFile (key + ".bin");
+    }
+
+    static bool readFile (const String& key, Binary& binary)
+    {
+        FileInputStream input (getFile (key));
+
+        if (! input.openedOk() || input.readInt() != (int) fileMagic)
+            return false;
+
+        binary.format = (GLenum) input.readInt();
+        const auto size = input.getNumBytesRemaining();
+
+        return size > 0 && input.readIntoMemoryBlock (binary.data, (ssize_t) size) == (size_t) size;
+    }
+
+    /** Writes through a temporary file, so another instance never reads a
+        partial binary.
+     */
+    static void writeFile (const String& key, const Binary& binary)
+    {
+        const auto file = getFile (key);
+
+        if (! file.getParentDirectory().createDirectory())
+            return;
+
+        TemporaryFile temporary (file);
+
+        {
+            FileOutputStream output (temporary.getFile());
+
+            if (! output.openedOk()
+                || ! output.writeInt ((int) fileMagic)
+                || ! output.writeInt ((int) binary.format)
+                || ! output.write (binary.data.getData(), binary.data.getSize()))
+                return;
+        }
+
+        temporary.overwriteTargetFileWithTemporary();
+    }
+
+    CriticalSection lock;
+    std::map<String, Binary> binaries;      // By key, for every context
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (ShaderCache)
+};
@@ -0,0 +1,293 @@
+//
+//  ShaderLibrary.h
+//  3DAudioVisualizers
+//
+//  Loads the visualizers' shaders from files, watches the files, and
+//  compiles changes in the background.
+//
+
+#pragma once
+
+#include "../JuceLibraryCode/JuceHeader.h"
+#include <GL/glew.h>
+#include "ShaderCache.h"
+#include "GlewInit.h"
+#include "Trace.h"
+#include <atomic>
+#include <vector>
+
+/** One program of a visualizer that the ShaderLibrary can replace.
+
+    The visualizer owns it. When it creates its shaders, it passes the
+    built-in sources to contextCreated(). At the start of each frame it calls
+    takeUpdate(), and on an update gets the program from the ShaderCache and
+    swaps it in with new uniforms. The ShaderLibrary has already compiled
+    and linked that program on its own context, so the ShaderCache has its
+    binary and the render thread only loads it.
+ */
+class ShaderSlot
+{
+public:
+    ShaderSlot() = default;
+
+    /** Call on the render thread when the context is created, with the
+        built-in sources, before OpenGLHelpers::translateVertexShaderToV3()
+        etc. The ShaderLibrary then sends the file version again.
+     */
+    void contextCreated (const ShaderCache::Program& builtInProgram)
+    {
+        {
+            const SpinLock::ScopedLockType sl (lock);
+            builtIn = builtInProgram;
+            hasBuiltIn = true;
+            hasUpdate = false;
+        }
+
+        needsProgram = true;
+    }
+
+    /** Call on the render thread before drawing. Returns true if the shader
+        files changed since the last call: program then has their sources,
+        ready for ShaderCache::getProgram(), or error why they do not link.
+     */
+    bool takeUpdate (ShaderCache::Program& program, String& error)
+    {
+        const SpinLock::ScopedTryLockType sl (lock);
+
+        // Never wait for the message thread; the update keeps until the next frame
+        if (! sl.isLocked() || ! hasUpdate)
+            return false;
+
+        program = pendingProgram;
+        error = pendingError;
+        hasUpdate = false;
+        return true;
+    }
+
+private:
+    friend class ShaderLibrary;
+
+    bool getBuiltIn (ShaderCache::Program& program)
+    {
+        const SpinLock::ScopedLockType sl (lock);
+        program = builtIn;
+        return hasBuiltIn;
+    }
+
+    void deliver (const ShaderCache::Program& program, const String& error)
+    {
+        const SpinLock::ScopedLockType sl (lock);
+        pendingProgram = program;
+        pendingError = error;
+        hasUpdate = true;
+    }
+
+    SpinLock lock;
+    ShaderCache::Program builtIn, pendingProgram;
+    String pendingError;
+    bool hasBuiltIn = false;
+    bool hasUpdate = false;
+    std::atomic<bool> needsProgram { false };
+
+    JUCE_DECLARE_NON_COPYABLE (ShaderSlot)
+};
+
+//==============================================================================
+/** Lets designers edit the visualizers' shaders while the app runs.
+
+    Every ShaderSlot is registered under a name. Its vertex and fragment
+    shaders are read from name.vert and name.frag in the directory given to
+    setDirectory(). Missing files are first written out from the built-in
+    sources, so there is always something to edit.
+
+    A message thread timer polls the files' modification times. A change is
+    compiled and linked on the OpenGL thread of a separate, hidden context,
+    never on a visualizer's. Only when it links are the sources handed to
+    the slot, which swaps the program in between two frames. A compile or
+    link error is handed over instead and shows in the visualizer's status
+    label, while the previous program keeps drawing.
+
+    The compiled program reaches the visualizer through ShaderCache's
+    program binaries. Without ARB_get_program_binary, the background
+    compile still reports errors, but the visualizer compiles again.
+
+    Until setDirectory() is called, nothing is loaded and the visualizers
+    use their built-in shaders. All functions must be called on the message
+    thread.
+ */
+class ShaderLibrary  : private Timer
+{
+public:
+    enum { pollHz = 4 };
+
+    ShaderLibrary() = default;
+
+    ~ShaderLibrary() override
+    {
+        stopTimer();
+    }
+
+    /** Registers slot, which draws into openGLContext. With translateToV3,
+        files are passed through OpenGLHelpers::translateVertexShaderToV3()
+        and translateFragmentShaderToV3() like the built-in sources.
+     */
+    void addShader (const String& name, ShaderSlot& slot, OpenGLContext& openGLContext, bool translateToV3)
+    {
+        Entry entry;
+        entry.name = name;
+        entry.slot = &slot;
+        entry.openGLContext = &openGLContext;
+        entry.translateToV3 = translateToV3;
+        entries.push_back (entry);
+    }
+
+    /** Starts loading and watching the shader files in directory, or stops
+        if it is File(). The hidden compile context needs a parent on screen,
+        see getCompilerComponent().
+     */
+    void setDirectory (const File& newDirectory)
+    {
+        directory = newDirectory;
+
+        for (auto& entry : entries)
+            entry.lastModified = Time();
+
+        if (directory == File())
+        {
+            stopTimer();
+            compiler.reset();
+            return;
+        }
+
+        directory.createDirectory();
+
+        if (compiler == nullptr)
+            compiler = std::make_unique<Compiler>();
+
+        startTimerHz (pollHz);
+    }
+
+    /** The component holding the compile context while a directory is set,
+        or nullptr. Add it to a window; it takes a single pixel.
+     */
+    Component* getCompilerComponent() const noexcept    { return compiler.get(); }
+
+private:
+    /** A one pixel component with an OpenGL context that only compiles.
+     */
+    struct Compiler  : public Component,
+                       private OpenGLRenderer
+    {
+        Compiler()
+        {
+            setSize (1, 1);
+            openGLContext.setOpenGLVersionRequired (OpenGLContext::OpenGLVersion::openGL3_2);
+            openGLContext.setComponentPaintingEnabled (false);
+            openGLContext.setRenderer (this);
+            openGLContext.attachTo (*this);
+        }
+
+        ~Compiler() override
+        {
+            openGLContext.detach();
+        }
+
+        void newOpenGLContextCreated() override
+        {
+            Trace::setThreadName ("OpenGL Shader Compiler");
+            glew = initialiseGlew();
+        }
+
+        void renderOpenGL() override
+        {
+            OpenGLHelpers::clear (Colours::black);
+        }
+
+        void openGLContextClosing() override {}
+
+        OpenGLContext openGLContext;
+        Result glew { Result::ok() };       // OpenGL thread only
+    };
+
+    struct Entry
+    {
+        String name;
+        ShaderSlot* slot = nullptr;
+        OpenGLContext* openGLContext = nullptr;
+        bool translateToV3 = false;
+        Time lastModified;
+    };
+
+    void timerCallback() override
+    {
+        // The context is created once the component is on screen
+        if (compiler == nullptr || compiler->openGLContext.getRawContext() == nullptr)
+            return;
+
+        for (auto& entry : entries)
+        {
+            ShaderCache::Program builtIn;
+
+            if (! entry.slot->getBuiltIn (builtIn))
+                continue;
+
+            const auto vertexFile = directory.getChildFile (entry.name + ".vert");
+            const auto fragmentFile = directory.getChildFile (entry.name + ".frag");
+
+            if (! vertexFile.existsAsFile())
+                vertexFile.replaceWithText (builtIn.vertexShader);
+
+            if (! fragmentFile.existsAsFile())
+                fragmentFile.replaceWithText (builtIn.fragmentShader);
+
+            const auto modified = jmax (vertexFile.getLastModificationTime(), fragmentFile.getLastModificationTime());
+            const bool changed = modified != entry.lastModified;
+            entry.lastModified = modified;
+
+            if (entry.slot->needsProgram.exchange (false) || changed)
+            {
+                ShaderCache::Program program;
+                program.vertexShader = vertexFile.loadFileAsString();
+                program.fragmentShader = fragmentFile.loadFileAsString();
+                program.attributes = builtIn.attributes;
+                program.saveToDisk = false;     // Every edit is a new program; only the built-in ones are worth keeping
+
+                if (entry.translateToV3)
+                {
+                    program.vertexShader = OpenGLHelpers::translateVertexShaderToV3 (program.vertexShader);
+                    program.fragmentShader = OpenGLHelpers::translateFragmentShaderToV3 (program.fragmentShader);
+                }
+
+                compile (entry, program);
+            }
+        }
+    }
+
+    /** Links program on the compile context's thread and hands the result
+        to entry's slot.
+     */
+    void compile (const Entry& entry, const ShaderCache::Program& program)
+    {
+        compiler->openGLContext.executeOnGLThread ([this, entry, program] (OpenGLContext& context)
+        {
+            String error;
+
+            if (compiler->glew.failed())
+                error = entry.name + ": " + compiler->glew.getErrorMessage();
+            else if (shaderCache->getProgram (context, program, error) != nullptr)
+                error = String();
+            else
+                error = entry.name + ": " + error;
+
+            entry.slot->deliver (program, error);
+            entry.openGLContext->triggerRepaint();
+        }, false);
+    }
+
+    SharedResourcePointer<ShaderCache> shaderCache;
+    std::vector<Entry> entries;
+    File directory;
+    std::unique_ptr<Compiler> compiler;     // Destroyed first: its jobs point at the entries' slots
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (ShaderLibrary)
+};
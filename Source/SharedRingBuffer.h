@@ -0,0 +1,387 @@
+//
+//  SharedRingBuffer.h
+//  3DAudioVisualizers
+//
+//  A stream's audio and analysis in POSIX shared memory, so other processes
+//  can read it without capturing or analysing anything themselves.
+//
+
+#pragma once
+
+#if ! TOWEL_HEADLESS
+ #include "../JuceLibraryCode/JuceHeader.h"
+#endif
+#include "AnalysisFrame.h"
+#include <atomic>
+
+#if JUCE_MAC || JUCE_LINUX || JUCE_BSD
+ #include <fcntl.h>
+ #include <sys/mman.h>
+ #include <sys/stat.h>
+ #include <unistd.h>
+ #define TOWEL_SHARED_MEMORY 1
+#else
+ #define TOWEL_SHARED_MEMORY 0
+#endif
+
+/** The multi-process counterpart of RingBuffer: one writer process, any
+    number of reader processes, float samples only.
+
+    The segment (shm_open() + mmap()) is laid out as
+
+        Header      two cache lines, see below
+        Analysis    an AnalysisFrameExchange, the same sequence lock the
+                    renderers read
+        Audio       numChannels x bufferSize floats, each channel starting
+                    on its own cache line
+
+    The header keeps the layout, which never changes after creation, on its
+    own cache line and the positions the writer updates for every block on
+    the next one, so readers polling the positions never share a line with
+    anything else. Readers map the segment read-only and never write to it,
+    so a crashed or stalled reader cannot affect the writer or other readers.
+
+    Writing and reading follow RingBuffer exactly: the writer claims a region,
+    copies, then publishes the new sample clock; readSamplesChecked() reports
+    reads the writer overlapped. Readers that want no copy at all can use
+    getChannelData() and getTotalSamplesWritten() directly.
+
+    The ring size is fixed when the segment is created. Only available on
+    macOS, Linux and BSD; create() and open() return nullptr elsewhere.
+ */
+class SharedRingBuffer
+{
+public:
+    enum
+    {
+        cacheLineSize = 128,    // Apple silicon lines, and x86 adjacent-line prefetch
+        version = 4,            // Bump whenever the Header or AnalysisFrame layout changes
+        ownerOnly = 0600        // Default permissions of a new segment
+    };
+
+    /** Creates a segment to write to, replacing any existing segment with the
+        same name. Readers still attached to a replaced segment keep it until
+        they reopen. name follows shm_open(): a leading slash and no others.
+
+        permissions are the segment's file mode bits, so by default only
+        processes of the same user can open it. Pass e.g. 0640 to let a group
+        read it too.
+     */
+    static std::unique_ptr<SharedRingBuffer> create (const String& name, int numChannels, int bufferSize,
+                                                     int permissions = ownerOnly)
+    {
+       #if TOWEL_SHARED_MEMORY
+        if (numChannels < 1 || numChannels > maxChannels || bufferSize < 2)
+            return nullptr;
+
+        const auto channelStride = (size_t) roundUp ((int) (bufferSize * sizeof (float)), cacheLineSize) / sizeof (float);
+        const auto frameOffset = (size_t) sizeof (Header);
+        const auto audioOffset = (size_t) roundUp ((int) (frameOffset + sizeof (AnalysisFrameExchange)), cacheLineSize);
+        const auto segmentSize = audioOffset + channelStride * sizeof (float) * (size_t) numChannels;
+
+        shm_unlink (name.toRawUTF8());
+        const int fd = shm_open (name.toRawUTF8(), O_CREAT | O_EXCL | O_RDWR, (mode_t) (permissions & 0777));
+
+        if (fd < 0)
+            return nullptr;
+
+        // Exactly as asked: the umask would otherwise take group or other bits away
+        if (fchmod (fd, (mode_t) (permissions & 0777)) != 0 || ftruncate (fd, (off_t) segmentSize) != 0)
+        {
+            ::close (fd);
+            shm_unlink (name.toRawUTF8());
+            return nullptr;
+        }
+
+        void* mapping = mmap (nullptr, segmentSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        ::close (fd);
+
+        if (mapping == MAP_FAILED)
+        {
+            shm_unlink (name.toRawUTF8());
+            return nullptr;
+        }
+
+        // ftruncate() zero-filled the segment; fill in the layout, then the
+        // magic number, which tells readers the segment is ready
+        auto* header = new (mapping) Header();
+        header->layout.numChannels = (uint32) numChannels;
+        header->layout.bufferSize = (uint32) bufferSize;
+        header->layout.channelStride = (uint32) channelStride;
+        header->layout.frameOffset = (uint32) frameOffset;
+        header->layout.audioOffset = (uint32) audioOffset;
+        header->layout.segmentSize = (uint64) segmentSize;
+        header->layout.version = version;
+        new (static_cast<char*> (mapping) + frameOffset) AnalysisFrameExchange();
+        header->layout.magic.store (magicNumber, std::memory_order_release);
+
+        return std::unique_ptr<SharedRingBuffer> (new SharedRingBuffer (name, mapping, segmentSize, true));
+       #else
+        ignoreUnused (name, numChannels, bufferSize, permissions);
+        return nullptr;
+       #endif
+    }
+
+    /** Attaches to a segment created by another process, read-only. Returns
+        nullptr if it does not exist (yet) or has an unknown layout.
+     */
+    static std::unique_ptr<SharedRingBuffer> open (const String& name)
+    {
+       #if TOWEL_SHARED_MEMORY
+        const int fd = shm_open (name.toRawUTF8(), O_RDONLY, 0);
+
+        if (fd < 0)
+            return nullptr;
+
+        struct stat info;
+        void* mapping = MAP_FAILED;
+
+        if (fstat (fd, &info) == 0 && (size_t) info.st_size >= sizeof (Header))
+            mapping = mmap (nullptr, (size_t) info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+
+        ::close (fd);
+
+        if (mapping == MAP_FAILED)
+            return nullptr;
+
+        const auto* header = static_cast<const Header*> (mapping);
+
+        if (header->layout.magic.load (std::memory_order_acquire) != magicNumber
+             || header->layout.version != version
+             || header->layout.segmentSize != (uint64) info.st_size)
+        {
+            munmap (mapping, (size_t) info.st_size);
+            return nullptr;
+        }
+
+        return std::unique_ptr<SharedRingBuffer> (new SharedRingBuffer (name, mapping, (size_t) info.st_size, false));
+       #else
+        ignoreUnused (name);
+        return nullptr;
+       #endif
+    }
+
+    /** Unmaps the segment. The writer also removes its name, so no new reader
+        can attach; readers already attached keep their mapping.
+     */
+    ~SharedRingBuffer()
+    {
+       #if TOWEL_SHARED_MEMORY
+        munmap (segment, segmentSize);
+
+        if (writer)
+            shm_unlink (name.toRawUTF8());
+       #endif
+    }
+
+    //==========================================================================
+    // Writer
+
+    /** Stores the sample rate of the audio, for readers.
+     */
+    void setSampleRate (double sampleRate)
+    {
+        jassert (writer);
+        getHeader().state.sampleRate.store (sampleRate, std::memory_order_release);
+    }
+
+    /** Writes numSamples samples from one pointer per channel. Like
+        RingBuffer::writeSamples(), numSamples must be less than the ring size.
+     */
+    void writeSamples (const float* const* channelData, int numSamples)
+    {
+        jassert (writer);
+        jassert (numSamples < bufferSize);
+
+        auto& state = getHeader().state;
+        const int64 curTotalWritten = state.totalSamplesWritten.load (std::memory_order_relaxed);
+        const int writePosition = (int) (curTotalWritten % bufferSize);
+
+        // Announce the region about to be overwritten, see RingBuffer::writeChannels()
+        state.writeClaimPosition.store (curTotalWritten + numSamples, std::memory_order_relaxed);
+        std::atomic_thread_fence (std::memory_order_release);
+
+        const int samplesToEdgeOfBuffer = jmin (numSamples, bufferSize - writePosition);
+
+        for (int i = 0; i < numChannels; ++i)
+        {
+            auto* dest = getChannelWritePointer (i);
+            FloatVectorOperations::copy (dest + writePosition, channelData[i], samplesToEdgeOfBuffer);
+            FloatVectorOperations::copy (dest, channelData[i] + samplesToEdgeOfBuffer, numSamples - samplesToEdgeOfBuffer);
+        }
+
+        state.lastWriteTicks.store (Time::getHighResolutionTicks(), std::memory_order_relaxed);
+        state.totalSamplesWritten.store (curTotalWritten + numSamples, std::memory_order_release);
+    }
+
+    void writeSamples (const AudioBuffer<float>& audioData, int startSample, int numSamples)
+    {
+        jassert (audioData.getNumChannels() >= numChannels);
+
+        const float* channels[maxChannels];
+
+        for (int i = 0; i < numChannels; ++i)
+            channels[i] = audioData.getReadPointer (i, startSample);
+
+        writeSamples (channels, numSamples);
+    }
+
+    /** Publishes an analysis frame. Only one thread may call this.
+     */
+    void publishFrame (const AnalysisFrame& frame)
+    {
+        jassert (writer);
+        const_cast<AnalysisFrameExchange&> (getFrameExchange()).publish (frame);
+    }
+
+    //==========================================================================
+    // Readers
+
+    /** Copies the readSize newest samples of every channel into bufferToFill.
+        Returns false if the writer overlapped the copy, see
+        RingBuffer::readSamplesChecked().
+     */
+    bool readSamplesChecked (AudioBuffer<float>& bufferToFill, int readSize, int64* readEndSample = nullptr) const
+    {
+        jassert (readSize < bufferSize && bufferToFill.getNumChannels() >= numChannels);
+
+        const auto& state = getHeader().state;
+        const int64 readEnd = state.totalSamplesWritten.load (std::memory_order_acquire);
+
+        int readPosition = (int) (readEnd % bufferSize) - readSize;
+
+        if (readPosition < 0)
+            readPosition += bufferSize;
+
+        const int samplesToEdgeOfBuffer = jmin (readSize, bufferSize - readPosition);
+
+        for (int i = 0; i < numChannels; ++i)
+        {
+            const auto* source = getChannelData (i);
+            auto* dest = bufferToFill.getWritePointer (i);
+            FloatVectorOperations::copy (dest, source + readPosition, samplesToEdgeOfBuffer);
+            FloatVectorOperations::copy (dest + samplesToEdgeOfBuffer, source, readSize - samplesToEdgeOfBuffer);
+        }
+
+        if (readEndSample != nullptr)
+            *readEndSample = readEnd;
+
+        std::atomic_thread_fence (std::memory_order_acquire);
+        return state.writeClaimPosition.load (std::memory_order_relaxed) - readEnd + readSize <= bufferSize;
+    }
+
+    void readSamples (AudioBuffer<float>& bufferToFill, int readSize) const
+    {
+        readSamplesChecked (bufferToFill, readSize);
+    }
+
+    /** Copies the newest analysis frame. Returns false if none was published.
+     */
+    bool readFrame (AnalysisFrame& dest) const      { return getFrameExchange().read (dest); }
+
+    /** Changes every time a frame is published, see AnalysisFrameExchange.
+     */
+    uint32 getFrameSequence() const                 { return getFrameExchange().getSequence(); }
+
+    /** The channel's samples in place, for readers that do their own
+        bookkeeping. Sample clock s lives at index s % getBufferSize().
+     */
+    const float* getChannelData (int channel) const
+    {
+        jassert (isPositiveAndBelow (channel, numChannels));
+        return reinterpret_cast<const float*> (static_cast<const char*> (segment) + getHeader().layout.audioOffset)
+                 + (size_t) channel * getHeader().layout.channelStride;
+    }
+
+    int64 getTotalSamplesWritten() const    { return getHeader().state.totalSamplesWritten.load (std::memory_order_acquire); }
+    int64 getWriteClaimPosition() const     { return getHeader().state.writeClaimPosition.load (std::memory_order_acquire); }
+    double getSampleRate() const            { return getHeader().state.sampleRate.load (std::memory_order_acquire); }
+
+    /** Seconds since the writer last wrote, e.g. to notice it has stopped.
+     */
+    double getSecondsSinceLastWrite() const
+    {
+        return Time::highResolutionTicksToSeconds (Time::getHighResolutionTicks()
+                                                   - getHeader().state.lastWriteTicks.load (std::memory_order_relaxed));
+    }
+
+    int getNumChannels() const              { return numChannels; }
+    int getBufferSize() const               { return bufferSize; }
+    const String& getName() const           { return name; }
+    bool isWriter() const                   { return writer; }
+
+private:
+    enum
+    {
+        magicNumber = 0x52535754,   // "TWSR"
+        maxChannels = 64
+    };
+
+    /** Set up once by the creator. magic is stored last.
+     */
+    struct Layout
+    {
+        std::atomic<uint32> magic { 0 };
+        uint32 version = 0;
+        uint32 numChannels = 0;
+        uint32 bufferSize = 0;
+        uint32 channelStride = 0;   // Floats from one channel to the next
+        uint32 frameOffset = 0;     // Bytes from the segment start
+        uint32 audioOffset = 0;
+        uint64 segmentSize = 0;
+    };
+
+    /** Updated by the writer for every block.
+     */
+    struct WriterState
+    {
+        std::atomic<int64> totalSamplesWritten { 0 };
+        std::atomic<int64> writeClaimPosition { 0 };
+        std::atomic<int64> lastWriteTicks { 0 };
+        std::atomic<double> sampleRate { 0.0 };
+    };
+
+    struct Header
+    {
+        alignas (cacheLineSize) Layout layout;
+        alignas (cacheLineSize) WriterState state;
+    };
+
+    static_assert (sizeof (Header) == 2 * cacheLineSize, "The header must be exactly two cache lines");
+    static_assert (std::atomic<int64>::is_always_lock_free && std::atomic<double>::is_always_lock_free
+                     && std::atomic<uint32>::is_always_lock_free,
+                   "Atomics shared between processes must be lock-free");
+
+    SharedRingBuffer (const String& segmentName, void* mapping, size_t mappingSize, bool isWriterProcess)
+    :   name (segmentName),
+        segment (mapping),
+        segmentSize (mappingSize),
+        writer (isWriterProcess),
+        numChannels ((int) getHeader().layout.numChannels),
+        bufferSize ((int) getHeader().layout.bufferSize)
+    {
+    }
+
+    static int roundUp (int value, int multiple)
+    {
+        return (value + multiple - 1) / multiple * multiple;
+    }
+
+    const Header& getHeader() const                 { return *static_cast<const Header*> (segment); }
+    Header& getHeader()                             { return *static_cast<Header*> (segment); }
+
+    const AnalysisFrameExchange& getFrameExchange() const
+    {
+        return *reinterpret_cast<const AnalysisFrameExchange*> (static_cast<const char*> (segment) + getHeader().layout.frameOffset);
+    }
+
+    float* getChannelWritePointer (int channel)     { return const_cast<float*> (getChannelData (channel)); }
+
+    String name;
+    void* segment;
+    size_t segmentSize;
+    bool writer;
+    int numChannels, bufferSize;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (SharedRingBuffer)
+};
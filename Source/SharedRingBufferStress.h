@@ -0,0 +1,299 @@
+//
+//  SharedRingBufferStress.h
+//  3DAudioVisualizers
+//
+//  Cross-process stress harness for SharedRingBuffer.
+//
+
+#pragma once
+
+#include "../JuceLibraryCode/JuceHeader.h"
+#include "SharedRingBuffer.h"
+#include <atomic>
+#include <iostream>
+#include <thread>
+
+/** Writes a SharedRingBuffer from this process and reads it from child
+    processes, to check that RingBuffer's single-writer, multi-reader
+    guarantees hold across process boundaries.
+
+    The writer pushes a counting pattern at the audio rate: channel 0 holds
+    the sample clock modulo 65536 (exact in a float), channel 1 its negation.
+    It also publishes an analysis frame every hop whose first magnitude
+    encodes the frame's sample clock the same way. Every reader process
+    checks each read like RingBufferStress does and checks that frames arrive
+    in order and intact.
+
+        "Towel OpenGL Audio Visualizer" --shared-ring-stress [--readers=4]
+            [--block=512] [--read=256] [--size=4096] [--seconds=2]
+
+    A reader can also be started by hand against any running writer, e.g. the
+    app started with --share:
+
+        "Towel OpenGL Audio Visualizer" --shared-ring-reader=/towel-visualizer
+            [--seconds=2]
+
+    which prints what it saw but does not check the pattern.
+ */
+class SharedRingBufferStress
+{
+public:
+    struct Options
+    {
+        int numReaders = 4;
+        int writeBlockSize = 512;
+        int readSize = 256;
+        int bufferSize = 4096;
+        double seconds = 2.0;
+        double sampleRate = 48000.0;
+    };
+
+    struct ReaderResult
+    {
+        int64 reads = 0;
+        int64 tornReads = 0;
+        int64 flaggedReads = 0;
+        int64 undetectedTornReads = 0;
+        int64 frames = 0;
+        int64 badFrames = 0;
+    };
+
+    //==========================================================================
+    /** Runs either the whole test or, with --shared-ring-reader=<name>, one
+        reader process. Returns a process exit code.
+     */
+    static int runFromCommandLine (const String& commandLine)
+    {
+        Options options;
+        String readerSegment;
+        StringArray args;
+        args.addTokens (commandLine, true);
+
+        for (auto& arg : args)
+        {
+            auto value = arg.fromFirstOccurrenceOf ("=", false, false);
+
+            if (arg.startsWith ("--readers="))                  options.numReaders = jmax (1, value.getIntValue());
+            else if (arg.startsWith ("--block="))               options.writeBlockSize = jmax (1, value.getIntValue());
+            else if (arg.startsWith ("--read="))                options.readSize = jmax (1, value.getIntValue());
+            else if (arg.startsWith ("--size="))                options.bufferSize = jmax (2, value.getIntValue());
+            else if (arg.startsWith ("--seconds="))             options.seconds = jmax (0.1, value.getDoubleValue());
+            else if (arg.startsWith ("--shared-ring-reader="))  readerSegment = value;
+        }
+
+        if (readerSegment.isNotEmpty())
+            return runReader (readerSegment, options, args.contains ("--check"));
+
+        if (options.writeBlockSize >= options.bufferSize || options.readSize >= options.bufferSize)
+        {
+            std::cout << "block and read sizes must both be smaller than the buffer size" << std::endl;
+            return 1;
+        }
+
+        return runTest (options);
+    }
+
+private:
+    enum
+    {
+        patternPeriod = 65536,
+        hopSize = 800
+    };
+
+    static float patternAt (int64 sampleClock)     { return (float) (sampleClock % patternPeriod); }
+
+    //==========================================================================
+    static int runTest (const Options& options)
+    {
+        const String name ("/towel-stress-" + String (Time::getHighResolutionTicks() % 1000000));
+        auto shared = SharedRingBuffer::create (name, 2, options.bufferSize);
+
+        if (shared == nullptr)
+        {
+            std::cout << "cannot create shared memory segment " << name << std::endl;
+            return 1;
+        }
+
+        shared->setSampleRate (options.sampleRate);
+
+        std::atomic<bool> running { true };
+        int64 samplesWritten = 0;
+
+        // Prime the ring so readers never see the initial zeros
+        AudioBuffer<float> block (2, options.writeBlockSize);
+
+        while (samplesWritten < options.bufferSize)
+            samplesWritten = writeBlock (*shared, block, samplesWritten);
+
+        std::thread writer ([&]
+        {
+            const double blockMs = 1000.0 * options.writeBlockSize / options.sampleRate;
+            auto nextDeadline = Time::getMillisecondCounterHiRes();
+            int64 nextFrameClock = samplesWritten;
+            AnalysisFrame frame;
+
+            while (running.load (std::memory_order_relaxed))
+            {
+                samplesWritten = writeBlock (*shared, block, samplesWritten);
+
+                for (; nextFrameClock <= samplesWritten; nextFrameClock += hopSize)
+                {
+                    frame.sampleClock = nextFrameClock;
+                    frame.numBins = AnalysisFrame::maxBins;
+                    FloatVectorOperations::fill (frame.magnitudes, -patternAt (nextFrameClock), frame.numBins);
+                    frame.magnitudes[0] = patternAt (nextFrameClock);
+                    shared->publishFrame (frame);
+                }
+
+                nextDeadline += blockMs;
+                const auto msToWait = nextDeadline - Time::getMillisecondCounterHiRes();
+
+                if (msToWait > 1.0)
+                    Thread::sleep ((int) msToWait);
+            }
+        });
+
+        OwnedArray<ChildProcess> readers;
+        const auto executable = File::getSpecialLocation (File::currentExecutableFile).getFullPathName();
+
+        for (int i = 0; i < options.numReaders; ++i)
+        {
+            auto* reader = readers.add (new ChildProcess());
+
+            reader->start (StringArray { executable, "--shared-ring-reader=" + name, "--check",
+                                         "--read=" + String (options.readSize),
+                                         "--seconds=" + String (options.seconds) });
+        }
+
+        std::cout << "SharedRingBuffer stress: " << name << ", block " << options.writeBlockSize
+                  << ", read " << options.readSize << ", size " << options.bufferSize
+                  << ", " << options.numReaders << " reader processes" << std::endl;
+
+        std::cout << "reader  reads/s  torn  flagged  undetected  frames  bad frames" << std::endl;
+
+        bool failed = false;
+
+        for (int i = 0; i < readers.size(); ++i)
+        {
+            const auto output = readers[i]->readAllProcessOutput().trim();
+            const auto exitCode = readers[i]->getExitCode();
+            StringArray fields;
+            fields.addTokens (output, true);
+
+            if (fields.size() != 6 || exitCode != 0)
+            {
+                std::cout << String (i).paddedLeft (' ', 6) << "  failed: " << output << std::endl;
+                failed = true;
+                continue;
+            }
+
+            failed = failed || fields[3].getLargeIntValue() > 0 || fields[4].getLargeIntValue() == 0
+                       || fields[5].getLargeIntValue() > 0;
+
+            std::cout << String (i).paddedLeft (' ', 6)
+                      << String (roundToInt (fields[0].getLargeIntValue() / options.seconds)).paddedLeft (' ', 9)
+                      << fields[1].paddedLeft (' ', 6)
+                      << fields[2].paddedLeft (' ', 9)
+                      << fields[3].paddedLeft (' ', 12)
+                      << fields[4].paddedLeft (' ', 8)
+                      << fields[5].paddedLeft (' ', 12) << std::endl;
+        }
+
+        running = false;
+        writer.join();
+
+        std::cout << (failed ? "FAILED" : "OK") << std::endl;
+        return failed ? 1 : 0;
+    }
+
+    static int64 writeBlock (SharedRingBuffer& shared, AudioBuffer<float>& block, int64 clock)
+    {
+        for (int i = 0; i < block.getNumSamples(); ++i)
+        {
+            block.setSample (0, i, patternAt (clock + i));
+            block.setSample (1, i, -patternAt (clock + i));
+        }
+
+        shared.writeSamples (block, 0, block.getNumSamples());
+        return clock + block.getNumSamples();
+    }
+
+    //==========================================================================
+    /** Reads as fast as possible for options.seconds. With check, prints one
+        line of counts for runTest() to parse.
+     */
+    static int runReader (const String& name, const Options& options, bool check)
+    {
+        // The writer may still be starting up
+        std::unique_ptr<SharedRingBuffer> shared;
+
+        for (int attempt = 0; shared == nullptr && attempt < 100; ++attempt)
+            if ((shared = SharedRingBuffer::open (name)) == nullptr)
+                Thread::sleep (10);
+
+        if (shared == nullptr || options.readSize >= shared->getBufferSize())
+        {
+            std::cout << "cannot attach to " << name << std::endl;
+            return 1;
+        }
+
+        ReaderResult r;
+        AudioBuffer<float> buffer (shared->getNumChannels(), options.readSize);
+        AnalysisFrame frame;
+        int64 lastFrameClock = -1;
+        uint32 lastSequence = 0;
+        const auto endTime = Time::getMillisecondCounterHiRes() + options.seconds * 1000.0;
+
+        while (Time::getMillisecondCounterHiRes() < endTime)
+        {
+            int64 readEnd = 0;
+            const bool intact = shared->readSamplesChecked (buffer, options.readSize, &readEnd);
+            bool torn = false;
+
+            if (check && buffer.getNumChannels() >= 2)
+            {
+                for (int i = 0; i < options.readSize && ! torn; ++i)
+                {
+                    const float expected = patternAt (readEnd - options.readSize + i);
+                    torn = buffer.getSample (0, i) != expected || buffer.getSample (1, i) != -expected;
+                }
+            }
+
+            ++r.reads;
+            r.tornReads += torn ? 1 : 0;
+            r.flaggedReads += intact ? 0 : 1;
+            r.undetectedTornReads += (torn && intact) ? 1 : 0;
+
+            const uint32 sequence = shared->getFrameSequence();
+
+            if (sequence != lastSequence && shared->readFrame (frame))
+            {
+                lastSequence = sequence;
+                ++r.frames;
+
+                const bool bad = frame.sampleClock <= lastFrameClock
+                                  || (check && (frame.magnitudes[0] != patternAt (frame.sampleClock)
+                                                 || frame.magnitudes[frame.numBins - 1] != -patternAt (frame.sampleClock)));
+                r.badFrames += bad ? 1 : 0;
+                lastFrameClock = frame.sampleClock;
+            }
+        }
+
+        if (check)
+        {
+            std::cout << r.reads << " " << r.tornReads << " " << r.flaggedReads << " "
+                      << r.undetectedTornReads << " " << r.frames << " " << r.badFrames << std::endl;
+        }
+        else
+        {
+            std::cout << name << ": " << shared->getNumChannels() << " channels, " << shared->getBufferSize()
+                      << " samples at " << shared->getSampleRate() << " Hz, sample clock "
+                      << shared->getTotalSamplesWritten() << ", last write "
+                      << String (shared->getSecondsSinceLastWrite() * 1000.0, 1) << " ms ago" << std::endl
+                      << r.reads << " reads (" << r.flaggedReads << " overlapped by the writer), "
+                      << r.frames << " analysis frames" << std::endl;
+        }
+
+        return 0;
+    }
+};
@@ -0,0 +1,356 @@
+//
+//  SignalGenerator.h
+//  3DAudioVisualizers
+//
+//  Deterministic test signals for streams, benchmarks and regression runs.
+//
+
+#pragma once
+
+#include "../JuceLibraryCode/JuceHeader.h"
+#include "AudioStream.h"
+
+/** Renders one of a fixed set of synthetic test signals.
+
+    The output only depends on the type, the settings, the seed and the
+    sample rate, so two runs with the same parameters produce bit-identical
+    audio on the same build. Noise comes from a counter-based hash rather than
+    a stateful random generator for the same reason.
+
+    The inner loops are written as independent per-sample operations over
+    whole blocks (phase ramps, polynomial sine, hashed noise) so the compiler
+    can vectorise them. Only the pink noise filter is inherently serial.
+ */
+class SignalGenerator
+{
+public:
+    enum Type
+    {
+        sineSweep = 0,      // Exponential sweep up and down between the low and high frequency
+        multitone,          // numTones log-spaced sines with Schroeder phases
+        whiteNoise,
+        pinkNoise,          // White noise through a -3 dB/octave filter
+        impulseTrain,       // Single-sample impulses at impulseRateHz
+        countingRamp,       // Sample clock modulo 65536, scaled to [-1, 1); exact in float
+        numTypes
+    };
+
+    struct Settings
+    {
+        float level = 0.5f;                 // Peak level, not applied to countingRamp
+        double lowFrequency = 100.0;
+        double highFrequency = 3200.0;
+        double sweepSeconds = 10.0;         // One full up-and-down sweep
+        double impulseRateHz = 10.0;
+        uint32 seed = 1;
+    };
+
+    SignalGenerator (Type generatorType)
+    :   SignalGenerator (generatorType, Settings())
+    {
+    }
+
+    SignalGenerator (Type generatorType, const Settings& generatorSettings)
+    :   type (generatorType),
+        settings (generatorSettings)
+    {
+        reset();
+    }
+
+    //==========================================================================
+    static const char* getTypeName (Type t)
+    {
+        switch (t)
+        {
+            case sineSweep:     return "sweep";
+            case multitone:     return "multitone";
+            case whiteNoise:    return "white";
+            case pinkNoise:     return "pink";
+            case impulseTrain:  return "impulse";
+            case countingRamp:  return "ramp";
+            default:            break;
+        }
+
+        return "";
+    }
+
+    /** Looks up a type by the name getTypeName() returns. Returns numTypes if
+        the name is unknown.
+     */
+    static Type findType (const String& name)
+    {
+        for (int i = 0; i < numTypes; ++i)
+            if (name.equalsIgnoreCase (getTypeName ((Type) i)))
+                return (Type) i;
+
+        return numTypes;
+    }
+
+    static String getTypeNames()
+    {
+        StringArray names;
+
+        for (int i = 0; i < numTypes; ++i)
+            names.add (getTypeName ((Type) i));
+
+        return names.joinIntoString ("|");
+    }
+
+    Type getType() const                { return type; }
+    const Settings& getSettings() const { return settings; }
+
+    //==========================================================================
+    /** Allocates the work buffers. render() may then be called with up to
+        maximumBlockSize samples at a time without allocating.
+     */
+    void prepare (double newSampleRate, int maximumBlockSize)
+    {
+        sampleRate = newSampleRate;
+        work.setSize (2, jmax (1, maximumBlockSize), false, false, true);
+        reset();
+    }
+
+    /** Restarts the signal from sample zero.
+     */
+    void reset()
+    {
+        clock = 0;
+        sweepPosition = 0.0;
+        samplesUntilImpulse = 0;
+        pinkState[0] = pinkState[1] = pinkState[2] = 0.0f;
+
+        for (int k = 0; k < numTones; ++k)
+        {
+            // Schroeder phases keep the crest factor of the sum low
+            const double schroeder = -0.5 * k * (k - 1) / (double) numTones;
+            tonePhases[k] = schroeder - std::floor (schroeder);
+        }
+
+        sweepPhase = 0.0;
+    }
+
+    /** Renders the next numSamples into dest.
+     */
+    void render (float* dest, int numSamples)
+    {
+        while (numSamples > 0)
+        {
+            const int n = jmin (numSamples, work.getNumSamples());
+
+            switch (type)
+            {
+                case sineSweep:     renderSweep (dest, n); break;
+                case multitone:     renderMultitone (dest, n); break;
+                case whiteNoise:    renderWhiteNoise (dest, n); break;
+                case pinkNoise:     renderPinkNoise (dest, n); break;
+                case impulseTrain:  renderImpulses (dest, n); break;
+                case countingRamp:  renderRamp (dest, n); break;
+                default:            FloatVectorOperations::clear (dest, n); break;
+            }
+
+            clock += n;
+            dest += n;
+            numSamples -= n;
+        }
+    }
+
+    /** Number of samples rendered since the last reset().
+     */
+    int64 getSampleClock() const    { return clock; }
+
+private:
+    //==========================================================================
+    void renderSweep (float* dest, int n)
+    {
+        // The phase increment is interpolated linearly across the block, which
+        // keeps the per-sample phase a closed form of i
+        const double startIncrement = sweepFrequency (sweepPosition) / sampleRate;
+        sweepPosition += n / (settings.sweepSeconds * sampleRate);
+        sweepPosition -= std::floor (sweepPosition);
+        const double endIncrement = sweepFrequency (sweepPosition) / sampleRate;
+
+        const float p0 = (float) sweepPhase;
+        const float inc = (float) startIncrement;
+        const float curve = (float) (0.5 * (endIncrement - startIncrement) / n);
+
+        for (int i = 0; i < n; ++i)
+            dest[i] = p0 + i * (inc + curve * i);
+
+        sinCycles (dest, n);
+        FloatVectorOperations::multiply (dest, settings.level, n);
+
+        sweepPhase += n * 0.5 * (startIncrement + endIncrement);
+        sweepPhase -= std::floor (sweepPhase);
+    }
+
+    double sweepFrequency (double position) const
+    {
+        const double triangle = 1.0 - std::abs (2.0 * position - 1.0);
+        const double octaves = std::log2 (settings.highFrequency / settings.lowFrequency);
+        return settings.lowFrequency * std::pow (2.0, octaves * triangle);
+    }
+
+    void renderMultitone (float* dest, int n)
+    {
+        auto* phases = work.getWritePointer (0);
+        const double octaves = std::log2 (settings.highFrequency / settings.lowFrequency);
+        const float gain = settings.level / numTones;
+
+        FloatVectorOperations::clear (dest, n);
+
+        for (int k = 0; k < numTones; ++k)
+        {
+            const double frequency = settings.lowFrequency * std::pow (2.0, octaves * k / (numTones - 1));
+            const double increment = frequency / sampleRate;
+            const float p0 = (float) tonePhases[k];
+            const float inc = (float) increment;
+
+            for (int i = 0; i < n; ++i)
+                phases[i] = p0 + i * inc;
+
+            sinCycles (phases, n);
+            FloatVectorOperations::addWithMultiply (dest, phases, gain, n);
+
+            tonePhases[k] += n * increment;
+            tonePhases[k] -= std::floor (tonePhases[k]);
+        }
+    }
+
+    void renderWhiteNoise (float* dest, int n)
+    {
+        hashNoise (dest, n);
+        FloatVectorOperations::multiply (dest, settings.level, n);
+    }
+
+    void renderPinkNoise (float* dest, int n)
+    {
+        hashNoise (dest, n);
+
+        // Paul Kellet's economy filter, accurate to about 0.5 dB above 10 Hz
+        float b0 = pinkState[0], b1 = pinkState[1], b2 = pinkState[2];
+        const float gain = settings.level * 0.25f;
+
+        for (int i = 0; i < n; ++i)
+        {
+            const float white = dest[i];
+            b0 = 0.99765f * b0 + white * 0.0990460f;
+            b1 = 0.96300f * b1 + white * 0.2965164f;
+            b2 = 0.57000f * b2 + white * 1.0526913f;
+            dest[i] = (b0 + b1 + b2 + white * 0.1848f) * gain;
+        }
+
+        pinkState[0] = b0; pinkState[1] = b1; pinkState[2] = b2;
+    }
+
+    void renderImpulses (float* dest, int n)
+    {
+        const int64 period = jmax ((int64) 1, (int64) std::llround (sampleRate / settings.impulseRateHz));
+
+        FloatVectorOperations::clear (dest, n);
+
+        while (samplesUntilImpulse < n)
+        {
+            dest[samplesUntilImpulse] = settings.level;
+            samplesUntilImpulse += period;
+        }
+
+        samplesUntilImpulse -= n;
+    }
+
+    void renderRamp (float* dest, int n)
+    {
+        const uint32 start = (uint32) clock;
+
+        for (int i = 0; i < n; ++i)
+            dest[i] = (float) ((start + (uint32) i) & 0xffff) * (1.0f / 32768.0f) - 1.0f;
+    }
+
+    /** Fills dest with uniform noise in [-1, 1) that depends only on the seed
+        and the sample clock.
+     */
+    void hashNoise (float* dest, int n) const
+    {
+        const uint32 start = (uint32) clock + settings.seed * 0x9e3779b9u;
+
+        for (int i = 0; i < n; ++i)
+        {
+            uint32 h = start + (uint32) i;
+            h ^= h >> 16; h *= 0x85ebca6bu;
+            h ^= h >> 13; h *= 0xc2b2ae35u;
+            h ^= h >> 16;
+
+            dest[i] = (float) (int32) h * (1.0f / 2147483648.0f);
+        }
+    }
+
+    /** Replaces each phase (in cycles) with sin (2 pi phase). Folds into
+        [-1/4, 1/4] cycles and uses an odd polynomial; error is below 1e-6.
+     */
+    static void sinCycles (float* data, int n)
+    {
+        for (int i = 0; i < n; ++i)
+        {
+            float t = data[i] - std::floor (data[i] + 0.5f);    // [-0.5, 0.5)
+            t = t > 0.25f ? 0.5f - t : (t < -0.25f ? -0.5f - t : t);
+
+            const float x = t * MathConstants<float>::twoPi;
+            const float x2 = x * x;
+
+            data[i] = x * (1.0f + x2 * (-1.0f / 6.0f + x2 * (1.0f / 120.0f
+                        + x2 * (-1.0f / 5040.0f + x2 * (1.0f / 362880.0f + x2 * (-1.0f / 39916800.0f))))));
+        }
+    }
+
+    enum
+    {
+        numTones = 8
+    };
+
+    Type type;
+    Settings settings;
+    double sampleRate = 44100.0;
+    AudioBuffer<float> work;
+
+    int64 clock = 0;
+    double sweepPosition = 0.0, sweepPhase = 0.0;
+    double tonePhases[numTones];
+    int64 samplesUntilImpulse = 0;
+    float pinkState[3];
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (SignalGenerator)
+};
+
+//==============================================================================
+/** A StreamSource that plays a SignalGenerator into both channels.
+ */
+class GeneratorSource : public StreamSource
+{
+public:
+    GeneratorSource (SignalGenerator::Type type,
+                     const SignalGenerator::Settings& settings = SignalGenerator::Settings())
+    :   generator (type, settings)
+    {
+    }
+
+    void prepare (int samplesPerBlockExpected, double sampleRate) override
+    {
+        generator.prepare (sampleRate, samplesPerBlockExpected);
+        scratch.setSize (2, samplesPerBlockExpected);
+    }
+
+    void processBlock (const AudioSourceChannelInfo& deviceInput,
+                       RingBuffer<float>& ringBuffer) override
+    {
+        const int numSamples = jmin (deviceInput.numSamples, scratch.getNumSamples());
+
+        generator.render (scratch.getWritePointer (0), numSamples);
+        scratch.copyFrom (1, 0, scratch, 0, 0, numSamples);
+        ringBuffer.writeSamples (scratch, 0, numSamples);
+    }
+
+    SignalGenerator& getGenerator()    { return generator; }
+
+private:
+    SignalGenerator generator;
+    AudioBuffer<float> scratch;
+};
@@ -0,0 +1,492 @@
+//
+//  Spectrogram.h
+//  3DAudioVisualizers
+//
+//  Scrolling spectrogram drawn from a float history texture and a colormap.
+//
+
+#pragma once
+
+#include "../JuceLibraryCode/JuceHeader.h"
+#include <GL/glew.h>
+#include "SpectrumBands.h"
+#include "SpectrumProcessor.h"
+#include "ShaderCache.h"
+#include "ShaderLibrary.h"
+#include "ScratchArena.h"
+#include "GlewInit.h"
+#include "Trace.h"
+
+/** Spectrogram visualizer: time runs left to right, frequency bottom to top.
+
+    The history lives on the GPU in a 2D float texture with one column per
+    analysis frame and one row per bin. Each new frame replaces the oldest
+    column with a single glTexSubImage2D call, and the whole view is one quad
+    whose fragment shader reads the texture at a circular offset, so nothing
+    is ever scrolled or re-uploaded. The shader maps dB to a colour through a
+    256 entry colormap texture.
+
+    The texture stores dB, so setScale()'s range recolours the whole history
+    at once, while its view only applies to new columns. Every bin of a frame
+    gets its own row, so bins are drawn at full resolution, but frames carry
+    at most AnalysisFrame::maxBins (512): all of the 1024 point FFT, or the
+    constant-Q octaves that fit. The texture would take up to
+    GL_MAX_TEXTURE_SIZE rows; going past 512 means widening AnalysisFrame,
+    and with it recordings, shared memory and the analysis server. Linear FFT
+    frames are drawn on a logarithmic frequency axis, constant-Q frames as
+    they are.
+ */
+class Spectrogram : public Component,
+                    public OpenGLRenderer,
+                    public AsyncUpdater
+{
+public:
+    enum
+    {
+        historyLength = 1024,   // Columns of history, about 17 s at 60 frames per second
+        colormapSize = 256
+    };
+
+    Spectrogram (AnalysisFrameExchange* analysisToDraw, ScratchArena& scratch)
+    {
+        openGLContext.setOpenGLVersionRequired (OpenGLContext::OpenGLVersion::openGL3_2);
+
+        analysis = analysisToDraw;
+
+        // One row of silence clears the history texture for any number of bins
+        silenceRow = scratch.allocate<GLfloat> (historyLength);
+        FloatVectorOperations::fill (silenceRow, SpectrumProcessor::floorDb, historyLength);
+
+        // Attach the OpenGL context but do not start [ see start() ]
+        openGLContext.setRenderer (this);
+        openGLContext.attachTo (*this);
+
+        addAndMakeVisible (statusLabel);
+        statusLabel.setJustificationType (Justification::topLeft);
+        statusLabel.setFont (Font (14.0f));
+        statusLabel.setText ("Starting OpenGL...", dontSendNotification);    // Until the shaders are ready
+    }
+
+    ~Spectrogram()
+    {
+        openGLContext.setContinuousRepainting (false);
+        openGLContext.detach();
+    }
+
+    void handleAsyncUpdate() override
+    {
+        statusLabel.setText (statusText, dontSendNotification);
+    }
+
+    //==========================================================================
+    // Spectrogram Control Functions
+
+    void start()
+    {
+        openGLContext.setContinuousRepainting (true);
+    }
+
+    void stop()
+    {
+        openGLContext.setContinuousRepainting (false);
+    }
+
+    /** Switches to the analysis of a different stream. Safe to call while
+        rendering; the history restarts with the new stream's first frame.
+     */
+    void setAnalysis (AnalysisFrameExchange* newAnalysis)
+    {
+        analysis = newAnalysis;
+    }
+
+    /** Chooses the dB spectrum new columns are taken from and the dB range
+        the colormap spans. Safe to call while rendering.
+     */
+    void setScale (const SpectrumBands::Scale& newScale)
+    {
+        const SpinLock::ScopedLockType sl (scaleLock);
+        scale = newScale;
+    }
+
+    /** Lets library replace the shader with one loaded from files.
+     */
+    void addShaders (ShaderLibrary& library)
+    {
+        library.addShader ("Spectrogram", shaderSlot, openGLContext, false);
+    }
+
+    /** Changes whenever the stream publishes a new analysis frame. See
+        FrameScheduler.
+     */
+    int64 getContentVersion() const
+    {
+        auto* source = analysis.get();
+        return source != nullptr ? (int64) source->getSequence() : 0;
+    }
+
+    OpenGLContext& getOpenGLContext() noexcept  { return openGLContext; }
+
+    //==========================================================================
+    // OpenGL Callbacks
+
+    void newOpenGLContextCreated() override
+    {
+        Trace::setThreadName ("OpenGL Spectrogram");
+        TOWEL_TRACE_ZONE ("Spectrogram::newOpenGLContextCreated");
+
+        const auto glew = initialiseGlew();
+        glewLoaded = glew.wasOk();
+
+        if (glew.failed())
+        {
+            statusText = glew.getErrorMessage();
+            triggerAsyncUpdate();
+            return;
+        }
+
+        glGetIntegerv (GL_MAX_TEXTURE_SIZE, &maxTextureSize);
+
+        // One quad covering the viewport, drawn as a triangle strip
+        const GLfloat quad[] = { -1.0f, -1.0f,   1.0f, -1.0f,   -1.0f, 1.0f,   1.0f, 1.0f };
+
+        glGenVertexArrays (1, &quadVAO);
+        glBindVertexArray (quadVAO);
+
+        glGenBuffers (1, &quadVBO);
+        glBindBuffer (GL_ARRAY_BUFFER, quadVBO);
+        glBufferData (GL_ARRAY_BUFFER, sizeof (quad), quad, GL_STATIC_DRAW);
+        glVertexAttribPointer (0, 2, GL_FLOAT, GL_FALSE, 2 * sizeof (GLfloat), nullptr);
+        glEnableVertexAttribArray (0);
+
+        glBindVertexArray (0);
+        glBindBuffer (GL_ARRAY_BUFFER, 0);
+
+        createColormap();
+        createShaders();
+    }
+
+    void openGLContextClosing() override
+    {
+        if (! glewLoaded)
+            return;
+
+        shader.reset();
+        uniforms.reset();
+
+        glDeleteTextures (1, &historyTexture);
+        glDeleteTextures (1, &colormapTexture);
+        glDeleteBuffers (1, &quadVBO);
+        glDeleteVertexArrays (1, &quadVAO);
+
+        historyTexture = colormapTexture = quadVBO = quadVAO = 0;
+        numRows = 0;
+    }
+
+    void renderOpenGL() override
+    {
+        TOWEL_TRACE_ZONE ("Spectrogram::renderOpenGL");
+        jassert (OpenGLHelpers::isContextActive());
+
+        if (! glewLoaded)
+        {
+            OpenGLHelpers::clear (Colours::black);
+            return;
+        }
+
+        updateShaders();
+
+        // Past the shader swap the frame never allocates, not even when the history is resized
+        const ScopedNoHeapAllocation noAllocation;
+
+        const float renderingScale = (float) openGLContext.getRenderingScale();
+        glViewport (0, 0, roundToInt (renderingScale * getWidth()), roundToInt (renderingScale * getHeight()));
+
+        OpenGLHelpers::clear (Colours::black);
+
+        if (shader == nullptr)
+            return;
+
+        SpectrumBands::Scale currentScale;
+        {
+            const SpinLock::ScopedLockType sl (scaleLock);
+            currentScale = scale;
+        }
+
+        auto* source = analysis.get();
+
+        if (source != lastSource)
+        {
+            // Another stream: forget the old stream's history
+            lastSource = source;
+            lastFrameSequence = 0;
+            numRows = 0;
+        }
+
+        if (source != nullptr && source->getSequence() != lastFrameSequence)
+        {
+            lastFrameSequence = source->getSequence();
+
+            if (source->read (frame) && frame.numBins > 0)
+                addColumn (currentScale.view);
+        }
+
+        if (numRows == 0 || currentScale.maxDb <= currentScale.minDb)
+            return;
+
+        shader->use();
+
+        glActiveTexture (GL_TEXTURE0);
+        glBindTexture (GL_TEXTURE_2D, historyTexture);
+        glActiveTexture (GL_TEXTURE1);
+        glBindTexture (GL_TEXTURE_1D, colormapTexture);
+
+        setUniform (uniforms->history, (GLint) 0);
+        setUniform (uniforms->colormap, (GLint) 1);
+        setUniform (uniforms->offset, (GLfloat) nextColumn);
+        setUniform (uniforms->minDb, currentScale.minDb);
+        setUniform (uniforms->maxDb, currentScale.maxDb);
+        setUniform (uniforms->logFrequency, (GLint) (logFrequency ? 1 : 0));
+
+        glBindVertexArray (quadVAO);
+        glDrawArrays (GL_TRIANGLE_STRIP, 0, 4);
+        glBindVertexArray (0);
+
+        glBindTexture (GL_TEXTURE_1D, 0);
+        glActiveTexture (GL_TEXTURE0);
+        glBindTexture (GL_TEXTURE_2D, 0);
+    }
+
+    //==========================================================================
+    // JUCE Callbacks
+
+    void paint (Graphics&) override {}
+
+    void resized() override
+    {
+        statusLabel.setBounds (getLocalBounds().reduced (4).removeFromTop (75));
+    }
+
+private:
+    //==========================================================================
+    /** Writes frame over the oldest column, reallocating the history when the
+        number of bins changes.
+     */
+    void addColumn (SpectrumBands::View view)
+    {
+        const int rows = jmin (frame.numBins, (int) maxTextureSize);
+
+        if (rows != numRows)
+            createHistory (rows);
+
+        logFrequency = frame.binsPerOctave == 0;
+
+        glBindTexture (GL_TEXTURE_2D, historyTexture);
+        glPixelStorei (GL_UNPACK_ALIGNMENT, 4);
+        glTexSubImage2D (GL_TEXTURE_2D, 0, nextColumn, 0, 1, numRows, GL_RED, GL_FLOAT,
+                         SpectrumBands::getSpectrum (frame, view));
+        glBindTexture (GL_TEXTURE_2D, 0);
+
+        nextColumn = (nextColumn + 1) % historyLength;
+    }
+
+    /** (Re)allocates the history texture for rows bins, filled with silence.
+     */
+    void createHistory (int rows)
+    {
+        if (historyTexture == 0)
+            glGenTextures (1, &historyTexture);
+
+        glBindTexture (GL_TEXTURE_2D, historyTexture);
+        glPixelStorei (GL_UNPACK_ALIGNMENT, 4);
+        glTexImage2D (GL_TEXTURE_2D, 0, GL_R32F, historyLength, rows, 0, GL_RED, GL_FLOAT, nullptr);
+
+        for (int row = 0; row < rows; ++row)
+            glTexSubImage2D (GL_TEXTURE_2D, 0, 0, row, historyLength, 1, GL_RED, GL_FLOAT, silenceRow);
+
+        // Time wraps around at the circular offset, frequency does not
+        glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+        glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glBindTexture (GL_TEXTURE_2D, 0);
+
+        numRows = rows;
+        nextColumn = 0;
+    }
+
+    /** Fills the colormap texture: black through purple, red and orange to
+        pale yellow, so level reads as brightness.
+     */
+    void createColormap()
+    {
+        ColourGradient gradient;
+        gradient.addColour (0.0,  Colour (0xff000004));
+        gradient.addColour (0.25, Colour (0xff3b0f70));
+        gradient.addColour (0.5,  Colour (0xff8c2981));
+        gradient.addColour (0.75, Colour (0xfffe9f6d));
+        gradient.addColour (1.0,  Colour (0xfffcfdbf));
+
+        uint8 texels[colormapSize * 4];
+
+        for (int i = 0; i < colormapSize; ++i)
+        {
+            const auto c = gradient.getColourAtPosition (i / (double) (colormapSize - 1));
+            texels[4 * i]     = c.getRed();
+            texels[4 * i + 1] = c.getGreen();
+            texels[4 * i + 2] = c.getBlue();
+            texels[4 * i + 3] = 255;
+        }
+
+        glGenTextures (1, &colormapTexture);
+        glBindTexture (GL_TEXTURE_1D, colormapTexture);
+        glTexImage1D (GL_TEXTURE_1D, 0, GL_RGBA8, colormapSize, 0, GL_RGBA, GL_UNSIGNED_BYTE, texels);
+        glTexParameteri (GL_TEXTURE_1D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri (GL_TEXTURE_1D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri (GL_TEXTURE_1D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glBindTexture (GL_TEXTURE_1D, 0);
+    }
+
+    void createShaders()
+    {
+        TOWEL_TRACE_ZONE ("Spectrogram::createShaders");
+
+        const char* vertexShader =
+            "#version 330 core\n"
+            "layout (location = 0) in vec2 position;\n"
+            "out vec2 uv;\n"
+            "void main()\n"
+            "{\n"
+            "    uv = position * 0.5 + 0.5;\n"
+            "    gl_Position = vec4 (position, 0.0, 1.0);\n"
+            "}\n";
+
+        // x runs from the centre of the oldest column (offset) to the centre
+        // of the newest; y from the lowest bin to the highest,
+        // logarithmically for linear FFT bins
+        const char* fragmentShader =
+            "#version 330 core\n"
+            "in vec2 uv;\n"
+            "out vec4 color;\n"
+            "uniform sampler2D history;\n"
+            "uniform sampler1D colormap;\n"
+            "uniform float offset;\n"
+            "uniform float minDb;\n"
+            "uniform float maxDb;\n"
+            "uniform int logFrequency;\n"
+            "void main()\n"
+            "{\n"
+            "    vec2 size = vec2 (textureSize (history, 0));\n"
+            "    float column = offset + uv.x * (size.x - 1.0) + 0.5;\n"
+            "    float bin = logFrequency != 0 ? pow (size.y, uv.y) - 1.0 : uv.y * (size.y - 1.0);\n"
+            "    float db = texture (history, vec2 (column / size.x, (bin + 0.5) / size.y)).r;\n"
+            "    float level = clamp ((db - minDb) / (maxDb - minDb), 0.0, 1.0);\n"
+            "    color = texture (colormap, (level * 255.0 + 0.5) / 256.0);\n"
+            "}\n";
+
+        ShaderCache::Program program;
+        program.vertexShader = vertexShader;
+        program.fragmentShader = fragmentShader;
+        shaderSlot.contextCreated (program);
+
+        String error;
+
+        if (auto shaderProgram = shaderCache->getProgram (openGLContext, program, error))
+        {
+            uniforms.reset();
+            shader = std::move (shaderProgram);
+            uniforms = std::make_unique<Uniforms> (*shader);
+            statusText = "";
+        }
+        else
+        {
+            statusText = error;
+        }
+
+        triggerAsyncUpdate();
+    }
+
+    /** Swaps in a program rebuilt from edited shader files. See ShaderLibrary.
+     */
+    void updateShaders()
+    {
+        ShaderCache::Program program;
+        String error;
+
+        if (! shaderSlot.takeUpdate (program, error))
+            return;
+
+        if (auto shaderProgram = error.isEmpty() ? shaderCache->getProgram (openGLContext, program, error) : nullptr)
+        {
+            uniforms.reset();
+            shader = std::move (shaderProgram);
+            uniforms = std::make_unique<Uniforms> (*shader);
+        }
+
+        statusText = error;
+        triggerAsyncUpdate();
+    }
+
+    //==========================================================================
+    struct Uniforms
+    {
+        Uniforms (OpenGLShaderProgram& shaderProgram)
+        {
+            history = createUniform (shaderProgram, "history");
+            colormap = createUniform (shaderProgram, "colormap");
+            offset = createUniform (shaderProgram, "offset");
+            minDb = createUniform (shaderProgram, "minDb");
+            maxDb = createUniform (shaderProgram, "maxDb");
+            logFrequency = createUniform (shaderProgram, "logFrequency");
+        }
+
+        std::unique_ptr<OpenGLShaderProgram::Uniform> history, colormap, offset, minDb, maxDb, logFrequency;
+
+    private:
+        static std::unique_ptr<OpenGLShaderProgram::Uniform> createUniform (OpenGLShaderProgram& shaderProgram,
+                                                                            const char* uniformName)
+        {
+            if (glGetUniformLocation (shaderProgram.getProgramID(), uniformName) < 0)
+                return nullptr;
+
+            return std::make_unique<OpenGLShaderProgram::Uniform> (shaderProgram, uniformName);
+        }
+    };
+
+    template <typename ValueType>
+    static void setUniform (const std::unique_ptr<OpenGLShaderProgram::Uniform>& uniform, ValueType value)
+    {
+        if (uniform != nullptr)
+            uniform->set (value);
+    }
+
+    // OpenGL Variables
+    OpenGLContext openGLContext;
+    bool glewLoaded = false;                    // OpenGL thread only; without GLEW no GL call is made
+    GLuint quadVAO = 0, quadVBO = 0;
+    GLuint historyTexture = 0, colormapTexture = 0;
+    GLint maxTextureSize = 1024;
+    SharedResourcePointer<ShaderCache> shaderCache;
+    std::shared_ptr<OpenGLShaderProgram> shader;
+    std::unique_ptr<Uniforms> uniforms;
+    ShaderSlot shaderSlot;              // Shader files, see addShaders()
+
+    // History, only touched on the OpenGL thread
+    int numRows = 0;            // Bins per column; 0 until the first frame
+    int nextColumn = 0;         // The oldest column, overwritten next
+    bool logFrequency = true;
+    GLfloat* silenceRow = nullptr;  // historyLength floors, in the pipeline's ScratchArena
+
+    // Analysis Structures
+    Atomic<AnalysisFrameExchange*> analysis;    // Swapped by setAnalysis() on the message thread
+    AnalysisFrameExchange* lastSource = nullptr;
+    AnalysisFrame frame;
+    uint32 lastFrameSequence = 0;
+    SpinLock scaleLock;
+    SpectrumBands::Scale scale;                 // Guarded by scaleLock, see setScale()
+
+    // Overlay GUI
+    String statusText;
+    Label statusLabel;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (Spectrogram)
+};
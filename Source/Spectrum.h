@@ -10,11 +10,23 @@
 
 #include "../JuceLibraryCode/JuceHeader.h"
 #include <GL/glew.h>                        // GLEW header
-#include "RingBuffer.h"
+#include "SpectrumBands.h"
+#include "Phosphor.h"
+#include "ShaderCache.h"
+#include "ShaderLibrary.h"
+#include "ScratchArena.h"
+#include "GlewInit.h"
+#include "Trace.h"
 
 /** Frequency Spectrum visualizer. Uses basic shaders, and calculates all points
     on the CPU as opposed to the OScilloscope3D which calculates points on the
     GPU.
+ 
+    The FFT itself is not computed here: the Spectrum draws the AnalysisFrames
+    its stream's StreamAnalyzer publishes on the analysis thread pool, and adds
+    a new row to the history every time a new frame arrives. Heights come from
+    the frame's dB spectra over a fixed range (see setScale()), not from each
+    frame's own peak.
  */
 
 class Spectrum :    public Component,
@@ -23,21 +35,29 @@ class Spectrum :    public Component,
 {
     
 public:
-    Spectrum (RingBuffer<GLfloat> * ringBuffer)
-    :   readBuffer (2, RING_BUFFER_READ_SIZE),
-        forwardFFT (fftOrder)
+    Spectrum (AnalysisFrameExchange * analysis, ScratchArena& scratch)
     {
         // Sets the version to 3.2
         openGLContext.setOpenGLVersionRequired (OpenGLContext::OpenGLVersion::openGL3_2);
      
-        this->ringBuffer = ringBuffer;
+        this->analysis = analysis;
+        
+        // Setup Sizing Variables
+        xFreqWidth = 3.0f;
+        yAmpHeight = 1.0f;
+        zTimeDepth = 3.0f;
+        xFreqResolution = 50;
+        zTimeResolution = 60;
+        
+        numVertices = xFreqResolution * zTimeResolution;
+        
+        // Vertex memory for every context this component will have, so rendering never allocates
+        xzVertices = scratch.allocate<GLfloat> ((size_t) numVertices * 2);
+        yVertices = scratch.allocate<GLfloat> ((size_t) numVertices);
         
         // Set default 3D orientation
         draggableOrientation.reset(Vector3D<float>(0.0, 1.0, 0.0));
         
-        // Allocate FFT data
-        fftData = new GLfloat [2 * fftSize];
-        
         // Attach the OpenGL context but do not start [ see start() ]
         openGLContext.setRenderer(this);
         openGLContext.attachTo(*this);
@@ -46,6 +66,7 @@ public:
         addAndMakeVisible (statusLabel);
         statusLabel.setJustificationType (Justification::topLeft);
         statusLabel.setFont (Font (14.0f));
+        statusLabel.setText ("Starting OpenGL...", dontSendNotification);    // Until the shaders are ready
     }
     
     ~Spectrum()
@@ -54,10 +75,8 @@ public:
         openGLContext.setContinuousRepainting (false);
         openGLContext.detach();
         
-        delete [] fftData;
-        
-        // Detach ringBuffer
-        ringBuffer = nullptr;
+        // Detach analysis
+        analysis = nullptr;
     }
     
     void handleAsyncUpdate() override
@@ -78,6 +97,48 @@ public:
         openGLContext.setContinuousRepainting (false);
     }
     
+    /** Switches to the analysis of a different stream. Safe to call while
+        rendering; the new stream is picked up on the next frame.
+     */
+    void setAnalysis (AnalysisFrameExchange * newAnalysis)
+    {
+        analysis = newAnalysis;
+    }
+    
+    /** Chooses which of the frames' dB spectra is drawn and which dB range
+        fills the height. Safe to call while rendering.
+     */
+    void setScale (const SpectrumBands::Scale& newScale)
+    {
+        const SpinLock::ScopedLockType sl (scaleLock);
+        scale = newScale;
+    }
+    
+    /** Turns trails on or off. See Phosphor.
+     */
+    void setPhosphor (const Phosphor::Settings& settings)
+    {
+        phosphor.setSettings (settings);
+    }
+    
+    /** Lets library replace the shader with one loaded from files.
+     */
+    void addShaders (ShaderLibrary& library)
+    {
+        library.addShader ("Spectrum", shaderSlot, openGLContext, false);
+    }
+    
+    /** Changes whenever the stream publishes a new analysis frame. See
+        FrameScheduler.
+     */
+    int64 getContentVersion() const
+    {
+        auto* source = analysis.get();
+        return source != nullptr ? (int64) source->getSequence() : 0;
+    }
+    
+    OpenGLContext& getOpenGLContext() noexcept  { return openGLContext; }
+    
     
     //==========================================================================
     // OpenGL Callbacks
@@ -87,27 +148,20 @@ public:
         Sets up GL objects that are needed for rendering.*/
 void newOpenGLContextCreated() override
 {
+    Trace::setThreadName("OpenGL Spectrum");
+    TOWEL_TRACE_ZONE("Spectrum::newOpenGLContextCreated");
+
     // Initialize GLEW
-    glewExperimental = GL_TRUE;  // Ensure modern OpenGL functionality
-    GLenum err = glewInit();     // Initialize GLEW
+    const auto glew = initialiseGlew();
+    glewLoaded = glew.wasOk();
 
-    if (GLEW_OK != err)
+    if (glew.failed())
     {
-        DBG("GLEW Initialization failed: " + String((const char*)glewGetErrorString(err)));
+        statusText = glew.getErrorMessage();
+        triggerAsyncUpdate();
         return;
     }
 
-    DBG("GLEW Initialized successfully");
-
-    // Setup Sizing Variables
-    xFreqWidth = 3.0f;
-    yAmpHeight = 1.0f;
-    zTimeDepth = 3.0f;
-    xFreqResolution = 50;
-    zTimeResolution = 60;
-
-    numVertices = xFreqResolution * zTimeResolution;
-
     // Initialize XZ Vertices
     initializeXZVertices();
 
@@ -157,6 +211,7 @@ void newOpenGLContextCreated() override
 
     // Setup Shaders
     createShaders();
+    phosphor.create(openGLContext);
 }
 
 
@@ -166,11 +221,12 @@ void newOpenGLContextCreated() override
      */
     void openGLContextClosing() override
     {
-        shader.release();
-        uniforms.release();
+        if (! glewLoaded)
+            return;
         
-        delete [] xzVertices;
-        delete [] yVertices;
+        uniforms.reset();
+        shader.reset();
+        phosphor.release();
     }
     
     
@@ -178,14 +234,44 @@ void newOpenGLContextCreated() override
      */
 void renderOpenGL() override
 {
+    TOWEL_TRACE_ZONE("Spectrum::renderOpenGL");
     jassert(OpenGLHelpers::isContextActive());
 
+    if (! glewLoaded)
+    {
+        OpenGLHelpers::clear(getLookAndFeel().findColour(ResizableWindow::backgroundColourId));
+        return;
+    }
+
+    updateShaders();
+
     // Setup the viewport according to the window size and device scaling
     const float renderingScale = (float) openGLContext.getRenderingScale();
-    glViewport(0, 0, roundToInt(renderingScale * getWidth()), roundToInt(renderingScale * getHeight()));
+    const int width = roundToInt(renderingScale * getWidth());
+    const int height = roundToInt(renderingScale * getHeight());
+
+    // With trails on, this frame is drawn over the faded previous ones
+    if (! phosphor.beginFrame(width, height))
+    {
+        phosphor.endFrame();
+        return;
+    }
+
+    // Shaders and trails are set up by now; the rest of the frame never allocates
+    const ScopedNoHeapAllocation noAllocation;
+
+    glViewport(0, 0, width, height);
 
     // Clear the background with a predefined color
-    OpenGLHelpers::clear(getLookAndFeel().findColour(ResizableWindow::backgroundColourId));
+    if (! phosphor.isActive() || shader == nullptr)
+        OpenGLHelpers::clear(getLookAndFeel().findColour(ResizableWindow::backgroundColourId));
+
+    // The shader did not compile: its error is in the status text
+    if (shader == nullptr)
+    {
+        phosphor.endFrame();
+        return;
+    }
 
     // Enable blending to smooth out the rendering
     glEnable(GL_BLEND);
@@ -194,40 +280,37 @@ void renderOpenGL() override
     // Activate the shader program
     shader->use();
 
-    // Retrieve samples from the ring buffer and clear the FFT data array
-    ringBuffer->readSamples(readBuffer, RING_BUFFER_READ_SIZE);
-    FloatVectorOperations::clear(fftData, 2 * fftSize);
+    // Only scroll the history when the analysis thread published a new frame
+    auto* source = analysis.get();
 
-    // Sum audio samples across channels for FFT processing
-    for (int i = 0; i < readBuffer.getNumChannels(); ++i)
+    if (source != nullptr && source->getSequence() != lastFrameSequence)
     {
-        FloatVectorOperations::add(fftData, readBuffer.getReadPointer(i), RING_BUFFER_READ_SIZE);
-    }
+        lastFrameSequence = source->getSequence();
 
-    // Perform the FFT
-    forwardFFT.performFrequencyOnlyForwardTransform(fftData);
+        if (source->read(frame) && frame.numBins > 0)
+        {
+            // Update vertex positions based on FFT results, with special attention to properly clear old data
+            for (int z = zTimeResolution - 1; z > 0; --z) {
+                for (int x = 0; x < xFreqResolution; ++x) {
+                    yVertices[z * xFreqResolution + x] = yVertices[(z - 1) * xFreqResolution + x];
+                }
+            }
 
-    // Compute the maximum FFT level for scaling
-    Range<float> maxFFTLevel = FloatVectorOperations::findMinAndMax(fftData, fftSize / 2);
+            SpectrumBands::Scale currentScale;
+            {
+                const SpinLock::ScopedLockType sl(scaleLock);
+                currentScale = scale;
+            }
 
-    // Update vertex positions based on FFT results, with special attention to properly clear old data
-    for (int z = zTimeResolution - 1; z > 0; --z) {
-        for (int x = 0; x < xFreqResolution; ++x) {
-            yVertices[z * xFreqResolution + x] = yVertices[(z - 1) * xFreqResolution + x];
-        }
-    }
+            // Populate the front-most row with new FFT data
+            SpectrumBands::map(frame, yVertices, xFreqResolution, yAmpHeight, currentScale);
 
-    // Populate new data at the front row
-    for (int x = 0; x < xFreqResolution; ++x) {
-        int fftIndex = jmap(x, 0, xFreqResolution - 1, 0, fftSize / 2 - 1);
-        float level = jmap(fftData[fftIndex], 0.0f, maxFFTLevel.getEnd(), 0.0f, yAmpHeight);
-        yVertices[x] = level; // Populate the front-most row with new FFT data
+            // Update the vertex buffer object with the new vertex data
+            glBindBuffer(GL_ARRAY_BUFFER, yVBO);
+            glBufferData(GL_ARRAY_BUFFER, sizeof(GLfloat) * numVertices, yVertices, GL_DYNAMIC_DRAW);
+        }
     }
 
-    // Update the vertex buffer object with the new vertex data
-    glBindBuffer(GL_ARRAY_BUFFER, yVBO);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(GLfloat) * numVertices, yVertices, GL_DYNAMIC_DRAW);
-
     // Set projection and view matrices in the shader
     if (uniforms->projectionMatrix != nullptr)
         uniforms->projectionMatrix->setMatrix4(getProjectionMatrix().mat, 1, GL_FALSE);
@@ -245,12 +328,11 @@ void renderOpenGL() override
     glBindVertexArray(VAO);
     glDrawArrays(GL_POINTS, 0, numVertices);
 
-    // Clear FFT data after use
-    zeromem(fftData, sizeof(GLfloat) * 2 * fftSize);
-
     // Reset state to ensure no interference with other OpenGL calls
     glBindBuffer(GL_ARRAY_BUFFER, 0);
     glBindVertexArray(0);
+
+    phosphor.endFrame();
 }
 
 
@@ -272,11 +354,13 @@ void renderOpenGL() override
     void mouseDown (const MouseEvent& e) override
     {
         draggableOrientation.mouseDown (e.getPosition());
+        openGLContext.triggerRepaint();
     }
     
     void mouseDrag (const MouseEvent& e) override
     {
         draggableOrientation.mouseDrag (e.getPosition());
+        openGLContext.triggerRepaint();     // Drawn on demand, see FrameScheduler
     }
     
 private:
@@ -288,7 +372,6 @@ private:
 void initializeXZVertices()
 {
     int numFloatsXZ = numVertices * 2;
-    xzVertices = new GLfloat[numFloatsXZ];
     
     // Adjust the scale to ensure the vertices spread appropriately across the visual space
     GLfloat xStart = -1.5f; // start more centrally
@@ -311,9 +394,8 @@ void initializeXZVertices()
     // Initialize the Y valies of vertices
     void initializeYVertices()
     {
-        // Set all Y values to 0.0
-        yVertices = new GLfloat [numVertices];
-        memset(yVertices, 0.0f, sizeof(GLfloat) * xFreqResolution * zTimeResolution);
+        // Set all Y values to 0.0; a new context starts with an empty history
+        FloatVectorOperations::clear (yVertices, numVertices);
     }
     
     
@@ -343,6 +425,8 @@ void initializeXZVertices()
      */
     void createShaders()
     {
+        TOWEL_TRACE_ZONE ("Spectrum::createShaders");
+
 vertexShader =
 "#version 330 core\n"
 "layout (location = 0) in vec2 xzPos;\n"  // Assume xzPos.x is the angle index, xzPos.y is the baseline radius or additional data
@@ -376,14 +460,17 @@ fragmentShader =
 
         
 
-        std::unique_ptr<OpenGLShaderProgram> shaderProgramAttempt = std::make_unique<OpenGLShaderProgram> (openGLContext);
+        ShaderCache::Program program;
+        program.vertexShader = vertexShader;
+        program.fragmentShader = fragmentShader;
+        shaderSlot.contextCreated (program);
         
-        if (shaderProgramAttempt->addVertexShader ((vertexShader))
-            && shaderProgramAttempt->addFragmentShader ((fragmentShader))
-            && shaderProgramAttempt->link())
+        String error;
+        
+        if (auto shaderProgram = shaderCache->getProgram (openGLContext, program, error))
         {
-            uniforms.release();
-            shader = std::move (shaderProgramAttempt);
+            uniforms.reset();
+            shader = std::move (shaderProgram);
             uniforms.reset (new Uniforms (openGLContext, *shader));
             
             // statusText = "GLSL: v" + String (OpenGLShaderProgram::getLanguageVersion(), 2);
@@ -392,12 +479,33 @@ statusText = "";  // This will make the status text empty
         }
         else
         {
-            statusText = shaderProgramAttempt->getLastError();
+            statusText = error;
         }
         
         triggerAsyncUpdate();
     }
     
+    /** Swaps in a program rebuilt from edited shader files. See ShaderLibrary.
+     */
+    void updateShaders()
+    {
+        ShaderCache::Program program;
+        String error;
+        
+        if (! shaderSlot.takeUpdate (program, error))
+            return;
+        
+        if (auto shaderProgram = error.isEmpty() ? shaderCache->getProgram (openGLContext, program, error) : nullptr)
+        {
+            uniforms.reset();
+            shader = std::move (shaderProgram);
+            uniforms.reset (new Uniforms (openGLContext, *shader));
+        }
+        
+        statusText = error;
+        triggerAsyncUpdate();
+    }
+    
     //==============================================================================
     // This class manages the uniform values that the shaders use.
     struct Uniforms
@@ -431,18 +539,21 @@ statusText = "";  // This will make the status text empty
     int zTimeResolution;
     
     int numVertices;
-    GLfloat * xzVertices;
+    GLfloat * xzVertices;   // Both in the pipeline's ScratchArena
     GLfloat * yVertices;
     
     
     // OpenGL Variables
     OpenGLContext openGLContext;
+    bool glewLoaded = false;                    // OpenGL thread only; without GLEW no GL call is made
     GLuint xzVBO;
     GLuint yVBO;
     GLuint VAO;/*, EBO;*/
     
-    std::unique_ptr<OpenGLShaderProgram> shader;
+    SharedResourcePointer<ShaderCache> shaderCache;
+    std::shared_ptr<OpenGLShaderProgram> shader;
     std::unique_ptr<Uniforms> uniforms;
+    ShaderSlot shaderSlot;                      // Shader files, see addShaders()
     
     const char* vertexShader;
     const char* fragmentShader;
@@ -451,30 +562,17 @@ statusText = "";  // This will make the status text empty
     // GUI Interaction
     Draggable3DOrientation draggableOrientation;
     
-    // Audio Structures
-    RingBuffer<GLfloat> * ringBuffer;
-    AudioBuffer<GLfloat> readBuffer;    // Stores data read from ring buffer
-    juce::dsp::FFT forwardFFT;
-    GLfloat * fftData;
-    
-    // This is so that we can initialize fowardFFT in the constructor with the order
-    enum
-    {
-        fftOrder = 10,
-        fftSize  = 1 << fftOrder // set 10th bit to one
-    };
+    // Analysis Structures
+    Atomic<AnalysisFrameExchange *> analysis;  // Swapped by setAnalysis() on the message thread
+    AnalysisFrame frame;                        // Latest frame copied out of the exchange
+    uint32 lastFrameSequence = 0;
+    SpinLock scaleLock;
+    SpectrumBands::Scale scale;                 // Guarded by scaleLock, see setScale()
+    Phosphor phosphor;                          // Trails, see setPhosphor()
     
     // Overlay GUI
     String statusText;
     Label statusLabel;
     
-    /** DEV NOTE
-        If I wanted to optionally have an interchangeable shader system,
-        this would be fairly easy to add. Chack JUCE Demo -> OpenGLDemo.cpp for
-        an implementation example of this. For now, we'll just allow these
-        shader files to be static instead of interchangeable and dynamic.
-        String newVertexShader, newFragmentShader;
-     */
-    
     JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (Spectrum)
 };
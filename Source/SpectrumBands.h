@@ -0,0 +1,81 @@
+//
+//  SpectrumBands.h
+//  3DAudioVisualizers
+//
+//  Maps the FFT bins of an AnalysisFrame onto a fixed number of display bands.
+//
+
+#pragma once
+
+#if ! TOWEL_HEADLESS
+ #include "../JuceLibraryCode/JuceHeader.h"
+#endif
+#include "AnalysisFrame.h"
+
+/** The band mapping the Spectrum visualizer draws, kept free of any GUI code
+    so offline tools produce exactly the same numbers.
+ */
+struct SpectrumBands
+{
+    enum
+    {
+        defaultNumBands = 50
+    };
+
+    /** Which of a frame's dB spectra to draw (see SpectrumProcessor).
+     */
+    enum View
+    {
+        levelView = 0,
+        smoothedView,
+        peakView
+    };
+
+    /** How one visualizer draws a frame: the spectrum, and the dB range that
+        maps onto its height. Levels outside the range are clipped.
+     */
+    struct Scale
+    {
+        View view = smoothedView;
+        float minDb = -90.0f;
+        float maxDb = 0.0f;
+    };
+
+    static const float* getSpectrum (const AnalysisFrame& frame, View view)
+    {
+        switch (view)
+        {
+            case levelView:     return frame.levelDb;
+            case peakView:      return frame.peakDb;
+            default:            return frame.smoothedDb;
+        }
+    }
+
+    /** Picks numBands bins spread linearly from DC to the highest bin and
+        maps their level from scale's dB range onto 0 to height.
+     */
+    static void map (const AnalysisFrame& frame, float* bands, int numBands, float height, const Scale& scale)
+    {
+        if (frame.numBins <= 0 || scale.maxDb <= scale.minDb)
+        {
+            FloatVectorOperations::clear (bands, numBands);
+            return;
+        }
+
+        const float* spectrum = getSpectrum (frame, scale.view);
+
+        for (int x = 0; x < numBands; ++x)
+            bands[x] = spectrum[jmap (x, 0, jmax (1, numBands - 1), 0, frame.numBins - 1)];
+
+        FloatVectorOperations::clip (bands, bands, scale.minDb, scale.maxDb, numBands);
+        FloatVectorOperations::add (bands, -scale.minDb, numBands);
+        FloatVectorOperations::multiply (bands, height / (scale.maxDb - scale.minDb), numBands);
+    }
+
+    /** Same as above, with the default Scale.
+     */
+    static void map (const AnalysisFrame& frame, float* bands, int numBands, float height = 1.0f)
+    {
+        map (frame, bands, numBands, height, Scale());
+    }
+};
@@ -0,0 +1,202 @@
+//
+//  SpectrumProcessor.h
+//  3DAudioVisualizers
+//
+//  Converts a frame's FFT magnitudes to decibels with ballistics, once per
+//  frame for every consumer.
+//
+
+#pragma once
+
+#if ! TOWEL_HEADLESS
+ #include "../JuceLibraryCode/JuceHeader.h"
+#endif
+#include "AnalysisFrame.h"
+#include <cmath>
+
+/** Fills an AnalysisFrame's levelDb, smoothedDb and peakDb from its
+    magnitudes.
+
+    Levels are in dB relative to a fixed reference (the magnitude of a full
+    scale sine, see StreamAnalyzer::getFullScaleMagnitude()), so quiet passages
+    look quiet instead of being scaled up to the frame's own peak. Optionally
+    the power of the last averagingFrames frames is averaged first. The
+    smoothed spectrum follows the level with separate attack and release
+    times, and the peaks hold for peakHoldMs before falling at a fixed rate.
+
+    The stream's analysis runs this once per frame, so every visualizer,
+    recorder and reader of the stream sees the same numbers; visualizers only
+    pick which of the three spectra to draw and over which dB range (see
+    SpectrumBands::Scale).
+
+    Everything except the logarithm and the per-bin peak-hold timers runs
+    through FloatVectorOperations. Never allocates after construction, so a
+    ReplaySource can run it on the audio thread.
+ */
+class SpectrumProcessor
+{
+public:
+    struct Settings
+    {
+        float attackMs = 20.0f;                 // Time constant towards a louder level
+        float releaseMs = 250.0f;               // Time constant towards a quieter level
+        float peakHoldMs = 1000.0f;             // How long a peak stays before falling
+        float peakDecayDbPerSecond = 24.0f;
+        int averagingFrames = 1;                // Frames whose power is averaged; 1 disables averaging
+    };
+
+    enum
+    {
+        maxAveragingFrames = 32
+    };
+
+    static constexpr float floorDb = -120.0f;
+
+    SpectrumProcessor()
+    :   history ((size_t) (maxAveragingFrames * AnalysisFrame::maxBins), true)
+    {
+        reset();
+    }
+
+    /** Changes the ballistics. Call from the thread that calls process().
+     */
+    void setSettings (const Settings& newSettings)
+    {
+        const bool averagingChanged = newSettings.averagingFrames != settings.averagingFrames;
+        settings = newSettings;
+        settings.averagingFrames = jlimit (1, (int) maxAveragingFrames, settings.averagingFrames);
+
+        if (averagingChanged)
+        {
+            numAveraged = 0;
+            nextHistorySlot = 0;
+        }
+    }
+
+    const Settings& getSettings() const     { return settings; }
+
+    /** Forgets all previous frames.
+     */
+    void reset()
+    {
+        FloatVectorOperations::fill (smoothed, floorDb, AnalysisFrame::maxBins);
+        FloatVectorOperations::fill (peaks, floorDb, AnalysisFrame::maxBins);
+        FloatVectorOperations::clear (peakHoldSeconds, AnalysisFrame::maxBins);
+        numAveraged = 0;
+        nextHistorySlot = 0;
+        numBins = 0;
+    }
+
+    /** Fills frame's dB spectra from its magnitudes. secondsSincePreviousFrame
+        scales the ballistics, so late or irregular frames keep the same
+        attack and release times.
+     */
+    void process (AnalysisFrame& frame, double secondsSincePreviousFrame, float fullScaleMagnitude)
+    {
+        if (frame.numBins != numBins)
+        {
+            reset();
+            numBins = frame.numBins;
+        }
+
+        if (numBins <= 0)
+            return;
+
+        const float dt = (float) jlimit (0.0, 1.0, secondsSincePreviousFrame);
+
+        computeLevel (frame, fullScaleMagnitude);
+        applyBallistics (frame.levelDb, dt);
+        updatePeaks (frame.levelDb, dt);
+
+        FloatVectorOperations::copy (frame.smoothedDb, smoothed, numBins);
+        FloatVectorOperations::copy (frame.peakDb, peaks, numBins);
+    }
+
+private:
+    /** levelDb = 10 log10 of the (averaged) power relative to full scale.
+     */
+    void computeLevel (AnalysisFrame& frame, float fullScaleMagnitude)
+    {
+        auto* power = frame.levelDb;    // Reused as scratch until the log
+
+        FloatVectorOperations::multiply (power, frame.magnitudes, frame.magnitudes, numBins);
+        FloatVectorOperations::multiply (power, 1.0f / (fullScaleMagnitude * fullScaleMagnitude), numBins);
+
+        if (settings.averagingFrames > 1)
+        {
+            FloatVectorOperations::copy (history + nextHistorySlot * AnalysisFrame::maxBins, power, numBins);
+            nextHistorySlot = (nextHistorySlot + 1) % settings.averagingFrames;
+            numAveraged = jmin (numAveraged + 1, settings.averagingFrames);
+
+            FloatVectorOperations::clear (power, numBins);
+
+            for (int i = 0; i < numAveraged; ++i)
+                FloatVectorOperations::add (power, history + i * AnalysisFrame::maxBins, numBins);
+
+            FloatVectorOperations::multiply (power, 1.0f / (float) numAveraged, numBins);
+        }
+
+        FloatVectorOperations::max (power, power, floorPower, numBins);
+
+        for (int i = 0; i < numBins; ++i)
+            power[i] = 10.0f * std::log10 (power[i]);
+    }
+
+    /** Moves smoothed towards level at the attack rate where the level is
+        higher and at the release rate where it is lower, without branching:
+        of (max - smoothed) and (min - smoothed), one is always zero.
+     */
+    void applyBallistics (const float* level, float dt)
+    {
+        const float attack = settings.attackMs > 0.0f ? 1.0f - std::exp (-1000.0f * dt / settings.attackMs) : 1.0f;
+        const float release = settings.releaseMs > 0.0f ? 1.0f - std::exp (-1000.0f * dt / settings.releaseMs) : 1.0f;
+
+        FloatVectorOperations::max (rising, level, smoothed, numBins);
+        FloatVectorOperations::subtract (rising, smoothed, numBins);
+        FloatVectorOperations::min (falling, level, smoothed, numBins);
+        FloatVectorOperations::subtract (falling, smoothed, numBins);
+
+        FloatVectorOperations::addWithMultiply (smoothed, rising, attack, numBins);
+        FloatVectorOperations::addWithMultiply (smoothed, falling, release, numBins);
+    }
+
+    void updatePeaks (const float* level, float dt)
+    {
+        const float holdSeconds = settings.peakHoldMs / 1000.0f;
+        const float decay = settings.peakDecayDbPerSecond * dt;
+
+        for (int i = 0; i < numBins; ++i)
+        {
+            if (level[i] >= peaks[i])
+            {
+                peaks[i] = level[i];
+                peakHoldSeconds[i] = holdSeconds;
+            }
+            else if (peakHoldSeconds[i] > 0.0f)
+            {
+                peakHoldSeconds[i] -= dt;
+            }
+            else
+            {
+                peaks[i] = jmax (level[i], peaks[i] - decay);
+            }
+        }
+    }
+
+    static constexpr float floorPower = 1.0e-12f;     // floorDb as a power ratio
+
+    Settings settings;
+    int numBins = 0;
+
+    float smoothed[AnalysisFrame::maxBins];
+    float peaks[AnalysisFrame::maxBins];
+    float peakHoldSeconds[AnalysisFrame::maxBins];
+    float rising[AnalysisFrame::maxBins];
+    float falling[AnalysisFrame::maxBins];
+
+    HeapBlock<float> history;           // Power of the last averagingFrames frames
+    int nextHistorySlot = 0;
+    int numAveraged = 0;
+
+    JUCE_DECLARE_NON_COPYABLE (SpectrumProcessor)
+};
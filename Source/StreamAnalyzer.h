@@ -0,0 +1,318 @@
+//
+//  StreamAnalyzer.h
+//  3DAudioVisualizers
+//
+//  Turns the newest window of a RingBuffer into an AnalysisFrame.
+//
+
+#pragma once
+
+#if ! TOWEL_HEADLESS
+ #include "../JuceLibraryCode/JuceHeader.h"
+#endif
+#include "RingBuffer.h"
+#include "AnalysisFrame.h"
+#include "ConstantQ.h"
+#include "LevelMeter.h"
+#include "SpectrumProcessor.h"
+
+/** Computes AnalysisFrames from a stream's RingBuffer. Runs as a job on the
+    StreamRegistry's shared ThreadPool whenever a hop of new audio is ready,
+    or inline from offline tools (see AnalysisEngine.h).
+
+    Each frame's magnitudes go through a SpectrumProcessor, so the dB spectra
+    every consumer draws are computed once, here.
+
+    The spectrum is either the FFT of the newest window, or, after
+    setConstantQ(), a ConstantQTransform fed with every new sample. Both sum
+    the channels first.
+
+    The FFT only looks at the newest window, but every sample written
+    since the previous frame goes through a LevelMeter, whose readings are
+    published with the frame. If the analysis falls more than half a ring,
+    or maxReadSize samples, behind, the audio in between is not metered.
+    Every buffer is sized by the constructor, so analysing never allocates.
+
+    Only depends on juce_core, juce_audio_basics and juce_dsp, so it builds
+    into the headless tools as well as the app.
+ */
+class StreamAnalyzer : public ThreadPoolJob
+{
+public:
+    StreamAnalyzer (RingBuffer<float>& ringBufferToAnalyse, AnalysisFrameExchange& output)
+    :   ThreadPoolJob ("Stream Analyzer"),
+        ringBuffer (ringBufferToAnalyse),
+        analysis (output),
+        readBuffer (ringBufferToAnalyse.getNumChannels(), windowSize),
+        meterBuffer (ringBufferToAnalyse.getNumChannels(), maxReadSize),
+        monoBuffer (1, maxReadSize),
+        forwardFFT (fftOrder)
+    {
+        lastAnalysedClock = 0;
+    }
+
+    /** Sets the sample rate the level meter works at. Until this is called,
+        frames carry no levels. Can be called from any thread; a new rate
+        resets the meter before the next frame.
+     */
+    void setSampleRate (double newSampleRate)
+    {
+        meterSampleRate = newSampleRate;
+    }
+
+    /** Changes the ballistics of the dB spectra. Can be called from any
+        thread; takes effect with the next frame.
+     */
+    void setSpectrumSettings (const SpectrumProcessor::Settings& newSettings)
+    {
+        const SpinLock::ScopedLockType sl (settingsLock);
+        pendingSpectrumSettings = newSettings;
+        spectrumSettingsChanged = true;
+    }
+
+    /** Switches the spectrum between the linear FFT (the default) and a
+        constant-Q transform. Can be called from any thread; takes effect with
+        the next frame. The constant-Q transform needs the sample rate, so
+        frames stay linear until setSampleRate() has been called.
+     */
+    void setConstantQ (bool enabled, const ConstantQTransform::Settings& newSettings = {})
+    {
+        const SpinLock::ScopedLockType sl (settingsLock);
+        pendingConstantQ = enabled;
+        pendingConstantQSettings = newSettings;
+        transformChanged = true;
+    }
+
+    /** The magnitude a full scale sine on one channel reaches in its bin:
+        the 0 dB reference of the dB spectra.
+     */
+    static float getFullScaleMagnitude()    { return windowSize / 2.0f; }
+
+    enum
+    {
+        analysisRateHz = 60,
+        maxReadSize = 1 << 15   // Most samples metered per frame, many hops even at 192 kHz
+    };
+
+    /** Receives every frame right after it is published, on the analysis
+        thread. window is the audio the frame was computed from.
+     */
+    class Listener
+    {
+    public:
+        virtual ~Listener() {}
+        virtual void analysisFrameReady (const AnalysisFrame& frame, const AudioBuffer<float>& window) = 0;
+    };
+
+    /** Sets or clears (nullptr) the listener. Waits for a callback in
+        progress, so the old listener may be deleted as soon as this returns.
+     */
+    void setListener (Listener* newListener)
+    {
+        const ScopedLock sl (listenerLock);
+        listener = newListener;
+    }
+
+    /** Samples between frames at sampleRate: analysisRateHz frames per second
+        of audio, independent of the display frame rate.
+     */
+    static int getHopSize (double sampleRate)
+    {
+        return jmax (1, roundToInt (sampleRate / analysisRateHz));
+    }
+
+    /** True if at least hopSize new samples arrived since the last frame.
+     */
+    bool isDue (int hopSize) const
+    {
+        return ringBuffer.getTotalSamplesWritten() - lastAnalysedClock.get() >= hopSize;
+    }
+
+    JobStatus runJob() override
+    {
+        analyse();
+        return jobHasFinished;
+    }
+
+    /** Analyses the newest window and publishes the frame.
+     */
+    void analyse()
+    {
+        // One read covers the FFT window and everything new for the meter
+        const int64 lastClock = lastAnalysedClock.get();
+        const int largestRead = jmax ((int) windowSize, jmin ((int) maxReadSize, ringBuffer.getBufferSize() / 2));
+        const int readSize = (int) jlimit ((int64) windowSize, (int64) largestRead,
+                                           ringBuffer.getTotalSamplesWritten() - lastClock);
+
+        meterBuffer.setSize (meterBuffer.getNumChannels(), readSize, false, false, true);
+
+        int64 readEnd = 0;
+        ringBuffer.readSamplesChecked (meterBuffer, readSize, &readEnd);
+
+        for (int i = 0; i < readBuffer.getNumChannels(); ++i)
+            readBuffer.copyFrom (i, 0, meterBuffer, i, readSize - windowSize, windowSize);
+
+        const int numNewSamples = (int) jmin ((int64) readSize, readEnd - lastClock);
+        frame.sampleClock = readEnd;
+
+        if (updateTransform())
+            computeConstantQ (numNewSamples, readSize);
+        else
+            computeFFT();
+
+        processSpectrum (readEnd - lastClock);
+        meterNewSamples (numNewSamples, readSize);
+
+        analysis.publish (frame);
+        lastAnalysedClock = readEnd;
+
+        const ScopedLock sl (listenerLock);
+
+        if (listener != nullptr)
+            listener->analysisFrameReady (frame, readBuffer);
+    }
+
+    /** Number of audio samples each frame was computed from.
+     */
+    static int getWindowSize()    { return windowSize; }
+
+private:
+    void computeFFT()
+    {
+        FloatVectorOperations::clear (fftData, 2 * fftSize);
+
+        // Sum audio samples across channels for FFT processing
+        for (int i = 0; i < readBuffer.getNumChannels(); ++i)
+            FloatVectorOperations::add (fftData, readBuffer.getReadPointer (i), windowSize);
+
+        forwardFFT.performFrequencyOnlyForwardTransform (fftData);
+
+        frame.numBins = fftSize / 2;
+        frame.binsPerOctave = 0;
+        frame.minFrequency = 0.0f;
+        FloatVectorOperations::copy (frame.magnitudes, fftData, frame.numBins);
+    }
+
+    /** Applies a pending setConstantQ() and prepares the transform for the
+        current sample rate. Returns true if this frame is constant-Q.
+     */
+    bool updateTransform()
+    {
+        if (transformChanged.exchange (false))
+        {
+            const SpinLock::ScopedLockType sl (settingsLock);
+            useConstantQ = pendingConstantQ;
+            constantQSettings = pendingConstantQSettings;
+            constantQSampleRate = 0.0;
+            spectrumProcessor.reset();
+        }
+
+        const double sampleRate = meterSampleRate.load();
+
+        if (! useConstantQ || sampleRate <= 0.0)
+            return false;
+
+        if (sampleRate != constantQSampleRate)
+        {
+            constantQ.prepare (sampleRate, constantQSettings);
+            constantQSampleRate = sampleRate;
+        }
+
+        return constantQ.getNumBins() > 0;
+    }
+
+    /** Streams the newest numSamples of meterBuffer, which holds bufferSize
+        samples, into the constant-Q transform and takes the frame from it.
+     */
+    void computeConstantQ (int numSamples, int bufferSize)
+    {
+        monoBuffer.setSize (1, jmax (1, numSamples), false, false, true);
+        auto* mono = monoBuffer.getWritePointer (0);
+
+        FloatVectorOperations::clear (mono, numSamples);
+
+        for (int i = 0; i < meterBuffer.getNumChannels(); ++i)
+            FloatVectorOperations::add (mono, meterBuffer.getReadPointer (i, bufferSize - numSamples), numSamples);
+
+        constantQ.process (mono, numSamples);
+        constantQ.getMagnitudes (frame.magnitudes, getFullScaleMagnitude());
+
+        const auto& settings = constantQ.getSettings();
+        frame.numBins = constantQ.getNumBins();
+        frame.binsPerOctave = settings.binsPerOctave;
+        frame.minFrequency = settings.minFrequency;
+    }
+
+    void processSpectrum (int64 samplesSincePreviousFrame)
+    {
+        if (spectrumSettingsChanged.exchange (false))
+        {
+            const SpinLock::ScopedLockType sl (settingsLock);
+            spectrumProcessor.setSettings (pendingSpectrumSettings);
+        }
+
+        const double sampleRate = meterSampleRate.load();
+        const double seconds = sampleRate > 0.0 ? samplesSincePreviousFrame / sampleRate
+                                                : 1.0 / analysisRateHz;
+
+        spectrumProcessor.process (frame, seconds, getFullScaleMagnitude());
+    }
+
+    /** Meters the newest numSamples of meterBuffer, which holds bufferSize
+        samples, and fills in the frame's levels.
+     */
+    void meterNewSamples (int numSamples, int bufferSize)
+    {
+        const double sampleRate = meterSampleRate.load();
+
+        if (sampleRate <= 0.0)
+        {
+            frame.levels.numChannels = 0;
+            return;
+        }
+
+        if (sampleRate != meter.getSampleRate())
+            meter.prepare (sampleRate, meterBuffer.getNumChannels());
+
+        if (numSamples > 0)
+            meter.process (meterBuffer, bufferSize - numSamples, numSamples);
+
+        meter.getLevels (frame.levels);
+    }
+
+    enum
+    {
+        fftOrder = 10,
+        fftSize  = 1 << fftOrder,
+        windowSize = 256        // Zero-padded up to fftSize
+    };
+
+    RingBuffer<float>& ringBuffer;
+    AnalysisFrameExchange& analysis;
+    AudioBuffer<float> readBuffer;      // The FFT window, as passed to the Listener
+    AudioBuffer<float> meterBuffer;     // The window plus any older unmetered samples
+    AudioBuffer<float> monoBuffer;      // New samples summed for the constant-Q transform
+    juce::dsp::FFT forwardFFT;
+    float fftData [2 * fftSize];
+    AnalysisFrame frame;
+    Atomic<int64> lastAnalysedClock;
+
+    SpectrumProcessor spectrumProcessor;
+    SpinLock settingsLock;
+    SpectrumProcessor::Settings pendingSpectrumSettings;
+    std::atomic<bool> spectrumSettingsChanged { false };
+
+    ConstantQTransform constantQ;
+    ConstantQTransform::Settings constantQSettings, pendingConstantQSettings;
+    bool useConstantQ = false, pendingConstantQ = false;
+    double constantQSampleRate = 0.0;
+    std::atomic<bool> transformChanged { false };
+
+    LevelMeter meter;
+    std::atomic<double> meterSampleRate { 0.0 };
+
+    CriticalSection listenerLock;
+    Listener* listener = nullptr;
+
+    JUCE_DECLARE_NON_COPYABLE (StreamAnalyzer)
+};
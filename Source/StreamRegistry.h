@@ -0,0 +1,229 @@
+//
+//  StreamRegistry.h
+//  3DAudioVisualizers
+//
+//  Owns every AudioStream and the worker pool that analyses them.
+//
+
+#pragma once
+
+#include "../JuceLibraryCode/JuceHeader.h"
+#include "AudioStream.h"
+
+/** A set of named AudioStreams that all run from the same audio device.
+
+    Each stream has its own RingBuffer and analysis. A single scheduler thread
+    hands analysis jobs to one shared ThreadPool as soon as a stream has a new
+    hop of audio, so the number of analysis threads does not grow with the
+    number of streams. It sleeps until the audio thread signals that a hop is
+    due, and only polls while a frame still has to be mirrored to shared
+    memory.
+
+    Streams can be added and removed at any time from the message thread.
+    Detach any visualizer from a stream before removing it.
+ */
+class StreamRegistry : private Thread
+{
+public:
+    StreamRegistry()
+    :   Thread ("Stream Analysis Scheduler"),
+        analysisPool (jmax (1, SystemStats::getNumCpus() - 1))
+    {
+        startThread();
+    }
+
+    ~StreamRegistry()
+    {
+        signalThreadShouldExit();
+        workDue.signal();
+        stopThread (1000);
+        analysisPool.removeAllJobs (true, 1000);
+    }
+
+    //==========================================================================
+    // Streams
+
+    /** Adds a stream. Pass a nullptr source for a stream that is fed with
+        AudioStream::writeSamples() instead. Returns the new stream.
+     */
+    AudioStream& addStream (const String& name, std::unique_ptr<StreamSource> source = nullptr)
+    {
+        auto newStream = std::make_unique<AudioStream> (name, std::move (source));
+
+        if (sampleRate > 0.0)
+            newStream->prepare (samplesPerBlock, sampleRate);
+
+        newStream->setDeviceInputLatency (deviceInputLatencySamples);
+        newStream->getAnalyzer().setConstantQ (constantQ, constantQSettings);
+        newStream->setSchedulerEvent (&workDue);
+
+        const ScopedLock audioLock (audioThreadLock);
+        const ScopedLock schedulerLock (schedulerThreadLock);
+        return *streams.add (newStream.release());
+    }
+
+    /** Removes and deletes a stream, waiting for any analysis in progress.
+     */
+    void removeStream (AudioStream* stream)
+    {
+        std::unique_ptr<AudioStream> removed;
+
+        {
+            const ScopedLock audioLock (audioThreadLock);
+            const ScopedLock schedulerLock (schedulerThreadLock);
+
+            const int index = streams.indexOf (stream);
+
+            if (index < 0)
+                return;
+
+            removed.reset (streams.removeAndReturn (index));
+        }
+
+        analysisPool.removeJob (&removed->getAnalyzer(), false, -1);
+        removed->release();
+    }
+
+    int getNumStreams() const                       { return streams.size(); }
+    AudioStream* getStream (int index) const        { return streams[index]; }
+
+    AudioStream* findStream (const String& name) const
+    {
+        for (auto* stream : streams)
+            if (stream->getName() == name)
+                return stream;
+
+        return nullptr;
+    }
+
+    //==========================================================================
+    // Audio Lifecycle
+
+    /** Call from prepareToPlay().
+     */
+    void prepare (int samplesPerBlockExpected, double newSampleRate)
+    {
+        const ScopedLock audioLock (audioThreadLock);
+        const ScopedLock schedulerLock (schedulerThreadLock);
+
+        samplesPerBlock = samplesPerBlockExpected;
+        sampleRate = newSampleRate;
+
+        for (auto* stream : streams)
+            stream->prepare (samplesPerBlock, sampleRate);
+    }
+
+    /** Call from releaseResources(). Streams keep their allocations.
+     */
+    void release()
+    {
+        const ScopedLock audioLock (audioThreadLock);
+        const ScopedLock schedulerLock (schedulerThreadLock);
+
+        for (auto* stream : streams)
+            stream->release();
+    }
+
+    /** Runs every stream's source for one device callback. Call from
+        getNextAudioBlock() before the buffer is overwritten, so device input
+        streams still see the input.
+     */
+    void processBlock (const AudioSourceChannelInfo& deviceInput)
+    {
+        // Never block the audio thread: skip a block while streams are changing
+        const ScopedTryLock audioLock (audioThreadLock);
+
+        if (! audioLock.isLocked())
+            return;
+
+        for (auto* stream : streams)
+            stream->processBlock (deviceInput);
+    }
+
+    /** Sets the device input latency on all device input streams.
+     */
+    void setDeviceInputLatency (int latencyInSamples)
+    {
+        deviceInputLatencySamples = latencyInSamples;
+
+        for (auto* stream : streams)
+            stream->setDeviceInputLatency (latencyInSamples);
+    }
+
+    /** Switches every stream, and every stream added later, between the FFT
+        and a constant-Q spectrum. See StreamAnalyzer::setConstantQ().
+     */
+    void setConstantQ (bool enabled, const ConstantQTransform::Settings& settings = {})
+    {
+        constantQ = enabled;
+        constantQSettings = settings;
+
+        for (auto* stream : streams)
+            stream->getAnalyzer().setConstantQ (enabled, settings);
+    }
+
+    /** Mirrors one stream into shared memory, or stops (nullptr). Any number
+        of streams may be switched while audio runs, but only delete shared
+        after the audio device has stopped and it was detached here.
+     */
+    void setSharedOutput (AudioStream& stream, SharedRingBuffer* shared)
+    {
+        const ScopedLock schedulerLock (schedulerThreadLock);
+        stream.setSharedOutput (shared);
+    }
+
+    ThreadPool& getAnalysisPool()    { return analysisPool; }
+
+private:
+    /** Scheduler loop: queues an analysis job for every stream with a new hop
+        of audio whose previous job has finished.
+     */
+    void run() override
+    {
+        while (! threadShouldExit())
+        {
+            bool mirrorPending = false;
+
+            {
+                const ScopedLock schedulerLock (schedulerThreadLock);
+
+                for (auto* stream : streams)
+                {
+                    auto* job = &stream->getAnalyzer();
+
+                    if (stream->isAnalysisDue() && ! analysisPool.contains (job))
+                        analysisPool.addJob (job, false);
+
+                    stream->mirrorAnalysisToSharedOutput();
+
+                    // Its frame is mirrored once the job has published it
+                    mirrorPending = mirrorPending || (stream->hasSharedOutput() && analysisPool.contains (job));
+                }
+            }
+
+            workDue.wait (mirrorPending ? (int) mirrorPollIntervalMs : (int) idleIntervalMs);
+        }
+    }
+
+    enum
+    {
+        mirrorPollIntervalMs = 2,
+        idleIntervalMs = 100        // Only a fallback: streams signal workDue
+    };
+
+    OwnedArray<AudioStream> streams;
+    ThreadPool analysisPool;
+    WaitableEvent workDue;                  // Signalled by the audio thread, see AudioStream::setSchedulerEvent()
+
+    // Adding or removing a stream takes both locks; the audio thread only ever
+    // try-locks its own, so the scheduler never makes it skip a block.
+    CriticalSection audioThreadLock, schedulerThreadLock;
+
+    int samplesPerBlock = 0;
+    double sampleRate = 0.0;
+    int deviceInputLatencySamples = 0;
+    bool constantQ = false;
+    ConstantQTransform::Settings constantQSettings;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (StreamRegistry)
+};
@@ -0,0 +1,286 @@
+//
+//  Trace.h
+//  3DAudioVisualizers
+//
+//  Records timed zones on every thread and writes them out as a Chrome
+//  trace, to see where startup, device switches and frames spend time.
+//
+
+#pragma once
+
+#include "../JuceLibraryCode/JuceHeader.h"
+#include <atomic>
+#include <memory>
+
+/** A timeline of what each thread was doing.
+
+    A Zone records when it was constructed and destroyed, under a name that
+    must be a string literal. While tracing is off, a Zone only reads one
+    atomic flag.
+
+    Each thread writes its zones to a buffer of its own, so recording never
+    locks or allocates. Every buffer is allocated by start(); a thread
+    claims one with a single atomic increment on its first zone. Threads
+    beyond maxThreads are not traced. Each buffer is a ring that keeps the
+    thread's newest zones, so the trace always ends at the moment it was
+    written. At the default size that is a few minutes of audio callbacks
+    or frames; pass a larger size to start() to keep startup in a longer
+    run.
+
+    write() saves every buffer as Chrome trace event JSON, which
+    chrome://tracing and https://ui.perfetto.dev open. Threads are named
+    after their juce::Thread, "Message" for the message thread, or whatever
+    setThreadName() gave them, e.g. the audio callback and each visualizer's
+    OpenGL thread.
+
+    Use the TOWEL_TRACE_ZONE macro to time the rest of a scope.
+ */
+class Trace
+{
+public:
+    enum
+    {
+        maxThreads = 32,
+        defaultEventsPerThread = 1 << 14
+    };
+
+    /** Allocates the buffers and starts recording. Call once, early, on the
+        message thread.
+     */
+    static void start (int eventsPerThread = defaultEventsPerThread)
+    {
+        auto& trace = getInstance();
+        jassert (! trace.enabled.load());
+        jassert (eventsPerThread > 0);
+
+        trace.startTicks = Time::getHighResolutionTicks();
+
+        for (auto& buffer : trace.buffers)
+        {
+            buffer.events.reset (new Event[(size_t) eventsPerThread]);
+            buffer.capacity = eventsPerThread;
+        }
+
+        trace.enabled.store (true, std::memory_order_release);
+    }
+
+    static bool isEnabled() noexcept
+    {
+        return getInstance().enabled.load (std::memory_order_acquire);
+    }
+
+    /** Names the calling thread in the trace. name must be a string literal.
+        Cheap enough to call on every audio callback.
+     */
+    static void setThreadName (const char* name) noexcept
+    {
+        if (auto* buffer = getThreadBuffer())
+            buffer->customName.store (name, std::memory_order_release);
+    }
+
+    /** Writes the zones each thread still holds to file. Threads may keep
+        recording meanwhile; zones they overwrite while it runs are left out.
+     */
+    static bool write (const File& file)
+    {
+        auto& trace = getInstance();
+
+        if (! trace.enabled.load (std::memory_order_acquire))
+            return false;
+
+        FileOutputStream output (file);
+
+        if (! output.openedOk())
+            return false;
+
+        output.setPosition (0);
+        output.truncate();
+
+        const int numThreads = jmin ((int) maxThreads, trace.numClaimed.load (std::memory_order_acquire));
+        const double microsecondsPerTick = 1.0e6 / (double) Time::getHighResolutionTicksPerSecond();
+        bool first = true;
+
+        auto separator = [&]() -> OutputStream&
+        {
+            output << (first ? "\n" : ",\n");
+            first = false;
+            return output;
+        };
+
+        output << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+
+        for (int tid = 0; tid < numThreads; ++tid)
+        {
+            auto& buffer = trace.buffers[tid];
+
+            if (! buffer.claimed.load (std::memory_order_acquire))
+                continue;
+
+            const char* customName = buffer.customName.load (std::memory_order_acquire);
+            String threadName = customName != nullptr ? String (customName) : String (buffer.name);
+
+            if (threadName.isEmpty())
+                threadName = "Thread " + String (tid);
+
+            separator() << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << tid
+                        << ",\"args\":{\"name\":" << JSON::toString (threadName) << "}}";
+
+            const int64 written = buffer.written.load (std::memory_order_acquire);
+
+            for (int64 i = jmax ((int64) 0, written - buffer.capacity); i < written; ++i)
+            {
+                const auto& event = buffer.events[(size_t) (i % buffer.capacity)];
+                const char* name = event.name.load (std::memory_order_relaxed);
+                const int64 startTicks = event.startTicks.load (std::memory_order_relaxed);
+                const int64 endTicks = event.endTicks.load (std::memory_order_relaxed);
+
+                // Skip the zone if the thread has since reused its slot, or may be doing so
+                std::atomic_thread_fence (std::memory_order_acquire);
+
+                if (i <= buffer.written.load (std::memory_order_relaxed) - buffer.capacity)
+                    continue;
+
+                separator() << "{\"name\":" << JSON::toString (String (name))
+                            << ",\"ph\":\"X\",\"pid\":1,\"tid\":" << tid
+                            << ",\"ts\":" << String ((double) (startTicks - trace.startTicks) * microsecondsPerTick, 3)
+                            << ",\"dur\":" << String ((double) (endTicks - startTicks) * microsecondsPerTick, 3)
+                            << "}";
+            }
+
+            if (written > buffer.capacity)
+                separator() << "{\"name\":\"overwritten\",\"ph\":\"M\",\"pid\":1,\"tid\":" << tid
+                            << ",\"args\":{\"zones\":" << (written - buffer.capacity) << "}}";
+        }
+
+        output << "\n]}\n";
+        output.flush();
+        return output.getStatus().wasOk();
+    }
+
+    //==============================================================================
+    /** Times its own lifetime on the calling thread.
+     */
+    class Zone
+    {
+    public:
+        explicit Zone (const char* zoneName) noexcept
+        {
+            if (isEnabled())
+            {
+                name = zoneName;
+                startTicks = Time::getHighResolutionTicks();
+            }
+        }
+
+        ~Zone()
+        {
+            if (name != nullptr)
+                record (name, startTicks, Time::getHighResolutionTicks());
+        }
+
+    private:
+        const char* name = nullptr;
+        int64 startTicks = 0;
+
+        JUCE_DECLARE_NON_COPYABLE (Zone)
+    };
+
+private:
+    /** Relaxed atomics, so write() can read a slot its thread is reusing.
+     */
+    struct Event
+    {
+        std::atomic<const char*> name { nullptr };
+        std::atomic<int64> startTicks { 0 };
+        std::atomic<int64> endTicks { 0 };
+    };
+
+    /** One thread's newest zones, the one written as number n in slot
+        n % capacity. Only its thread writes to it.
+     */
+    struct ThreadBuffer
+    {
+        std::unique_ptr<Event[]> events;
+        int64 capacity = 0;
+        std::atomic<int64> written { 0 };   // Zones recorded so far
+
+        std::atomic<bool> claimed { false };
+        std::atomic<const char*> customName { nullptr };
+        char name[64] = {};                 // The juce::Thread's name, if any
+    };
+
+    Trace() = default;
+
+    static Trace& getInstance()
+    {
+        static Trace trace;
+        return trace;
+    }
+
+    /** The calling thread's buffer, claimed on first use, or nullptr if
+        tracing is off or every buffer is taken.
+     */
+    static ThreadBuffer* getThreadBuffer() noexcept
+    {
+        static thread_local ThreadBuffer* threadBuffer = nullptr;
+        static thread_local bool untraced = false;     // Found every buffer taken
+
+        if (threadBuffer != nullptr || untraced || ! isEnabled())
+            return threadBuffer;
+
+        auto& trace = getInstance();
+        const int index = trace.numClaimed.fetch_add (1);
+
+        if (index >= maxThreads)
+        {
+            // Never try again, so later zones cost no more than with tracing off
+            untraced = true;
+            return nullptr;
+        }
+
+        auto& buffer = trace.buffers[index];
+
+        if (MessageManager::existsAndIsCurrentThread())
+            buffer.customName.store ("Message", std::memory_order_relaxed);
+        else if (auto* thread = Thread::getCurrentThread())
+            thread->getThreadName().copyToUTF8 (buffer.name, sizeof (buffer.name));
+
+        buffer.claimed.store (true, std::memory_order_release);
+
+        threadBuffer = &buffer;
+        return threadBuffer;
+    }
+
+    static void record (const char* name, int64 startTicks, int64 endTicks) noexcept
+    {
+        auto* buffer = getThreadBuffer();
+
+        if (buffer == nullptr)
+            return;
+
+        const int64 index = buffer->written.load (std::memory_order_relaxed);
+
+        // Orders the previous publish before this slot is overwritten, see write()
+        std::atomic_thread_fence (std::memory_order_release);
+
+        auto& event = buffer->events[(size_t) (index % buffer->capacity)];
+        event.name.store (name, std::memory_order_relaxed);
+        event.startTicks.store (startTicks, std::memory_order_relaxed);
+        event.endTicks.store (endTicks, std::memory_order_relaxed);
+
+        // Publishes the event to write()
+        buffer->written.store (index + 1, std::memory_order_release);
+    }
+
+    std::atomic<bool> enabled { false };
+    std::atomic<int> numClaimed { 0 };
+    int64 startTicks = 0;
+    ThreadBuffer buffers[maxThreads];
+
+    JUCE_DECLARE_NON_COPYABLE (Trace)
+};
+
+/** Times the rest of the enclosing scope as a Trace zone named name, a
+    string literal.
+ */
+#define TOWEL_TRACE_ZONE(name)  const Trace::Zone JUCE_JOIN_MACRO (traceZone, __LINE__) (name)
@@ -0,0 +1,184 @@
+//
+//  TriggerBenchmark.h
+//  3DAudioVisualizers
+//
+//  Headless check of how still OscilloscopeTrigger holds a periodic
+//  waveform, and how long each search takes.
+//
+
+#pragma once
+
+#include "../JuceLibraryCode/JuceHeader.h"
+#include "OscilloscopeTrigger.h"
+#include <chrono>
+#include <iostream>
+
+/** Writes a harmonic tone into a RingBuffer one display frame at a time and
+    reads a 256 sample trace after every frame, once per trigger setting.
+
+    The tone has two rising crossings of 0 per period, so a plain edge
+    trigger alternates between them while pitch lock keeps one. For each
+    setting it prints the time per read() and the change between
+    consecutive traces (RMS of the difference relative to RMS of the trace;
+    0% is a trace that stands perfectly still).
+
+        "Towel OpenGL Audio Visualizer" --trigger-benchmark [--frequency=220]
+            [--rate=48000] [--seconds=10] [--noise=0] [--holdoff=0]
+
+    --noise is the level of white noise added to the tone, --holdoff is in
+    milliseconds.
+
+    Fails if pitch lock misses a trigger on any frame or, without noise,
+    lets the trace change by more than maxPitchLockChangePercent. The edge
+    trigger alone changes it by tens of percent.
+ */
+class TriggerBenchmark
+{
+public:
+    struct Options
+    {
+        double frequency = 220.0;
+        double sampleRate = 48000.0;
+        double seconds = 10.0;
+        float noise = 0.0f;
+        double holdoffSeconds = 0.0;
+    };
+
+    enum { maxPitchLockChangePercent = 1 };
+
+    struct Result
+    {
+        double meanMicroseconds = 0.0;
+        double maxMicroseconds = 0.0;
+        double traceChangePercent = 0.0;
+        double triggeredPercent = 0.0;
+    };
+
+    /** Runs the benchmark described by the command line and prints the
+        result. Returns a process exit code.
+     */
+    static int runFromCommandLine (const String& commandLine)
+    {
+        Options options;
+        StringArray args;
+        args.addTokens (commandLine, true);
+
+        for (auto& arg : args)
+        {
+            auto value = arg.fromFirstOccurrenceOf ("=", false, false);
+
+            if (arg.startsWith ("--frequency="))    options.frequency = jmax (1.0, value.getDoubleValue());
+            else if (arg.startsWith ("--rate="))    options.sampleRate = jmax (1000.0, value.getDoubleValue());
+            else if (arg.startsWith ("--seconds=")) options.seconds = jmax (0.1, value.getDoubleValue());
+            else if (arg.startsWith ("--noise="))   options.noise = jmax (0.0f, value.getFloatValue());
+            else if (arg.startsWith ("--holdoff=")) options.holdoffSeconds = jmax (0.0, value.getDoubleValue() / 1000.0);
+        }
+
+        std::cout << "trigger: " << options.frequency << " Hz tone, " << options.sampleRate << " Hz, "
+                  << String (options.seconds, 2) << " s, noise " << options.noise << std::endl;
+
+        struct Variant { const char* name; OscilloscopeTrigger::Mode mode; bool pitchLock; };
+
+        const Variant variants[] = { { "free run  ", OscilloscopeTrigger::freeRun, false },
+                                     { "edge      ", OscilloscopeTrigger::risingEdge, false },
+                                     { "pitch lock", OscilloscopeTrigger::risingEdge, true } };
+
+        Result pitchLockResult;
+
+        for (auto& variant : variants)
+        {
+            OscilloscopeTrigger::Settings settings;
+            settings.mode = variant.mode;
+            settings.pitchLock = variant.pitchLock;
+            settings.holdoffSeconds = options.holdoffSeconds;
+
+            const auto result = run (options, settings);
+
+            std::cout << "  " << variant.name << ": " << String (result.meanMicroseconds, 1) << " us per read (max "
+                      << String (result.maxMicroseconds, 1) << "), trace change " << String (result.traceChangePercent, 2)
+                      << "%, triggered " << String (result.triggeredPercent, 1) << "%" << std::endl;
+
+            if (variant.pitchLock)
+                pitchLockResult = result;
+        }
+
+        if (pitchLockResult.triggeredPercent < 100.0)
+        {
+            std::cout << "pitch lock missed a trigger" << std::endl;
+            return 1;
+        }
+
+        // Noise alone changes the trace, so only a clean tone has to stand still
+        if (options.noise == 0.0f && pitchLockResult.traceChangePercent > (double) maxPitchLockChangePercent)
+        {
+            std::cout << "pitch lock trace change above " << (int) maxPitchLockChangePercent << "%" << std::endl;
+            return 1;
+        }
+
+        return 0;
+    }
+
+    static Result run (const Options& options, const OscilloscopeTrigger::Settings& settings)
+    {
+        enum { traceSize = 256 };
+
+        const int hopSize = jmax (1, roundToInt (options.sampleRate / 60.0));
+        const int numFrames = jmax (2, (int) (options.seconds * 60.0));
+
+        RingBuffer<float> ringBuffer (2, jmax (hopSize * 10, 2 * OscilloscopeTrigger::getHistorySize (options.sampleRate)));
+        AudioBuffer<float> block (2, hopSize);
+        Random random (1);
+
+        OscilloscopeTrigger trigger;
+        trigger.setSampleRate (options.sampleRate);
+        trigger.setSettings (settings);
+
+        float trace[traceSize], previousTrace[traceSize];
+        double totalSeconds = 0.0, changeSum = 0.0;
+        Result result;
+        int64 clock = 0;
+        int numTriggered = 0;
+
+        for (int frame = 0; frame < numFrames; ++frame)
+        {
+            for (int i = 0; i < hopSize; ++i)
+            {
+                const double phase = MathConstants<double>::twoPi * options.frequency * (double) clock++ / options.sampleRate;
+                const float tone = (float) (0.3 * std::sin (phase) + 0.5 * std::sin (2.0 * phase + 0.3) + 0.15 * std::sin (3.0 * phase + 0.5));
+                const float value = tone + options.noise * (2.0f * random.nextFloat() - 1.0f);
+
+                block.setSample (0, i, value);
+                block.setSample (1, i, value);
+            }
+
+            ringBuffer.writeSamples (block, 0, hopSize);
+
+            const auto startTime = std::chrono::steady_clock::now();
+            numTriggered += trigger.read (ringBuffer, trace, traceSize) ? 1 : 0;
+            const double seconds = std::chrono::duration<double> (std::chrono::steady_clock::now() - startTime).count();
+
+            totalSeconds += seconds;
+            result.maxMicroseconds = jmax (result.maxMicroseconds, seconds * 1.0e6);
+
+            if (frame > 0)
+            {
+                double difference = 0.0, energy = 0.0;
+
+                for (int i = 0; i < traceSize; ++i)
+                {
+                    difference += (trace[i] - previousTrace[i]) * (trace[i] - previousTrace[i]);
+                    energy += trace[i] * trace[i];
+                }
+
+                changeSum += energy > 0.0 ? std::sqrt (difference / energy) : 0.0;
+            }
+
+            std::copy (trace, trace + traceSize, previousTrace);
+        }
+
+        result.meanMicroseconds = 1.0e6 * totalSeconds / numFrames;
+        result.traceChangePercent = 100.0 * changeSum / (numFrames - 1);
+        result.triggeredPercent = 100.0 * numTriggered / numFrames;
+        return result;
+    }
+};
@@ -0,0 +1,434 @@
+//
+//  VisualizerPipeline.h
+//  3DAudioVisualizers
+//
+//  Owns the visualizers and tracks which stream each one is attached to.
+//
+
+#pragma once
+
+#include "../JuceLibraryCode/JuceHeader.h"
+#include <GL/glew.h>
+#include "AudioStream.h"
+#include "Oscilloscope2D.h"
+#include "Oscilloscope3D.h"
+#include "Spectrum.h"
+#include "Spectrogram.h"
+#include "FrameScheduler.h"
+#include "ShaderLibrary.h"
+#include "ScratchArena.h"
+#include "Trace.h"
+
+/** Every visualizer, each allocated once, when it is first shown.
+
+    Only the visualizer on screen exists at startup, so only one OpenGL
+    context and render thread start. Its GLEW init and shaders run on that
+    thread, while the message thread goes on; the status label reads
+    "Starting OpenGL..." until the shaders are ready. Settings made before
+    a visualizer exists are kept and applied when it is created.
+
+    Once created, the visualizers are never recreated, so their OpenGL
+    contexts, shaders and buffer objects survive audio device switches. Each
+    visualizer reads from one AudioStream at a time and can be moved to any
+    other stream with attach().
+
+    The visualizers are owned here and added to the parent component given
+    to the constructor. They repaint on demand, when their stream has new
+    data, see FrameScheduler.
+ */
+class VisualizerPipeline
+{
+public:
+    enum VisualizerType
+    {
+        oscilloscope2DType = 0,
+        oscilloscope3DType,
+        spectrumType,
+        spectrogramType,
+        numVisualizerTypes
+    };
+
+    VisualizerPipeline (AudioStream& initialStream, Component& parentComponent)
+    :   parent (parentComponent)
+    {
+        for (auto& stream : attachedStreams)
+            stream = &initialStream;
+    }
+
+    ~VisualizerPipeline()
+    {
+        for (int i = 0; i < numVisualizerTypes; ++i)
+            stop ((VisualizerType) i);
+    }
+
+    //==========================================================================
+    // Streams
+
+    /** Points one visualizer at a different stream.
+     */
+    void attach (VisualizerType type, AudioStream& stream)
+    {
+        jassert (type >= 0 && type < numVisualizerTypes);
+        attachedStreams[type] = &stream;
+
+        if (oscilloscope2D != nullptr && type == oscilloscope2DType)    oscilloscope2D->setRingBuffer (&stream.getRingBuffer());
+        if (oscilloscope3D != nullptr && type == oscilloscope3DType)    oscilloscope3D->setRingBuffer (&stream.getRingBuffer());
+        if (spectrum != nullptr && type == spectrumType)                spectrum->setAnalysis (&stream.getAnalysis());
+        if (spectrogram != nullptr && type == spectrogramType)          spectrogram->setAnalysis (&stream.getAnalysis());
+
+        updateSampleRates();
+        invalidate (type);
+    }
+
+    /** Points every visualizer at the same stream.
+     */
+    void attachAll (AudioStream& stream)
+    {
+        for (int i = 0; i < numVisualizerTypes; ++i)
+            attach ((VisualizerType) i, stream);
+    }
+
+    AudioStream* getAttachedStream (VisualizerType type) const
+    {
+        return attachedStreams[type];
+    }
+
+    /** Passes the sample rates and playback latencies of the attached
+        streams on again. Call after the streams were prepared for a new
+        audio device.
+     */
+    void updateSampleRates()
+    {
+        if (oscilloscope2D != nullptr)
+        {
+            auto& stream2D = *attachedStreams[oscilloscope2DType];
+            oscilloscope2D->setSampleRate (stream2D.getSampleRate());
+            oscilloscope2D->setPlaybackLatency (stream2D.getPlaybackLatency());
+        }
+
+        if (oscilloscope3D != nullptr)
+        {
+            auto& stream3D = *attachedStreams[oscilloscope3DType];
+            oscilloscope3D->setSampleRate (stream3D.getSampleRate());
+            oscilloscope3D->setPlaybackLatency (stream3D.getPlaybackLatency());
+        }
+
+        updateLingerSeconds();
+    }
+
+    /** Delays the oscilloscopes' pictures by this much more than the display
+        timing FramePacer measures, e.g. for a display with its own
+        processing.
+     */
+    void setDisplayLatency (double seconds)
+    {
+        displayLatency = seconds;
+
+        if (oscilloscope2D != nullptr)  oscilloscope2D->setDisplayLatency (seconds);
+        if (oscilloscope3D != nullptr)  oscilloscope3D->setDisplayLatency (seconds);
+    }
+
+    /** Makes the 2D oscilloscope draw the envelope of the last seconds of
+        audio instead of a short trace (0). See Oscilloscope2D::setTimeWindow().
+     */
+    void setOscilloscopeTimeWindow (double seconds)
+    {
+        oscilloscopeTimeWindow = seconds;
+
+        if (oscilloscope2D != nullptr)
+            oscilloscope2D->setTimeWindow (seconds);
+
+        invalidate (oscilloscope2DType);
+    }
+
+    /** Chooses how the 2D oscilloscope draws its trace. See
+        Oscilloscope2D::setRenderer().
+     */
+    void setOscilloscopeRenderer (Oscilloscope2D::Renderer renderer)
+    {
+        oscilloscopeRenderer = renderer;
+
+        if (oscilloscope2D != nullptr)
+            oscilloscope2D->setRenderer (renderer);
+
+        invalidate (oscilloscope2DType);
+    }
+
+    /** Turns trails on or off in the oscilloscopes and the Spectrum. See
+        Phosphor.
+     */
+    void setPhosphor (const Phosphor::Settings& settings)
+    {
+        phosphorSettings = settings;
+
+        if (oscilloscope2D != nullptr)  oscilloscope2D->setPhosphor (settings);
+        if (oscilloscope3D != nullptr)  oscilloscope3D->setPhosphor (settings);
+        if (spectrum != nullptr)        spectrum->setPhosphor (settings);
+
+        // Trails keep fading after the data stops
+        updateLingerSeconds();
+        scheduler.invalidateAll();
+    }
+
+    /** Chooses how both oscilloscopes trigger.
+     */
+    void setTriggerSettings (const OscilloscopeTrigger::Settings& settings)
+    {
+        triggerSettings = settings;
+
+        if (oscilloscope2D != nullptr)  oscilloscope2D->setTriggerSettings (settings);
+        if (oscilloscope3D != nullptr)  oscilloscope3D->setTriggerSettings (settings);
+
+        invalidate (oscilloscope2DType);
+        invalidate (oscilloscope3DType);
+    }
+
+    /** Chooses the dB spectrum and range the Spectrum and the Spectrogram
+        draw.
+     */
+    void setSpectrumScale (const SpectrumBands::Scale& scale)
+    {
+        spectrumScale = scale;
+
+        if (spectrum != nullptr)        spectrum->setScale (scale);
+        if (spectrogram != nullptr)     spectrogram->setScale (scale);
+
+        invalidate (spectrumType);
+        invalidate (spectrogramType);
+    }
+
+    /** Chooses the frame rate cap, or continuous repainting. See
+        FrameScheduler.
+     */
+    void setFrameScheduling (const FrameScheduler::Settings& settings)
+    {
+        scheduler.setSettings (settings);
+
+        if (oscilloscope2D != nullptr)  oscilloscope2D->setContinuousRepainting (settings.continuous);
+        if (oscilloscope3D != nullptr)  oscilloscope3D->setContinuousRepainting (settings.continuous);
+    }
+
+    /** Loads the shaders from files in directory and reloads them when they
+        change, or goes back to the built-in shaders (File()). Add
+        getShaderCompiler() to the window afterwards. See ShaderLibrary.
+     */
+    void setShaderDirectory (const File& directory)
+    {
+        shaderLibrary.setDirectory (directory);
+    }
+
+    /** The component that compiles edited shaders while a shader directory
+        is set, or nullptr.
+     */
+    Component* getShaderCompiler() const noexcept
+    {
+        return shaderLibrary.getCompilerComponent();
+    }
+
+    //==========================================================================
+    // Visualizer Control
+
+    /** The visualizer of a type, or nullptr if it has not been shown yet.
+     */
+    Component* getVisualizer (VisualizerType type) const
+    {
+        switch (type)
+        {
+            case oscilloscope2DType:    return oscilloscope2D.get();
+            case oscilloscope3DType:    return oscilloscope3D.get();
+            case spectrumType:          return spectrum.get();
+            case spectrogramType:       return spectrogram.get();
+            default:                    break;
+        }
+
+        jassertfalse;
+        return nullptr;
+    }
+
+    /** Lets the FrameScheduler repaint a visualizer.
+     */
+    void start (VisualizerType type)
+    {
+        if (getVisualizer (type) != nullptr)
+            scheduler.setRunning (type, true);
+    }
+
+    void stop (VisualizerType type)
+    {
+        if (getVisualizer (type) != nullptr)
+            scheduler.setRunning (type, false);
+    }
+
+    /** Makes one visualizer visible and rendering, creating it the first
+        time, and hides and stops the others.
+     */
+    void showOnly (VisualizerType type)
+    {
+        for (int i = 0; i < numVisualizerTypes; ++i)
+        {
+            auto t = (VisualizerType) i;
+
+            if (t != type && getVisualizer (t) != nullptr)
+            {
+                getVisualizer (t)->setVisible (false);
+                stop (t);
+            }
+        }
+
+        create (type).setVisible (true);
+        start (type);
+    }
+
+    /** Hides and stops every visualizer.
+     */
+    void hideAll()
+    {
+        for (int i = 0; i < numVisualizerTypes; ++i)
+        {
+            if (auto* visualizer = getVisualizer ((VisualizerType) i))
+            {
+                visualizer->setVisible (false);
+                stop ((VisualizerType) i);
+            }
+        }
+    }
+
+    void setBounds (Rectangle<int> bounds)
+    {
+        visualizerBounds = bounds;
+
+        for (int i = 0; i < numVisualizerTypes; ++i)
+            if (auto* visualizer = getVisualizer ((VisualizerType) i))
+                visualizer->setBounds (bounds);
+    }
+
+private:
+    /** Returns the visualizer of a type, creating it with the current
+        settings and stream if it does not exist yet. It starts hidden and
+        stopped.
+     */
+    Component& create (VisualizerType type)
+    {
+        if (auto* existing = getVisualizer (type))
+            return *existing;
+
+        TOWEL_TRACE_ZONE ("VisualizerPipeline::create");
+
+        auto& stream = *attachedStreams[type];
+        Component* visualizer = nullptr;
+
+        switch (type)
+        {
+            case oscilloscope2DType:
+                oscilloscope2D = std::make_unique<Oscilloscope2D> (&stream.getRingBuffer(), scratchArena);
+                oscilloscope2D->setTriggerSettings (triggerSettings);
+                oscilloscope2D->setTimeWindow (oscilloscopeTimeWindow);
+                oscilloscope2D->setRenderer (oscilloscopeRenderer);
+                oscilloscope2D->setPhosphor (phosphorSettings);
+                oscilloscope2D->setDisplayLatency (displayLatency);
+                oscilloscope2D->setContinuousRepainting (scheduler.getSettings().continuous);
+                oscilloscope2D->addShaders (shaderLibrary);
+                scheduler.addClient (type, *oscilloscope2D, oscilloscope2D->getOpenGLContext(),
+                                     [this] { return oscilloscope2D->getContentVersion(); });
+                visualizer = oscilloscope2D.get();
+                break;
+
+            case oscilloscope3DType:
+                oscilloscope3D = std::make_unique<Oscilloscope3D> (&stream.getRingBuffer());
+                oscilloscope3D->setTriggerSettings (triggerSettings);
+                oscilloscope3D->setPhosphor (phosphorSettings);
+                oscilloscope3D->setDisplayLatency (displayLatency);
+                oscilloscope3D->setContinuousRepainting (scheduler.getSettings().continuous);
+                oscilloscope3D->addShaders (shaderLibrary);
+                scheduler.addClient (type, *oscilloscope3D, oscilloscope3D->getOpenGLContext(),
+                                     [this] { return oscilloscope3D->getContentVersion(); });
+                visualizer = oscilloscope3D.get();
+                break;
+
+            case spectrumType:
+                spectrum = std::make_unique<Spectrum> (&stream.getAnalysis(), scratchArena);
+                spectrum->setScale (spectrumScale);
+                spectrum->setPhosphor (phosphorSettings);
+                spectrum->addShaders (shaderLibrary);
+                scheduler.addClient (type, *spectrum, spectrum->getOpenGLContext(),
+                                     [this] { return spectrum->getContentVersion(); });
+                visualizer = spectrum.get();
+                break;
+
+            case spectrogramType:
+            default:
+                jassert (type == spectrogramType);
+                spectrogram = std::make_unique<Spectrogram> (&stream.getAnalysis(), scratchArena);
+                spectrogram->setScale (spectrumScale);
+                spectrogram->addShaders (shaderLibrary);
+                scheduler.addClient (spectrogramType, *spectrogram, spectrogram->getOpenGLContext(),
+                                     [this] { return spectrogram->getContentVersion(); });
+                visualizer = spectrogram.get();
+                break;
+        }
+
+        updateSampleRates();
+
+        visualizer->setBounds (visualizerBounds);
+        parent.addChildComponent (visualizer);
+        return *visualizer;
+    }
+
+    /** Repaints a visualizer that exists, see FrameScheduler::invalidate().
+     */
+    void invalidate (VisualizerType type)
+    {
+        if (getVisualizer (type) != nullptr)
+            scheduler.invalidate (type);
+    }
+
+    /** Keeps repainting after the data stops while trails fade and, for the
+        oscilloscopes, until the last samples written have been heard.
+     */
+    void updateLingerSeconds()
+    {
+        const double phosphorLingerSeconds = 5.0 * phosphorSettings.decaySeconds;
+
+        for (auto type : { oscilloscope2DType, oscilloscope3DType })
+        {
+            if (getVisualizer (type) == nullptr)
+                continue;
+
+            auto& stream = *attachedStreams[type];
+            const double playbackSeconds = stream.getSampleRate() > 0.0
+                                               ? stream.getPlaybackLatency() / stream.getSampleRate()
+                                               : 0.0;
+
+            scheduler.setLingerSeconds (type, jmax (phosphorLingerSeconds, playbackSeconds));
+        }
+
+        if (spectrum != nullptr)
+            scheduler.setLingerSeconds (spectrumType, phosphorLingerSeconds);
+    }
+
+    // Scratch memory of every visualizer, so it outlives them
+    ScratchArena scratchArena;
+
+    // Visualizers
+    std::unique_ptr<Oscilloscope2D> oscilloscope2D;
+    std::unique_ptr<Oscilloscope3D> oscilloscope3D;
+    std::unique_ptr<Spectrum> spectrum;
+    std::unique_ptr<Spectrogram> spectrogram;
+
+    Component& parent;
+    AudioStream* attachedStreams[numVisualizerTypes];
+    Rectangle<int> visualizerBounds;
+
+    // Settings, also applied to visualizers created later
+    OscilloscopeTrigger::Settings triggerSettings;
+    Phosphor::Settings phosphorSettings;
+    SpectrumBands::Scale spectrumScale;
+    double oscilloscopeTimeWindow = 0.0;
+    Oscilloscope2D::Renderer oscilloscopeRenderer = Oscilloscope2D::fragmentRenderer;
+    double displayLatency = 0.0;
+
+    ShaderLibrary shaderLibrary;    // Declared after the visualizers: it points at their shader slots
+    FrameScheduler scheduler;       // Declared last: it points at the visualizers
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (VisualizerPipeline)
+};
@@ -0,0 +1,375 @@
+//
+//  WaveformDecimator.h
+//  3DAudioVisualizers
+//
+//  Reduces long windows of a stream to one min/max/RMS triplet per pixel
+//  column.
+//
+
+#pragma once
+
+#if ! TOWEL_HEADLESS
+ #include "../JuceLibraryCode/JuceHeader.h"
+#endif
+#include "RingBuffer.h"
+#include <cmath>
+#include <limits>
+
+/** Keeps the last maxWindowSize samples of a stream (channels summed) with
+    a pyramid of block summaries, so a window of any length up to that can
+    be drawn as per-column envelopes at a cost that depends on the number of
+    columns, not on the window.
+
+    Level 0 is the samples themselves; every level above summarises
+    blockFactor entries of the one below with their minimum, maximum and sum
+    of squares. A column's samples are split into the largest aligned blocks
+    that fit, so each column reads fewer than 2 * blockFactor entries per
+    level. Columns start at fixed multiples of samplesPerColumn on the
+    stream's sample clock, so the envelope scrolls instead of shimmering as
+    new samples arrive.
+
+    Summaries are stored per field (all minimums, all maximums, all sums), so
+    the minimum and maximum of a run of entries come from
+    FloatVectorOperations::findMinimum() and findMaximum(), which are
+    vectorised. New audio costs one pass over the new samples.
+
+    Not thread safe: update() and getColumns() must be called from the same
+    thread, e.g. the render thread. Give it its memory with useStorage(),
+    e.g. from a ScratchArena, so that thread never allocates; otherwise the
+    first update() or push() allocates it.
+ */
+class WaveformDecimator
+{
+public:
+    /** One pixel column: the same layout as an RGB32F texel.
+     */
+    struct Column
+    {
+        float min, max, rms;
+    };
+
+    enum
+    {
+        maxWindowSize = 1 << 20,
+        blockFactorBits = 4,
+        blockFactor = 1 << blockFactorBits,
+        numLevels = 5,                          // Samples, then blocks of 16, 256, 4096 and 65536
+        capacity = 2 * maxWindowSize,           // Room for a full window plus the largest block
+        maxReadSize = 1 << 16,                  // Most samples update() takes from a ring at once
+        maxChannels = 2
+    };
+
+    WaveformDecimator() = default;
+
+    /** The number of floats useStorage() needs.
+     */
+    static size_t getStorageSize() noexcept
+    {
+        size_t total = (size_t) maxChannels * maxReadSize;
+
+        for (int level = 0; level < numLevels; ++level)
+            total += (size_t) (level == 0 ? 1 : 3) * (size_t) (capacity >> (level * blockFactorBits));
+
+        return total;
+    }
+
+    /** Keeps the history and the read buffer in storage: getStorageSize()
+        zeroed floats that outlive the decimator. Call before the first
+        update() or push().
+     */
+    void useStorage (float* storage)
+    {
+        jassert (levels[0].max == nullptr);
+
+        for (int level = 0; level < numLevels; ++level)
+        {
+            auto& l = levels[level];
+            l.size = capacity >> (level * blockFactorBits);
+            l.max = storage;
+            storage += l.size;
+
+            if (level == 0)
+            {
+                l.min = l.max;
+            }
+            else
+            {
+                l.min = storage;
+                l.sum = storage + l.size;
+                storage += 2 * l.size;
+            }
+        }
+
+        for (auto*& channel : readChannels)
+        {
+            channel = storage;
+            storage += maxReadSize;
+        }
+    }
+
+    /** Appends every sample written to ringBuffer since the previous call. If
+        the writer got more than half a ring, or maxReadSize samples, ahead,
+        the samples in between are skipped. Switching to another RingBuffer
+        clears the history.
+     */
+    void update (RingBuffer<float>& ringBuffer)
+    {
+        allocate();
+
+        if (ringBuffer.getNumChannels() > maxChannels)
+        {
+            jassertfalse;
+            return;
+        }
+
+        const int64 written = ringBuffer.getTotalSamplesWritten();
+
+        if (&ringBuffer != lastRingBuffer || written < lastReadEnd)
+        {
+            // Start with as much of the ring's history as one read can take
+            reset();
+            lastRingBuffer = &ringBuffer;
+            lastReadEnd = jmax ((int64) 0, written - ringBuffer.getBufferSize() / 2);
+        }
+
+        // Newer samples may arrive while reading; read a little more so they
+        // are not mistaken for a gap
+        const int readSize = (int) jmin ((int64) ringBuffer.getBufferSize() / 2, (int64) maxReadSize,
+                                         written - lastReadEnd + (int64) readMargin);
+
+        if (readSize <= 0)
+            return;
+
+        AudioBuffer<float> readBuffer (readChannels, ringBuffer.getNumChannels(), readSize);
+
+        int64 readEnd = 0;
+        ringBuffer.readSamplesChecked (readBuffer, readSize, &readEnd);
+
+        const int numNew = (int) jmin ((int64) readSize, readEnd - lastReadEnd);
+        lastReadEnd = readEnd;
+
+        if (numNew <= 0)
+            return;
+
+        // Sum channels together
+        const int first = readSize - numNew;
+        float* mono = readBuffer.getWritePointer (0, first);
+
+        for (int ch = 1; ch < readBuffer.getNumChannels(); ++ch)
+            FloatVectorOperations::add (mono, readBuffer.getReadPointer (ch, first), numNew);
+
+        push (mono, numNew);
+    }
+
+    /** Appends samples directly, for streams that are not in a RingBuffer.
+     */
+    void push (const float* samples, int numSamples)
+    {
+        allocate();
+
+        while (numSamples > 0)
+        {
+            const int position = (int) (numPushed & (capacity - 1));
+            const int count = jmin (numSamples, (int) capacity - position);
+
+            FloatVectorOperations::copy (levels[0].max + position, samples, count);
+
+            const int64 before = numPushed;
+            numPushed += count;
+            summariseNewBlocks (before);
+
+            samples += count;
+            numSamples -= count;
+        }
+    }
+
+    void reset()
+    {
+        numPushed = 0;
+        lastRingBuffer = nullptr;
+        lastReadEnd = 0;
+    }
+
+    /** Fills dest with the newest numColumns columns of samplesPerColumn
+        samples each, oldest first. samplesPerColumn * numColumns must not
+        exceed maxWindowSize. Columns before the first sample are silent.
+     */
+    void getColumns (double samplesPerColumn, int numColumns, Column* dest) const
+    {
+        jassert (samplesPerColumn >= 1.0 && samplesPerColumn * numColumns <= maxWindowSize);
+
+        const int64 lastColumn = (int64) std::floor ((double) numPushed / samplesPerColumn);
+        const int64 oldestAvailable = jmax ((int64) 0, numPushed - (int64) maxWindowSize);
+
+        for (int i = 0; i < numColumns; ++i)
+        {
+            const int64 column = lastColumn - numColumns + i;
+            const int64 start = jmax (oldestAvailable, (int64) std::floor (column * samplesPerColumn));
+            const int64 end = (int64) std::floor ((column + 1) * samplesPerColumn);
+
+            dest[i] = start < end ? summarise (start, end) : Column { 0.0f, 0.0f, 0.0f };
+        }
+    }
+
+    /** The number of samples appended so far, i.e. the decimator's own sample
+        clock.
+     */
+    int64 getNumSamplesPushed() const noexcept      { return numPushed; }
+
+private:
+    /** One level of the pyramid. Level 0 keeps the samples in max, its min
+        points to the same memory and it has no sums: squares are summed as
+        they are read.
+     */
+    struct Level
+    {
+        float* min = nullptr;
+        float* max = nullptr;
+        float* sum = nullptr;
+        int size = 0;       // Entries, a power of two
+    };
+
+    /** Allocates the storage if useStorage() was not called.
+     */
+    void allocate()
+    {
+        if (levels[0].max != nullptr)
+            return;
+
+        ownStorage.calloc (getStorageSize());
+        useStorage (ownStorage);
+    }
+
+    /** Summarises every block, on every level, that the samples from
+        pushedBefore to numPushed completed.
+     */
+    void summariseNewBlocks (int64 pushedBefore)
+    {
+        for (int level = 1; level < numLevels; ++level)
+        {
+            const int shift = level * blockFactorBits;
+            const int64 firstBlock = pushedBefore >> shift;
+            const int64 endBlock = numPushed >> shift;
+
+            if (firstBlock == endBlock)
+                break;
+
+            const auto& below = levels[level - 1];
+            auto& l = levels[level];
+
+            for (int64 block = firstBlock; block < endBlock; ++block)
+            {
+                // A block's entries below never wrap: every size is a multiple of blockFactor
+                const int dest = (int) (block & (l.size - 1));
+                const int source = (int) ((block << blockFactorBits) & (below.size - 1));
+
+                l.min[dest] = FloatVectorOperations::findMinimum (below.min + source, (int) blockFactor);
+                l.max[dest] = FloatVectorOperations::findMaximum (below.max + source, (int) blockFactor);
+                l.sum[dest] = getSum (below, source, blockFactor);
+            }
+        }
+    }
+
+    /** Min, max and RMS of the samples from start to end, read from the
+        coarsest blocks that fit.
+     */
+    Column summarise (int64 start, int64 end) const
+    {
+        Accumulator result;
+        const int64 numSamples = end - start;
+        int level = 0;
+
+        while (start < end)
+        {
+            const int shift = (level + 1) * blockFactorBits;
+
+            if (level + 1 == numLevels)
+            {
+                accumulate (result, level, start, end);
+                break;
+            }
+
+            const int64 blockSize = (int64) 1 << shift;
+            const int64 alignedStart = (start + blockSize - 1) & ~(blockSize - 1);
+            const int64 alignedEnd = end & ~(blockSize - 1);
+
+            if (alignedStart >= alignedEnd)
+            {
+                accumulate (result, level, start, end);
+                break;
+            }
+
+            accumulate (result, level, start, alignedStart);
+            accumulate (result, level, alignedEnd, end);
+            start = alignedStart;
+            end = alignedEnd;
+            ++level;
+        }
+
+        return { result.min, result.max, (float) std::sqrt (result.sum / (double) numSamples) };
+    }
+
+    struct Accumulator
+    {
+        float min = std::numeric_limits<float>::max();
+        float max = std::numeric_limits<float>::lowest();
+        double sum = 0.0;
+    };
+
+    /** Adds the entries of one level covering samples start to end, which are
+        multiples of the level's block size.
+     */
+    void accumulate (Accumulator& result, int level, int64 start, int64 end) const
+    {
+        const auto& l = levels[level];
+        const int shift = level * blockFactorBits;
+        int64 first = start >> shift;
+        const int64 last = end >> shift;
+
+        while (first < last)
+        {
+            // Split where the level's ring wraps around
+            const int position = (int) (first & (l.size - 1));
+            const int count = (int) jmin (last - first, (int64) (l.size - position));
+
+            result.min = jmin (result.min, FloatVectorOperations::findMinimum (l.min + position, count));
+            result.max = jmax (result.max, FloatVectorOperations::findMaximum (l.max + position, count));
+            result.sum += getSum (l, position, count);
+
+            first += count;
+        }
+    }
+
+    /** The sum of squares of the samples under count of the level's
+        entries, from position on.
+     */
+    static float getSum (const Level& l, int position, int count) noexcept
+    {
+        float total = 0.0f;
+
+        if (l.sum != nullptr)
+        {
+            for (int i = position; i < position + count; ++i)
+                total += l.sum[i];
+        }
+        else
+        {
+            for (int i = position; i < position + count; ++i)
+                total += l.max[i] * l.max[i];
+        }
+
+        return total;
+    }
+
+    enum { readMargin = 4096 };
+
+    Level levels[numLevels];
+    int64 numPushed = 0;
+
+    RingBuffer<float>* lastRingBuffer = nullptr;
+    int64 lastReadEnd = 0;
+    float* readChannels[maxChannels] = {};    // maxReadSize samples each
+    HeapBlock<float> ownStorage;            // Without useStorage()
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (WaveformDecimator)
+};
@@ -0,0 +1,451 @@
+//
+//  WaveformOverview.h
+//  3DAudioVisualizers
+//
+//  Min/max overview of a whole audio file, scanned in parallel and drawn at
+//  any zoom from a decimation pyramid.
+//
+
+#pragma once
+
+#include "../JuceLibraryCode/JuceHeader.h"
+#include <atomic>
+#include <functional>
+#include <vector>
+
+/** The min/max envelope of a whole file, over all channels, at several
+    resolutions.
+
+    Level 0 holds the minimum and maximum of every samplesPerBlock samples;
+    each further level combines levelFactor entries of the one below, up to
+    one entry per chunk. The file is scanned in chunks by one job per core,
+    each with its own reader, so nothing but the chunk counter is shared.
+    Chunks are taken in bit-reversed order: the first few finished ones are
+    spread over the whole file, so a long file shows a usable outline long
+    before the scan is complete, and the gaps fill in as the rest arrive.
+
+    Readers prefer the format's memory-mapped reader (WAV and AIFF), which
+    decodes straight from the page cache.
+ */
+class WaveformEnvelope
+{
+public:
+    struct MinMax
+    {
+        float min = 0.0f;
+        float max = 0.0f;
+    };
+
+    enum
+    {
+        samplesPerBlock = 256,
+        levelFactor = 4,
+        numLevels = 6,
+        chunkSize = samplesPerBlock << (2 * (numLevels - 1))   // One entry of the top level
+    };
+
+    /** Makes a new reader of the file for each job. Readers are used by one
+        thread each.
+     */
+    using ReaderFactory = std::function<std::unique_ptr<AudioFormatReader>()>;
+
+    /** Starts scanning straight away on numThreads threads of its own.
+     */
+    WaveformEnvelope (ReaderFactory createReader, int64 lengthInSamples, double fileSampleRate,
+                      int numThreads = SystemStats::getNumCpus())
+    :   length (jmax ((int64) 0, lengthInSamples)),
+        sampleRate (fileSampleRate),
+        numChunks ((int) ((length + chunkSize - 1) / chunkSize)),
+        chunkDone (new std::atomic<bool>[(size_t) jmax (1, numChunks)]),
+        pool (jmax (1, numThreads))
+    {
+        for (int i = 0; i < numChunks; ++i)
+            chunkDone[i] = false;
+
+        for (int level = 0; level < numLevels; ++level)
+            levels[level].resize ((size_t) numChunks * (size_t) getBlocksPerChunk (level));
+
+        while (chunkOrderSize < numChunks)
+            chunkOrderSize <<= 1;
+
+        for (int i = 0; i < jmax (1, numThreads); ++i)
+            pool.addJob ([this, createReader] { scan (createReader()); });
+    }
+
+    /** Stops the scan, waiting for the chunks in progress.
+     */
+    ~WaveformEnvelope()
+    {
+        cancelled = true;
+        pool.removeAllJobs (true, -1);
+    }
+
+    /** Creates an envelope of a file, or nullptr if no format can read it.
+        formats must outlive the envelope.
+     */
+    static std::unique_ptr<WaveformEnvelope> forFile (AudioFormatManager& formats, const File& file)
+    {
+        auto createReader = [&formats, file]() -> std::unique_ptr<AudioFormatReader>
+        {
+            for (int i = 0; i < formats.getNumKnownFormats(); ++i)
+            {
+                auto* format = formats.getKnownFormat (i);
+
+                if (format->canHandleFile (file))
+                {
+                    std::unique_ptr<MemoryMappedAudioFormatReader> mapped (format->createMemoryMappedReader (file));
+
+                    if (mapped != nullptr && mapped->mapEntireFile())
+                        return mapped;
+                }
+            }
+
+            return std::unique_ptr<AudioFormatReader> (formats.createReaderFor (file));
+        };
+
+        auto reader = createReader();
+
+        if (reader == nullptr)
+            return nullptr;
+
+        return std::make_unique<WaveformEnvelope> (createReader, reader->lengthInSamples, reader->sampleRate);
+    }
+
+    int64 getLengthInSamples() const    { return length; }
+    double getSampleRate() const        { return sampleRate; }
+    int getNumChunks() const            { return numChunks; }
+    int getNumChunksDone() const        { return numChunksDone.load(); }
+    bool isComplete() const             { return numChunksDone.load() == numChunks; }
+
+    static int getBlockSize (int level)             { return samplesPerBlock << (2 * level); }
+    static int getBlocksPerChunk (int level)        { return chunkSize / getBlockSize (level); }
+
+    /** Fills numPixels min/max pairs, each covering samplesPerPixel samples
+        from startSample on, from the coarsest level that still resolves a
+        pixel. Pixels outside the file or whose chunks are not scanned yet
+        get valid[i] = false. Can be called while the scan runs.
+     */
+    void getPixels (double startSample, double samplesPerPixel, MinMax* dest, bool* valid, int numPixels) const
+    {
+        int level = 0;
+
+        while (level + 1 < numLevels && getBlockSize (level + 1) <= samplesPerPixel)
+            ++level;
+
+        const double blockSize = getBlockSize (level);
+        const int blocksPerChunk = getBlocksPerChunk (level);
+        const int64 numBlocks = (int64) levels[level].size();
+        const auto& entries = levels[level];
+
+        for (int i = 0; i < numPixels; ++i)
+        {
+            const double start = startSample + i * samplesPerPixel;
+            const int64 firstBlock = jmax ((int64) 0, (int64) std::floor (start / blockSize));
+            const int64 endBlock = jmin (numBlocks, jmax (firstBlock + 1, (int64) std::ceil ((start + samplesPerPixel) / blockSize)));
+
+            valid[i] = false;
+
+            if (start < 0.0 || start >= (double) length)
+                continue;
+
+            for (int64 block = firstBlock; block < endBlock; ++block)
+            {
+                if (! chunkDone[(size_t) (block / blocksPerChunk)].load (std::memory_order_acquire))
+                    continue;
+
+                const auto& e = entries[(size_t) block];
+
+                if (! valid[i])
+                    dest[i] = e;
+
+                dest[i].min = jmin (dest[i].min, e.min);
+                dest[i].max = jmax (dest[i].max, e.max);
+                valid[i] = true;
+            }
+        }
+    }
+
+private:
+    /** One job: takes chunks until none are left.
+     */
+    void scan (std::unique_ptr<AudioFormatReader> reader)
+    {
+        if (reader == nullptr)
+            return;
+
+        AudioBuffer<float> buffer ((int) reader->numChannels, chunkSize);
+
+        while (! cancelled)
+        {
+            const int index = nextChunk++;
+
+            if (index >= chunkOrderSize)
+                return;
+
+            const int chunk = reverseBits (index);
+
+            if (chunk >= numChunks)
+                continue;
+
+            scanChunk (*reader, buffer, chunk);
+            chunkDone[chunk].store (true, std::memory_order_release);
+            ++numChunksDone;
+        }
+    }
+
+    void scanChunk (AudioFormatReader& reader, AudioBuffer<float>& buffer, int chunk)
+    {
+        const int64 start = (int64) chunk * chunkSize;
+        const int numSamples = (int) jmin ((int64) chunkSize, length - start);
+
+        reader.read (&buffer, 0, numSamples, start, true, true);
+
+        // Level 0 straight from the samples, over all channels
+        auto* level0 = levels[0].data() + (size_t) chunk * getBlocksPerChunk (0);
+
+        for (int block = 0; block < getBlocksPerChunk (0); ++block)
+        {
+            const int blockStart = block * samplesPerBlock;
+            const int n = jmin ((int) samplesPerBlock, numSamples - blockStart);
+            MinMax e;
+
+            for (int ch = 0; n > 0 && ch < buffer.getNumChannels(); ++ch)
+            {
+                const auto range = FloatVectorOperations::findMinAndMax (buffer.getReadPointer (ch, blockStart), n);
+                e.min = ch == 0 ? range.getStart() : jmin (e.min, range.getStart());
+                e.max = ch == 0 ? range.getEnd() : jmax (e.max, range.getEnd());
+            }
+
+            level0[block] = e;
+        }
+
+        // Every other level combines levelFactor entries of the one below
+        for (int level = 1; level < numLevels; ++level)
+        {
+            const auto* below = levels[level - 1].data() + (size_t) chunk * getBlocksPerChunk (level - 1);
+            auto* above = levels[level].data() + (size_t) chunk * getBlocksPerChunk (level);
+
+            for (int block = 0; block < getBlocksPerChunk (level); ++block)
+            {
+                MinMax e = below[block * levelFactor];
+
+                for (int i = 1; i < levelFactor; ++i)
+                {
+                    e.min = jmin (e.min, below[block * levelFactor + i].min);
+                    e.max = jmax (e.max, below[block * levelFactor + i].max);
+                }
+
+                above[block] = e;
+            }
+        }
+    }
+
+    int reverseBits (int index) const
+    {
+        int reversed = 0;
+
+        for (int bit = 1; bit < chunkOrderSize; bit <<= 1)
+            reversed = (reversed << 1) | ((index & bit) != 0 ? 1 : 0);
+
+        return reversed;
+    }
+
+    const int64 length;
+    const double sampleRate;
+    const int numChunks;
+    int chunkOrderSize = 1;     // numChunks rounded up to a power of two
+
+    std::vector<MinMax> levels[numLevels];
+    std::unique_ptr<std::atomic<bool>[]> chunkDone;
+    std::atomic<int> nextChunk { 0 };
+    std::atomic<int> numChunksDone { 0 };
+    std::atomic<bool> cancelled { false };
+
+    ThreadPool pool;    // Last, so its jobs are gone before anything else
+
+    JUCE_DECLARE_NON_COPYABLE (WaveformEnvelope)
+};
+
+//==============================================================================
+/** Draws a WaveformEnvelope and repaints while the scan is running, so the
+    overview fills in chunk by chunk.
+
+    The mouse wheel zooms around the pointer and dragging pans; each zoom
+    draws from the pyramid level that matches the pixels, so any zoom costs
+    about the same. A click without dragging calls onSeek with the time
+    under the pointer.
+ */
+class WaveformOverview : public Component,
+                         private Timer
+{
+public:
+    WaveformOverview() {}
+
+    /** Starts scanning file and shows all of it. Returns false, and shows
+        nothing, if no format in formats can read it. formats must outlive
+        this component.
+     */
+    bool setFile (AudioFormatManager& formats, const File& file)
+    {
+        envelope = WaveformEnvelope::forFile (formats, file);
+        visibleStart = 0.0;
+        visibleLength = envelope != nullptr ? (double) jmax ((int64) 1, envelope->getLengthInSamples()) : 1.0;
+
+        startTimerHz (30);
+        repaint();
+        return envelope != nullptr;
+    }
+
+    void clear()
+    {
+        envelope = nullptr;
+        stopTimer();
+        repaint();
+    }
+
+    std::function<void (double seconds)> onSeek;
+
+    //==========================================================================
+    void paint (Graphics& g) override
+    {
+        g.fillAll (Colours::black);
+
+        if (envelope == nullptr || getWidth() <= 0)
+            return;
+
+        const int width = getWidth();
+        const float height = (float) getHeight();
+        const float centre = height * 0.5f;
+
+        if (width != numPixelsAllocated)
+        {
+            pixels.allocate ((size_t) width, false);
+            pixelValid.allocate ((size_t) width, false);
+            nearestValid.allocate ((size_t) width, false);
+            numPixelsAllocated = width;
+        }
+
+        envelope->getPixels (visibleStart, visibleLength / width, pixels, pixelValid, width);
+        findNearestValidPixels (width);
+
+        g.setColour (Colours::darkgrey);
+        g.drawHorizontalLine (roundToInt (centre), 0.0f, (float) width);
+
+        for (int x = 0; x < width && sampleAt (x) < (double) envelope->getLengthInSamples(); ++x)
+        {
+            if (nearestValid[x] < 0)
+                continue;
+
+            // Not scanned yet: borrow the nearest scanned pixel, dimmed
+            g.setColour (pixelValid[x] ? Colours::lightgreen : Colours::lightgreen.withAlpha (0.35f));
+
+            const auto& p = pixels[nearestValid[x]];
+            const float top = centre - jlimit (-1.0f, 1.0f, p.max) * centre;
+            const float bottom = centre - jlimit (-1.0f, 1.0f, p.min) * centre;
+            g.drawVerticalLine (x, top, jmax (top + 1.0f, bottom));
+        }
+
+        if (! envelope->isComplete())
+        {
+            g.setColour (Colours::white);
+            g.drawText ("Scanning " + String (100 * envelope->getNumChunksDone() / jmax (1, envelope->getNumChunks())) + "%",
+                        getLocalBounds().reduced (4), Justification::topRight);
+        }
+    }
+
+    void mouseDown (const MouseEvent&) override
+    {
+        dragStart = visibleStart;
+        dragged = false;
+    }
+
+    void mouseDrag (const MouseEvent& e) override
+    {
+        dragged = dragged || e.getDistanceFromDragStartX() != 0;
+        setVisibleRange (dragStart - e.getDistanceFromDragStartX() * visibleLength / jmax (1, getWidth()), visibleLength);
+    }
+
+    void mouseUp (const MouseEvent& e) override
+    {
+        if (! dragged && envelope != nullptr && onSeek != nullptr)
+            onSeek (sampleAt (e.x) / envelope->getSampleRate());
+    }
+
+    void mouseWheelMove (const MouseEvent& e, const MouseWheelDetails& wheel) override
+    {
+        if (envelope == nullptr)
+            return;
+
+        // The sample under the pointer stays put
+        const double anchor = sampleAt (e.x);
+        const double newLength = visibleLength * std::pow (2.0, -4.0 * wheel.deltaY);
+        const double fraction = e.x / (double) jmax (1, getWidth());
+
+        setVisibleRange (anchor - fraction * newLength, newLength);
+    }
+
+private:
+    void timerCallback() override
+    {
+        repaint();
+
+        if (envelope == nullptr || envelope->isComplete())
+            stopTimer();
+    }
+
+    /** For every pixel, the closest pixel with data, or -1 if none has any.
+     */
+    void findNearestValidPixels (int width)
+    {
+        int previous = -1;
+
+        for (int x = 0; x < width; ++x)
+        {
+            if (pixelValid[x])
+                previous = x;
+
+            nearestValid[x] = previous;
+        }
+
+        int next = -1;
+
+        for (int x = width; --x >= 0;)
+        {
+            if (pixelValid[x])
+                next = x;
+            else if (next >= 0 && (nearestValid[x] < 0 || next - x < x - nearestValid[x]))
+                nearestValid[x] = next;
+        }
+    }
+
+    double sampleAt (int x) const
+    {
+        return visibleStart + x * visibleLength / jmax (1, getWidth());
+    }
+
+    /** Clamps the range to the file, and to at least a sample per pixel.
+     */
+    void setVisibleRange (double start, double numSamples)
+    {
+        if (envelope == nullptr)
+            return;
+
+        const double fileLength = (double) jmax ((int64) 1, envelope->getLengthInSamples());
+
+        visibleLength = jlimit (jmin (fileLength, (double) jmax (1, getWidth())), fileLength, numSamples);
+        visibleStart = jlimit (0.0, fileLength - visibleLength, start);
+        repaint();
+    }
+
+    std::unique_ptr<WaveformEnvelope> envelope;
+    double visibleStart = 0.0, visibleLength = 1.0;     // In samples
+    double dragStart = 0.0;
+    bool dragged = false;
+
+    HeapBlock<WaveformEnvelope::MinMax> pixels;     // Reused by paint()
+    HeapBlock<bool> pixelValid;
+    HeapBlock<int> nearestValid;
+    int numPixelsAllocated = 0;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (WaveformOverview)
+};
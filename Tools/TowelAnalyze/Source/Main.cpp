@@ -0,0 +1,190 @@
+/*
+  ==============================================================================
+
+    Headless analysis driver. Runs audio files or raw PCM from stdin through
+    the visualizers' analysis engine (Source/AnalysisEngine.h) and writes one
+    record per analysis frame as CSV or binary. Needs no display, OpenGL or
+    audio device.
+
+  ==============================================================================
+*/
+
+#include "../JuceLibraryCode/JuceHeader.h"
+#include "../../../Source/AnalysisEngine.h"
+#include <cstdio>
+#include <iostream>
+
+//==============================================================================
+/** Reads the process's standard input.
+ */
+class StandardInputStream : public InputStream
+{
+public:
+    int64 getTotalLength() override             { return -1; }
+    bool isExhausted() override                 { return std::feof (stdin) != 0; }
+    int64 getPosition() override                { return position; }
+    bool setPosition (int64) override           { return false; }
+
+    int read (void* destBuffer, int maxBytesToRead) override
+    {
+        const auto n = (int) std::fread (destBuffer, 1, (size_t) maxBytesToRead, stdin);
+        position += n;
+        return n;
+    }
+
+private:
+    int64 position = 0;
+};
+
+/** Writes to the process's standard output.
+ */
+class StandardOutputStream : public OutputStream
+{
+public:
+    void flush() override                       { std::fflush (stdout); }
+    bool setPosition (int64) override           { return false; }
+    int64 getPosition() override                { return position; }
+
+    bool write (const void* dataToWrite, size_t numberOfBytes) override
+    {
+        position += (int64) numberOfBytes;
+        return std::fwrite (dataToWrite, 1, numberOfBytes, stdout) == numberOfBytes;
+    }
+
+private:
+    int64 position = 0;
+};
+
+//==============================================================================
+static void printUsage()
+{
+    std::cerr << "Usage: TowelAnalyze [options] <audio file>...\n"
+                 "       TowelAnalyze [options] -        (raw PCM on stdin, frames on stdout)\n"
+                 "\n"
+                 "  --format=csv|binary|recording\n"
+                 "                          Output format (default csv); recordings (.twar)\n"
+                 "                          can be added as replay streams in the app\n"
+                 "  --out=<directory>       Where per-file outputs go (default: current directory)\n"
+                 "  --threads=<n>           Files analysed in parallel (default: number of CPUs)\n"
+                 "  --bands=<n>             Spectrum bands per frame (default "
+              << (int) SpectrumBands::defaultNumBands << ")\n"
+                 "  --view=level|smoothed|peak\n"
+                 "                          Spectrum the bands are taken from (default smoothed)\n"
+                 "  --min-db=<db>           Level of band value 0 (default -90)\n"
+                 "  --max-db=<db>           Level of band value 1 (default 0, a full scale sine)\n"
+                 "  --constant-q[=<n>]      Log-spaced constant-Q spectrum from 32.7 Hz with n\n"
+                 "                          bins per octave (default 24) instead of the FFT\n"
+                 "  --min-freq=<hz>         Lowest constant-Q bin (default 32.7)\n"
+                 "  --bins                  Write raw spectrum magnitudes instead of bands\n"
+                 "  --levels                Write loudness and levels instead of bands: momentary,\n"
+                 "                          short-term and integrated LUFS, max true peak dBTP,\n"
+                 "                          then true peak, RMS and peak dB per channel\n"
+                 "  --block=<n>             Samples read at a time (default 4096)\n"
+                 "\n"
+                 "  stdin only:\n"
+                 "  --rate=<hz>             Sample rate (default 48000)\n"
+                 "  --channels=<n>          Interleaved channels (default 2)\n"
+                 "  --encoding=f32|s16      Little-endian sample encoding (default f32)\n";
+}
+
+int main (int argc, char* argv[])
+{
+    OfflineAnalyzer::Options options;
+    BatchAnalyzer::OutputFormat format = BatchAnalyzer::csvFormat;
+    File outputDirectory = File::getCurrentWorkingDirectory();
+    int numThreads = SystemStats::getNumCpus();
+    double rawSampleRate = 48000.0;
+    int rawChannels = 2;
+    RawPcmInput::Encoding rawEncoding = RawPcmInput::float32Encoding;
+    bool readStdin = false;
+    Array<File> inputs;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        const String arg (argv[i]);
+        auto value = arg.fromFirstOccurrenceOf ("=", false, false);
+
+        if (arg == "-")                             readStdin = true;
+        else if (arg == "--bins")                   options.rawBins = true;
+        else if (arg == "--levels")                 options.levels = true;
+        else if (arg.startsWith ("--constant-q"))
+        {
+            options.constantQ = true;
+
+            if (value.isNotEmpty())
+                options.constantQSettings.binsPerOctave = jlimit (1, (int) ConstantQTransform::maxBinsPerOctave, value.getIntValue());
+        }
+        else if (arg.startsWith ("--min-freq="))    options.constantQSettings.minFrequency = jmax (1.0f, value.getFloatValue());
+        else if (arg.startsWith ("--view="))        options.scale.view = value == "level" ? SpectrumBands::levelView
+                                                                   : value == "peak" ? SpectrumBands::peakView
+                                                                   : SpectrumBands::smoothedView;
+        else if (arg.startsWith ("--min-db="))      options.scale.minDb = value.getFloatValue();
+        else if (arg.startsWith ("--max-db="))      options.scale.maxDb = value.getFloatValue();
+        else if (arg.startsWith ("--format="))      format = value == "binary" ? BatchAnalyzer::binaryFormat
+                                                           : value == "recording" ? BatchAnalyzer::recordingFormat
+                                                           : BatchAnalyzer::csvFormat;
+        else if (arg.startsWith ("--out="))         outputDirectory = File::getCurrentWorkingDirectory().getChildFile (value);
+        else if (arg.startsWith ("--threads="))     numThreads = jmax (1, value.getIntValue());
+        else if (arg.startsWith ("--bands="))       options.numBands = jmax (1, value.getIntValue());
+        else if (arg.startsWith ("--block="))       options.blockSize = jmax (1, value.getIntValue());
+        else if (arg.startsWith ("--rate="))        rawSampleRate = jmax (1000.0, value.getDoubleValue());
+        else if (arg.startsWith ("--channels="))    rawChannels = jlimit (1, 64, value.getIntValue());
+        else if (arg.startsWith ("--encoding="))    rawEncoding = value == "s16" ? RawPcmInput::int16Encoding : RawPcmInput::float32Encoding;
+        else if (arg.startsWith ("-"))              { printUsage(); return 1; }
+        else                                        inputs.add (File::getCurrentWorkingDirectory().getChildFile (arg));
+    }
+
+    // Either stdin or a list of files, never both
+    if (readStdin != inputs.isEmpty())
+    {
+        printUsage();
+        return 1;
+    }
+
+    if (readStdin)
+    {
+        StandardInputStream in;
+        StandardOutputStream out;
+        RawPcmInput input (in, rawSampleRate, rawChannels, rawEncoding);
+        auto writer = BatchAnalyzer::createWriter (format, out);
+
+        OfflineAnalyzer (options).run (input, *writer);
+        return 0;
+    }
+
+    if (! outputDirectory.createDirectory())
+    {
+        std::cerr << "cannot create " << outputDirectory.getFullPathName() << std::endl;
+        return 1;
+    }
+
+    AudioFormatManager formatManager;
+    formatManager.registerBasicFormats();
+
+    BatchAnalyzer batch (formatManager, options, format, numThreads);
+    const auto startTime = Time::getMillisecondCounterHiRes();
+    auto results = batch.run (inputs, outputDirectory);
+    const auto seconds = (Time::getMillisecondCounterHiRes() - startTime) / 1000.0;
+
+    int numFailed = 0;
+
+    for (auto& r : results)
+    {
+        if (r.error.isNotEmpty())
+        {
+            std::cerr << r.input.getFullPathName() << ": " << r.error << std::endl;
+            ++numFailed;
+        }
+        else
+        {
+            std::cerr << r.input.getFileName() << " -> " << r.output.getFullPathName()
+                      << " (" << r.numFrames << " frames, " << String (r.levels.integratedLoudness, 1) << " LUFS, "
+                      << String (Decibels::gainToDecibels (r.levels.maxTruePeak), 1) << " dBTP)" << std::endl;
+        }
+    }
+
+    std::cerr << results.size() << " files in " << String (seconds, 2) << " s on "
+              << numThreads << " threads" << std::endl;
+
+    return numFailed > 0 ? 1 : 0;
+}